@@ -0,0 +1,282 @@
+#pragma once
+
+#include <glib.h>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Maps a destination pixel centre (x + 0.5, y + 0.5) to the source position it samples:
+// (a x + b y + c, d x + e y + f), both in continuous pixel coordinates.
+struct AffineTransform {
+    double a = 1, b = 0, c = 0.5;
+    double d = 0, e = 1, f = 0.5;
+
+    // Clockwise rotation (on screen, y pointing down) about the image centre, with the
+    // source centred in a destination of the given size.
+    static AffineTransform rotation(double degrees, int src_width, int src_height, int dst_width, int dst_height) {
+        const double angle = degrees * M_PI / 180.0;
+        const double cos_a = std::cos(angle), sin_a = std::sin(angle);
+        const double dx = 0.5 - dst_width / 2.0, dy = 0.5 - dst_height / 2.0;
+
+        AffineTransform t;
+        t.a = cos_a;
+        t.b = sin_a;
+        t.c = cos_a * dx + sin_a * dy + src_width / 2.0;
+        t.d = -sin_a;
+        t.e = cos_a;
+        t.f = -sin_a * dx + cos_a * dy + src_height / 2.0;
+        return t;
+    }
+
+    // Size of the box that holds the whole source rotated by `degrees`.
+    static void rotatedSize(double degrees, int width, int height, int& out_width, int& out_height) {
+        const double angle = degrees * M_PI / 180.0;
+        const double cos_a = std::fabs(std::cos(angle)), sin_a = std::fabs(std::sin(angle));
+        out_width = std::max(1, static_cast<int>(std::ceil(width * cos_a + height * sin_a - 1e-6)));
+        out_height = std::max(1, static_cast<int>(std::ceil(width * sin_a + height * cos_a - 1e-6)));
+    }
+};
+
+// Inverse-mapping warp with bilinear sampling. The destination is walked in square tiles,
+// so the source footprint of a tile stays in cache whatever the rotation; within a tile
+// row, source positions advance by a constant step in 16.16 fixed point, restarted from
+// the exact transform at the start of every row. Filter weights have 7 bits, so the two
+// interpolation passes fit the 16-bit lanes of SSE2 pmaddwd.
+//
+// Destination pixels whose samples fall outside the source blend towards the background:
+// white, and transparent if the image has alpha. Sizes are limited to maxSize so that
+// every sample position, inside the source or not, fits the fixed-point format.
+class AffineWarp {
+   public:
+    static constexpr int tileSize = 64;
+    static constexpr int maxSize = 16384;
+    static constexpr int fractionBits = 7;
+
+    AffineWarp(const AffineTransform& transform, int src_width, int src_height, int dst_width, int dst_height)
+        : transform(transform), srcWidth(src_width), srcHeight(src_height), dstWidth(dst_width),
+          dstHeight(dst_height), tilesX((dst_width + tileSize - 1) / tileSize),
+          tilesY((dst_height + tileSize - 1) / tileSize) {}
+
+    int tileCount() const { return tilesX * tilesY; }
+
+    void warpTile(int index, const guint8* src, int rowstride, int n_channels, guint8* dst, int dst_rowstride) const {
+        if (n_channels == 4) {
+            warp<4>(index, src, rowstride, dst, dst_rowstride);
+        } else {
+            warp<3>(index, src, rowstride, dst, dst_rowstride);
+        }
+    }
+
+   private:
+    static constexpr int one = 1 << fractionBits;
+    static constexpr int fixedOne = 1 << 16;
+
+    AffineTransform transform;
+    int srcWidth, srcHeight, dstWidth, dstHeight;
+    int tilesX, tilesY;
+
+    // Source position of destination pixel (x, y), moved back by half a pixel so that its
+    // integer part is the first of the two taps in each direction.
+    void samplePosition(double x, double y, double& u, double& v) const {
+        u = transform.a * x + transform.b * y + transform.c - 0.5;
+        v = transform.d * x + transform.e * y + transform.f - 0.5;
+    }
+
+    bool insidePosition(double u, double v) const {
+        const double margin = 1.0 / 64;
+        return u >= margin && v >= margin && u <= srcWidth - 1 - margin && v <= srcHeight - 1 - margin;
+    }
+
+    template <int Channels>
+    void warp(int index, const guint8* src, int rowstride, guint8* dst, int dst_rowstride) const {
+        const int x_begin = (index % tilesX) * tileSize, x_end = std::min(dstWidth, x_begin + tileSize);
+        const int y_begin = (index / tilesX) * tileSize, y_end = std::min(dstHeight, y_begin + tileSize);
+
+        // The map is affine, so the tile is inside the source when its corners are.
+        bool inside = true;
+        for (int corner = 0; corner < 4; corner++) {
+            double u, v;
+            samplePosition(corner & 1 ? x_end - 1 : x_begin, corner & 2 ? y_end - 1 : y_begin, u, v);
+            inside = inside && insidePosition(u, v);
+        }
+
+        const int32_t step_u = static_cast<int32_t>(std::lround(transform.a * fixedOne));
+        const int32_t step_v = static_cast<int32_t>(std::lround(transform.d * fixedOne));
+
+        for (int y = y_begin; y < y_end; ++y) {
+            double u0, v0;
+            samplePosition(x_begin, y, u0, v0);
+            int32_t u = static_cast<int32_t>(std::floor(u0 * fixedOne + 0.5));
+            int32_t v = static_cast<int32_t>(std::floor(v0 * fixedOne + 0.5));
+            guint8* d = dst + static_cast<size_t>(y) * dst_rowstride + x_begin * Channels;
+
+            for (int x = x_begin; x < x_end; ++x, u += step_u, v += step_v, d += Channels) {
+                const int x0 = u >> 16, y0 = v >> 16;
+                const int fx = (u >> (16 - fractionBits)) & (one - 1);
+                const int fy = (v >> (16 - fractionBits)) & (one - 1);
+                if (inside || (x0 >= 0 && y0 >= 0 && x0 + 1 < srcWidth && y0 + 1 < srcHeight)) {
+                    const guint8* row0 = src + static_cast<size_t>(y0) * rowstride + x0 * Channels;
+                    bilinear<Channels>(row0, row0 + rowstride, fx, fy, d);
+                } else {
+                    borderSample<Channels>(src, rowstride, x0, y0, fx, fy, d);
+                }
+            }
+        }
+    }
+
+#if defined(__SSE2__)
+    static __m128i weightPair(int a, int b) { return _mm_set1_epi32((b << 16) | a); }
+
+    // Two neighbouring pixels widened to 16-bit lanes, four lanes each.
+    template <int Channels>
+    static __m128i loadPair(const guint8* p) {
+        uint64_t value = 0;
+        if (Channels == 4) {
+            std::memcpy(&value, p, 8);
+        } else {
+            uint32_t first = p[0] | (p[1] << 8) | (p[2] << 16);
+            uint32_t second = p[3] | (p[4] << 8) | (p[5] << 16);
+            value = first | (static_cast<uint64_t>(second) << 32);
+        }
+        return _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(&value)), _mm_setzero_si128());
+    }
+#endif
+
+    // Vertical then horizontal interpolation of the 2x2 block at row0[0], row1[0]; every
+    // intermediate stays below 2^15 and the result is rounded once.
+    template <int Channels>
+    static void bilinear(const guint8* row0, const guint8* row1, int fx, int fy, guint8* out) {
+#if defined(__SSE2__)
+        __m128i top = loadPair<Channels>(row0), bottom = loadPair<Channels>(row1);
+        __m128i vertical = weightPair(one - fy, fy);
+        __m128i left = _mm_madd_epi16(_mm_unpacklo_epi16(top, bottom), vertical);
+        __m128i right = _mm_madd_epi16(_mm_unpackhi_epi16(top, bottom), vertical);
+        __m128i columns = _mm_packs_epi32(left, right);
+        __m128i sum = _mm_madd_epi16(_mm_unpacklo_epi16(columns, _mm_srli_si128(columns, 8)), weightPair(one - fx, fx));
+        sum = _mm_srai_epi32(_mm_add_epi32(sum, _mm_set1_epi32(1 << (2 * fractionBits - 1))), 2 * fractionBits);
+        sum = _mm_packs_epi32(sum, sum);
+        uint32_t packed = static_cast<uint32_t>(_mm_cvtsi128_si32(_mm_packus_epi16(sum, sum)));
+        if (Channels == 4) {
+            std::memcpy(out, &packed, 4);
+        } else {
+            for (int c = 0; c < Channels; c++) out[c] = static_cast<guint8>(packed >> (8 * c));
+        }
+#else
+        for (int c = 0; c < Channels; c++) {
+            int left = row0[c] * (one - fy) + row1[c] * fy;
+            int right = row0[Channels + c] * (one - fy) + row1[Channels + c] * fy;
+            out[c] = static_cast<guint8>((left * (one - fx) + right * fx + (1 << (2 * fractionBits - 1))) >>
+                                         (2 * fractionBits));
+        }
+#endif
+    }
+
+    // Same arithmetic as bilinear, with taps outside the source replaced by the background.
+    template <int Channels>
+    void borderSample(const guint8* src, int rowstride, int x0, int y0, int fx, int fy, guint8* out) const {
+        static const guint8 background[4] = {255, 255, 255, 0};
+        if (x0 < -1 || y0 < -1 || x0 >= srcWidth || y0 >= srcHeight) {
+            std::memcpy(out, background, Channels);
+            return;
+        }
+        const guint8* taps[4];
+        for (int k = 0; k < 4; k++) {
+            int x = x0 + (k & 1), y = y0 + (k >> 1);
+            bool valid = x >= 0 && y >= 0 && x < srcWidth && y < srcHeight;
+            taps[k] = valid ? src + static_cast<size_t>(y) * rowstride + x * Channels : background;
+        }
+        for (int c = 0; c < Channels; c++) {
+            int left = taps[0][c] * (one - fy) + taps[2][c] * fy;
+            int right = taps[1][c] * (one - fy) + taps[3][c] * fy;
+            out[c] = static_cast<guint8>((left * (one - fx) + right * fx + (1 << (2 * fractionBits - 1))) >>
+                                         (2 * fractionBits));
+        }
+    }
+};
+
+// Exact rotations by multiples of 90 degrees (clockwise) and mirror images.
+enum class Orientation { Rotate90, Rotate180, Rotate270, FlipHorizontal, FlipVertical };
+
+// Pixel copy for an Orientation, walked in destination tiles like AffineWarp so the
+// column-wise reads of the 90 and 270 degree cases stay in cache.
+class OrientationCopy {
+   public:
+    static constexpr int tileSize = 64;
+
+    OrientationCopy(Orientation orientation, int src_width, int src_height) {
+        const bool swap = orientation == Orientation::Rotate90 || orientation == Orientation::Rotate270;
+        dstWidth = swap ? src_height : src_width;
+        dstHeight = swap ? src_width : src_height;
+        tilesX = (dstWidth + tileSize - 1) / tileSize;
+        tilesY = (dstHeight + tileSize - 1) / tileSize;
+
+        // Source pixel of destination (x, y) is (originX + x * xStepX + y * yStepX, originY + ...).
+        switch (orientation) {
+            case Orientation::Rotate90:
+                set(0, src_height - 1, 0, -1, 1, 0);
+                break;
+            case Orientation::Rotate180:
+                set(src_width - 1, src_height - 1, -1, 0, 0, -1);
+                break;
+            case Orientation::Rotate270:
+                set(src_width - 1, 0, 0, 1, -1, 0);
+                break;
+            case Orientation::FlipHorizontal:
+                set(src_width - 1, 0, -1, 0, 0, 1);
+                break;
+            case Orientation::FlipVertical:
+                set(0, src_height - 1, 1, 0, 0, -1);
+                break;
+        }
+    }
+
+    int getWidth() const { return dstWidth; }
+    int getHeight() const { return dstHeight; }
+    int tileCount() const { return tilesX * tilesY; }
+
+    void copyTile(int index, const guint8* src, int rowstride, int n_channels, guint8* dst, int dst_rowstride) const {
+        if (n_channels == 4) {
+            copy<4>(index, src, rowstride, dst, dst_rowstride);
+        } else {
+            copy<3>(index, src, rowstride, dst, dst_rowstride);
+        }
+    }
+
+   private:
+    int dstWidth, dstHeight;
+    int tilesX, tilesY;
+    int originX = 0, originY = 0;
+    int xStepX = 1, xStepY = 0, yStepX = 0, yStepY = 1;
+
+    void set(int origin_x, int origin_y, int x_step_x, int x_step_y, int y_step_x, int y_step_y) {
+        originX = origin_x;
+        originY = origin_y;
+        xStepX = x_step_x;
+        xStepY = x_step_y;
+        yStepX = y_step_x;
+        yStepY = y_step_y;
+    }
+
+    template <int Channels>
+    void copy(int index, const guint8* src, int rowstride, guint8* dst, int dst_rowstride) const {
+        const int x_begin = (index % tilesX) * tileSize, x_end = std::min(dstWidth, x_begin + tileSize);
+        const int y_begin = (index / tilesX) * tileSize, y_end = std::min(dstHeight, y_begin + tileSize);
+        const std::ptrdiff_t step = static_cast<std::ptrdiff_t>(xStepY) * rowstride + xStepX * Channels;
+
+        for (int y = y_begin; y < y_end; ++y) {
+            const int sx = originX + x_begin * xStepX + y * yStepX;
+            const int sy = originY + x_begin * xStepY + y * yStepY;
+            const guint8* s = src + static_cast<std::ptrdiff_t>(sy) * rowstride + sx * Channels;
+            guint8* d = dst + static_cast<size_t>(y) * dst_rowstride + x_begin * Channels;
+            for (int x = x_begin; x < x_end; ++x, s += step, d += Channels) {
+                std::memcpy(d, s, Channels);
+            }
+        }
+    }
+};
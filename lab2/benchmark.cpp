@@ -0,0 +1,1437 @@
+#include <gdkmm.h>
+#include <gdkmm/wrap_init.h>
+#include <giomm/init.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <functional>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <set>
+#include <iostream>
+#include <iomanip>
+#include <filesystem>
+#include <thread>
+
+#include "image_processor.h"
+
+struct BenchmarkOptions {
+    std::vector<int> sizes{256, 1024, 4096};
+    std::vector<std::string> suites{"processor"};
+    int warmup = 1;
+    int repetitions = 5;
+    std::string filter;
+    std::string baselinePath;
+    std::string writeBaselinePath;
+    double threshold = 0.15;
+};
+
+struct BenchmarkResult {
+    std::string name;
+    double megapixels = 0;
+    std::vector<double> samplesMs;
+
+    double percentile(double p) const {
+        std::vector<double> sorted = samplesMs;
+        std::sort(sorted.begin(), sorted.end());
+        if (sorted.empty()) return 0;
+
+        double rank = p / 100.0 * (sorted.size() - 1);
+        size_t lower = static_cast<size_t>(rank);
+        size_t upper = std::min(lower + 1, sorted.size() - 1);
+        return sorted[lower] + (sorted[upper] - sorted[lower]) * (rank - lower);
+    }
+
+    double median() const { return percentile(50); }
+
+    double megapixelsPerSecond() const {
+        double ms = median();
+        return ms > 0 ? megapixels / (ms / 1000.0) : 0;
+    }
+};
+
+class BenchmarkRunner {
+   public:
+    explicit BenchmarkRunner(const BenchmarkOptions& options) : options(options) {}
+
+    // `setup` runs before every warm-up and timed repetition and is not timed.
+    void run(const std::string& name, double megapixels, const std::function<void()>& body,
+             const std::function<void()>& setup = nullptr) {
+        if (!options.filter.empty() && name.find(options.filter) == std::string::npos) return;
+
+        BenchmarkResult result;
+        result.name = name;
+        result.megapixels = megapixels;
+
+        for (int i = 0; i < options.warmup + options.repetitions; i++) {
+            if (setup) setup();
+
+            auto start = std::chrono::steady_clock::now();
+            body();
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+            if (i >= options.warmup) result.samplesMs.push_back(ms);
+        }
+
+        std::cout << std::left << std::setw(52) << name << std::right << std::fixed << std::setprecision(3)
+                  << " p50 " << std::setw(10) << result.median() << " ms"
+                  << "  p90 " << std::setw(10) << result.percentile(90) << " ms"
+                  << "  min " << std::setw(10) << result.percentile(0) << " ms"
+                  << "  " << std::setprecision(1) << std::setw(8) << result.megapixelsPerSecond() << " MP/s"
+                  << std::endl;
+
+        results.push_back(result);
+    }
+
+    const std::vector<BenchmarkResult>& getResults() const { return results; }
+    const BenchmarkOptions& getOptions() const { return options; }
+
+   private:
+    BenchmarkOptions options;
+    std::vector<BenchmarkResult> results;
+};
+
+enum class Content { Flat, Gradient, Noise, Natural };
+
+const char* contentName(Content content) {
+    switch (content) {
+        case Content::Flat: return "flat";
+        case Content::Gradient: return "gradient";
+        case Content::Noise: return "noise";
+        case Content::Natural: return "natural";
+    }
+    return "";
+}
+
+const Content allContents[] = {Content::Flat, Content::Gradient, Content::Noise, Content::Natural};
+
+class Random {
+   public:
+    explicit Random(guint32 seed) : state(seed ? seed : 1) {}
+
+    guint32 next() {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+
+   private:
+    guint32 state;
+};
+
+// Lattice value noise: bilinear interpolation of random values on a grid of `cell` pixels.
+class ValueNoise {
+   public:
+    ValueNoise(int width, int height, int cell, guint32 seed)
+            : cell(cell), columns(width / cell + 2), rows(height / cell + 2), lattice(columns * rows) {
+        Random random(seed);
+        for (float& v : lattice) v = (random.next() & 0xFFFF) / 65535.0f;
+    }
+
+    float at(int x, int y) const {
+        int gx = x / cell, gy = y / cell;
+        float fx = (x % cell) / static_cast<float>(cell);
+        float fy = (y % cell) / static_cast<float>(cell);
+        float a = lattice[gy * columns + gx], b = lattice[gy * columns + gx + 1];
+        float c = lattice[(gy + 1) * columns + gx], d = lattice[(gy + 1) * columns + gx + 1];
+        return (a + (b - a) * fx) * (1 - fy) + (c + (d - c) * fx) * fy;
+    }
+
+   private:
+    int cell, columns, rows;
+    std::vector<float> lattice;
+};
+
+Glib::RefPtr<Gdk::Pixbuf> createSyntheticImage(Content content, int size, int n_channels, guint32 seed = 1) {
+    auto image = Gdk::Pixbuf::create(Gdk::COLORSPACE_RGB, n_channels == 4, 8, size, size);
+    guint8* pixels = image->get_pixels();
+    int rowstride = image->get_rowstride();
+
+    Random random(seed);
+    std::vector<ValueNoise> octaves;
+    if (content == Content::Natural) {
+        for (int cell = std::max(8, size / 4), i = 0; cell >= 4 && i < 5; cell /= 3, i++) {
+            octaves.emplace_back(size, size, cell, seed + i);
+        }
+    }
+
+    for (int y = 0; y < size; ++y) {
+        guint8* p = pixels + static_cast<size_t>(y) * rowstride;
+        for (int x = 0; x < size; ++x, p += n_channels) {
+            switch (content) {
+                case Content::Flat:
+                    p[0] = 128; p[1] = 96; p[2] = 64;
+                    break;
+                case Content::Gradient:
+                    p[0] = static_cast<guint8>(x * 255 / std::max(1, size - 1));
+                    p[1] = static_cast<guint8>(y * 255 / std::max(1, size - 1));
+                    p[2] = static_cast<guint8>((p[0] + p[1]) / 2);
+                    break;
+                case Content::Noise: {
+                    guint32 r = random.next();
+                    p[0] = r & 0xFF; p[1] = (r >> 8) & 0xFF; p[2] = (r >> 16) & 0xFF;
+                    break;
+                }
+                case Content::Natural: {
+                    float value = 0, amplitude = 0.5f;
+                    for (const auto& octave : octaves) {
+                        value += octave.at(x, y) * amplitude;
+                        amplitude *= 0.5f;
+                    }
+                    float grain = ((random.next() & 0xFF) - 127.5f) / 255.0f * 0.04f;
+                    float luminance = std::min(1.0f, std::max(0.0f, value + grain));
+                    p[0] = static_cast<guint8>(luminance * 230 + 20);
+                    p[1] = static_cast<guint8>(luminance * 200 + 30);
+                    p[2] = static_cast<guint8>(luminance * luminance * 180 + 40);
+                    break;
+                }
+            }
+            if (n_channels == 4) p[3] = 255;
+        }
+    }
+
+    return image;
+}
+
+std::string imageLabel(Content content, int size, int n_channels) {
+    std::ostringstream label;
+    label << contentName(content) << "/" << size << "x" << size << "x" << n_channels;
+    return label.str();
+}
+
+std::string temporaryPath(const std::string& name) {
+    return (std::filesystem::temp_directory_path() / ("lab2_benchmark_" + name)).string();
+}
+
+void benchmarkProcessor(BenchmarkRunner& runner) {
+    for (int size : runner.getOptions().sizes) {
+        for (int n_channels : {3, 4}) {
+            for (Content content : allContents) {
+                auto image = createSyntheticImage(content, size, n_channels);
+                const std::string label = imageLabel(content, size, n_channels);
+                const double megapixels = size * static_cast<double>(size) / 1e6;
+
+                ImageProcessor processor;
+                processor.setImage(image);
+                auto reset = [&]() { processor.setImage(image); };
+
+                const std::string png_path = temporaryPath("image.png");
+                const std::string rle_path = temporaryPath("image.rle");
+                image->save(png_path, "png");
+
+                runner.run("loadImage/" + label, megapixels, [&]() { processor.loadImage(png_path); });
+                runner.run("setImage/" + label, megapixels, [&]() { processor.setImage(image); });
+                runner.run("applyLowPassFilter/" + label, megapixels, [&]() { processor.applyLowPassFilter(); }, reset);
+                runner.run("getHistogram/" + label, megapixels, [&]() { processor.getHistogram(); }, reset);
+                runner.run("applyHistogramEqualization/" + label, megapixels,
+                           [&]() { processor.applyHistogramEqualization(); });
+                runner.run("applyLinearContrast/" + label, megapixels,
+                           [&]() { processor.applyLinearContrast(20, 235); }, reset);
+                runner.run("createProxy/" + label, megapixels, [&]() { processor.createProxy(size / 4, size / 4); });
+
+                std::vector<unsigned char> encoded;
+                runner.run("encodeRLE/" + label, megapixels, [&]() { encoded = processor.encodeRLE(); }, reset);
+                runner.run("decodeRLE/" + label, megapixels, [&]() { processor.decodeRLE(encoded); });
+                runner.run("saveRLEToFile/" + label, megapixels, [&]() { processor.saveRLEToFile(rle_path); }, reset);
+                runner.run("loadRLEFromFile/" + label, megapixels, [&]() { processor.loadRLEFromFile(rle_path); });
+                runner.run("setOriginalFromFiltered/" + label, megapixels, [&]() { processor.setOriginalFromFiltered(); });
+                runner.run("resetToOriginal/" + label, megapixels, [&]() { processor.resetToOriginal(); });
+
+                std::remove(png_path.c_str());
+                std::remove(rle_path.c_str());
+            }
+        }
+    }
+}
+
+// CLAHE throughput on ~50 MP images; the tile count should not change the per-pixel cost.
+void benchmarkClahe(BenchmarkRunner& runner) {
+    const int size = 7072;
+    const double megapixels = size * static_cast<double>(size) / 1e6;
+
+    for (Content content : {Content::Natural, Content::Noise}) {
+        auto image = createSyntheticImage(content, size, 3);
+        const std::string label = imageLabel(content, size, 3);
+
+        ImageProcessor processor;
+        processor.setImage(image);
+
+        runner.run("applyHistogramEqualization/" + label, megapixels, [&]() { processor.applyHistogramEqualization(); });
+        for (int tiles : {4, 8, 16, 32, 64}) {
+            runner.run("applyCLAHE/" + std::to_string(tiles) + "x" + std::to_string(tiles) + "/" + label, megapixels,
+                       [&]() { processor.applyCLAHE(tiles, tiles, 2.0); });
+        }
+    }
+}
+
+// Histogram cache: a cold count, a cached lookup, a point operation whose histogram is
+// derived through its LUT, an ROI mostly made of whole tiles, and a 256x256 region edit.
+void benchmarkHistogram(BenchmarkRunner& runner) {
+    for (int size : runner.getOptions().sizes) {
+        auto image = createSyntheticImage(Content::Natural, size, 3);
+        const std::string label = imageLabel(Content::Natural, size, 3);
+        const double megapixels = size * static_cast<double>(size) / 1e6;
+
+        ImageProcessor processor;
+        auto reset = [&]() { processor.setImage(image); };
+        auto counted = [&]() {
+            processor.setImage(image);
+            processor.getHistogram();
+        };
+
+        runner.run("getHistogram/cold/" + label, megapixels, [&]() { processor.getHistogram(); }, reset);
+        runner.run("getHistogram/cached/" + label, megapixels, [&]() { processor.getHistogram(); });
+        runner.run("contrastHistogram/rescan/" + label, megapixels, [&]() {
+            processor.applyLinearContrast(20, 235);
+            processor.updateFilteredRegion(0, 0, size, size);
+            processor.getFilteredHistogram();
+        }, counted);
+        runner.run("contrastHistogram/derived/" + label, megapixels, [&]() {
+            processor.applyLinearContrast(20, 235);
+            processor.getFilteredHistogram();
+        }, counted);
+
+        const int roi = std::max(1, size / 2);
+        const double roi_megapixels = roi * static_cast<double>(roi) / 1e6;
+        processor.getFilteredHistogram();
+        runner.run("getRegionHistogram/" + std::to_string(roi) + "/" + label, roi_megapixels,
+                   [&]() { processor.getRegionHistogram(size / 4 + 1, size / 4 + 1, roi, roi); });
+
+        const int edit = std::min(size, 256);
+        runner.run("updateFilteredRegion/" + std::to_string(edit) + "/" + label, edit * edit / 1e6,
+                   [&]() { processor.updateFilteredRegion(size / 3, size / 3, edit, edit); });
+    }
+}
+
+// Median filter cost from radius 1 to 30; it should stay flat as the radius grows.
+void benchmarkMedian(BenchmarkRunner& runner) {
+    for (int size : runner.getOptions().sizes) {
+        auto image = createSyntheticImage(Content::Natural, size, 3);
+        const std::string label = imageLabel(Content::Natural, size, 3);
+        const double megapixels = size * static_cast<double>(size) / 1e6;
+
+        ImageProcessor processor;
+        auto reset = [&]() { processor.setImage(image); };
+
+        for (int radius : {1, 2, 3, 5, 8, 12, 16, 20, 25, 30}) {
+            runner.run("applyMedianFilter/r" + std::to_string(radius) + "/" + label, megapixels,
+                       [&]() { processor.applyMedianFilter(radius); }, reset);
+        }
+    }
+}
+
+// Summed-area table construction on one thread, then the operations built on it with
+// radii from small to large; box filter and threshold times should not grow with radius.
+void benchmarkIntegral(BenchmarkRunner& runner) {
+    for (int size : runner.getOptions().sizes) {
+        auto image = createSyntheticImage(Content::Natural, size, 3);
+        const std::string label = imageLabel(Content::Natural, size, 3);
+        const double megapixels = size * static_cast<double>(size) / 1e6;
+
+        for (bool squares : {false, true}) {
+            IntegralImage table(size, size, 3, squares);
+            runner.run(std::string(squares ? "integralImage+squares/" : "integralImage/") + label, megapixels, [&]() {
+                table.scanRows(image->get_pixels(), image->get_rowstride(), image->get_n_channels(), 0, size);
+                table.scanColumns(0, table.rowValues());
+            });
+            std::cout << "  table size " << std::fixed << std::setprecision(1)
+                      << table.getBytes() / (1024.0 * 1024.0) << " MiB" << std::defaultfloat << std::endl;
+        }
+
+        ImageProcessor processor;
+        auto reset = [&]() { processor.setImage(image); };
+
+        for (int radius : {1, 4, 16, 64, 256}) {
+            runner.run("applyBoxFilter/r" + std::to_string(radius) + "/" + label, megapixels,
+                       [&]() { processor.applyBoxFilter(radius); }, reset);
+        }
+        for (int radius : {4, 16, 64, 128}) {
+            runner.run("applyLocalThreshold/sauvola/r" + std::to_string(radius) + "/" + label, megapixels,
+                       [&]() { processor.applyLocalThreshold(ThresholdMethod::Sauvola, radius, 0.34); }, reset);
+            runner.run("applyLocalThreshold/bradley/r" + std::to_string(radius) + "/" + label, megapixels,
+                       [&]() { processor.applyLocalThreshold(ThresholdMethod::Bradley, radius, 0.15); }, reset);
+        }
+    }
+}
+
+// Separable direct convolution with a sampled Gaussian of radius ceil(4 sigma) and
+// replicated borders; the accuracy reference for the recursive filter.
+Glib::RefPtr<Gdk::Pixbuf> referenceGaussian(const Glib::RefPtr<Gdk::Pixbuf>& image, double sigma) {
+    const int width = image->get_width(), height = image->get_height();
+    const int n_channels = image->get_n_channels(), rowstride = image->get_rowstride();
+    const int radius = static_cast<int>(std::ceil(4 * sigma));
+
+    std::vector<double> kernel(2 * radius + 1);
+    double total = 0;
+    for (int k = -radius; k <= radius; k++) total += kernel[k + radius] = std::exp(-k * k / (2 * sigma * sigma));
+    for (double& k : kernel) k /= total;
+
+    std::vector<double> rows(static_cast<size_t>(width) * height * 3);
+    const guint8* src = image->get_pixels();
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            for (int c = 0; c < 3; c++) {
+                double sum = 0;
+                for (int k = -radius; k <= radius; k++) {
+                    int sx = std::max(0, std::min(width - 1, x + k));
+                    sum += kernel[k + radius] * src[static_cast<size_t>(y) * rowstride + sx * n_channels + c];
+                }
+                rows[(static_cast<size_t>(y) * width + x) * 3 + c] = sum;
+            }
+        }
+    }
+
+    auto result = image->copy();
+    guint8* dst = result->get_pixels();
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            for (int c = 0; c < 3; c++) {
+                double sum = 0;
+                for (int k = -radius; k <= radius; k++) {
+                    int sy = std::max(0, std::min(height - 1, y + k));
+                    sum += kernel[k + radius] * rows[(static_cast<size_t>(sy) * width + x) * 3 + c];
+                }
+                dst[static_cast<size_t>(y) * rowstride + x * n_channels + c] =
+                    static_cast<guint8>(std::min(255.0, std::max(0.0, sum + 0.5)));
+            }
+        }
+    }
+    return result;
+}
+
+struct ImageDifference {
+    int maxAbs = 0;
+    double rms = 0;
+};
+
+ImageDifference compareImages(const Glib::RefPtr<Gdk::Pixbuf>& a, const Glib::RefPtr<Gdk::Pixbuf>& b, int margin) {
+    ImageDifference difference;
+    double sum = 0;
+    long long count = 0;
+    for (int y = margin; y < a->get_height() - margin; ++y) {
+        for (int x = margin; x < a->get_width() - margin; ++x) {
+            for (int c = 0; c < 3; c++) {
+                int d = a->get_pixels()[static_cast<size_t>(y) * a->get_rowstride() + x * a->get_n_channels() + c] -
+                        b->get_pixels()[static_cast<size_t>(y) * b->get_rowstride() + x * b->get_n_channels() + c];
+                difference.maxAbs = std::max(difference.maxAbs, std::abs(d));
+                sum += d * d;
+                count++;
+            }
+        }
+    }
+    difference.rms = count ? std::sqrt(sum / count) : 0;
+    return difference;
+}
+
+// Recursive Gaussian runtime across sigma (should stay flat), the direct convolution it
+// replaces on the smallest size, and the accuracy of one against the other.
+void benchmarkGaussian(BenchmarkRunner& runner) {
+    const double sigmas[] = {1, 2, 4, 8, 16, 32, 64};
+
+    for (int size : runner.getOptions().sizes) {
+        auto image = createSyntheticImage(Content::Natural, size, 3);
+        const std::string label = imageLabel(Content::Natural, size, 3);
+        const double megapixels = size * static_cast<double>(size) / 1e6;
+
+        ImageProcessor processor;
+        auto reset = [&]() { processor.setImage(image); };
+
+        for (double sigma : sigmas) {
+            std::ostringstream name;
+            name << "applyGaussianBlur/s" << sigma << "/" << label;
+            runner.run(name.str(), megapixels, [&]() { processor.applyGaussianBlur(sigma); }, reset);
+        }
+
+        if (size != runner.getOptions().sizes.front()) continue;
+
+        for (double sigma : sigmas) {
+            std::ostringstream name;
+            name << "referenceGaussian/s" << sigma << "/" << label;
+            Glib::RefPtr<Gdk::Pixbuf> reference;
+            runner.run(name.str(), megapixels, [&]() { reference = referenceGaussian(image, sigma); });
+            if (!reference) reference = referenceGaussian(image, sigma);
+
+            processor.setImage(image);
+            processor.applyGaussianBlur(sigma);
+            auto all = compareImages(processor.getFilteredPixbuf(), reference, 0);
+            auto interior = compareImages(processor.getFilteredPixbuf(), reference,
+                                          std::min(size / 4, static_cast<int>(std::ceil(4 * sigma))));
+            std::cout << "  accuracy s" << sigma << ": max " << all.maxAbs << " rms " << std::setprecision(3)
+                      << all.rms << " | interior max " << interior.maxAbs << " rms " << interior.rms << std::endl;
+        }
+    }
+}
+
+// Direct bilateral filter over a (4 sigma_spatial + 1)^2 window cut off at the image
+// edge, with the range weight on luminance like the grid; the quality reference.
+Glib::RefPtr<Gdk::Pixbuf> referenceBilateral(const Glib::RefPtr<Gdk::Pixbuf>& image, double sigma_spatial,
+                                             double sigma_range) {
+    const int width = image->get_width(), height = image->get_height();
+    const int n_channels = image->get_n_channels(), rowstride = image->get_rowstride();
+    const int radius = static_cast<int>(std::ceil(2 * sigma_spatial));
+    const guint8* src = image->get_pixels();
+
+    std::vector<double> spatial(2 * radius + 1), range(256);
+    for (int k = -radius; k <= radius; k++) spatial[k + radius] = std::exp(-k * k / (2 * sigma_spatial * sigma_spatial));
+    for (int d = 0; d < 256; d++) range[d] = std::exp(-d * d / (2 * sigma_range * sigma_range));
+
+    std::vector<int> luma(static_cast<size_t>(width) * height);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            const guint8* p = src + static_cast<size_t>(y) * rowstride + x * n_channels;
+            luma[static_cast<size_t>(y) * width + x] = (77 * p[0] + 150 * p[1] + 29 * p[2] + 128) >> 8;
+        }
+    }
+
+    auto result = image->copy();
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            const int centre = luma[static_cast<size_t>(y) * width + x];
+            double sum[3] = {0, 0, 0}, total = 0;
+            for (int sy = std::max(0, y - radius); sy <= std::min(height - 1, y + radius); sy++) {
+                for (int sx = std::max(0, x - radius); sx <= std::min(width - 1, x + radius); sx++) {
+                    const double w = spatial[sx - x + radius] * spatial[sy - y + radius] *
+                                     range[std::abs(luma[static_cast<size_t>(sy) * width + sx] - centre)];
+                    const guint8* p = src + static_cast<size_t>(sy) * rowstride + sx * n_channels;
+                    for (int c = 0; c < 3; c++) sum[c] += w * p[c];
+                    total += w;
+                }
+            }
+            guint8* d = result->get_pixels() + static_cast<size_t>(y) * rowstride + x * n_channels;
+            for (int c = 0; c < 3; c++) d[c] = static_cast<guint8>(sum[c] / total + 0.5);
+        }
+    }
+    return result;
+}
+
+// Bilateral grid runtime across spatial sigma (should stay nearly flat) and, on the
+// smallest size, the direct filter for the smaller sigmas with the difference between
+// the two. The "input" figure is the difference between the reference and the unfiltered
+// image, for scale.
+void benchmarkBilateral(BenchmarkRunner& runner) {
+    const double spatial_sigmas[] = {4, 8, 16, 32, 64};
+    const double range_sigma = 24;
+    const double max_reference_sigma = 16;
+
+    for (int size : runner.getOptions().sizes) {
+        auto image = createSyntheticImage(Content::Natural, size, 3);
+        const std::string label = imageLabel(Content::Natural, size, 3);
+        const double megapixels = size * static_cast<double>(size) / 1e6;
+
+        ImageProcessor processor;
+        auto reset = [&]() { processor.setImage(image); };
+
+        for (double sigma : spatial_sigmas) {
+            std::ostringstream name;
+            name << "applyBilateralFilter/s" << sigma << "/r" << range_sigma << "/" << label;
+            runner.run(name.str(), megapixels, [&]() { processor.applyBilateralFilter(sigma, range_sigma); }, reset);
+        }
+
+        if (size != runner.getOptions().sizes.front()) continue;
+
+        for (double sigma : spatial_sigmas) {
+            if (sigma > max_reference_sigma) break;
+
+            std::ostringstream name;
+            name << "referenceBilateral/s" << sigma << "/r" << range_sigma << "/" << label;
+            Glib::RefPtr<Gdk::Pixbuf> reference;
+            runner.run(name.str(), megapixels, [&]() { reference = referenceBilateral(image, sigma, range_sigma); });
+            if (!reference) reference = referenceBilateral(image, sigma, range_sigma);
+
+            processor.setImage(image);
+            processor.applyBilateralFilter(sigma, range_sigma);
+            auto grid = compareImages(processor.getFilteredPixbuf(), reference, 0);
+            auto input = compareImages(image, reference, 0);
+            std::cout << std::defaultfloat << "  accuracy s" << sigma << ": max " << grid.maxAbs << " rms "
+                      << std::fixed << std::setprecision(2) << grid.rms << " | input max " << input.maxAbs << " rms "
+                      << input.rms << std::defaultfloat << std::endl;
+        }
+    }
+}
+
+// Erosion by direct scans over the window, one axis at a time: O(radius) per pixel.
+Glib::RefPtr<Gdk::Pixbuf> referenceErode(const Glib::RefPtr<Gdk::Pixbuf>& image, int radius) {
+    const int width = image->get_width(), height = image->get_height();
+    const int n_channels = image->get_n_channels(), rowstride = image->get_rowstride();
+    auto temp = image->copy();
+    auto result = image->copy();
+
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            for (int c = 0; c < 3; c++) {
+                guint8 value = 255;
+                for (int sy = std::max(0, y - radius); sy <= std::min(height - 1, y + radius); sy++) {
+                    value = std::min(value, image->get_pixels()[static_cast<size_t>(sy) * rowstride + x * n_channels + c]);
+                }
+                temp->get_pixels()[static_cast<size_t>(y) * rowstride + x * n_channels + c] = value;
+            }
+        }
+    }
+    for (int y = 0; y < height; ++y) {
+        const guint8* row = temp->get_pixels() + static_cast<size_t>(y) * rowstride;
+        for (int x = 0; x < width; ++x) {
+            for (int c = 0; c < 3; c++) {
+                guint8 value = 255;
+                for (int sx = std::max(0, x - radius); sx <= std::min(width - 1, x + radius); sx++) {
+                    value = std::min(value, row[sx * n_channels + c]);
+                }
+                result->get_pixels()[static_cast<size_t>(y) * rowstride + x * n_channels + c] = value;
+            }
+        }
+    }
+    return result;
+}
+
+// Van Herk/Gil-Werman morphology over radii from 1 to 256; times should not grow with
+// the radius. On the first size the direct separable scan runs for the smaller radii, and
+// the outputs must be identical.
+void benchmarkMorphology(BenchmarkRunner& runner) {
+    const int max_reference_radius = 16;
+
+    for (int size : runner.getOptions().sizes) {
+        auto image = createSyntheticImage(Content::Natural, size, 3);
+        const std::string label = imageLabel(Content::Natural, size, 3);
+        const double megapixels = size * static_cast<double>(size) / 1e6;
+
+        ImageProcessor processor;
+        auto reset = [&]() { processor.setImage(image); };
+
+        for (int radius : {1, 4, 16, 64, 256}) {
+            runner.run("erode/r" + std::to_string(radius) + "/" + label, megapixels,
+                       [&]() { processor.applyMorphology(MorphologyOp::Erode, radius, radius, false); }, reset);
+        }
+        runner.run("erode/gray/r16/" + label, megapixels,
+                   [&]() { processor.applyMorphology(MorphologyOp::Erode, 16, 16, true); }, reset);
+        runner.run("open/r16/" + label, megapixels,
+                   [&]() { processor.applyMorphology(MorphologyOp::Open, 16, 16, false); }, reset);
+
+        if (size != runner.getOptions().sizes.front()) continue;
+
+        for (int radius : {1, 4, 16}) {
+            if (radius > max_reference_radius) break;
+
+            Glib::RefPtr<Gdk::Pixbuf> reference;
+            runner.run("referenceErode/r" + std::to_string(radius) + "/" + label, megapixels,
+                       [&]() { reference = referenceErode(image, radius); });
+            if (!reference) reference = referenceErode(image, radius);
+
+            processor.setImage(image);
+            processor.applyMorphology(MorphologyOp::Erode, radius, radius, false);
+            auto difference = compareImages(processor.getFilteredPixbuf(), reference, 0);
+            std::cout << "  r" << radius << (difference.maxAbs == 0 ? ": identical" : ": MISMATCH, max ")
+                      << (difference.maxAbs == 0 ? "" : std::to_string(difference.maxAbs)) << std::endl;
+        }
+    }
+}
+
+// Quality metrics of a blurred image against its source, next to the scalar per-pixel
+// difference the other suites use, and the cost of RLE verification on top of encoding.
+void benchmarkQuality(BenchmarkRunner& runner) {
+    for (int size : runner.getOptions().sizes) {
+        for (int n_channels : {3, 4}) {
+            auto image = createSyntheticImage(Content::Natural, size, n_channels);
+            const std::string label = imageLabel(Content::Natural, size, n_channels);
+            const double megapixels = size * static_cast<double>(size) / 1e6;
+
+            ImageProcessor processor;
+            processor.setImage(image);
+            processor.applyGaussianBlur(2);
+            auto blurred = processor.getFilteredPixbuf();
+
+            ImageQuality quality;
+            runner.run("measureQuality/" + label, megapixels, [&]() { processor.measureQuality(image, quality); });
+            ImageDifference difference;
+            runner.run("compareImages/" + label, megapixels, [&]() { difference = compareImages(blurred, image, 0); });
+            std::cout << std::fixed << std::setprecision(3) << "  psnr " << quality.psnr << " dB, ssim "
+                      << quality.ssim << ", max " << quality.maxAbsDifference << " (scalar rms "
+                      << difference.rms << " vs " << std::sqrt(quality.mse) << ")" << std::defaultfloat << std::endl;
+
+            auto reset = [&]() { processor.setImage(image); };
+            processor.setVerifyRLE(false);
+            runner.run("encodeRLE/" + label, megapixels, [&]() { processor.encodeRLE(); }, reset);
+            processor.setVerifyRLE(true);
+            std::vector<unsigned char> encoded;
+            runner.run("encodeRLE+verify/" + label, megapixels, [&]() { encoded = processor.encodeRLE(); }, reset);
+            std::cout << "  verify " << (encoded.empty() ? "FAILED" : "passed") << std::endl;
+        }
+    }
+}
+
+// The chunked parallel PNG encoder at several levels and filters against the Pixbuf
+// saver, with the file sizes each produces.
+void benchmarkPng(BenchmarkRunner& runner) {
+    auto file_size = [](const std::string& path) {
+        std::error_code error;
+        return std::filesystem::file_size(path, error) / (1024.0 * 1024.0);
+    };
+    const std::pair<const char*, PngFilter> filters[] = {
+        {"none", PngFilter::None}, {"up", PngFilter::Up}, {"paeth", PngFilter::Paeth}, {"adaptive", PngFilter::Adaptive}};
+
+    for (int size : runner.getOptions().sizes) {
+        auto image = createSyntheticImage(Content::Natural, size, 3);
+        const std::string label = imageLabel(Content::Natural, size, 3);
+        const double megapixels = size * static_cast<double>(size) / 1e6;
+        const std::string path = temporaryPath("save.png");
+
+        runner.run("pixbufSave/" + label, megapixels, [&]() { image->save(path, "png"); });
+        std::cout << std::fixed << std::setprecision(2) << "  " << file_size(path) << " MB" << std::defaultfloat
+                  << std::endl;
+
+        ImageProcessor processor;
+        processor.setImage(image);
+        for (int level : {1, 6, 9}) {
+            for (const auto& filter : filters) {
+                if (level != 6 && filter.second != PngFilter::Adaptive) continue;
+                std::ostringstream name;
+                name << "savePNG/l" << level << "/" << filter.first << "/" << label;
+                runner.run(name.str(), megapixels, [&]() { processor.savePNG(path, level, filter.second); });
+                std::cout << std::fixed << std::setprecision(2) << "  " << file_size(path) << " MB"
+                          << std::defaultfloat << std::endl;
+            }
+        }
+
+        std::remove(path.c_str());
+    }
+}
+
+// Contrast stretch and display conversion of the deep pipeline for each sample type on
+// the same natural image, then the banding that repeated contrast and equalization leave
+// on a dark, low-contrast gradient: distinct levels in 8 bits and in 16.
+void benchmarkDeep(BenchmarkRunner& runner) {
+    for (int size : runner.getOptions().sizes) {
+        auto image = createSyntheticImage(Content::Natural, size, 3);
+        const std::string label = imageLabel(Content::Natural, size, 3);
+        const double megapixels = size * static_cast<double>(size) / 1e6;
+        const guint8* pixels = image->get_pixels();
+        const int rowstride = image->get_rowstride();
+
+        PixelBuffer<guint8> narrow(size, size, 3);
+        PixelBuffer<uint16_t> wide(size, size, 3);
+        PixelBuffer<float> hdr(size, size, 3);
+        const float* to_linear = SrgbTables::instance().toLinear;
+        for (int y = 0; y < size; ++y) {
+            const guint8* p = pixels + static_cast<size_t>(y) * rowstride;
+            for (int i = 0; i < size * 3; i++) {
+                narrow.row(y)[i] = p[i];
+                wide.row(y)[i] = static_cast<uint16_t>(p[i] * 257);
+                hdr.row(y)[i] = to_linear[p[i]] / 255.0f;
+            }
+        }
+
+        auto run_type = [&](const char* type, const auto& buffer) {
+            using T = typename std::decay_t<decltype(buffer)>::Sample;
+            float lo[4] = {1e30f, 1e30f, 1e30f, 1e30f}, hi[4] = {-1e30f, -1e30f, -1e30f, -1e30f};
+            runner.run(std::string("rangeRows/") + type + "/" + label, megapixels,
+                       [&]() { PixelKernels::rangeRows(buffer, 0, size, lo, hi); });
+
+            const float scale[3] = {1.2f, 1.1f, 0.9f}, offset[3] = {-0.05f * SampleTraits<T>::white, 0, 0};
+            PixelBuffer<T> result(size, size, 3);
+            runner.run(std::string("affineRows/") + type + "/" + label, megapixels,
+                       [&]() { PixelKernels::affineRows(buffer, result, scale, offset, 0, size); });
+
+            std::vector<guint8> display(static_cast<size_t>(size) * size * 3);
+            runner.run(std::string("displayRows/") + type + "/" + label, megapixels,
+                       [&]() { PixelKernels::displayRows(buffer, display.data(), size * 3, 3, 0, size); });
+        };
+        run_type("u8", narrow);
+        run_type("u16", wide);
+        run_type("f32", hdr);
+    }
+
+    // 1/16 of the range, as an underexposed shot would have; contrast then equalization.
+    const int width = 4096, height = 16;
+    PixelBuffer<uint16_t> gradient(width, height, 3);
+    auto gradient8 = Gdk::Pixbuf::create(Gdk::COLORSPACE_RGB, false, 8, width, height);
+    for (int y = 0; y < height; ++y) {
+        guint8* p = gradient8->get_pixels() + static_cast<size_t>(y) * gradient8->get_rowstride();
+        for (int x = 0; x < width; ++x) {
+            const uint16_t value = static_cast<uint16_t>(8192 + x);
+            for (int c = 0; c < 3; c++) {
+                gradient.row(y)[x * 3 + c] = value;
+                p[x * 3 + c] = static_cast<guint8>((value + 128) / 257);
+            }
+        }
+    }
+
+    const std::string png_path = temporaryPath("gradient16.png");
+    PngEncoder encoder(reinterpret_cast<const guint8*>(gradient.row(0)), width * 3 * 2, 3, width, height, 1,
+                       PngFilter::Up, 16);
+    encoder.filterRows(0, height);
+    for (int chunk = 0; chunk < encoder.chunkCount(); chunk++) encoder.compressChunk(chunk);
+    {
+        std::ofstream file(png_path, std::ios::binary);
+        encoder.write(file);
+    }
+
+    ImageProcessor narrow_processor, wide_processor;
+    narrow_processor.setImage(gradient8);
+    wide_processor.loadDeepImage(png_path);
+    for (ImageProcessor* processor : {&narrow_processor, &wide_processor}) {
+        processor->applyLinearContrast(0, 255);
+        processor->setOriginalFromFiltered();
+        processor->applyHistogramEqualization();
+    }
+
+    const std::string saved_path = temporaryPath("gradient16_out.png");
+    wide_processor.savePNG(saved_path, 1, PngFilter::Up);
+    auto saved = DeepImageIO::readPNG16(saved_path);
+    std::set<int> levels8, levels16;
+    const guint8* row8 = narrow_processor.getFilteredPixbuf()->get_pixels();
+    for (int x = 0; x < width; ++x) {
+        levels8.insert(row8[x * 3]);
+        if (saved) levels16.insert(saved->row(0)[x * 3]);
+    }
+    std::cout << "  gradient of " << width << " values after contrast and equalization: " << levels8.size()
+              << " levels in 8 bits, " << levels16.size() << " in 16 bits" << std::endl;
+
+    std::remove(png_path.c_str());
+    std::remove(saved_path.c_str());
+}
+
+// One-shot loading against the chunked loader: total time, the time until the thumbnail
+// is ready (the first pixel the window could show), and how soon a cancel takes effect
+// when it arrives halfway through.
+void benchmarkLoad(BenchmarkRunner& runner) {
+    using Clock = std::chrono::steady_clock;
+    auto elapsed_ms = [](Clock::time_point since) {
+        return std::chrono::duration<double, std::milli>(Clock::now() - since).count();
+    };
+
+    for (int size : runner.getOptions().sizes) {
+        auto image = createSyntheticImage(Content::Natural, size, 3);
+        const std::string label = imageLabel(Content::Natural, size, 3);
+        const double megapixels = size * static_cast<double>(size) / 1e6;
+        const std::string path = temporaryPath("image.jpg");
+        image->save(path, "jpeg", {"quality"}, {"90"});
+
+        ImageProcessor processor;
+        runner.run("loadImage/jpeg/" + label, megapixels, [&]() { processor.loadImage(path); });
+
+        double first_pixel_ms = 0;
+        Clock::time_point start;
+        auto on_thumbnail = [&](const Glib::RefPtr<Gdk::Pixbuf>&, int, int) { first_pixel_ms = elapsed_ms(start); };
+        runner.run("loadImageProgressive/jpeg/" + label, megapixels, [&]() {
+            start = Clock::now();
+            first_pixel_ms = 0;
+            processor.loadImageProgressive(path, on_thumbnail);
+        });
+        std::cout << std::fixed << std::setprecision(1) << "  first pixel after " << first_pixel_ms << " ms"
+                  << std::defaultfloat << std::endl;
+
+        start = Clock::now();
+        processor.loadImageProgressive(path, nullptr);
+        const double full_ms = elapsed_ms(start);
+
+        JobControl control;
+        ImageProcessor cancelled;
+        cancelled.setJobControl(&control);
+        std::thread load([&]() { cancelled.loadImageProgressive(path, nullptr); });
+        std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(full_ms / 2));
+        Clock::time_point cancel_time = Clock::now();
+        control.cancel();
+        load.join();
+        std::cout << std::fixed << std::setprecision(1) << "  cancel at " << full_ms / 2 << " ms returned after "
+                  << elapsed_ms(cancel_time) << " ms" << std::defaultfloat << std::endl;
+
+        std::remove(path.c_str());
+    }
+}
+
+// Reopening a file: a full decode against a hit in the decoded-image cache, and switching
+// between two open images by moving their processors. Then three images take turns in a
+// cache with room for two, which in LRU order evicts on every open.
+void benchmarkCache(BenchmarkRunner& runner) {
+    for (int size : runner.getOptions().sizes) {
+        auto image = createSyntheticImage(Content::Natural, size, 3);
+        const std::string label = imageLabel(Content::Natural, size, 3);
+        const double megapixels = size * static_cast<double>(size) / 1e6;
+        std::vector<std::string> paths;
+        for (int i = 0; i < 3; i++) {
+            paths.push_back(temporaryPath("cache" + std::to_string(i) + ".jpg"));
+            image->save(paths.back(), "jpeg", {"quality"}, {"90"});
+        }
+
+        ImageProcessor processor;
+        DecodedImageCache cache;
+        runner.run("loadImageProgressive/jpeg/" + label, megapixels,
+                   [&]() { processor.loadImageProgressive(paths[0], nullptr); });
+        processor.loadImageCached(paths[0], cache, nullptr);
+        runner.run("loadImageCached/hit/" + label, megapixels,
+                   [&]() { processor.loadImageCached(paths[0], cache, nullptr); });
+
+        ImageProcessor other;
+        other.loadImageCached(paths[1], cache, nullptr);
+        runner.run("switchImage/" + label, megapixels, [&]() { std::swap(processor, other); });
+
+        const size_t image_bytes =
+            static_cast<size_t>(processor.getOriginalPixbuf()->get_rowstride()) * processor.getHeight();
+        DecodedImageCache small(2 * image_bytes);
+        for (int round = 0; round < 3; round++) {
+            for (const std::string& path : paths) processor.loadImageCached(path, small, nullptr);
+        }
+        auto stats = small.getStats();
+        std::cout << "  budget for 2 of 3: " << stats.hits << " hits, " << stats.misses << " misses, "
+                  << stats.evictions << " evictions, " << stats.bytes / (1024.0 * 1024.0) << " MB kept" << std::endl;
+
+        for (const std::string& path : paths) std::remove(path.c_str());
+    }
+}
+
+// Palette construction and remapping on a 24 MP photo-like image, with the error the
+// palette leaves behind.
+void benchmarkQuantize(BenchmarkRunner& runner) {
+    const int size = 4899;
+    const double megapixels = size * static_cast<double>(size) / 1e6;
+
+    auto image = createSyntheticImage(Content::Natural, size, 3);
+    const std::string label = imageLabel(Content::Natural, size, 3);
+
+    ImageProcessor processor;
+    auto reset = [&]() { processor.setImage(image); };
+
+    for (QuantizeMethod method : {QuantizeMethod::MedianCut, QuantizeMethod::Octree}) {
+        const std::string method_name = method == QuantizeMethod::MedianCut ? "mediancut" : "octree";
+        for (int bits : {5, 6}) {
+            for (int colors : {16, 64, 256}) {
+                std::ostringstream name;
+                name << "applyColorQuantization/" << method_name << "/" << 3 * bits << "bit/c" << colors << "/"
+                     << label;
+                runner.run(name.str(), megapixels,
+                           [&]() { processor.applyColorQuantization(method, colors, bits); }, reset);
+
+                auto difference = compareImages(processor.getFilteredPixbuf(), image, 0);
+                std::cout << "  palette " << processor.getPalette().size() << " colors, rms " << std::fixed
+                          << std::setprecision(2) << difference.rms << std::defaultfloat << std::endl;
+            }
+        }
+    }
+}
+
+// Canny in the textbook shape: one full-image buffer per step and a flood fill from the
+// strong pixels; same arithmetic as CannyEdgeDetector, so the output must match.
+Glib::RefPtr<Gdk::Pixbuf> referenceCanny(const Glib::RefPtr<Gdk::Pixbuf>& image, int low, int high) {
+    const int width = image->get_width(), height = image->get_height();
+    const int rowstride = image->get_rowstride(), n_channels = image->get_n_channels();
+    const size_t pixels = static_cast<size_t>(width) * height;
+    auto luma_at = [&](int x, int y) {
+        const guint8* p = image->get_pixels() + static_cast<size_t>(std::max(0, std::min(height - 1, y))) * rowstride +
+                          std::max(0, std::min(width - 1, x)) * n_channels;
+        return (77 * p[0] + 150 * p[1] + 29 * p[2] + 128) >> 8;
+    };
+
+    // Smoothed planes keep a border of one pixel, smoothed from edge-replicated luminance.
+    const int padded_width = width + 2;
+    std::vector<int> smooth_x(static_cast<size_t>(padded_width) * (height + 4));
+    std::vector<int> smooth(static_cast<size_t>(padded_width) * (height + 2)), gx(pixels), gy(pixels);
+    for (int y = -2; y < height + 2; ++y) {
+        for (int x = -1; x <= width; ++x) {
+            smooth_x[static_cast<size_t>(y + 2) * padded_width + x + 1] =
+                luma_at(x - 1, y) + 2 * luma_at(x, y) + luma_at(x + 1, y);
+        }
+    }
+    for (int y = -1; y <= height; ++y) {
+        for (int x = 0; x < padded_width; ++x) {
+            const int* column = smooth_x.data() + static_cast<size_t>(y + 2) * padded_width + x;
+            smooth[static_cast<size_t>(y + 1) * padded_width + x] =
+                (column[-padded_width] + 2 * column[0] + column[padded_width]) >> 2;
+        }
+    }
+    auto at = [&](int x, int y) { return smooth[static_cast<size_t>(y + 1) * padded_width + x + 1]; };
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            const size_t i = static_cast<size_t>(y) * width + x;
+            gx[i] = at(x + 1, y - 1) - at(x - 1, y - 1) + 2 * (at(x + 1, y) - at(x - 1, y)) + at(x + 1, y + 1) -
+                    at(x - 1, y + 1);
+            gy[i] = at(x - 1, y + 1) + 2 * at(x, y + 1) + at(x + 1, y + 1) - at(x - 1, y - 1) - 2 * at(x, y - 1) -
+                    at(x + 1, y - 1);
+        }
+    }
+
+    std::vector<int> magnitude(pixels);
+    std::vector<guint8> direction(pixels), level(pixels, 0);
+    for (size_t i = 0; i < pixels; i++) {
+        const int ax = std::abs(gx[i]), ay = std::abs(gy[i]);
+        magnitude[i] = static_cast<int>(std::sqrt(static_cast<float>(gx[i] * gx[i] + gy[i] * gy[i])));
+        direction[i] = ay < ((ax * 27146) >> 16) ? 0 : ax < ((ay * 27146) >> 16) ? 2 : (gx[i] ^ gy[i]) < 0 ? 3 : 1;
+    }
+
+    const int steps[4][2] = {{-1, 0}, {-1, -1}, {0, -1}, {1, -1}};
+    auto magnitude_at = [&](int x, int y) {
+        return x < 0 || y < 0 || x >= width || y >= height ? 0 : magnitude[static_cast<size_t>(y) * width + x];
+    };
+    std::vector<size_t> stack;
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            const size_t i = static_cast<size_t>(y) * width + x;
+            const int m = magnitude[i];
+            if (m < 4 * low) continue;
+            const int sx = steps[direction[i]][0], sy = steps[direction[i]][1];
+            if (m > magnitude_at(x + sx, y + sy) && m >= magnitude_at(x - sx, y - sy)) {
+                level[i] = m >= 4 * high ? 2 : 1;
+                if (level[i] == 2) stack.push_back(i);
+            }
+        }
+    }
+
+    auto result = image->copy();
+    std::vector<guint8> edge(pixels, 0);
+    for (size_t i : stack) edge[i] = 1;
+    while (!stack.empty()) {
+        const size_t i = stack.back();
+        stack.pop_back();
+        const int x = static_cast<int>(i % width), y = static_cast<int>(i / width);
+        for (int dy = -1; dy <= 1; dy++) {
+            for (int dx = -1; dx <= 1; dx++) {
+                if (x + dx < 0 || y + dy < 0 || x + dx >= width || y + dy >= height) continue;
+                const size_t n = static_cast<size_t>(y + dy) * width + x + dx;
+                if (level[n] && !edge[n]) {
+                    edge[n] = 1;
+                    stack.push_back(n);
+                }
+            }
+        }
+    }
+    for (int y = 0; y < height; ++y) {
+        guint8* p = result->get_pixels() + static_cast<size_t>(y) * result->get_rowstride();
+        for (int x = 0; x < width; ++x, p += n_channels) {
+            p[0] = p[1] = p[2] = edge[static_cast<size_t>(y) * width + x] ? 255 : 0;
+        }
+    }
+    return result;
+}
+
+// Fused Canny on a 24 MP photo-like image across thresholds, against the multi-pass
+// reference.
+void benchmarkEdges(BenchmarkRunner& runner) {
+    const int size = 4899;
+    const double megapixels = size * static_cast<double>(size) / 1e6;
+    const std::pair<int, int> thresholds[] = {{2, 6}, {4, 12}, {8, 24}};
+
+    auto image = createSyntheticImage(Content::Natural, size, 3);
+    const std::string label = imageLabel(Content::Natural, size, 3);
+
+    ImageProcessor processor;
+    auto reset = [&]() { processor.setImage(image); };
+
+    for (const auto& threshold : thresholds) {
+        std::ostringstream suffix;
+        suffix << "/t" << threshold.first << "-" << threshold.second << "/" << label;
+        runner.run("applyEdgeDetection" + suffix.str(), megapixels,
+                   [&]() { processor.applyEdgeDetection(threshold.first, threshold.second); }, reset);
+
+        Glib::RefPtr<Gdk::Pixbuf> reference;
+        runner.run("referenceCanny" + suffix.str(), megapixels,
+                   [&]() { reference = referenceCanny(image, threshold.first, threshold.second); });
+        if (!reference) continue;
+
+        processor.setImage(image);
+        processor.applyEdgeDetection(threshold.first, threshold.second);
+        const int edge_pixels = processor.getFilteredHistogram()[0][255];
+        auto difference = compareImages(processor.getFilteredPixbuf(), reference, 0);
+        std::cout << "  edge pixels " << std::fixed << std::setprecision(2)
+                  << 100.0 * edge_pixels / (megapixels * 1e6) << "%, max difference from reference "
+                  << difference.maxAbs << std::defaultfloat << std::endl;
+    }
+}
+
+// Error diffusion with 1, 2, 4, ... threads up to the pool size, to show how the
+// wavefront scales with cores, and ordered dithering for comparison.
+void benchmarkDither(BenchmarkRunner& runner) {
+    std::vector<int> thread_counts;
+    for (int threads = 1; threads < ThreadPool::instance().size(); threads *= 2) thread_counts.push_back(threads);
+    thread_counts.push_back(ThreadPool::instance().size());
+
+    for (int size : runner.getOptions().sizes) {
+        auto image = createSyntheticImage(Content::Natural, size, 3);
+        const std::string label = imageLabel(Content::Natural, size, 3);
+        const double megapixels = size * static_cast<double>(size) / 1e6;
+
+        ImageProcessor processor;
+        auto reset = [&]() { processor.setImage(image); };
+
+        for (DitherMethod method : {DitherMethod::FloydSteinberg, DitherMethod::Jarvis}) {
+            const std::string method_name = method == DitherMethod::Jarvis ? "jarvis" : "floydsteinberg";
+            for (int threads : thread_counts) {
+                runner.run("applyDithering/" + method_name + "/t" + std::to_string(threads) + "/" + label, megapixels,
+                           [&]() { processor.applyDithering(method, 2, threads); }, reset);
+            }
+        }
+        runner.run("applyDithering/bayer/" + label, megapixels,
+                   [&]() { processor.applyDithering(DitherMethod::Bayer, 2); }, reset);
+    }
+}
+
+// 2D real FFT round trips at power-of-two and mixed-radix sizes, then lens blur with the
+// spatial and FFT paths forced across radii. The crossover is the first radius at which
+// the FFT path wins; the cost model should switch near it. The spatial path is no longer
+// timed once it is ten times slower.
+void benchmarkFFT(BenchmarkRunner& runner) {
+    for (int n : {240, 256, 480, 500, 512, 810, 1000, 1024}) {
+        RealFFT2D fft(n, n);
+        std::vector<float> real(static_cast<size_t>(n) * n), re(fft.spectrumSize()), im(fft.spectrumSize());
+        std::vector<float> scratch;
+        Random random(n);
+        for (float& v : real) v = (random.next() & 0xFF) / 255.0f;
+
+        runner.run("realFFT2D/" + std::to_string(n) + "x" + std::to_string(n), n * static_cast<double>(n) / 1e6,
+                   [&]() {
+                       fft.forwardRows(real.data(), n, re.data(), im.data(), 0, n, scratch);
+                       fft.transformColumns(re.data(), im.data(), 0, fft.spectrumWidth(), false, scratch);
+                       fft.transformColumns(re.data(), im.data(), 0, fft.spectrumWidth(), true, scratch);
+                       fft.inverseRows(re.data(), im.data(), real.data(), n, 0, n, scratch);
+                       for (float& v : real) v /= static_cast<float>(n) * n;
+                   });
+    }
+
+    for (int size : runner.getOptions().sizes) {
+        auto image = createSyntheticImage(Content::Natural, size, 3);
+        const std::string label = imageLabel(Content::Natural, size, 3);
+        const double megapixels = size * static_cast<double>(size) / 1e6;
+
+        ImageProcessor processor;
+        auto reset = [&]() { processor.setImage(image); };
+
+        int crossover = 0;
+        bool time_spatial = true;
+        for (int radius : {1, 2, 3, 4, 6, 8, 12, 16, 24, 32, 48, 64}) {
+            const std::string suffix = "/r" + std::to_string(radius) + "/" + label;
+            size_t first = runner.getResults().size();
+            if (time_spatial) {
+                runner.run("applyLensBlur/spatial" + suffix, megapixels,
+                           [&]() { processor.applyLensBlur(radius, ConvolutionPath::Spatial); }, reset);
+            }
+            runner.run("applyLensBlur/fft" + suffix, megapixels,
+                       [&]() { processor.applyLensBlur(radius, ConvolutionPath::FFT); }, reset);
+
+            ConvolutionKernel kernel = ConvolutionKernel::disk(radius);
+            int fft_size = FFTConvolution::bestFFTSize(kernel.size(), size, size);
+            bool picks_fft = fft_size > 0 && FFTConvolution::fftCost(kernel.size(), fft_size, size, size) <
+                                                 FFTConvolution::spatialCost(kernel.taps());
+            std::cout << "  " << kernel.taps() << " taps, fft size " << fft_size << ", auto picks "
+                      << (picks_fft ? "fft" : "spatial") << std::endl;
+
+            const auto& results = runner.getResults();
+            if (results.size() == first + 2) {
+                if (!crossover && results[first + 1].median() < results[first].median()) crossover = radius;
+                if (results[first].median() > 10 * results[first + 1].median()) time_spatial = false;
+            }
+        }
+        if (crossover) std::cout << "  crossover at radius " << crossover << " on " << label << std::endl;
+    }
+}
+
+// Every operation with a linear-light path, in sRGB and then in linear light, with the
+// extra time linear light costs; it should stay within 30%.
+void benchmarkLinear(BenchmarkRunner& runner) {
+    struct Operation {
+        const char* name;
+        std::function<void(ImageProcessor&)> apply;
+    };
+    const Operation operations[] = {
+        {"applyGaussianBlur/s4", [](ImageProcessor& p) { p.applyGaussianBlur(4); }},
+        {"applyBoxFilter/r16", [](ImageProcessor& p) { p.applyBoxFilter(16); }},
+        {"applyLowPassFilter", [](ImageProcessor& p) { p.applyLowPassFilter(); }},
+        {"applyLinearContrast", [](ImageProcessor& p) { p.applyLinearContrast(20, 235); }},
+    };
+
+    for (int size : runner.getOptions().sizes) {
+        auto image = createSyntheticImage(Content::Natural, size, 3);
+        const std::string label = imageLabel(Content::Natural, size, 3);
+        const double megapixels = size * static_cast<double>(size) / 1e6;
+
+        ImageProcessor processor;
+        auto reset = [&]() { processor.setImage(image); };
+
+        for (const Operation& operation : operations) {
+            size_t first = runner.getResults().size();
+            for (bool linear : {false, true}) {
+                processor.setLinearLight(linear);
+                runner.run(std::string(operation.name) + (linear ? "/linear/" : "/srgb/") + label, megapixels,
+                           [&]() { operation.apply(processor); }, reset);
+            }
+
+            const auto& results = runner.getResults();
+            if (results.size() != first + 2 || results[first].median() <= 0) continue;
+            std::cout << "  linear light overhead " << std::fixed << std::setprecision(1)
+                      << (results[first + 1].median() / results[first].median() - 1) * 100 << "%"
+                      << std::defaultfloat << std::endl;
+        }
+    }
+}
+
+void benchmarkResample(BenchmarkRunner& runner) {
+    struct Target {
+        const char* name;
+        double scale;
+    };
+    const Target targets[] = {{"half", 0.5}, {"third", 1.0 / 3}, {"x1.5", 1.5}};
+    const std::pair<const char*, Gdk::InterpType> gdk_filters[] = {
+        {"nearest", Gdk::INTERP_NEAREST}, {"bilinear", Gdk::INTERP_BILINEAR},
+        {"tiles", Gdk::INTERP_TILES}, {"hyper", Gdk::INTERP_HYPER}};
+
+    for (int size : runner.getOptions().sizes) {
+        for (int n_channels : {3, 4}) {
+            auto image = createSyntheticImage(Content::Natural, size, n_channels);
+            const std::string label = imageLabel(Content::Natural, size, n_channels);
+            const double megapixels = size * static_cast<double>(size) / 1e6;
+            ImageProcessor processor;
+
+            runner.run("resample/box2x/" + label, megapixels,
+                       [&]() { processor.resample(image, size / 2, size / 2, ResampleFilter::Area); });
+
+            for (const Target& target : targets) {
+                const int new_size = std::max(1, static_cast<int>(std::lround(size * target.scale)));
+                const std::string suffix = std::string("/") + target.name + "/" + label;
+
+                runner.run("resample/area" + suffix, megapixels,
+                           [&]() { processor.resample(image, new_size, new_size, ResampleFilter::Area); });
+                runner.run("resample/lanczos3" + suffix, megapixels,
+                           [&]() { processor.resample(image, new_size, new_size, ResampleFilter::Lanczos3); });
+                for (const auto& filter : gdk_filters) {
+                    runner.run(std::string("scale_simple/") + filter.first + suffix, megapixels,
+                               [&]() { image->scale_simple(new_size, new_size, filter.second); });
+                }
+            }
+        }
+    }
+}
+
+// Row-major inverse mapping with a floating-point bilinear sample per pixel, the loop the
+// tiled warp replaces. Pixels sampling outside the source are left black.
+Glib::RefPtr<Gdk::Pixbuf> referenceWarp(const Glib::RefPtr<Gdk::Pixbuf>& image, const AffineTransform& t,
+                                        int width, int height) {
+    auto result = Gdk::Pixbuf::create(Gdk::COLORSPACE_RGB, image->get_has_alpha(), 8, width, height);
+    const guint8* src = image->get_pixels();
+    const int rowstride = image->get_rowstride(), n_channels = image->get_n_channels();
+    const int src_width = image->get_width(), src_height = image->get_height();
+
+    for (int y = 0; y < height; ++y) {
+        guint8* d = result->get_pixels() + static_cast<size_t>(y) * result->get_rowstride();
+        for (int x = 0; x < width; ++x, d += n_channels) {
+            double u = t.a * x + t.b * y + t.c - 0.5, v = t.d * x + t.e * y + t.f - 0.5;
+            int x0 = static_cast<int>(std::floor(u)), y0 = static_cast<int>(std::floor(v));
+            if (x0 < 0 || y0 < 0 || x0 + 1 >= src_width || y0 + 1 >= src_height) {
+                std::fill(d, d + n_channels, 0);
+                continue;
+            }
+            double fx = u - x0, fy = v - y0;
+            const guint8* p = src + static_cast<size_t>(y0) * rowstride + x0 * n_channels;
+            for (int c = 0; c < n_channels; c++) {
+                double top = p[c] * (1 - fx) + p[n_channels + c] * fx;
+                double bottom = p[rowstride + c] * (1 - fx) + p[rowstride + n_channels + c] * fx;
+                d[c] = static_cast<guint8>(top * (1 - fy) + bottom * fy + 0.5);
+            }
+        }
+    }
+    return result;
+}
+
+// Tiled fixed-point warp against the row-major reference across angles, and the exact
+// orientation paths.
+void benchmarkRotate(BenchmarkRunner& runner) {
+    const double angles[] = {3, 45, 89.5};
+    const std::pair<const char*, Orientation> orientations[] = {
+        {"rotate90", Orientation::Rotate90}, {"rotate180", Orientation::Rotate180},
+        {"flipHorizontal", Orientation::FlipHorizontal}, {"flipVertical", Orientation::FlipVertical}};
+
+    for (int size : runner.getOptions().sizes) {
+        auto image = createSyntheticImage(Content::Natural, size, 4);
+        const std::string label = imageLabel(Content::Natural, size, 4);
+        const double megapixels = size * static_cast<double>(size) / 1e6;
+
+        ImageProcessor processor;
+        auto reset = [&]() { processor.setImage(image); };
+
+        for (double angle : angles) {
+            std::ostringstream suffix;
+            suffix << "/a" << angle << "/" << label;
+            runner.run("applyRotation" + suffix.str(), megapixels, [&]() { processor.applyRotation(angle); }, reset);
+
+            int width, height;
+            AffineTransform::rotatedSize(angle, size, size, width, height);
+            auto transform = AffineTransform::rotation(angle, size, size, width, height);
+            runner.run("referenceWarp" + suffix.str(), megapixels,
+                       [&]() { referenceWarp(image, transform, width, height); });
+        }
+
+        for (const auto& orientation : orientations) {
+            runner.run(std::string("applyOrientation/") + orientation.first + "/" + label, megapixels,
+                       [&]() { processor.applyOrientation(orientation.second); }, reset);
+        }
+    }
+}
+
+struct BenchmarkSuite {
+    const char* name;
+    std::function<void(BenchmarkRunner&)> run;
+};
+
+std::vector<BenchmarkSuite> benchmarkSuites() {
+    return {
+        {"processor", benchmarkProcessor},
+        {"load", benchmarkLoad},
+        {"cache", benchmarkCache},
+        {"png", benchmarkPng},
+        {"deep", benchmarkDeep},
+        {"clahe", benchmarkClahe},
+        {"histogram", benchmarkHistogram},
+        {"median", benchmarkMedian},
+        {"gaussian", benchmarkGaussian},
+        {"integral", benchmarkIntegral},
+        {"quantize", benchmarkQuantize},
+        {"dither", benchmarkDither},
+        {"fft", benchmarkFFT},
+        {"linear", benchmarkLinear},
+        {"resample", benchmarkResample},
+        {"rotate", benchmarkRotate},
+        {"edges", benchmarkEdges},
+        {"bilateral", benchmarkBilateral},
+        {"morphology", benchmarkMorphology},
+        {"quality", benchmarkQuality},
+    };
+}
+
+bool writeBaseline(const std::string& path, const std::vector<BenchmarkResult>& results) {
+    std::ofstream file(path);
+    if (!file) return false;
+
+    file << "{\n  \"results\": [";
+    for (size_t i = 0; i < results.size(); i++) {
+        const auto& result = results[i];
+        file << (i ? ",\n" : "\n") << std::fixed << std::setprecision(4)
+             << "    {\"name\": \"" << result.name << "\", \"median_ms\": " << result.median()
+             << ", \"p90_ms\": " << result.percentile(90)
+             << ", \"mp_per_s\": " << result.megapixelsPerSecond() << "}";
+    }
+    file << "\n  ]\n}\n";
+    return (bool)file;
+}
+
+// Reads back the format written by writeBaseline: name -> median milliseconds.
+std::map<std::string, double> readBaseline(const std::string& path) {
+    std::map<std::string, double> baseline;
+    std::ifstream file(path);
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    const std::string text = buffer.str();
+
+    size_t pos = 0;
+    while ((pos = text.find("\"name\"", pos)) != std::string::npos) {
+        size_t open = text.find('"', text.find(':', pos) + 1);
+        size_t close = text.find('"', open + 1);
+        size_t median = text.find("\"median_ms\"", close);
+        if (open == std::string::npos || close == std::string::npos || median == std::string::npos) break;
+
+        baseline[text.substr(open + 1, close - open - 1)] =
+            std::strtod(text.c_str() + text.find(':', median) + 1, nullptr);
+        pos = close;
+    }
+    return baseline;
+}
+
+int compareWithBaseline(const std::vector<BenchmarkResult>& results, const std::string& path, double threshold) {
+    auto baseline = readBaseline(path);
+    if (baseline.empty()) {
+        std::cerr << "No baseline entries in " << path << std::endl;
+        return 2;
+    }
+
+    int regressions = 0;
+    for (const auto& result : results) {
+        auto it = baseline.find(result.name);
+        if (it == baseline.end() || it->second <= 0) continue;
+
+        double ratio = result.median() / it->second;
+        if (ratio > 1.0 + threshold) {
+            std::cout << "REGRESSION " << result.name << std::fixed << std::setprecision(3)
+                      << ": " << result.median() << " ms vs baseline " << it->second << " ms ("
+                      << std::setprecision(1) << (ratio - 1.0) * 100 << "% slower)" << std::endl;
+            regressions++;
+        }
+    }
+
+    std::cout << regressions << " regression(s) above " << threshold * 100 << "% threshold" << std::endl;
+    return regressions ? 1 : 0;
+}
+
+std::vector<std::string> splitList(const std::string& text) {
+    std::vector<std::string> items;
+    std::stringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (!item.empty()) items.push_back(item);
+    }
+    return items;
+}
+
+void printUsage(const char* program) {
+    std::cout << "Usage: " << program << " [options]\n"
+              << "  --suite NAME[,NAME]     suites to run, or 'all' (default: processor)\n"
+              << "  --sizes N[,N]           square image sizes (default: 256,1024,4096; up to 16384)\n"
+              << "  --warmup N              untimed warm-up runs per case (default: 1)\n"
+              << "  --reps N                timed repetitions per case (default: 5)\n"
+              << "  --filter TEXT           only run cases whose name contains TEXT\n"
+              << "  --baseline FILE         compare medians with FILE, exit 1 on regression\n"
+              << "  --threshold FRACTION    allowed slowdown against the baseline (default: 0.15)\n"
+              << "  --write-baseline FILE   store the results as a new baseline\n";
+}
+
+int main(int argc, char** argv) {
+    Gio::init();
+    Gdk::wrap_init();
+
+    BenchmarkOptions options;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+
+        if (arg == "--suite" && has_value) {
+            options.suites = splitList(argv[++i]);
+        } else if (arg == "--sizes" && has_value) {
+            options.sizes.clear();
+            for (const auto& size : splitList(argv[++i])) options.sizes.push_back(std::atoi(size.c_str()));
+        } else if (arg == "--warmup" && has_value) {
+            options.warmup = std::atoi(argv[++i]);
+        } else if (arg == "--reps" && has_value) {
+            options.repetitions = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--filter" && has_value) {
+            options.filter = argv[++i];
+        } else if (arg == "--baseline" && has_value) {
+            options.baselinePath = argv[++i];
+        } else if (arg == "--threshold" && has_value) {
+            options.threshold = std::atof(argv[++i]);
+        } else if (arg == "--write-baseline" && has_value) {
+            options.writeBaselinePath = argv[++i];
+        } else {
+            printUsage(argv[0]);
+            return arg == "--help" ? 0 : 2;
+        }
+    }
+
+    BenchmarkRunner runner(options);
+    bool run_all = std::find(options.suites.begin(), options.suites.end(), "all") != options.suites.end();
+    for (const auto& suite : benchmarkSuites()) {
+        if (run_all || std::find(options.suites.begin(), options.suites.end(), suite.name) != options.suites.end()) {
+            std::cout << "== " << suite.name << " ==" << std::endl;
+            suite.run(runner);
+        }
+    }
+
+    if (!options.writeBaselinePath.empty() && !writeBaseline(options.writeBaselinePath, runner.getResults())) {
+        std::cerr << "Failed to write " << options.writeBaselinePath << std::endl;
+        return 2;
+    }
+
+    if (!options.baselinePath.empty()) {
+        return compareWithBaseline(runner.getResults(), options.baselinePath, options.threshold);
+    }
+
+    return 0;
+}
@@ -0,0 +1,200 @@
+#pragma once
+
+#include <glib.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Bilateral filter on a downsampled 3D grid (x, y, luminance), after Chen, Paris and
+// Durand. Every pixel is splatted into the nearest cell as (r, g, b, 1); the grid is then
+// blurred with [1 4 6 4 1] / 16 along each axis, about one cell of standard deviation,
+// and every output pixel is the trilinear interpolation of the blurred (r, g, b) divided
+// by that of the weight. Cells are sigma_spatial pixels by sigma_range levels, so the
+// work outside splat and slice shrinks as the spatial sigma grows.
+//
+// The grid costs 16 bytes per cell, about 16 * 256 / (sigma_spatial^2 * sigma_range)
+// bytes per pixel: 32 at the minimum sigmas, under 1 from sigma_spatial 16 and
+// sigma_range 16 up.
+// Three cells of padding on every side keep blur and slice free of bounds checks.
+class BilateralGrid {
+   public:
+    static constexpr double minSpatialSigma = 4;
+    static constexpr double minRangeSigma = 8;
+    static constexpr int padding = 3;
+
+    struct Cell {
+        float r = 0, g = 0, b = 0, weight = 0;
+    };
+
+    BilateralGrid(int width, int height, double sigma_spatial, double sigma_range)
+        : spatial(std::max(minSpatialSigma, sigma_spatial)), range(std::max(minRangeSigma, sigma_range)) {
+        sizeX = cellOf(width - 1, spatial) + 1 + 2 * padding;
+        sizeY = cellOf(height - 1, spatial) + 1 + 2 * padding;
+        sizeZ = cellOf(255, range) + 1 + 2 * padding;
+        cells.resize(static_cast<size_t>(sizeX) * sizeY * sizeZ);
+
+        firstRow.assign(sizeY + 1, height);
+        for (int y = height - 1; y >= 0; --y) firstRow[cellOf(y, spatial) + padding] = y;
+        for (int gy = sizeY - 1; gy >= 0; --gy) firstRow[gy] = std::min(firstRow[gy], firstRow[gy + 1]);
+    }
+
+    int getRows() const { return sizeY; }
+    size_t getBytes() const { return cells.size() * sizeof(Cell); }
+
+    // Splats the pixels that fall into grid row `gy`; rows are independent of each other.
+    void splatRow(int gy, const guint8* src, int rowstride, int n_channels, int width) {
+        Cell* row = cellRow(gy);
+        for (int y = firstRow[gy]; y < firstRow[gy + 1]; ++y) {
+            const guint8* p = src + static_cast<size_t>(y) * rowstride;
+            for (int x = 0; x < width; ++x, p += n_channels) {
+                const int luma = (77 * p[0] + 150 * p[1] + 29 * p[2] + 128) >> 8;
+                Cell& cell = row[(cellOf(x, spatial) + padding) * sizeZ + cellOf(luma, range) + padding];
+                cell.r += p[0];
+                cell.g += p[1];
+                cell.b += p[2];
+                cell.weight += 1;
+            }
+        }
+    }
+
+    // Blur passes along x, y and z, in place. Each pass splits into independent lines:
+    // blurTasks(axis) of them, grid rows for x and z and grid columns for y.
+    int blurTasks(int axis) const { return axis == 1 ? sizeX : sizeY; }
+
+    void blur(int axis, int index) {
+        const int row_cells = sizeX * sizeZ;
+        std::vector<Cell> line;
+        switch (axis) {
+            case 0: {
+                Cell* row = cellRow(index);
+                line.assign(row, row + row_cells);
+                blurLine(line.data(), row, sizeX, sizeZ, sizeZ);
+                break;
+            }
+            case 1:
+                line.resize(static_cast<size_t>(sizeY) * sizeZ);
+                for (int gy = 0; gy < sizeY; gy++) {
+                    const Cell* column = cellRow(gy) + index * sizeZ;
+                    std::copy(column, column + sizeZ, line.data() + gy * sizeZ);
+                }
+                for (int gy = 0; gy < sizeY; gy++) {
+                    Cell* out = cellRow(gy) + index * sizeZ;
+                    if (gy < 2 || gy >= sizeY - 2) {
+                        std::fill(out, out + sizeZ, Cell());
+                        continue;
+                    }
+                    for (int k = 0; k < sizeZ; k++) blend(line.data() + gy * sizeZ + k, sizeZ, out + k);
+                }
+                break;
+            default: {
+                Cell* row = cellRow(index);
+                line.resize(sizeZ);
+                for (int gx = 0; gx < sizeX; gx++) {
+                    std::copy(row + gx * sizeZ, row + (gx + 1) * sizeZ, line.begin());
+                    blurLine(line.data(), row + gx * sizeZ, sizeZ, 1, 1);
+                }
+                break;
+            }
+        }
+    }
+
+    // Trilinear slice of rows [y_begin, y_end) into `dst`; pixels in empty cells are left
+    // as they are.
+    void sliceRows(const guint8* src, int rowstride, int n_channels, int width, guint8* dst, int y_begin,
+                   int y_end) const {
+        for (int y = y_begin; y < y_end; ++y) {
+            const guint8* p = src + static_cast<size_t>(y) * rowstride;
+            guint8* d = dst + static_cast<size_t>(y) * rowstride;
+            const float fy = static_cast<float>(y / spatial) + padding;
+            const int gy = static_cast<int>(fy);
+            const float wy = fy - gy;
+
+            for (int x = 0; x < width; ++x, p += n_channels, d += n_channels) {
+                const int luma = (77 * p[0] + 150 * p[1] + 29 * p[2] + 128) >> 8;
+                const float fx = static_cast<float>(x / spatial) + padding;
+                const float fz = static_cast<float>(luma / range) + padding;
+                const int gx = static_cast<int>(fx), gz = static_cast<int>(fz);
+                const float wx = fx - gx, wz = fz - gz;
+
+                const Cell* c = cells.data() + (static_cast<size_t>(gy) * sizeX + gx) * sizeZ + gz;
+                float sum[4];
+                trilinear(c, sizeZ, sizeX * sizeZ, wx, wy, wz, sum);
+                if (sum[3] <= 0) continue;
+
+                d[0] = clampByte(sum[0] / sum[3]);
+                d[1] = clampByte(sum[1] / sum[3]);
+                d[2] = clampByte(sum[2] / sum[3]);
+            }
+        }
+    }
+
+   private:
+    double spatial, range;
+    int sizeX = 0, sizeY = 0, sizeZ = 0;
+    std::vector<Cell> cells;
+    std::vector<int> firstRow;
+
+    static int cellOf(int value, double sigma) { return static_cast<int>(value / sigma + 0.5); }
+
+    static guint8 clampByte(float value) {
+        return static_cast<guint8>(std::min(255.0f, std::max(0.0f, value + 0.5f)));
+    }
+
+    Cell* cellRow(int gy) { return cells.data() + static_cast<size_t>(gy) * sizeX * sizeZ; }
+
+    // out = [1 4 6 4 1] / 16 around `in`, taps `stride` cells apart.
+    static void blend(const Cell* in, int stride, Cell* out) {
+#if defined(__SSE2__)
+        auto load = [&](int k) { return _mm_loadu_ps(&in[k * stride].r); };
+        __m128 sum = _mm_add_ps(_mm_add_ps(load(-2), load(2)),
+                                _mm_add_ps(_mm_mul_ps(_mm_add_ps(load(-1), load(1)), _mm_set1_ps(4.0f)),
+                                           _mm_mul_ps(load(0), _mm_set1_ps(6.0f))));
+        _mm_storeu_ps(&out->r, _mm_mul_ps(sum, _mm_set1_ps(1.0f / 16)));
+#else
+        for (int k = 0; k < 4; k++) {
+            auto at = [&](int tap) { return (&in[tap * stride].r)[k]; };
+            const float sum = (at(-2) + at(2)) + ((at(-1) + at(1)) * 4.0f + at(0) * 6.0f);
+            (&out->r)[k] = sum * (1.0f / 16);
+        }
+#endif
+    }
+
+    // Blurs a line of `length` positions `step` cells apart, each `width` cells wide. The
+    // two positions at either end, whose taps would leave the line, are set to zero; slice
+    // never reaches them.
+    static void blurLine(const Cell* in, Cell* out, int length, int step, int width) {
+        for (int i = 0; i < length; i++) {
+            Cell* o = out + static_cast<size_t>(i) * step;
+            if (i < 2 || i >= length - 2) {
+                std::fill(o, o + width, Cell());
+                continue;
+            }
+            for (int k = 0; k < width; k++) blend(in + static_cast<size_t>(i) * step + k, step, o + k);
+        }
+    }
+
+    static void trilinear(const Cell* c, int stride_x, int stride_y, float wx, float wy, float wz, float* sum) {
+#if defined(__SSE2__)
+        auto lerp_z = [&](const Cell* p) {
+            __m128 a = _mm_loadu_ps(&p->r), b = _mm_loadu_ps(&p[1].r);
+            return _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), _mm_set1_ps(wz)));
+        };
+        auto lerp = [](__m128 a, __m128 b, float w) { return _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), _mm_set1_ps(w))); };
+        __m128 top = lerp(lerp_z(c), lerp_z(c + stride_x), wx);
+        __m128 bottom = lerp(lerp_z(c + stride_y), lerp_z(c + stride_y + stride_x), wx);
+        _mm_storeu_ps(sum, lerp(top, bottom, wy));
+#else
+        for (int k = 0; k < 4; k++) {
+            auto at = [&](int offset, int z) { return (&c[offset + z].r)[k]; };
+            auto lerp_z = [&](int offset) { return at(offset, 0) + (at(offset, 1) - at(offset, 0)) * wz; };
+            float top = lerp_z(0) + (lerp_z(stride_x) - lerp_z(0)) * wx;
+            float bottom = lerp_z(stride_y) + (lerp_z(stride_y + stride_x) - lerp_z(stride_y)) * wx;
+            sum[k] = top + (bottom - top) * wy;
+        }
+#endif
+    }
+};
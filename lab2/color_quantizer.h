@@ -0,0 +1,280 @@
+#pragma once
+
+#include <glib.h>
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+struct PaletteColor {
+    guint8 red, green, blue;
+};
+
+// Counts of colors reduced to `bits` bits per channel: 5 gives a 15-bit (32K bin) and 6
+// an 18-bit (256K bin) histogram. Bands of rows can be counted into separate histograms
+// and merged afterwards. The quantizers below only ever see the occupied bins, never the
+// pixels, so their cost does not depend on the image size.
+class ColorHistogram {
+   public:
+    static constexpr int minBits = 5;
+    static constexpr int maxBits = 6;
+
+    explicit ColorHistogram(int bits)
+        : bits(std::max(minBits, std::min(bits, maxBits))), counts(size_t(1) << (3 * this->bits), 0) {}
+
+    int getBits() const { return bits; }
+    int size() const { return static_cast<int>(counts.size()); }
+    uint32_t count(int bin) const { return counts[bin]; }
+
+    int binOf(const guint8* p) const {
+        const int shift = 8 - bits;
+        return ((p[0] >> shift) << (2 * bits)) | ((p[1] >> shift) << bits) | (p[2] >> shift);
+    }
+
+    // Channel values of a bin, as bin coordinates.
+    void coordinates(int bin, int* c) const {
+        const int mask = (1 << bits) - 1;
+        c[0] = bin >> (2 * bits);
+        c[1] = (bin >> bits) & mask;
+        c[2] = bin & mask;
+    }
+
+    // The 8-bit value at the middle of a bin coordinate.
+    int centre(int coordinate) const { return (coordinate << (8 - bits)) + (1 << (8 - bits)) / 2; }
+
+    void countRows(const guint8* pixels, int rowstride, int n_channels, int width, int y_begin, int y_end) {
+        for (int y = y_begin; y < y_end; ++y) {
+            const guint8* p = pixels + static_cast<size_t>(y) * rowstride;
+            for (int x = 0; x < width; ++x, p += n_channels) counts[binOf(p)]++;
+        }
+    }
+
+    void merge(const ColorHistogram& other) {
+        for (size_t i = 0; i < counts.size(); i++) counts[i] += other.counts[i];
+    }
+
+   private:
+    int bits;
+    std::vector<uint32_t> counts;
+};
+
+// Heckbert's median cut: the box with the largest population times extent is split at
+// the weighted median of its longest axis until there are enough boxes; each box
+// contributes the weighted mean of its colors.
+inline std::vector<PaletteColor> medianCutPalette(const ColorHistogram& histogram, int colors) {
+    struct Entry {
+        int c[3];
+        uint32_t count;
+    };
+    struct Box {
+        int begin, end;
+        uint64_t count;
+        int axis, extent;
+    };
+
+    std::vector<Entry> entries;
+    for (int bin = 0; bin < histogram.size(); bin++) {
+        if (histogram.count(bin) == 0) continue;
+        Entry entry;
+        histogram.coordinates(bin, entry.c);
+        entry.count = histogram.count(bin);
+        entries.push_back(entry);
+    }
+
+    auto makeBox = [&](int begin, int end) {
+        Box box{begin, end, 0, 0, -1};
+        int lo[3] = {255, 255, 255}, hi[3] = {0, 0, 0};
+        for (int i = begin; i < end; i++) {
+            box.count += entries[i].count;
+            for (int a = 0; a < 3; a++) {
+                lo[a] = std::min(lo[a], entries[i].c[a]);
+                hi[a] = std::max(hi[a], entries[i].c[a]);
+            }
+        }
+        for (int a = 0; a < 3; a++) {
+            if (hi[a] - lo[a] > box.extent) {
+                box.extent = hi[a] - lo[a];
+                box.axis = a;
+            }
+        }
+        return box;
+    };
+
+    std::vector<Box> boxes;
+    if (!entries.empty()) boxes.push_back(makeBox(0, static_cast<int>(entries.size())));
+
+    while (static_cast<int>(boxes.size()) < colors) {
+        int best = -1;
+        double best_score = 0;
+        for (int i = 0; i < static_cast<int>(boxes.size()); i++) {
+            double score = static_cast<double>(boxes[i].count) * boxes[i].extent;
+            if (boxes[i].end - boxes[i].begin > 1 && score > best_score) {
+                best_score = score;
+                best = i;
+            }
+        }
+        if (best < 0) break;
+
+        Box box = boxes[best];
+        const int axis = box.axis;
+        std::sort(entries.begin() + box.begin, entries.begin() + box.end,
+                  [axis](const Entry& a, const Entry& b) { return a.c[axis] < b.c[axis]; });
+
+        uint64_t below = 0;
+        int split = box.begin + 1;
+        for (int i = box.begin; i < box.end - 1; i++) {
+            below += entries[i].count;
+            split = i + 1;
+            if (below * 2 >= box.count) break;
+        }
+
+        boxes[best] = makeBox(box.begin, split);
+        boxes.push_back(makeBox(split, box.end));
+    }
+
+    std::vector<PaletteColor> palette;
+    for (const Box& box : boxes) {
+        uint64_t sum[3] = {0, 0, 0};
+        for (int i = box.begin; i < box.end; i++) {
+            for (int a = 0; a < 3; a++) sum[a] += static_cast<uint64_t>(histogram.centre(entries[i].c[a])) * entries[i].count;
+        }
+        palette.push_back({static_cast<guint8>((sum[0] + box.count / 2) / box.count),
+                           static_cast<guint8>((sum[1] + box.count / 2) / box.count),
+                           static_cast<guint8>((sum[2] + box.count / 2) / box.count)});
+    }
+    return palette;
+}
+
+// Gervautz-Purgathofer octree: every occupied bin is a leaf at depth `bits`, and nodes
+// of the deepest level with children are folded into single leaves, least populated
+// first, until no more than `colors` leaves remain.
+inline std::vector<PaletteColor> octreePalette(const ColorHistogram& histogram, int colors) {
+    struct Node {
+        int children[8] = {-1, -1, -1, -1, -1, -1, -1, -1};
+        uint64_t count = 0;
+        uint64_t sum[3] = {0, 0, 0};
+        int level = 0;
+        bool leaf = false;
+    };
+
+    const int depth = histogram.getBits();
+    std::vector<Node> nodes(1);
+    std::vector<std::vector<int>> levels(depth);
+    int leaves = 0;
+
+    for (int bin = 0; bin < histogram.size(); bin++) {
+        uint32_t count = histogram.count(bin);
+        if (count == 0) continue;
+
+        int c[3];
+        histogram.coordinates(bin, c);
+        int node = 0;
+        for (int level = 0;; level++) {
+            nodes[node].count += count;
+            for (int a = 0; a < 3; a++) nodes[node].sum[a] += static_cast<uint64_t>(histogram.centre(c[a])) * count;
+            if (level == depth) break;
+
+            int shift = depth - 1 - level;
+            int child = (((c[0] >> shift) & 1) << 2) | (((c[1] >> shift) & 1) << 1) | ((c[2] >> shift) & 1);
+            if (nodes[node].children[child] < 0) {
+                nodes[node].children[child] = static_cast<int>(nodes.size());
+                Node created;
+                created.level = level + 1;
+                created.leaf = created.level == depth;
+                if (created.leaf) {
+                    leaves++;
+                } else {
+                    levels[created.level].push_back(static_cast<int>(nodes.size()));
+                }
+                nodes.push_back(created);
+            }
+            node = nodes[node].children[child];
+        }
+    }
+    if (depth > 0 && leaves > 0) levels[0].push_back(0);
+
+    for (int level = depth - 1; level >= 0 && leaves > colors; level--) {
+        std::vector<int>& reducible = levels[level];
+        std::sort(reducible.begin(), reducible.end(),
+                  [&](int a, int b) { return nodes[a].count < nodes[b].count; });
+
+        for (int index : reducible) {
+            if (leaves <= colors) break;
+
+            Node& node = nodes[index];
+            int children = 0;
+            for (int& child : node.children) {
+                if (child >= 0) children++;
+                child = -1;
+            }
+            node.leaf = true;
+            leaves -= children - 1;
+        }
+    }
+
+    std::vector<PaletteColor> palette;
+    std::vector<int> stack{0};
+    while (!stack.empty() && leaves > 0) {
+        const Node& node = nodes[stack.back()];
+        stack.pop_back();
+        if (node.leaf) {
+            palette.push_back({static_cast<guint8>((node.sum[0] + node.count / 2) / node.count),
+                               static_cast<guint8>((node.sum[1] + node.count / 2) / node.count),
+                               static_cast<guint8>((node.sum[2] + node.count / 2) / node.count)});
+            continue;
+        }
+        for (int child : node.children) {
+            if (child >= 0) stack.push_back(child);
+        }
+    }
+    return palette;
+}
+
+// Nearest palette entry for every histogram bin, so remapping a pixel is a single
+// lookup. Only occupied bins are searched; every pixel of the counted image is in one.
+class InverseColorMap {
+   public:
+    InverseColorMap(const ColorHistogram& histogram, const std::vector<PaletteColor>& palette)
+        : histogram(histogram), palette(palette), indices(histogram.size(), 0) {}
+
+    // Fills the map for bins [bin_begin, bin_end); ranges may be filled concurrently.
+    void build(int bin_begin, int bin_end) {
+        for (int bin = bin_begin; bin < bin_end; bin++) {
+            if (histogram.count(bin) == 0) continue;
+
+            int c[3];
+            histogram.coordinates(bin, c);
+            int r = histogram.centre(c[0]), g = histogram.centre(c[1]), b = histogram.centre(c[2]);
+
+            int best = 0, best_distance = 1 << 30;
+            for (int i = 0; i < static_cast<int>(palette.size()); i++) {
+                int dr = r - palette[i].red, dg = g - palette[i].green, db = b - palette[i].blue;
+                int distance = dr * dr + dg * dg + db * db;
+                if (distance < best_distance) {
+                    best_distance = distance;
+                    best = i;
+                }
+            }
+            indices[bin] = static_cast<guint8>(best);
+        }
+    }
+
+    int indexOf(const guint8* p) const { return indices[histogram.binOf(p)]; }
+
+    // Replaces the colors of rows [y_begin, y_end) with their palette entries.
+    void remapRows(guint8* pixels, int rowstride, int n_channels, int width, int y_begin, int y_end) const {
+        for (int y = y_begin; y < y_end; ++y) {
+            guint8* p = pixels + static_cast<size_t>(y) * rowstride;
+            for (int x = 0; x < width; ++x, p += n_channels) {
+                const PaletteColor& color = palette[indexOf(p)];
+                p[0] = color.red;
+                p[1] = color.green;
+                p[2] = color.blue;
+            }
+        }
+    }
+
+   private:
+    const ColorHistogram& histogram;
+    const std::vector<PaletteColor>& palette;
+    std::vector<guint8> indices;
+};
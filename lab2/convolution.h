@@ -0,0 +1,270 @@
+#pragma once
+
+#include <glib.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include "fft.h"
+
+// Square kernel of odd size 2r+1, row-major, applied as a convolution to R, G and B.
+// Pixels outside the image are replaced by the nearest edge pixel.
+struct ConvolutionKernel {
+    static constexpr int maxRadius = 255;
+
+    int radius = 0;
+    std::vector<float> weights;
+
+    int size() const { return 2 * radius + 1; }
+    float at(int dx, int dy) const { return weights[(dy + radius) * size() + dx + radius]; }
+
+    int taps() const {
+        return static_cast<int>(std::count_if(weights.begin(), weights.end(), [](float w) { return w != 0; }));
+    }
+
+    // Uniform disk, the defocus blur of a lens with a round aperture; not separable.
+    // Pixels on the rim are weighted by how much of them the disk covers.
+    static ConvolutionKernel disk(int radius) {
+        ConvolutionKernel kernel;
+        kernel.radius = std::max(1, std::min(radius, maxRadius));
+        const int size = kernel.size();
+        kernel.weights.assign(static_cast<size_t>(size) * size, 0.0f);
+
+        const int samples = 4;
+        double total = 0;
+        for (int dy = -kernel.radius; dy <= kernel.radius; dy++) {
+            for (int dx = -kernel.radius; dx <= kernel.radius; dx++) {
+                int inside = 0;
+                for (int sy = 0; sy < samples; sy++) {
+                    for (int sx = 0; sx < samples; sx++) {
+                        double px = dx + (sx + 0.5) / samples - 0.5, py = dy + (sy + 0.5) / samples - 0.5;
+                        if (px * px + py * py <= (kernel.radius + 0.5) * (kernel.radius + 0.5)) inside++;
+                    }
+                }
+                kernel.weights[(dy + kernel.radius) * size + dx + kernel.radius] = inside;
+                total += inside;
+            }
+        }
+        for (float& w : kernel.weights) w = static_cast<float>(w / total);
+        return kernel;
+    }
+};
+
+// Direct convolution. A band of source rows is widened by r on every side and split into
+// float planes, then every nonzero tap adds a shifted source row into a row of sums, so
+// the inner loop is a multiply-add over contiguous floats. Cost: one multiply-add per
+// tap, pixel and channel.
+class SpatialConvolution {
+   public:
+    explicit SpatialConvolution(const ConvolutionKernel& kernel) : kernel(kernel) {
+        for (int dy = -kernel.radius; dy <= kernel.radius; dy++) {
+            for (int dx = -kernel.radius; dx <= kernel.radius; dx++) {
+                if (kernel.at(dx, dy) != 0) taps.push_back({dx, dy, kernel.at(dx, dy)});
+            }
+        }
+    }
+
+    void filterRows(const guint8* src, guint8* dst, int width, int height, int rowstride, int n_channels,
+                    int y_begin, int y_end) const {
+        const int r = kernel.radius;
+        const int padded_width = width + 2 * r;
+        const int rows = y_end - y_begin + 2 * r;
+        std::vector<float> planes(static_cast<size_t>(3) * rows * padded_width);
+        std::vector<float> sums(width);
+
+        for (int row = 0; row < rows; row++) {
+            const int y = std::max(0, std::min(height - 1, y_begin - r + row));
+            const guint8* p = src + static_cast<size_t>(y) * rowstride;
+            for (int c = 0; c < 3; c++) {
+                float* plane = planes.data() + (static_cast<size_t>(c) * rows + row) * padded_width;
+                for (int x = 0; x < padded_width; x++) {
+                    plane[x] = p[std::max(0, std::min(width - 1, x - r)) * n_channels + c];
+                }
+            }
+        }
+
+        for (int y = y_begin; y < y_end; ++y) {
+            guint8* d = dst + static_cast<size_t>(y) * rowstride;
+            for (int c = 0; c < 3; c++) {
+                std::fill(sums.begin(), sums.end(), 0.0f);
+                for (const Tap& tap : taps) {
+                    const float* s = planes.data() + (static_cast<size_t>(c) * rows + y - y_begin + r - tap.dy) *
+                                                         padded_width + r - tap.dx;
+                    for (int x = 0; x < width; x++) sums[x] += tap.weight * s[x];
+                }
+                for (int x = 0; x < width; x++) d[x * n_channels + c] = clampByte(sums[x]);
+            }
+        }
+    }
+
+    static guint8 clampByte(float value) {
+        return static_cast<guint8>(std::min(255.0f, std::max(0.0f, value + 0.5f)));
+    }
+
+   private:
+    struct Tap {
+        int dx, dy;
+        float weight;
+    };
+
+    const ConvolutionKernel& kernel;
+    std::vector<Tap> taps;
+};
+
+// Overlap-add convolution through the FFT. The source, extended by r edge pixels on
+// every side, is cut into tiles of `tileSize` x `tileSize`; each tile is zero-padded to
+// fftSize, multiplied with the kernel spectrum and added back into the output, where it
+// covers tileSize + 2r rows and columns. The fft size leaves room for all of them, so
+// nothing wraps around.
+//
+// Output is collected one row of tiles at a time in a band of float sums, tileSize + 2r
+// rows tall; once a row of tiles is added, the band's first tileSize rows are final and
+// the rest carries over to the next. Within a row, tiles two apart never touch the same
+// sums, so even and odd tiles can each run in parallel.
+class FFTConvolution {
+   public:
+    static constexpr int maxFFTSize = 1024;
+
+    FFTConvolution(const ConvolutionKernel& kernel, int fft_size, int width, int height)
+        : radius(kernel.radius), fftSize(fft_size), tileSize(fft_size - 2 * kernel.radius), width(width),
+          height(height), fft(fft_size, fft_size), kernelRe(fft.spectrumSize()), kernelIm(fft.spectrumSize()) {}
+
+    int getFFTSize() const { return fftSize; }
+    int getTileSize() const { return tileSize; }
+    int tilesX() const { return (width + 2 * radius + tileSize - 1) / tileSize; }
+    int tilesY() const { return (height + 2 * radius + tileSize - 1) / tileSize; }
+    int bandRows() const { return tileSize + 2 * radius; }
+    size_t bandValues() const { return static_cast<size_t>(3) * bandRows() * width; }
+    size_t getBytes() const { return (kernelRe.size() + kernelIm.size() + bandValues()) * sizeof(float); }
+
+    const RealFFT2D& getFFT() const { return fft; }
+
+    // The kernel padded to the fft size, scaled so that the unscaled inverse transform
+    // gives the true result. Its spectrum is filled by transforming these rows and then
+    // all columns into kernelSpectrumRe() and kernelSpectrumIm().
+    std::vector<float> paddedKernel(const ConvolutionKernel& kernel) const {
+        std::vector<float> padded(static_cast<size_t>(fftSize) * fftSize, 0.0f);
+        const float scale = 1.0f / (static_cast<float>(fftSize) * fftSize);
+        for (int y = 0; y < kernel.size(); y++) {
+            for (int x = 0; x < kernel.size(); x++) {
+                padded[static_cast<size_t>(y) * fftSize + x] = kernel.weights[y * kernel.size() + x] * scale;
+            }
+        }
+        return padded;
+    }
+
+    float* kernelSpectrumRe() { return kernelRe.data(); }
+    float* kernelSpectrumIm() { return kernelIm.data(); }
+
+    // Adds tile (tx, ty) of tile row ty into `band`, one plane per channel.
+    void addTile(const guint8* src, int rowstride, int n_channels, int tx, int ty, float* band,
+                 std::vector<float>& scratch) const {
+        const int x0 = tx * tileSize - radius, y0 = ty * tileSize - radius;
+        const int out_x0 = x0 - radius;
+        const int x_begin = std::max(0, -out_x0), x_end = std::min(bandRows(), width - out_x0);
+
+        const size_t values = static_cast<size_t>(fftSize) * fftSize;
+        const size_t spectrum = fft.spectrumSize();
+        if (scratch.size() < values + 2 * spectrum) scratch.resize(values + 2 * spectrum);
+        float* real = scratch.data();
+        float* re = real + values;
+        float* im = re + spectrum;
+        std::vector<float> fft_scratch;
+
+        for (int c = 0; c < 3; c++) {
+            std::fill(real, real + values, 0.0f);
+            for (int y = 0; y < tileSize; y++) {
+                const int sy = std::max(0, std::min(height - 1, y0 + y));
+                const guint8* p = src + static_cast<size_t>(sy) * rowstride + c;
+                float* row = real + static_cast<size_t>(y) * fftSize;
+                for (int x = 0; x < tileSize; x++) row[x] = p[std::max(0, std::min(width - 1, x0 + x)) * n_channels];
+            }
+
+            // Rows past the tile are zero and so is their spectrum.
+            fft.forwardRows(real, fftSize, re, im, 0, tileSize, fft_scratch);
+            std::fill(re + static_cast<size_t>(tileSize) * fft.spectrumWidth(), re + spectrum, 0.0f);
+            std::fill(im + static_cast<size_t>(tileSize) * fft.spectrumWidth(), im + spectrum, 0.0f);
+            fft.transformColumns(re, im, 0, fft.spectrumWidth(), false, fft_scratch);
+            for (size_t i = 0; i < spectrum; i++) {
+                float a = re[i], b = im[i];
+                re[i] = a * kernelRe[i] - b * kernelIm[i];
+                im[i] = a * kernelIm[i] + b * kernelRe[i];
+            }
+            fft.transformColumns(re, im, 0, fft.spectrumWidth(), true, fft_scratch);
+            fft.inverseRows(re, im, real, fftSize, 0, bandRows(), fft_scratch);
+
+            float* plane = band + static_cast<size_t>(c) * bandRows() * width;
+            for (int y = 0; y < bandRows(); y++) {
+                const float* row = real + static_cast<size_t>(y) * fftSize;
+                float* sums = plane + static_cast<size_t>(y) * width;
+                for (int x = x_begin; x < x_end; x++) sums[out_x0 + x] += row[x];
+            }
+        }
+    }
+
+    // Writes band rows [row_begin, row_end) of tile row ty to `dst`, skipping rows that
+    // lie above or below the image.
+    void storeRows(const float* band, int ty, guint8* dst, int rowstride, int n_channels, int row_begin,
+                   int row_end) const {
+        for (int row = row_begin; row < row_end; row++) {
+            const int y = ty * tileSize - 2 * radius + row;
+            if (y < 0 || y >= height) continue;
+            guint8* d = dst + static_cast<size_t>(y) * rowstride;
+            for (int c = 0; c < 3; c++) {
+                const float* sums = band + (static_cast<size_t>(c) * bandRows() + row) * width;
+                for (int x = 0; x < width; x++) d[x * n_channels + c] = SpatialConvolution::clampByte(sums[x]);
+            }
+        }
+    }
+
+    // Moves the rows still open to the top of the band for the next row of tiles.
+    void advance(float* band) const {
+        for (int c = 0; c < 3; c++) {
+            float* plane = band + static_cast<size_t>(c) * bandRows() * width;
+            const size_t kept = static_cast<size_t>(2 * radius) * width;
+            std::memmove(plane, plane + static_cast<size_t>(tileSize) * width, kept * sizeof(float));
+            std::fill(plane + kept, plane + static_cast<size_t>(bandRows()) * width, 0.0f);
+        }
+    }
+
+    // Relative cost per pixel and channel of a width x height image. A tap of the direct
+    // convolution counts 1; the FFT path pays a forward and an inverse transform of
+    // fftSize^2 values, about fftSize^2 log2(fftSize^2) butterfly operations each, for
+    // every tile, including the parts of edge tiles that hang over the image. fftWeight
+    // was measured with `--suite fft`, which puts the crossover at a radius of about 4.
+    static constexpr double fftWeight = 2.0;
+
+    static double spatialCost(int taps) { return taps; }
+
+    static double fftCost(int kernel_size, int fft_size, int width, int height) {
+        const int tile = fft_size - (kernel_size - 1);
+        if (tile < kernel_size - 1 || tile < 1) return INFINITY;
+        const double tiles = std::ceil(static_cast<double>(width + kernel_size - 1) / tile) *
+                             std::ceil(static_cast<double>(height + kernel_size - 1) / tile);
+        const double n = static_cast<double>(fft_size) * fft_size;
+        return fftWeight * tiles * 2 * n * std::log2(n) / (static_cast<double>(width) * height);
+    }
+
+    // The cheapest fft size for a kernel on a width x height image: an even size whose
+    // factors are 2, 3 and 5, with tiles at least as large as the kernel. 0 when none fits
+    // within maxFFTSize.
+    static int bestFFTSize(int kernel_size, int width, int height) {
+        int best = 0;
+        double best_cost = INFINITY;
+        for (int size = 2 * (kernel_size - 1); size <= maxFFTSize; size++) {
+            if (size % 2 || !FFTPlan::isSmooth(size)) continue;
+            double cost = fftCost(kernel_size, size, width, height);
+            if (cost < best_cost) {
+                best_cost = cost;
+                best = size;
+            }
+        }
+        return best;
+    }
+
+   private:
+    int radius, fftSize, tileSize, width, height;
+    RealFFT2D fft;
+    std::vector<float> kernelRe, kernelIm;
+};
@@ -0,0 +1,263 @@
+#pragma once
+
+#include <glib.h>
+#include <zlib.h>
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "pixel_buffer.h"
+
+// Files that need more than 8 bits per sample: 16-bit PNG into PixelBuffer<uint16_t>
+// and PFM into PixelBuffer<float>. 16-bit PNG is written by PngEncoder. The PNG reader
+// takes gray, gray + alpha, RGB and RGBA at 16 bits without interlacing; everything else
+// is left to the Pixbuf loader. Both readers return null for a damaged file: chunk
+// lengths and CRCs are checked against the file, and images may not exceed maxDimension
+// on a side or maxPixels in all. The image is allocated only once the file holds enough
+// data for it: all the samples for PFM, enough deflate data for PNG at the highest
+// ratio deflate can reach.
+class DeepImageIO {
+   public:
+    static constexpr int maxDimension = 1 << 16;
+    static constexpr size_t maxPixels = size_t(1) << 28;
+    static constexpr size_t maxDeflateRatio = 1032;
+
+    // True for a PFM file or a 16-bit PNG this reader takes.
+    static bool isDeepFile(const std::string& filename) {
+        std::ifstream file(filename, std::ios::binary);
+        guint8 head[29] = {};
+        file.read(reinterpret_cast<char*>(head), sizeof(head));
+        if (file.gcount() >= 3 && head[0] == 'P' && (head[1] == 'F' || head[1] == 'f') && std::isspace(head[2])) {
+            return true;
+        }
+        if (file.gcount() < 29 || std::memcmp(head, pngSignature, 8) != 0 || std::memcmp(head + 12, "IHDR", 4) != 0) {
+            return false;
+        }
+        return head[24] == 16 && channelsOf(head[25]) > 0 && head[28] == 0;
+    }
+
+    static std::shared_ptr<PixelBuffer<uint16_t>> readPNG16(const std::string& filename) {
+        std::ifstream file(filename, std::ios::binary | std::ios::ate);
+        const uint64_t file_size = file ? static_cast<uint64_t>(file.tellg()) : 0;
+        file.seekg(0);
+        guint8 signature[8];
+        if (!file.read(reinterpret_cast<char*>(signature), 8) || std::memcmp(signature, pngSignature, 8) != 0) {
+            return nullptr;
+        }
+
+        int width = 0, height = 0, channels = 0;
+        std::vector<guint8> compressed;
+        uint64_t position = 8;
+        while (true) {
+            guint8 header[8];
+            if (!file.read(reinterpret_cast<char*>(header), 8)) return nullptr;
+            const uint32_t length = getBigEndian(header);
+            position += 8;
+            if (length > 0x7FFFFFFFu || length + uint64_t(4) > file_size - position) return nullptr;
+            std::vector<guint8> data(length);
+            guint8 crc[4];
+            if (!file.read(reinterpret_cast<char*>(data.data()), length) || !file.read(reinterpret_cast<char*>(crc), 4)) {
+                return nullptr;
+            }
+            position += length + 4;
+            // crc32 with no buffer returns its initial value, so empty chunks skip the call.
+            uLong expected = crc32(0, header + 4, 4);
+            if (length > 0) expected = crc32(expected, data.data(), length);
+            if (getBigEndian(crc) != static_cast<uint32_t>(expected)) return nullptr;
+
+            if (std::memcmp(header + 4, "IHDR", 4) == 0) {
+                if (length != 13 || data[8] != 16 || data[10] != 0 || data[11] != 0 || data[12] != 0) return nullptr;
+                const uint32_t declared_width = getBigEndian(data.data()), declared_height = getBigEndian(data.data() + 4);
+                if (!validSize(declared_width, declared_height)) return nullptr;
+                width = static_cast<int>(declared_width);
+                height = static_cast<int>(declared_height);
+                channels = channelsOf(data[9]);
+                if (channels == 0) return nullptr;
+            } else if (std::memcmp(header + 4, "IDAT", 4) == 0) {
+                compressed.insert(compressed.end(), data.begin(), data.end());
+            } else if (std::memcmp(header + 4, "IEND", 4) == 0) {
+                break;
+            }
+        }
+        if (channels == 0) return nullptr;
+
+        // Deflate expands at most about 1032:1, so data too short for the declared size is
+        // rejected before the image is allocated.
+        const size_t row_bytes = static_cast<size_t>(width) * channels * 2;
+        if ((row_bytes + 1) * height > maxDeflateRatio * compressed.size()) return nullptr;
+
+        // Rows are inflated one at a time, next to the unfiltered row above.
+        z_stream stream{};
+        if (inflateInit(&stream) != Z_OK) return nullptr;
+        stream.next_in = compressed.data();
+        stream.avail_in = static_cast<uInt>(compressed.size());
+
+        auto image = std::make_shared<PixelBuffer<uint16_t>>(width, height, channels);
+        std::vector<guint8> line(row_bytes + 1), previous(row_bytes + 1);
+        const int bpp = channels * 2;
+        bool ok = true;
+        for (int y = 0; y < height && ok; ++y) {
+            stream.next_out = line.data();
+            stream.avail_out = static_cast<uInt>(line.size());
+            while (ok && stream.avail_out > 0) {
+                const int result = inflate(&stream, Z_NO_FLUSH);
+                ok = result == Z_OK || (result == Z_STREAM_END && stream.avail_out == 0);
+            }
+            if (!ok || !unfilterRow(line[0], line.data() + 1, y > 0 ? previous.data() + 1 : nullptr, row_bytes, bpp)) {
+                ok = false;
+                break;
+            }
+
+            uint16_t* out = image->row(y);
+            for (size_t i = 0; i < row_bytes / 2; i++) out[i] = static_cast<uint16_t>(line[1 + 2 * i] << 8 | line[2 + 2 * i]);
+            std::swap(line, previous);
+        }
+
+        // The stream must end with the last row: no data left over, and its checksum read.
+        if (ok) {
+            guint8 extra;
+            stream.next_out = &extra;
+            stream.avail_out = 1;
+            ok = inflate(&stream, Z_FINISH) == Z_STREAM_END && stream.avail_out == 1;
+        }
+        inflateEnd(&stream);
+        return ok ? image : nullptr;
+    }
+
+    // PF (RGB) or Pf (gray), little-endian, rows from the bottom up. NaN and infinite
+    // samples are read as 0, so ranges and stretches stay finite.
+    static std::shared_ptr<PixelBuffer<float>> readPFM(const std::string& filename) {
+        std::ifstream file(filename, std::ios::binary);
+        std::string magic;
+        int width = 0, height = 0;
+        double scale = 0;
+        if (!(file >> magic >> width >> height >> scale) || (magic != "PF" && magic != "Pf")) return nullptr;
+        if (width <= 0 || height <= 0 || !validSize(width, height) || scale == 0) return nullptr;
+        file.get();
+
+        // The samples must be in the file before they are allocated.
+        const int channels = magic == "PF" ? 3 : 1;
+        const std::streamoff start = file.tellg();
+        file.seekg(0, std::ios::end);
+        const uint64_t available = static_cast<uint64_t>(file.tellg() - start);
+        if (available < static_cast<uint64_t>(width) * height * channels * 4) return nullptr;
+        file.seekg(start);
+
+        const bool big_endian = scale > 0;
+        auto image = std::make_shared<PixelBuffer<float>>(width, height, channels);
+        std::vector<guint8> bytes(image->rowSamples() * 4);
+        for (int y = height - 1; y >= 0; --y) {
+            if (!file.read(reinterpret_cast<char*>(bytes.data()), bytes.size())) return nullptr;
+            float* out = image->row(y);
+            for (size_t i = 0; i < image->rowSamples(); i++) {
+                const guint8* b = bytes.data() + 4 * i;
+                const uint32_t bits = big_endian ? getBigEndian(b)
+                                                 : static_cast<uint32_t>(b[3]) << 24 | b[2] << 16 | b[1] << 8 | b[0];
+                std::memcpy(&out[i], &bits, 4);
+                if (!std::isfinite(out[i])) out[i] = 0.0f;
+            }
+        }
+        return image;
+    }
+
+    // Writes the color channels: PF for color, Pf for gray; alpha has no place in PFM.
+    static bool writePFM(const std::string& filename, const PixelBuffer<float>& image) {
+        std::ofstream file(filename, std::ios::binary);
+        if (!file) return false;
+
+        const int channels = image.getChannels(), colors = image.colorChannels();
+        const int out_channels = colors >= 3 ? 3 : 1;
+        file << (out_channels == 3 ? "PF" : "Pf") << "\n" << image.getWidth() << " " << image.getHeight() << "\n-1.0\n";
+
+        std::vector<guint8> bytes(static_cast<size_t>(image.getWidth()) * out_channels * 4);
+        for (int y = image.getHeight() - 1; y >= 0; --y) {
+            const float* p = image.row(y);
+            guint8* b = bytes.data();
+            for (int x = 0; x < image.getWidth(); ++x, p += channels) {
+                for (int c = 0; c < out_channels; c++, b += 4) {
+                    uint32_t bits;
+                    std::memcpy(&bits, &p[c], 4);
+                    b[0] = bits;
+                    b[1] = bits >> 8;
+                    b[2] = bits >> 16;
+                    b[3] = bits >> 24;
+                }
+            }
+            file.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+        }
+        return static_cast<bool>(file);
+    }
+
+    // Linear light from 16-bit sRGB codes through a 65536-entry table; alpha stays linear.
+    static std::shared_ptr<PixelBuffer<float>> toLinear(const PixelBuffer<uint16_t>& image) {
+        static const std::vector<float> table = []() {
+            std::vector<float> values(65536);
+            for (int code = 0; code < 65536; code++) {
+                const double v = code / 65535.0;
+                values[code] = static_cast<float>(v <= 0.04045 ? v / 12.92 : std::pow((v + 0.055) / 1.055, 2.4));
+            }
+            return values;
+        }();
+
+        auto result = std::make_shared<PixelBuffer<float>>(image.getWidth(), image.getHeight(), image.getChannels());
+        const int channels = image.getChannels(), colors = image.colorChannels();
+        for (int y = 0; y < image.getHeight(); ++y) {
+            const uint16_t* p = image.row(y);
+            float* out = result->row(y);
+            for (size_t i = 0; i < image.rowSamples(); i++) {
+                out[i] = static_cast<int>(i % channels) < colors ? table[p[i]] : p[i] / 65535.0f;
+            }
+        }
+        return result;
+    }
+
+   private:
+    static constexpr guint8 pngSignature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+
+    static bool validSize(uint64_t width, uint64_t height) {
+        return width > 0 && height > 0 && width <= maxDimension && height <= maxDimension && width * height <= maxPixels;
+    }
+
+    // Channels of a PNG color type this reader takes, 0 for the others.
+    static int channelsOf(int color_type) {
+        switch (color_type) {
+            case 0: return 1;
+            case 4: return 2;
+            case 2: return 3;
+            case 6: return 4;
+            default: return 0;
+        }
+    }
+
+    static uint32_t getBigEndian(const guint8* p) {
+        return static_cast<uint32_t>(p[0]) << 24 | p[1] << 16 | p[2] << 8 | p[3];
+    }
+
+    static bool unfilterRow(int type, guint8* row, const guint8* previous, size_t bytes, int bpp) {
+        for (size_t i = 0; i < bytes; i++) {
+            const int a = i >= static_cast<size_t>(bpp) ? row[i - bpp] : 0, b = previous ? previous[i] : 0;
+            const int c = i >= static_cast<size_t>(bpp) && previous ? previous[i - bpp] : 0;
+            switch (type) {
+                case 0: break;
+                case 1: row[i] += a; break;
+                case 2: row[i] += b; break;
+                case 3: row[i] += (a + b) >> 1; break;
+                case 4: {
+                    const int pa = std::abs(b - c), pb = std::abs(a - c), pc = std::abs(a + b - 2 * c);
+                    row[i] += pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+                    break;
+                }
+                default: return false;
+            }
+        }
+        return true;
+    }
+};
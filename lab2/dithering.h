@@ -0,0 +1,202 @@
+#pragma once
+
+#include <glib.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Error diffusion (Floyd-Steinberg or Jarvis-Judice-Ninke) to `levels` values per
+// channel, run as a diagonal wavefront. Rows are claimed in order by any number of
+// threads, and a row only advances while the row above it is at least `radius` + 1
+// columns ahead, which is all the error a pixel needs. Instead of pushing its error
+// into rows below, each pixel pulls the errors of already finished neighbours, so every
+// row only writes its own error row and no two threads touch the same memory. The
+// result is identical to a sequential left-to-right pass.
+class ErrorDiffusion {
+   public:
+    static constexpr int chunkWidth = 64;
+
+    ErrorDiffusion(bool jarvis, int levels, int width, int height, int channels, int threads)
+        : width(width), height(height), channels(channels), levels(std::max(2, std::min(levels, 256))),
+          jarvis(jarvis), radius(jarvis ? 2 : 1), ringRows(2 * std::max(1, threads) + 4), done(height),
+          errors(static_cast<size_t>(ringRows + 1) * rowLength(), 0) {
+        for (auto& d : done) d.store(0, std::memory_order_relaxed);
+        for (int value = 0; value < 256; value++) {
+            int level = (value * (this->levels - 1) + 127) / 255;
+            nearest[value] = static_cast<guint8>(level * 255 / (this->levels - 1));
+        }
+    }
+
+    // Processes rows until none are left; to be called from every participating thread.
+    // Returns false when `cancelled` stopped it.
+    bool run(const guint8* src, guint8* dst, int rowstride, int n_channels, const std::function<bool()>& cancelled,
+             const std::function<void()>& row_done) {
+        for (int y = nextRow++; y < height; y = nextRow++) {
+            // The ring slot of this row last held row y - ringRows; rows up to two below
+            // that one may still be reading it.
+            if (y - ringRows + 2 >= 0 && !waitFor(y - ringRows + 2, width, cancelled)) return false;
+
+            for (int x0 = 0; x0 < width; x0 += chunkWidth) {
+                int x1 = std::min(width, x0 + chunkWidth);
+                if (y > 0 && !waitFor(y - 1, std::min(width, x1 + radius), cancelled)) return false;
+
+                if (jarvis) {
+                    ditherSpan<JarvisKernel>(src, dst, rowstride, n_channels, y, x0, x1);
+                } else {
+                    ditherSpan<FloydSteinbergKernel>(src, dst, rowstride, n_channels, y, x0, x1);
+                }
+                done[y].store(x1, std::memory_order_release);
+            }
+            if (row_done) row_done();
+        }
+        return !cancelled();
+    }
+
+   private:
+    // Weights a pixel pulls from the errors of the pixels dx to its left (dx < 0: right)
+    // and dy rows above.
+    struct Tap {
+        int dx, dy, weight;
+    };
+
+    struct FloydSteinbergKernel {
+        static constexpr int divisor = 16;
+        static constexpr int count = 4;
+        static constexpr Tap taps[count] = {{1, 0, 7}, {-1, 1, 3}, {0, 1, 5}, {1, 1, 1}};
+    };
+
+    struct JarvisKernel {
+        static constexpr int divisor = 48;
+        static constexpr int count = 12;
+        static constexpr Tap taps[count] = {{1, 0, 7},  {2, 0, 5},  {-2, 1, 3}, {-1, 1, 5}, {0, 1, 7}, {1, 1, 5},
+                                            {2, 1, 3},  {-2, 2, 1}, {-1, 2, 3}, {0, 2, 5},  {1, 2, 3}, {2, 2, 1}};
+    };
+
+    // Error rows carry two zero pixels on either side, so no tap needs a bounds check.
+    static constexpr int padding = 2;
+
+    int width, height, channels, levels;
+    bool jarvis;
+    int radius;
+    int ringRows;
+    std::atomic<int> nextRow{0};
+    std::vector<std::atomic<int>> done;
+    std::vector<int16_t> errors;
+    guint8 nearest[256];
+
+    size_t rowLength() const { return static_cast<size_t>(width + 2 * padding) * channels; }
+
+    // Row ringRows of the buffer stays zero and stands in for the rows above the image.
+    int16_t* errorRow(int y) {
+        return errors.data() + (y < 0 ? ringRows : y % ringRows) * rowLength() + padding * channels;
+    }
+
+    bool waitFor(int row, int columns, const std::function<bool()>& cancelled) {
+        while (done[row].load(std::memory_order_acquire) < columns) {
+            if (cancelled()) return false;
+            std::this_thread::yield();
+        }
+        return true;
+    }
+
+    template <typename Kernel>
+    void ditherSpan(const guint8* src, guint8* dst, int rowstride, int n_channels, int y, int x0, int x1) {
+        int16_t* own = errorRow(y);
+        const int16_t* rows[3] = {own, errorRow(y - 1), errorRow(y - 2)};
+        const guint8* s = src + static_cast<size_t>(y) * rowstride + x0 * n_channels;
+        guint8* d = dst + static_cast<size_t>(y) * rowstride + x0 * n_channels;
+
+        for (int x = x0; x < x1; ++x, s += n_channels, d += n_channels) {
+            for (int c = 0; c < channels; c++) {
+                int sum = 0;
+                for (int t = 0; t < Kernel::count; t++) {
+                    const Tap& tap = Kernel::taps[t];
+                    sum += tap.weight * rows[tap.dy][(x - tap.dx) * channels + c];
+                }
+                int diffused = (sum >= 0 ? sum + Kernel::divisor / 2 : sum - Kernel::divisor / 2) / Kernel::divisor;
+                int value = std::min(255, std::max(0, s[c] + diffused));
+                int output = nearest[value];
+                d[c] = static_cast<guint8>(output);
+                own[x * channels + c] = static_cast<int16_t>(value - output);
+            }
+        }
+    }
+};
+
+// Ordered dithering with an 8x8 Bayer matrix: level = floor(v * (levels - 1) / 255 +
+// (m + 0.5) / 64). Thresholds and scales are laid out per byte for a whole number of
+// pixels and 16-byte vectors, so the SSE2 path handles 16 channel values per step and
+// leaves alpha bytes as they are.
+class OrderedDither {
+   public:
+    OrderedDither(int levels, int n_channels) : levels(std::max(2, std::min(levels, 256))), nChannels(n_channels) {
+        static const int bayer[8][8] = {
+            {0, 32, 8, 40, 2, 34, 10, 42}, {48, 16, 56, 24, 50, 18, 58, 26},
+            {12, 44, 4, 36, 14, 46, 6, 38}, {60, 28, 52, 20, 62, 30, 54, 22},
+            {3, 35, 11, 43, 1, 33, 9, 41},  {51, 19, 59, 27, 49, 17, 57, 25},
+            {15, 47, 7, 39, 13, 45, 5, 37}, {63, 31, 55, 23, 61, 29, 53, 21}};
+
+        period = n_channels == 3 ? 48 : 32;
+        const float scale = (this->levels - 1) / 255.0f;
+        const float step = 255.0f / (this->levels - 1);
+        for (int row = 0; row < 8; row++) {
+            for (int i = 0; i < period; i++) {
+                bool alpha = i % n_channels == 3;
+                int pixel = (i / n_channels) % 8;
+                thresholds[row][i] = alpha ? 0.0f : (bayer[row][pixel] + 0.5f) / 64.0f;
+                scales[i] = alpha ? 1.0f : scale;
+                steps[i] = alpha ? 1.0f : step;
+            }
+        }
+    }
+
+    void ditherRows(const guint8* src, guint8* dst, int rowstride, int width, int y_begin, int y_end) const {
+        const int bytes = width * nChannels;
+        for (int y = y_begin; y < y_end; ++y) {
+            const guint8* s = src + static_cast<size_t>(y) * rowstride;
+            guint8* d = dst + static_cast<size_t>(y) * rowstride;
+            const float* threshold = thresholds[y % 8];
+
+            int i = 0;
+#if defined(__SSE2__)
+            const __m128i zero = _mm_setzero_si128();
+            const __m128 half = _mm_set1_ps(0.5f);
+            for (; i + 16 <= bytes; i += 16) {
+                const int j = i % period;
+                __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+                __m128i lo = _mm_unpacklo_epi8(v, zero), hi = _mm_unpackhi_epi8(v, zero);
+                __m128i words[4] = {_mm_unpacklo_epi16(lo, zero), _mm_unpackhi_epi16(lo, zero),
+                                    _mm_unpacklo_epi16(hi, zero), _mm_unpackhi_epi16(hi, zero)};
+                __m128i out[4];
+                for (int k = 0; k < 4; k++) {
+                    __m128 f = _mm_cvtepi32_ps(words[k]);
+                    f = _mm_add_ps(_mm_mul_ps(f, _mm_loadu_ps(scales + j + 4 * k)), _mm_loadu_ps(threshold + j + 4 * k));
+                    __m128 level = _mm_cvtepi32_ps(_mm_cvttps_epi32(f));
+                    out[k] = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(level, _mm_loadu_ps(steps + j + 4 * k)), half));
+                }
+                __m128i packed = _mm_packus_epi16(_mm_packs_epi32(out[0], out[1]), _mm_packs_epi32(out[2], out[3]));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(d + i), packed);
+            }
+#endif
+            for (; i < bytes; i++) {
+                const int j = i % period;
+                float level = static_cast<float>(static_cast<int>(s[i] * scales[j] + threshold[j]));
+                d[i] = static_cast<guint8>(static_cast<int>(level * steps[j] + 0.5f));
+            }
+        }
+    }
+
+   private:
+    int levels, nChannels;
+    int period;
+    float thresholds[8][48];
+    float scales[48];
+    float steps[48];
+};
@@ -0,0 +1,384 @@
+#pragma once
+
+#include <glib.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Canny edge detection on luminance, one band of rows at a time.
+//
+// detectBand runs everything up to the edge candidates in a single pass over the band:
+// luminance, 3x3 binomial smoothing, Sobel gradients, magnitude and quantized direction
+// are produced row by row into rings of three or four rows (the band recomputes three
+// rows of halo on either side), and non-maximum suppression turns each row straight into
+// horizontal runs of candidate pixels, linked into components with a union-find that
+// stays inside the band.
+//
+// Hysteresis is connectivity between runs: link() joins the components across band
+// boundaries and keeps those that contain a strong pixel, paintBand() draws their runs.
+// Edges are 8-connected. Thresholds are in units of a plain Sobel magnitude on 8-bit
+// values, 0 to maxThreshold.
+class CannyEdgeDetector {
+   public:
+    static constexpr int maxThreshold = 1442;
+
+    struct Run {
+        int y, x_begin, x_end;
+        bool strong;
+    };
+
+    struct Band {
+        std::vector<Run> runs;
+        std::vector<int> parent;
+        int offset = 0;
+    };
+
+    CannyEdgeDetector(int width, int height, int low, int high)
+        : width(width), height(height), low(std::max(1, low) * magnitudeScale),
+          high(std::max(low, high) * magnitudeScale) {}
+
+    void detectBand(const guint8* src, int rowstride, int n_channels, int y_begin, int y_end, Band& band) const {
+        const int luma_stride = width + 4, blur_stride = width + 2, packed_stride = width + 2;
+
+        // Rings of the most recent rows: luminance edge-replicated by two pixels, smoothed
+        // rows padded by one, gradients padded by one zero pixel either side.
+        std::vector<int16_t> luma(4 * luma_stride), blurred(4 * blur_stride), vertical(luma_stride);
+        std::vector<uint16_t> packed(3 * packed_stride, 0);
+        auto luma_row = [&](int y) { return luma.data() + (y - y_begin + 3) % 4 * luma_stride; };
+        auto blurred_row = [&](int y) { return blurred.data() + (y - y_begin + 2) % 4 * blur_stride; };
+        auto packed_row = [&](int y) { return packed.data() + (y - y_begin + 1) % 3 * packed_stride + 1; };
+
+        band.runs.clear();
+        band.parent.clear();
+        int next_luma = y_begin - 3, next_blurred = y_begin - 2;
+        int previous_begin = 0, previous_end = 0;
+
+        for (int y = y_begin - 1; y <= y_end; ++y) {
+            for (; next_blurred <= y + 1; next_blurred++) {
+                for (; next_luma <= next_blurred + 1; next_luma++) {
+                    const int source_y = std::max(0, std::min(height - 1, next_luma));
+                    lumaRow(src + static_cast<size_t>(source_y) * rowstride, n_channels, luma_row(next_luma));
+                }
+                blurRow(luma_row(next_blurred - 1), luma_row(next_blurred), luma_row(next_blurred + 1),
+                        vertical.data(), blurred_row(next_blurred));
+            }
+
+            uint16_t* gradient = packed_row(y);
+            if (y < 0 || y >= height) {
+                std::fill(gradient, gradient + width, 0);
+            } else {
+                sobelRow(blurred_row(y - 1), blurred_row(y), blurred_row(y + 1), gradient);
+            }
+            if (y - 1 < y_begin) continue;
+
+            const int current_begin = static_cast<int>(band.runs.size());
+            suppressRow(packed_row(y - 2), packed_row(y - 1), gradient, y - 1, band.runs);
+            const int current_end = static_cast<int>(band.runs.size());
+
+            for (int i = current_begin; i < current_end; i++) band.parent.push_back(i);
+            forEachOverlap(band.runs.data() + previous_begin, previous_end - previous_begin,
+                           band.runs.data() + current_begin, current_end - current_begin,
+                           [&](int a, int b) { unite(band.parent, previous_begin + a, current_begin + b); });
+            previous_begin = current_begin;
+            previous_end = current_end;
+        }
+    }
+
+    // Joins components across the boundaries between consecutive bands and returns, per
+    // global run index (band offset + index in band), whether its component is strong.
+    static std::vector<char> link(std::vector<Band>& bands) {
+        int total = 0;
+        for (Band& band : bands) {
+            band.offset = total;
+            total += static_cast<int>(band.runs.size());
+        }
+
+        std::vector<int> parent(total);
+        std::vector<const Run*> runs(total);
+        for (Band& band : bands) {
+            for (size_t i = 0; i < band.runs.size(); i++) {
+                parent[band.offset + i] = band.offset + find(band.parent, static_cast<int>(i));
+                runs[band.offset + i] = &band.runs[i];
+            }
+        }
+
+        for (size_t k = 1; k < bands.size(); k++) {
+            const Band& above = bands[k - 1];
+            const Band& below = bands[k];
+            if (above.runs.empty() || below.runs.empty()) continue;
+
+            // The last row of the band above against the first row of the band below.
+            const int last_y = above.runs.back().y;
+            int above_begin = static_cast<int>(above.runs.size());
+            while (above_begin > 0 && above.runs[above_begin - 1].y == last_y) above_begin--;
+            int below_end = 0;
+            while (below_end < static_cast<int>(below.runs.size()) && below.runs[below_end].y == below.runs[0].y) {
+                below_end++;
+            }
+            if (below.runs[0].y != last_y + 1) continue;
+
+            forEachOverlap(above.runs.data() + above_begin, static_cast<int>(above.runs.size()) - above_begin,
+                           below.runs.data(), below_end, [&](int a, int b) {
+                               unite(parent, above.offset + above_begin + a, below.offset + b);
+                           });
+        }
+
+        std::vector<char> strong_root(total, 0);
+        for (int i = 0; i < total; i++) {
+            if (runs[i]->strong) strong_root[find(parent, i)] = 1;
+        }
+        std::vector<char> strong(total);
+        for (int i = 0; i < total; i++) strong[i] = strong_root[find(parent, i)];
+        return strong;
+    }
+
+    // Writes white edges on black into rows [y_begin, y_end) of `dst`, leaving alpha alone.
+    void paintBand(const Band& band, const std::vector<char>& strong, guint8* dst, int rowstride, int n_channels,
+                   int y_begin, int y_end) const {
+        for (int y = y_begin; y < y_end; ++y) {
+            guint8* p = dst + static_cast<size_t>(y) * rowstride;
+            for (int x = 0; x < width; ++x, p += n_channels) p[0] = p[1] = p[2] = 0;
+        }
+        for (size_t i = 0; i < band.runs.size(); i++) {
+            if (!strong[band.offset + i]) continue;
+            const Run& run = band.runs[i];
+            guint8* p = dst + static_cast<size_t>(run.y) * rowstride + run.x_begin * n_channels;
+            for (int x = run.x_begin; x < run.x_end; ++x, p += n_channels) p[0] = p[1] = p[2] = 255;
+        }
+    }
+
+   private:
+    // Smoothing keeps 4x luminance and Sobel adds another 4x, so magnitudes come out
+    // magnitudeScale times those of a plain Sobel on 8-bit values.
+    static constexpr int magnitudeScale = 4;
+    // tan(22.5 degrees) in 0.16 fixed point, for pmulhw.
+    static constexpr int tanEighth = 27146;
+
+    int width, height;
+    int low, high;
+
+    void lumaRow(const guint8* p, int n_channels, int16_t* out) const {
+        for (int x = 0; x < width; ++x, p += n_channels) {
+            out[x + 2] = static_cast<int16_t>((77 * p[0] + 150 * p[1] + 29 * p[2] + 128) >> 8);
+        }
+        out[0] = out[1] = out[2];
+        out[width + 2] = out[width + 3] = out[width + 1];
+    }
+
+    // [1 2 1] vertically into `vertical`, then horizontally into `out`, divided by 4.
+    void blurRow(const int16_t* l0, const int16_t* l1, const int16_t* l2, int16_t* vertical, int16_t* out) const {
+        const int count = width + 4;
+        int x = 0;
+#if defined(__SSE2__)
+        for (; x + 8 <= count; x += 8) {
+            __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(l0 + x));
+            __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(l1 + x));
+            __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(l2 + x));
+            __m128i sum = _mm_add_epi16(_mm_add_epi16(a, c), _mm_slli_epi16(b, 1));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(vertical + x), sum);
+        }
+#endif
+        for (; x < count; x++) vertical[x] = static_cast<int16_t>(l0[x] + 2 * l1[x] + l2[x]);
+
+        x = 0;
+#if defined(__SSE2__)
+        for (; x + 8 <= width + 2; x += 8) {
+            __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(vertical + x));
+            __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(vertical + x + 1));
+            __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(vertical + x + 2));
+            __m128i sum = _mm_add_epi16(_mm_add_epi16(a, c), _mm_slli_epi16(b, 1));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), _mm_srai_epi16(sum, 2));
+        }
+#endif
+        for (; x < width + 2; x++) {
+            out[x] = static_cast<int16_t>((vertical[x] + 2 * vertical[x + 1] + vertical[x + 2]) >> 2);
+        }
+    }
+
+    // Directions: 0 horizontal gradient, 1 along the main diagonal, 2 vertical, 3 along
+    // the anti-diagonal.
+    static uint16_t pack(int gx, int gy) {
+        const int ax = std::abs(gx), ay = std::abs(gy);
+        const int magnitude = static_cast<int>(std::sqrt(static_cast<float>(gx * gx + gy * gy)));
+        int direction;
+        if (ay < ((ax * tanEighth) >> 16)) {
+            direction = 0;
+        } else if (ax < ((ay * tanEighth) >> 16)) {
+            direction = 2;
+        } else {
+            direction = (gx ^ gy) < 0 ? 3 : 1;
+        }
+        return static_cast<uint16_t>(magnitude << 2 | direction);
+    }
+
+    void sobelRow(const int16_t* b0, const int16_t* b1, const int16_t* b2, uint16_t* out) const {
+        int x = 0;
+#if defined(__SSE2__)
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i tan_eighth = _mm_set1_epi16(tanEighth);
+        for (; x + 8 <= width; x += 8) {
+            auto load = [x](const int16_t* row, int dx) {
+                return _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x + dx));
+            };
+            __m128i gx = _mm_add_epi16(_mm_add_epi16(_mm_sub_epi16(load(b0, 2), load(b0, 0)),
+                                                     _mm_sub_epi16(load(b2, 2), load(b2, 0))),
+                                       _mm_slli_epi16(_mm_sub_epi16(load(b1, 2), load(b1, 0)), 1));
+            __m128i gy = _mm_sub_epi16(
+                _mm_add_epi16(_mm_add_epi16(load(b2, 0), load(b2, 2)), _mm_slli_epi16(load(b2, 1), 1)),
+                _mm_add_epi16(_mm_add_epi16(load(b0, 0), load(b0, 2)), _mm_slli_epi16(load(b0, 1), 1)));
+
+            // gx^2 + gy^2 from interleaved pairs, then a float square root per pixel.
+            __m128i lo = _mm_unpacklo_epi16(gx, gy), hi = _mm_unpackhi_epi16(gx, gy);
+            __m128i magnitude = _mm_packs_epi32(
+                _mm_cvttps_epi32(_mm_sqrt_ps(_mm_cvtepi32_ps(_mm_madd_epi16(lo, lo)))),
+                _mm_cvttps_epi32(_mm_sqrt_ps(_mm_cvtepi32_ps(_mm_madd_epi16(hi, hi)))));
+
+            __m128i ax = _mm_max_epi16(gx, _mm_sub_epi16(zero, gx));
+            __m128i ay = _mm_max_epi16(gy, _mm_sub_epi16(zero, gy));
+            __m128i horizontal = _mm_cmplt_epi16(ay, _mm_mulhi_epi16(ax, tan_eighth));
+            __m128i vertical = _mm_cmplt_epi16(ax, _mm_mulhi_epi16(ay, tan_eighth));
+            __m128i diagonal = _mm_or_si128(_mm_set1_epi16(1),
+                                            _mm_and_si128(_mm_srai_epi16(_mm_xor_si128(gx, gy), 15), _mm_set1_epi16(2)));
+            __m128i direction = _mm_or_si128(_mm_andnot_si128(_mm_or_si128(horizontal, vertical), diagonal),
+                                             _mm_and_si128(vertical, _mm_set1_epi16(2)));
+
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x),
+                             _mm_or_si128(_mm_slli_epi16(magnitude, 2), direction));
+        }
+#endif
+        for (; x < width; x++) {
+            int gx = (b0[x + 2] - b0[x]) + 2 * (b1[x + 2] - b1[x]) + (b2[x + 2] - b2[x]);
+            int gy = (b2[x] + 2 * b2[x + 1] + b2[x + 2]) - (b0[x] + 2 * b0[x + 1] + b0[x + 2]);
+            out[x] = pack(gx, gy);
+        }
+    }
+
+    // Keeps pixels at least `low` that are a maximum across their gradient direction (ties
+    // go to the pixel before), as runs; rows have a zero pixel either side. Pixels are
+    // classified eight at a time into edge and strong bit masks, then the runs are read
+    // off the bits.
+    void suppressRow(const uint16_t* above, const uint16_t* row, const uint16_t* below, int y,
+                     std::vector<Run>& runs) const {
+        int run_begin = -1;
+        bool run_strong = false;
+
+        for (int x = 0; x < width;) {
+            const int count = std::min(8, width - x);
+            unsigned edges = 0, strong = 0;
+#if defined(__SSE2__)
+            if (count == 8) {
+                classify(above + x, row + x, below + x, edges, strong);
+            } else
+#endif
+            {
+                for (int k = 0; k < count; k++) {
+                    if (!isMaximum(above, row, below, x + k)) continue;
+                    edges |= 1u << k;
+                    if ((row[x + k] >> 2) >= high) strong |= 1u << k;
+                }
+            }
+
+            if (edges == 0 && run_begin < 0) {
+                x += count;
+                continue;
+            }
+            for (int k = 0; k < count; k++) {
+                if (edges >> k & 1) {
+                    if (run_begin < 0) {
+                        run_begin = x + k;
+                        run_strong = false;
+                    }
+                    run_strong = run_strong || (strong >> k & 1);
+                } else if (run_begin >= 0) {
+                    runs.push_back({y, run_begin, x + k, run_strong});
+                    run_begin = -1;
+                }
+            }
+            x += count;
+        }
+        if (run_begin >= 0) runs.push_back({y, run_begin, width, run_strong});
+    }
+
+    bool isMaximum(const uint16_t* above, const uint16_t* row, const uint16_t* below, int x) const {
+        const int magnitude = row[x] >> 2;
+        if (magnitude < low) return false;
+
+        int before, after;
+        switch (row[x] & 3) {
+            case 0:
+                before = row[x - 1], after = row[x + 1];
+                break;
+            case 1:
+                before = above[x - 1], after = below[x + 1];
+                break;
+            case 2:
+                before = above[x], after = below[x];
+                break;
+            default:
+                before = above[x + 1], after = below[x - 1];
+                break;
+        }
+        return magnitude > (before >> 2) && magnitude >= (after >> 2);
+    }
+
+#if defined(__SSE2__)
+    // isMaximum for eight pixels: the neighbours of all four directions are loaded and the
+    // pair matching each pixel's direction is selected by mask.
+    void classify(const uint16_t* above, const uint16_t* row, const uint16_t* below, unsigned& edges,
+                  unsigned& strong) const {
+        auto load = [](const uint16_t* p) {
+            return _mm_srli_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)), 2);
+        };
+        const __m128i packed = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row));
+        const __m128i magnitude = _mm_srli_epi16(packed, 2);
+        const __m128i direction = _mm_and_si128(packed, _mm_set1_epi16(3));
+
+        const __m128i befores[4] = {load(row - 1), load(above - 1), load(above), load(above + 1)};
+        const __m128i afters[4] = {load(row + 1), load(below + 1), load(below), load(below - 1)};
+        __m128i before = _mm_setzero_si128(), after = _mm_setzero_si128();
+        for (int d = 0; d < 4; d++) {
+            const __m128i select = _mm_cmpeq_epi16(direction, _mm_set1_epi16(static_cast<int16_t>(d)));
+            before = _mm_or_si128(before, _mm_and_si128(select, befores[d]));
+            after = _mm_or_si128(after, _mm_and_si128(select, afters[d]));
+        }
+
+        __m128i edge = _mm_and_si128(_mm_cmpgt_epi16(magnitude, _mm_set1_epi16(static_cast<int16_t>(low - 1))),
+                                     _mm_andnot_si128(_mm_cmpgt_epi16(after, magnitude),
+                                                      _mm_cmpgt_epi16(magnitude, before)));
+        __m128i strong_edge =
+            _mm_and_si128(edge, _mm_cmpgt_epi16(magnitude, _mm_set1_epi16(static_cast<int16_t>(high - 1))));
+        edges = static_cast<unsigned>(_mm_movemask_epi8(_mm_packs_epi16(edge, edge))) & 0xFF;
+        strong = static_cast<unsigned>(_mm_movemask_epi8(_mm_packs_epi16(strong_edge, strong_edge))) & 0xFF;
+    }
+#endif
+
+    // Calls `join(a, b)` for every run above[a] of one row that touches a run below[b] of
+    // the next row, diagonals included.
+    template <typename F>
+    static void forEachOverlap(const Run* above, int above_count, const Run* below, int below_count, F join) {
+        int a = 0;
+        for (int b = 0; b < below_count; b++) {
+            while (a < above_count && above[a].x_end < below[b].x_begin) a++;
+            for (int k = a; k < above_count && above[k].x_begin <= below[b].x_end; k++) join(k, b);
+        }
+    }
+
+    static int find(std::vector<int>& parent, int i) {
+        while (parent[i] != i) {
+            parent[i] = parent[parent[i]];
+            i = parent[i];
+        }
+        return i;
+    }
+
+    static void unite(std::vector<int>& parent, int a, int b) {
+        a = find(parent, a);
+        b = find(parent, b);
+        if (a != b) parent[std::max(a, b)] = std::min(a, b);
+    }
+};
@@ -0,0 +1,394 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+// Complex FFT of any length whose only prime factors are 2, 3 and 5, as a sequence of
+// Stockham autosort stages: radix 4 as long as possible, then 2, 3 and 5. Every stage
+// reads one buffer and writes the other in natural order, so there is no bit-reversal
+// pass. Values are kept as separate real and imaginary arrays.
+//
+// A transform works on `batch` interleaved sequences at once (element e of sequence b
+// is at e * batch + b). The innermost loop of every butterfly then runs over at least
+// `batch` contiguous floats, which is what lets it vectorize even in the first stage.
+//
+// Neither direction is scaled: a forward and an inverse transform multiply by n.
+class FFTPlan {
+   public:
+    explicit FFTPlan(int n) : n(n) {
+        int rest = n;
+        std::vector<int> radices;
+        while (rest % 4 == 0) radices.push_back(4), rest /= 4;
+        while (rest % 2 == 0) radices.push_back(2), rest /= 2;
+        while (rest % 3 == 0) radices.push_back(3), rest /= 3;
+        while (rest % 5 == 0) radices.push_back(5), rest /= 5;
+        if (rest != 1) radices.push_back(rest);
+
+        int length = n;
+        for (int radix : radices) {
+            Stage stage{radix, length / radix, twiddleRe.size()};
+            for (int p = 0; p < stage.m; p++) {
+                for (int j = 1; j < radix; j++) {
+                    double angle = -2 * M_PI * p * j / length;
+                    twiddleRe.push_back(static_cast<float>(std::cos(angle)));
+                    twiddleIm.push_back(static_cast<float>(std::sin(angle)));
+                }
+            }
+            stages.push_back(stage);
+            length = stage.m;
+        }
+    }
+
+    int size() const { return n; }
+
+    // Sizes with no prime factor above 5 are the ones this plan handles.
+    static bool isSmooth(int size) {
+        for (int factor : {2, 3, 5}) {
+            while (size % factor == 0) size /= factor;
+        }
+        return size == 1;
+    }
+
+    // Transforms `batch` interleaved sequences in place; `work_re` and `work_im` need as
+    // much room as `re` and `im`.
+    void transform(float* re, float* im, float* work_re, float* work_im, int batch, bool inverse) const {
+        float *xr = re, *xi = im, *yr = work_re, *yi = work_im;
+        int s = batch;
+        for (const Stage& stage : stages) {
+            const float* wr = twiddleRe.data() + stage.twiddles;
+            const float* wi = twiddleIm.data() + stage.twiddles;
+            if (inverse) {
+                runStage<true>(stage, xr, xi, yr, yi, s, wr, wi);
+            } else {
+                runStage<false>(stage, xr, xi, yr, yi, s, wr, wi);
+            }
+            std::swap(xr, yr);
+            std::swap(xi, yi);
+            s *= stage.radix;
+        }
+        if (xr != re) {
+            std::memcpy(re, xr, sizeof(float) * n * batch);
+            std::memcpy(im, xi, sizeof(float) * n * batch);
+        }
+    }
+
+   private:
+    // One stage splits sequences of `m` * `radix` elements into `radix` interleaved
+    // sequences of `m`; its twiddles start at `twiddles`, radix - 1 for every p < m.
+    struct Stage {
+        int radix;
+        int m;
+        size_t twiddles;
+    };
+
+    int n;
+    std::vector<Stage> stages;
+    std::vector<float> twiddleRe, twiddleIm;
+
+    template <bool Inverse>
+    static void runStage(const Stage& stage, const float* xr, const float* xi, float* yr, float* yi, int s,
+                         const float* wr, const float* wi) {
+        switch (stage.radix) {
+            case 4: radix4<Inverse>(xr, xi, yr, yi, stage.m, s, wr, wi); break;
+            case 2: radix2<Inverse>(xr, xi, yr, yi, stage.m, s, wr, wi); break;
+            case 3: radix3<Inverse>(xr, xi, yr, yi, stage.m, s, wr, wi); break;
+            case 5: radix5<Inverse>(xr, xi, yr, yi, stage.m, s, wr, wi); break;
+            default: radixOdd<Inverse>(stage.radix, xr, xi, yr, yi, stage.m, s, wr, wi); break;
+        }
+    }
+
+    template <bool Inverse>
+    static void radix2(const float* xr, const float* xi, float* yr, float* yi, int m, int s, const float* wr,
+                       const float* wi) {
+        for (int p = 0; p < m; p++) {
+            const float w_re = wr[p], w_im = Inverse ? -wi[p] : wi[p];
+            const float *a0r = xr + s * p, *a0i = xi + s * p;
+            const float *a1r = xr + s * (p + m), *a1i = xi + s * (p + m);
+            float *b0r = yr + s * 2 * p, *b0i = yi + s * 2 * p;
+            float *b1r = b0r + s, *b1i = b0i + s;
+            for (int q = 0; q < s; q++) {
+                float dr = a0r[q] - a1r[q], di = a0i[q] - a1i[q];
+                b0r[q] = a0r[q] + a1r[q];
+                b0i[q] = a0i[q] + a1i[q];
+                b1r[q] = dr * w_re - di * w_im;
+                b1i[q] = dr * w_im + di * w_re;
+            }
+        }
+    }
+
+    template <bool Inverse>
+    static void radix4(const float* xr, const float* xi, float* yr, float* yi, int m, int s, const float* wr,
+                       const float* wi) {
+        for (int p = 0; p < m; p++) {
+            const float w1r = wr[3 * p], w1i = Inverse ? -wi[3 * p] : wi[3 * p];
+            const float w2r = wr[3 * p + 1], w2i = Inverse ? -wi[3 * p + 1] : wi[3 * p + 1];
+            const float w3r = wr[3 * p + 2], w3i = Inverse ? -wi[3 * p + 2] : wi[3 * p + 2];
+            const float *a0r = xr + s * p, *a0i = xi + s * p;
+            const float *a1r = xr + s * (p + m), *a1i = xi + s * (p + m);
+            const float *a2r = xr + s * (p + 2 * m), *a2i = xi + s * (p + 2 * m);
+            const float *a3r = xr + s * (p + 3 * m), *a3i = xi + s * (p + 3 * m);
+            float *b0r = yr + s * 4 * p, *b0i = yi + s * 4 * p;
+            float *b1r = b0r + s, *b1i = b0i + s;
+            float *b2r = b1r + s, *b2i = b1i + s;
+            float *b3r = b2r + s, *b3i = b2i + s;
+            for (int q = 0; q < s; q++) {
+                float t0r = a0r[q] + a2r[q], t0i = a0i[q] + a2i[q];
+                float t1r = a0r[q] - a2r[q], t1i = a0i[q] - a2i[q];
+                float t2r = a1r[q] + a3r[q], t2i = a1i[q] + a3i[q];
+                float t3r = a1r[q] - a3r[q], t3i = a1i[q] - a3i[q];
+                // Forward, the odd outputs are t1 -/+ i * t3; inverse swaps the signs.
+                float u1r = Inverse ? t1r - t3i : t1r + t3i, u1i = Inverse ? t1i + t3r : t1i - t3r;
+                float u3r = Inverse ? t1r + t3i : t1r - t3i, u3i = Inverse ? t1i - t3r : t1i + t3r;
+                float u2r = t0r - t2r, u2i = t0i - t2i;
+                b0r[q] = t0r + t2r;
+                b0i[q] = t0i + t2i;
+                b1r[q] = u1r * w1r - u1i * w1i;
+                b1i[q] = u1r * w1i + u1i * w1r;
+                b2r[q] = u2r * w2r - u2i * w2i;
+                b2i[q] = u2r * w2i + u2i * w2r;
+                b3r[q] = u3r * w3r - u3i * w3i;
+                b3i[q] = u3r * w3i + u3i * w3r;
+            }
+        }
+    }
+
+    template <bool Inverse>
+    static void radix3(const float* xr, const float* xi, float* yr, float* yi, int m, int s, const float* wr,
+                       const float* wi) {
+        // Forward, b1 and b2 are a0 - (a1 + a2) / 2 -/+ i sin(2pi/3) (a1 - a2).
+        const float sine = Inverse ? -0.866025403784f : 0.866025403784f;
+        for (int p = 0; p < m; p++) {
+            const float w1r = wr[2 * p], w1i = Inverse ? -wi[2 * p] : wi[2 * p];
+            const float w2r = wr[2 * p + 1], w2i = Inverse ? -wi[2 * p + 1] : wi[2 * p + 1];
+            const float *a0r = xr + s * p, *a0i = xi + s * p;
+            const float *a1r = xr + s * (p + m), *a1i = xi + s * (p + m);
+            const float *a2r = xr + s * (p + 2 * m), *a2i = xi + s * (p + 2 * m);
+            float *b0r = yr + s * 3 * p, *b0i = yi + s * 3 * p;
+            float *b1r = b0r + s, *b1i = b0i + s;
+            float *b2r = b1r + s, *b2i = b1i + s;
+            for (int q = 0; q < s; q++) {
+                float tr = a1r[q] + a2r[q], ti = a1i[q] + a2i[q];
+                float mr = a0r[q] - 0.5f * tr, mi = a0i[q] - 0.5f * ti;
+                float nr = sine * (a1r[q] - a2r[q]), ni = sine * (a1i[q] - a2i[q]);
+                float u1r = mr + ni, u1i = mi - nr;
+                float u2r = mr - ni, u2i = mi + nr;
+                b0r[q] = a0r[q] + tr;
+                b0i[q] = a0i[q] + ti;
+                b1r[q] = u1r * w1r - u1i * w1i;
+                b1i[q] = u1r * w1i + u1i * w1r;
+                b2r[q] = u2r * w2r - u2i * w2i;
+                b2i[q] = u2r * w2i + u2i * w2r;
+            }
+        }
+    }
+
+    template <bool Inverse>
+    static void radix5(const float* xr, const float* xi, float* yr, float* yi, int m, int s, const float* wr,
+                       const float* wi) {
+        // With t1 = a1 + a4, t2 = a2 + a3, t3 = a1 - a4, t4 = a2 - a3, forward:
+        // b1, b4 = a0 + c1 t1 + c2 t2 -/+ i (s1 t3 + s2 t4),
+        // b2, b3 = a0 + c2 t1 + c1 t2 -/+ i (s2 t3 - s1 t4).
+        const float c1 = 0.309016994375f, c2 = -0.809016994375f;
+        const float s1 = Inverse ? -0.951056516295f : 0.951056516295f;
+        const float s2 = Inverse ? -0.587785252292f : 0.587785252292f;
+        for (int p = 0; p < m; p++) {
+            float w_re[4], w_im[4];
+            for (int j = 0; j < 4; j++) {
+                w_re[j] = wr[4 * p + j];
+                w_im[j] = Inverse ? -wi[4 * p + j] : wi[4 * p + j];
+            }
+            const float *a0r = xr + s * p, *a0i = xi + s * p;
+            const float *a1r = xr + s * (p + m), *a1i = xi + s * (p + m);
+            const float *a2r = xr + s * (p + 2 * m), *a2i = xi + s * (p + 2 * m);
+            const float *a3r = xr + s * (p + 3 * m), *a3i = xi + s * (p + 3 * m);
+            const float *a4r = xr + s * (p + 4 * m), *a4i = xi + s * (p + 4 * m);
+            float *b0r = yr + s * 5 * p, *b0i = yi + s * 5 * p;
+            for (int q = 0; q < s; q++) {
+                float t1r = a1r[q] + a4r[q], t1i = a1i[q] + a4i[q];
+                float t2r = a2r[q] + a3r[q], t2i = a2i[q] + a3i[q];
+                float t3r = a1r[q] - a4r[q], t3i = a1i[q] - a4i[q];
+                float t4r = a2r[q] - a3r[q], t4i = a2i[q] - a3i[q];
+                float m1r = a0r[q] + c1 * t1r + c2 * t2r, m1i = a0i[q] + c1 * t1i + c2 * t2i;
+                float m2r = a0r[q] + c2 * t1r + c1 * t2r, m2i = a0i[q] + c2 * t1i + c1 * t2i;
+                float n1r = s1 * t3r + s2 * t4r, n1i = s1 * t3i + s2 * t4i;
+                float n2r = s2 * t3r - s1 * t4r, n2i = s2 * t3i - s1 * t4i;
+                float ur[4] = {m1r + n1i, m2r + n2i, m2r - n2i, m1r - n1i};
+                float ui[4] = {m1i - n1r, m2i - n2r, m2i + n2r, m1i + n1r};
+                b0r[q] = a0r[q] + t1r + t2r;
+                b0i[q] = a0i[q] + t1i + t2i;
+                for (int j = 0; j < 4; j++) {
+                    b0r[s * (j + 1) + q] = ur[j] * w_re[j] - ui[j] * w_im[j];
+                    b0i[s * (j + 1) + q] = ur[j] * w_im[j] + ui[j] * w_re[j];
+                }
+            }
+        }
+    }
+
+    // Direct DFT butterfly for a prime factor above 5; only reached for non-smooth sizes.
+    template <bool Inverse>
+    static void radixOdd(int radix, const float* xr, const float* xi, float* yr, float* yi, int m, int s,
+                         const float* wr, const float* wi) {
+        std::vector<float> root_re(radix), root_im(radix);
+        for (int t = 0; t < radix; t++) {
+            double angle = (Inverse ? 2 : -2) * M_PI * t / radix;
+            root_re[t] = static_cast<float>(std::cos(angle));
+            root_im[t] = static_cast<float>(std::sin(angle));
+        }
+        std::vector<float> sum_re(s), sum_im(s);
+
+        for (int p = 0; p < m; p++) {
+            for (int j = 0; j < radix; j++) {
+                std::fill(sum_re.begin(), sum_re.end(), 0.0f);
+                std::fill(sum_im.begin(), sum_im.end(), 0.0f);
+                for (int k = 0; k < radix; k++) {
+                    const float cr = root_re[j * k % radix], ci = root_im[j * k % radix];
+                    const float *ar = xr + s * (p + k * m), *ai = xi + s * (p + k * m);
+                    for (int q = 0; q < s; q++) {
+                        sum_re[q] += ar[q] * cr - ai[q] * ci;
+                        sum_im[q] += ar[q] * ci + ai[q] * cr;
+                    }
+                }
+
+                const float w_re = j ? wr[(radix - 1) * p + j - 1] : 1.0f;
+                const float w_im = j ? (Inverse ? -1 : 1) * wi[(radix - 1) * p + j - 1] : 0.0f;
+                float *br = yr + s * (radix * p + j), *bi = yi + s * (radix * p + j);
+                for (int q = 0; q < s; q++) {
+                    br[q] = sum_re[q] * w_re - sum_im[q] * w_im;
+                    bi[q] = sum_re[q] * w_im + sum_im[q] * w_re;
+                }
+            }
+        }
+    }
+};
+
+// 2D FFT of a real width x height image, width even. Its spectrum has width / 2 + 1
+// complex columns, the rest follows from symmetry. Rows are transformed as complex
+// sequences of width / 2 (even samples real, odd samples imaginary) and untangled
+// afterwards, columns as complex sequences of height. Both passes take ranges so the
+// caller can spread rows and column strips over threads; each call needs its own
+// scratch vector.
+class RealFFT2D {
+   public:
+    static constexpr int rowBatch = 8;
+    static constexpr int columnBatch = 16;
+
+    RealFFT2D(int width, int height)
+        : width(width), height(height), half(width / 2), rowPlan(width / 2), columnPlan(height),
+          unpackRe(width / 2 + 1), unpackIm(width / 2 + 1) {
+        for (int k = 0; k <= half; k++) {
+            double angle = -2 * M_PI * k / width;
+            unpackRe[k] = static_cast<float>(std::cos(angle));
+            unpackIm[k] = static_cast<float>(std::sin(angle));
+        }
+    }
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    int spectrumWidth() const { return half + 1; }
+    size_t spectrumSize() const { return static_cast<size_t>(height) * spectrumWidth(); }
+
+    // Forward transform of rows [y_begin, y_end) of `src` into the same spectrum rows.
+    void forwardRows(const float* src, int src_stride, float* re, float* im, int y_begin, int y_end,
+                     std::vector<float>& scratch) const {
+        float *zr, *zi, *work_re, *work_im;
+        buffers(scratch, half * rowBatch, zr, zi, work_re, work_im);
+
+        for (int y0 = y_begin; y0 < y_end; y0 += rowBatch) {
+            const int batch = std::min(rowBatch, y_end - y0);
+            for (int b = 0; b < batch; b++) {
+                const float* row = src + static_cast<size_t>(y0 + b) * src_stride;
+                for (int k = 0; k < half; k++) {
+                    zr[k * batch + b] = row[2 * k];
+                    zi[k * batch + b] = row[2 * k + 1];
+                }
+            }
+            rowPlan.transform(zr, zi, work_re, work_im, batch, false);
+
+            for (int b = 0; b < batch; b++) {
+                float* out_re = re + static_cast<size_t>(y0 + b) * spectrumWidth();
+                float* out_im = im + static_cast<size_t>(y0 + b) * spectrumWidth();
+                for (int k = 0; k <= half; k++) {
+                    const int a = (k % half) * batch + b, c = ((half - k) % half) * batch + b;
+                    // Even part (Z[k] + conj Z[-k]) / 2, odd part (Z[k] - conj Z[-k]) / 2i.
+                    float even_re = 0.5f * (zr[a] + zr[c]), even_im = 0.5f * (zi[a] - zi[c]);
+                    float odd_re = 0.5f * (zi[a] + zi[c]), odd_im = -0.5f * (zr[a] - zr[c]);
+                    out_re[k] = even_re + odd_re * unpackRe[k] - odd_im * unpackIm[k];
+                    out_im[k] = even_im + odd_re * unpackIm[k] + odd_im * unpackRe[k];
+                }
+            }
+        }
+    }
+
+    // Transforms spectrum columns [c_begin, c_end) in either direction.
+    void transformColumns(float* re, float* im, int c_begin, int c_end, bool inverse,
+                          std::vector<float>& scratch) const {
+        float *zr, *zi, *work_re, *work_im;
+        buffers(scratch, height * columnBatch, zr, zi, work_re, work_im);
+        const int stride = spectrumWidth();
+
+        for (int c0 = c_begin; c0 < c_end; c0 += columnBatch) {
+            const int batch = std::min(columnBatch, c_end - c0);
+            for (int y = 0; y < height; y++) {
+                std::memcpy(zr + y * batch, re + static_cast<size_t>(y) * stride + c0, sizeof(float) * batch);
+                std::memcpy(zi + y * batch, im + static_cast<size_t>(y) * stride + c0, sizeof(float) * batch);
+            }
+            columnPlan.transform(zr, zi, work_re, work_im, batch, inverse);
+            for (int y = 0; y < height; y++) {
+                std::memcpy(re + static_cast<size_t>(y) * stride + c0, zr + y * batch, sizeof(float) * batch);
+                std::memcpy(im + static_cast<size_t>(y) * stride + c0, zi + y * batch, sizeof(float) * batch);
+            }
+        }
+    }
+
+    // Inverse transform of spectrum rows [y_begin, y_end) into real rows of `dst`,
+    // scaled by width (and by height once the columns went through an inverse too).
+    void inverseRows(const float* re, const float* im, float* dst, int dst_stride, int y_begin, int y_end,
+                     std::vector<float>& scratch) const {
+        float *zr, *zi, *work_re, *work_im;
+        buffers(scratch, half * rowBatch, zr, zi, work_re, work_im);
+
+        for (int y0 = y_begin; y0 < y_end; y0 += rowBatch) {
+            const int batch = std::min(rowBatch, y_end - y0);
+            for (int b = 0; b < batch; b++) {
+                const float* in_re = re + static_cast<size_t>(y0 + b) * spectrumWidth();
+                const float* in_im = im + static_cast<size_t>(y0 + b) * spectrumWidth();
+                for (int k = 0; k < half; k++) {
+                    // Even part X[k] + conj X[-k], odd part (X[k] - conj X[-k]) / W^k;
+                    // Z[k] = even + i * odd is twice the half-length spectrum.
+                    float even_re = in_re[k] + in_re[half - k], even_im = in_im[k] - in_im[half - k];
+                    float diff_re = in_re[k] - in_re[half - k], diff_im = in_im[k] + in_im[half - k];
+                    float odd_re = diff_re * unpackRe[k] + diff_im * unpackIm[k];
+                    float odd_im = diff_im * unpackRe[k] - diff_re * unpackIm[k];
+                    zr[k * batch + b] = even_re - odd_im;
+                    zi[k * batch + b] = even_im + odd_re;
+                }
+            }
+            rowPlan.transform(zr, zi, work_re, work_im, batch, true);
+
+            for (int b = 0; b < batch; b++) {
+                float* row = dst + static_cast<size_t>(y0 + b) * dst_stride;
+                for (int k = 0; k < half; k++) {
+                    row[2 * k] = zr[k * batch + b];
+                    row[2 * k + 1] = zi[k * batch + b];
+                }
+            }
+        }
+    }
+
+   private:
+    int width, height, half;
+    FFTPlan rowPlan, columnPlan;
+    std::vector<float> unpackRe, unpackIm;
+
+    static void buffers(std::vector<float>& scratch, int count, float*& zr, float*& zi, float*& work_re,
+                        float*& work_im) {
+        if (scratch.size() < static_cast<size_t>(4) * count) scratch.resize(static_cast<size_t>(4) * count);
+        zr = scratch.data();
+        zi = zr + count;
+        work_re = zi + count;
+        work_im = work_re + count;
+    }
+};
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <glib.h>
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Channel histograms of one image version, counted per 128x128 tile. The image
+// histogram is the sum of the tiles, a region histogram adds up the tiles it covers and
+// only scans the pixels of tiles it cuts through, and an edit to part of the image only
+// needs the tiles it touched recounted. A point operation maps every tile through its
+// lookup table without looking at a single pixel.
+class TileHistogram {
+   public:
+    static constexpr int tileSize = 128;
+    static constexpr int binsPerTile = 3 * 256;
+
+    using Histogram = std::vector<std::vector<int>>;
+
+    TileHistogram(int width, int height)
+        : width(width), height(height),
+          tilesX((width + tileSize - 1) / tileSize), tilesY((height + tileSize - 1) / tileSize),
+          counts(static_cast<size_t>(tilesX) * tilesY * binsPerTile), totals(binsPerTile) {}
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    int tileCount() const { return tilesX * tilesY; }
+    size_t getBytes() const { return (counts.size() + totals.size()) * sizeof(uint32_t); }
+
+    // Recounts one tile of the image; different tiles may be scanned concurrently.
+    // updateTotals must be called once all rescans are done.
+    void scanTile(const guint8* pixels, int rowstride, int n_channels, int tile) {
+        uint32_t* bins = tileBins(tile);
+        std::fill(bins, bins + binsPerTile, 0);
+
+        int x0, y0, x1, y1;
+        tileBounds(tile, x0, y0, x1, y1);
+        countPixels(pixels, rowstride, n_channels, x0, y0, x1, y1, bins);
+    }
+
+    void updateTotals() {
+        std::fill(totals.begin(), totals.end(), 0);
+        for (int tile = 0; tile < tileCount(); tile++) {
+            const uint32_t* bins = tileBins(tile);
+            for (int i = 0; i < binsPerTile; i++) totals[i] += bins[i];
+        }
+    }
+
+    // Tiles that overlap [x, x + w) x [y, y + h).
+    std::vector<int> tilesInRegion(int x, int y, int w, int h) const {
+        std::vector<int> tiles;
+        int tx0 = std::max(0, x / tileSize), tx1 = std::min(tilesX, (x + w + tileSize - 1) / tileSize);
+        int ty0 = std::max(0, y / tileSize), ty1 = std::min(tilesY, (y + h + tileSize - 1) / tileSize);
+        for (int ty = ty0; ty < ty1; ty++) {
+            for (int tx = tx0; tx < tx1; tx++) tiles.push_back(ty * tilesX + tx);
+        }
+        return tiles;
+    }
+
+    Histogram total() const { return toHistogram(totals.data()); }
+
+    // Histogram of [x, x + w) x [y, y + h); `pixels` must be the image the tiles describe.
+    Histogram region(const guint8* pixels, int rowstride, int n_channels, int x, int y, int w, int h) const {
+        int rx0 = std::max(0, x), ry0 = std::max(0, y);
+        int rx1 = std::min(width, x + w), ry1 = std::min(height, y + h);
+        std::vector<uint32_t> bins(binsPerTile, 0);
+        if (rx0 >= rx1 || ry0 >= ry1) return toHistogram(bins.data());
+
+        for (int tile : tilesInRegion(rx0, ry0, rx1 - rx0, ry1 - ry0)) {
+            int x0, y0, x1, y1;
+            tileBounds(tile, x0, y0, x1, y1);
+            if (x0 >= rx0 && y0 >= ry0 && x1 <= rx1 && y1 <= ry1) {
+                const uint32_t* tile_bins = tileBins(tile);
+                for (int i = 0; i < binsPerTile; i++) bins[i] += tile_bins[i];
+            } else {
+                countPixels(pixels, rowstride, n_channels, std::max(x0, rx0), std::max(y0, ry0),
+                            std::min(x1, rx1), std::min(y1, ry1), bins.data());
+            }
+        }
+        return toHistogram(bins.data());
+    }
+
+    // The tiles of the image after every value of channel c was replaced by lut[c][value].
+    TileHistogram mapped(const std::vector<std::vector<guint8>>& lut) const {
+        TileHistogram result(width, height);
+        for (int tile = 0; tile < tileCount(); tile++) mapBins(tileBins(tile), result.tileBins(tile), lut);
+        mapBins(totals.data(), result.totals.data(), lut);
+        return result;
+    }
+
+   private:
+    int width, height;
+    int tilesX, tilesY;
+    std::vector<uint32_t> counts;
+    std::vector<uint32_t> totals;
+
+    uint32_t* tileBins(int tile) { return counts.data() + static_cast<size_t>(tile) * binsPerTile; }
+    const uint32_t* tileBins(int tile) const { return counts.data() + static_cast<size_t>(tile) * binsPerTile; }
+
+    void tileBounds(int tile, int& x0, int& y0, int& x1, int& y1) const {
+        x0 = tile % tilesX * tileSize;
+        y0 = tile / tilesX * tileSize;
+        x1 = std::min(width, x0 + tileSize);
+        y1 = std::min(height, y0 + tileSize);
+    }
+
+    static void countPixels(const guint8* pixels, int rowstride, int n_channels, int x0, int y0, int x1, int y1,
+                            uint32_t* bins) {
+        for (int y = y0; y < y1; ++y) {
+            const guint8* p = pixels + static_cast<size_t>(y) * rowstride + x0 * n_channels;
+            for (int x = x0; x < x1; ++x, p += n_channels) {
+                bins[p[0]]++;
+                bins[256 + p[1]]++;
+                bins[512 + p[2]]++;
+            }
+        }
+    }
+
+    static void mapBins(const uint32_t* src, uint32_t* dst, const std::vector<std::vector<guint8>>& lut) {
+        for (int channel = 0; channel < 3; channel++) {
+            for (int value = 0; value < 256; value++) {
+                dst[channel * 256 + lut[channel][value]] += src[channel * 256 + value];
+            }
+        }
+    }
+
+    static Histogram toHistogram(const uint32_t* bins) {
+        Histogram histogram(3, std::vector<int>(256));
+        for (int channel = 0; channel < 3; channel++) {
+            for (int value = 0; value < 256; value++) {
+                histogram[channel][value] = static_cast<int>(bins[channel * 256 + value]);
+            }
+        }
+        return histogram;
+    }
+};
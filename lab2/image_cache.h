@@ -0,0 +1,140 @@
+#pragma once
+
+#include <gdkmm.h>
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+
+// Decoded images by file, so reopening a file that was open recently skips the decode.
+// An entry is valid for the file as it was when decoded: the key holds the modification
+// time and size, and a lookup with a different one drops the stale entry. Entries are
+// kept in least recently used order and evicted from the back once their pixbufs exceed
+// the byte budget; an image larger than the whole budget is not kept at all.
+//
+// Pixbufs are handed out by reference and never written to, so an evicted image stays
+// alive for as long as a document still shows it. Lookups and inserts come from the
+// worker thread as well as the main one and take a lock.
+class DecodedImageCache {
+   public:
+    static constexpr size_t defaultBudget = size_t(512) * 1024 * 1024;
+
+    struct Key {
+        std::string path;
+        int64_t modified = 0;
+        uintmax_t size = 0;
+    };
+
+    struct Stats {
+        size_t entries = 0;
+        size_t bytes = 0;
+        uint64_t hits = 0, misses = 0, evictions = 0;
+    };
+
+    explicit DecodedImageCache(size_t budget = defaultBudget) : budget(budget) {}
+
+    // The key of the file as it is now: false if it cannot be read.
+    static bool keyOf(const std::string& filename, Key& key) {
+        std::error_code error;
+        std::filesystem::path path = std::filesystem::weakly_canonical(filename, error);
+        if (error) return false;
+        key.size = std::filesystem::file_size(path, error);
+        if (error) return false;
+        auto modified = std::filesystem::last_write_time(path, error);
+        if (error) return false;
+
+        key.path = path.string();
+        key.modified = modified.time_since_epoch().count();
+        return true;
+    }
+
+    Glib::RefPtr<Gdk::Pixbuf> find(const Key& key) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = index.find(key.path);
+        if (it == index.end()) {
+            misses++;
+            return {};
+        }
+
+        auto entry = it->second;
+        if (entry->key.modified != key.modified || entry->key.size != key.size) {
+            remove(it);
+            misses++;
+            return {};
+        }
+
+        entries.splice(entries.begin(), entries, entry);
+        hits++;
+        return entry->image;
+    }
+
+    void insert(const Key& key, const Glib::RefPtr<Gdk::Pixbuf>& image) {
+        if (!image) return;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = index.find(key.path);
+        if (it != index.end()) remove(it);
+
+        const size_t image_bytes = static_cast<size_t>(image->get_rowstride()) * image->get_height();
+        if (image_bytes > budget) return;
+
+        entries.push_front({key, image, image_bytes});
+        index[key.path] = entries.begin();
+        bytes += image_bytes;
+        evict();
+    }
+
+    void setBudget(size_t bytes_budget) {
+        std::lock_guard<std::mutex> lock(mutex);
+        budget = bytes_budget;
+        evict();
+    }
+
+    size_t getBudget() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return budget;
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+        entries.clear();
+        index.clear();
+        bytes = 0;
+    }
+
+    Stats getStats() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return {entries.size(), bytes, hits, misses, evictions};
+    }
+
+   private:
+    struct Entry {
+        Key key;
+        Glib::RefPtr<Gdk::Pixbuf> image;
+        size_t bytes;
+    };
+
+    // Most recently used first.
+    std::list<Entry> entries;
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+    size_t budget;
+    size_t bytes = 0;
+    uint64_t hits = 0, misses = 0, evictions = 0;
+    mutable std::mutex mutex;
+
+    void remove(std::unordered_map<std::string, std::list<Entry>::iterator>::iterator it) {
+        bytes -= it->second->bytes;
+        entries.erase(it->second);
+        index.erase(it);
+    }
+
+    void evict() {
+        while (bytes > budget && !entries.empty()) {
+            remove(index.find(entries.back().key.path));
+            evictions++;
+        }
+    }
+};
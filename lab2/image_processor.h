@@ -0,0 +1,1913 @@
+#pragma once
+
+#include <gdkmm.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <fstream>
+#include <atomic>
+#include <functional>
+#include <cmath>
+#include <memory>
+#include <new>
+
+#include "affine_warp.h"
+#include "bilateral_grid.h"
+#include "color_quantizer.h"
+#include "convolution.h"
+#include "deep_image_io.h"
+#include "dithering.h"
+#include "edge_detector.h"
+#include "gaussian_blur.h"
+#include "histogram_cache.h"
+#include "image_cache.h"
+#include "integral_image.h"
+#include "median_filter.h"
+#include "morphology.h"
+#include "parallel.h"
+#include "pixel_buffer.h"
+#include "png_encoder.h"
+#include "profiler.h"
+#include "quality_metrics.h"
+#include "resampler.h"
+#include "srgb.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+class JobControl {
+   public:
+    void cancel() { cancelled = true; }
+    bool isCancelled() const { return cancelled.load(std::memory_order_relaxed); }
+
+    void beginStage(int index, int count) {
+        stageIndex = index;
+        stageCount = std::max(1, count);
+        setProgress(0.0);
+    }
+
+    void setProgress(double fraction) {
+        progress = (stageIndex + std::min(1.0, fraction)) / stageCount;
+        if (onProgress) onProgress();
+    }
+
+    double getProgress() const { return progress.load(); }
+
+    void setProgressCallback(std::function<void()> callback) { onProgress = std::move(callback); }
+
+   private:
+    std::atomic<bool> cancelled{false};
+    std::atomic<double> progress{0.0};
+    int stageIndex = 0;
+    int stageCount = 1;
+    std::function<void()> onProgress;
+};
+
+// Sauvola: t = m * (1 + k * (s / 128 - 1)) from the window mean m and deviation s.
+// Bradley: t = m * (1 - k), the mean darkened by a fixed fraction.
+enum class ThresholdMethod { Sauvola, Bradley };
+
+enum class QuantizeMethod { MedianCut, Octree };
+
+enum class DitherMethod { FloydSteinberg, Jarvis, Bayer };
+
+// Auto picks whichever convolution path the cost model expects to be faster.
+enum class ConvolutionPath { Auto, Spatial, FFT };
+
+class ImageProcessor {
+   public:
+    static constexpr int bandHeight = 64;
+    static constexpr size_t loadChunkBytes = 256 * 1024;
+    static constexpr int thumbnailSize = 512;
+
+    ImageProcessor() : width(0), height(0) {}
+
+    bool loadImage(const std::string& filename) {
+        ProfileScope scope("load");
+        try {
+            auto loaded = Gdk::Pixbuf::create_from_file(filename);
+            if (!loaded) return false;
+
+            ProfileScope::countAllocation(pixbufBytes(loaded));
+            setImage(loaded);
+            scope.setMegapixels(getMegapixels());
+
+            return true;
+        }
+        catch (const Glib::Exception& ex) {
+            return false;
+        }
+    }
+
+    // Loads through a PixbufLoader fed loadChunkBytes at a time, so a cancelled job stops
+    // between chunks and progress follows the bytes read. Once the header gives the size,
+    // a JPEG larger than thumbnailSize is also decoded at reduced size (libjpeg scales the
+    // DCT, so this costs a small fraction of the full decode), and `on_thumbnail` receives
+    // it with the full size before the full decode continues. Other formats would have to
+    // be decoded in full for a thumbnail, so they skip it.
+    bool loadImageProgressive(const std::string& filename,
+                              const std::function<void(const Glib::RefPtr<Gdk::Pixbuf>&, int, int)>& on_thumbnail) {
+        ProfileScope scope("load");
+        std::ifstream file(filename, std::ios::binary);
+        if (!file) return false;
+
+        file.seekg(0, std::ios::end);
+        const double file_size = std::max<double>(1, static_cast<double>(file.tellg()));
+        file.seekg(0, std::ios::beg);
+
+        try {
+            auto loader = Gdk::PixbufLoader::create();
+            int full_width = 0, full_height = 0;
+            loader->signal_size_prepared().connect([&](int w, int h) {
+                full_width = w;
+                full_height = h;
+            });
+
+            std::vector<guint8> chunk(loadChunkBytes);
+            size_t total = 0;
+            bool thumbnail_checked = false;
+            while (true) {
+                if (isCancelled()) {
+                    closeLoader(loader);
+                    return false;
+                }
+
+                file.read(reinterpret_cast<char*>(chunk.data()), chunk.size());
+                std::streamsize count = file.gcount();
+                if (count <= 0) break;
+
+                loader->write(chunk.data(), count);
+                total += count;
+                if (job) job->setProgress(total / file_size);
+
+                if (!thumbnail_checked && full_width > 0) {
+                    thumbnail_checked = true;
+                    if (on_thumbnail && std::max(full_width, full_height) > thumbnailSize &&
+                        loader->get_format().get_name() == "jpeg") {
+                        loadThumbnail(filename, full_width, full_height, on_thumbnail);
+                    }
+                }
+            }
+
+            loader->close();
+            auto loaded = loader->get_pixbuf();
+            if (!loaded) return false;
+
+            ProfileScope::countAllocation(pixbufBytes(loaded));
+            setImage(loaded);
+            scope.setMegapixels(getMegapixels());
+
+            return true;
+        }
+        catch (const Glib::Exception& ex) {
+            return false;
+        }
+    }
+
+    // Takes the decoded image from `cache` if the file has not changed since it was put
+    // there, without reading the file; otherwise loads it progressively and caches it.
+    // The cached pixbuf becomes the original by reference, so a hit costs only the copy
+    // that starts the filtered image.
+    bool loadImageCached(const std::string& filename, DecodedImageCache& cache,
+                         const std::function<void(const Glib::RefPtr<Gdk::Pixbuf>&, int, int)>& on_thumbnail) {
+        if (DeepImageIO::isDeepFile(filename)) return loadDeepImage(filename);
+
+        DecodedImageCache::Key key;
+        if (!DecodedImageCache::keyOf(filename, key)) return false;
+
+        if (auto cached = cache.find(key)) {
+            ProfileScope scope("load cached");
+            setImage(cached);
+            scope.setMegapixels(getMegapixels());
+            return true;
+        }
+
+        if (!loadImageProgressive(filename, on_thumbnail)) return false;
+        cache.insert(key, originalPixbuf);
+        return true;
+    }
+
+    // Loads a 16-bit PNG or a PFM file as the deep original; the pixbufs become its 8-bit
+    // display versions. An image too large for memory fails the load, as a Pixbuf loader
+    // error does, rather than escaping the worker thread.
+    bool loadDeepImage(const std::string& filename) {
+        ProfileScope scope("load deep");
+        DeepImage image;
+        Glib::RefPtr<Gdk::Pixbuf> display;
+        try {
+            if (auto wide = DeepImageIO::readPNG16(filename)) {
+                image = DeepImage(std::shared_ptr<const PixelBuffer<uint16_t>>(wide));
+            } else if (auto hdr = DeepImageIO::readPFM(filename)) {
+                image = DeepImage(std::shared_ptr<const PixelBuffer<float>>(hdr));
+            } else {
+                return false;
+            }
+
+            image.visit([&](const auto& buffer) {
+                ProfileScope::countAllocation(buffer.getBytes());
+                display = toDisplayPixbuf(buffer);
+            });
+        }
+        catch (const std::bad_alloc&) {
+            return false;
+        }
+        if (!display) return false;
+
+        setImage(display);
+        deepOriginal = deepFiltered = image;
+        scope.setMegapixels(getMegapixels());
+        return true;
+    }
+
+    void setImage(const Glib::RefPtr<Gdk::Pixbuf>& image) {
+        deepOriginal = DeepImage();
+        pixbuf = image;
+
+        width = pixbuf->get_width();
+        height = pixbuf->get_height();
+
+        originalPixbuf = pixbuf;
+        originalHistogram.reset();
+        setFiltered(copyPixbuf(pixbuf));
+        rangeValid = false;
+        deepRangeValid = false;
+    }
+
+    void applyLowPassFilter() {
+        if (!filteredPixbuf) return;
+
+        ProfileScope scope("filter", getMegapixels());
+        auto resultPixbuf = copyPixbuf(filteredPixbuf);
+
+        const int kernelSize = 3;
+        int radius = kernelSize / 2;
+        guint8* src_pixels = filteredPixbuf->get_pixels();
+        guint8* dst_pixels = resultPixbuf->get_pixels();
+        int rowstride = filteredPixbuf->get_rowstride();
+        int n_channels = filteredPixbuf->get_n_channels();
+        const SrgbTables* srgb = linearTables();
+
+        bool done = forEachBand(radius, height - radius, [&](int y_begin, int y_end) {
+            for (int y = y_begin; y < y_end; ++y) {
+                for (int x = radius; x < width - radius; ++x) {
+                    for (int channel = 0; channel < 3; channel++) {
+                        int sum = 0;
+                        int count = 0;
+
+                        for (int ky = -radius; ky <= radius; ++ky) {
+                            for (int kx = -radius; kx <= radius; ++kx) {
+                                guint8* p = src_pixels + (y + ky) * rowstride + (x + kx) * n_channels;
+                                sum += srgb ? srgb->toLinearCode[p[channel]] : p[channel];
+                                count++;
+                            }
+                        }
+
+                        guint8* dst_p = dst_pixels + y * rowstride + x * n_channels;
+                        dst_p[channel] = srgb ? srgb->fromLinearCode[(sum + count / 2) / count]
+                                              : static_cast<guint8>(sum / count);
+                    }
+                }
+            }
+        });
+
+        if (done) setFiltered(resultPixbuf);
+    }
+
+    // Canny edges of the luminance as white on black. Pixels with a gradient magnitude of
+    // at least `low` are kept when connected to one of at least `high`.
+    void applyEdgeDetection(int low, int high) {
+        if (!filteredPixbuf) return;
+
+        ProfileScope scope("edge detection", getMegapixels());
+        low = std::max(1, std::min(low, CannyEdgeDetector::maxThreshold));
+        high = std::max(low, std::min(high, CannyEdgeDetector::maxThreshold));
+
+        CannyEdgeDetector detector(width, height, low, high);
+        std::vector<CannyEdgeDetector::Band> bands((height + bandHeight - 1) / bandHeight);
+        const guint8* src_pixels = filteredPixbuf->get_pixels();
+        int rowstride = filteredPixbuf->get_rowstride();
+        int n_channels = filteredPixbuf->get_n_channels();
+
+        beginStage(0, 2);
+        bool done = parallelBands(0, height, [&](int y_begin, int y_end) {
+            detector.detectBand(src_pixels, rowstride, n_channels, y_begin, y_end, bands[y_begin / bandHeight]);
+        });
+        if (!done) return;
+
+        std::vector<char> strong = CannyEdgeDetector::link(bands);
+
+        auto resultPixbuf = copyPixbuf(filteredPixbuf);
+        guint8* dst_pixels = resultPixbuf->get_pixels();
+
+        beginStage(1, 2);
+        done = parallelBands(0, height, [&](int y_begin, int y_end) {
+            detector.paintBand(bands[y_begin / bandHeight], strong, dst_pixels, rowstride, n_channels, y_begin, y_end);
+        });
+
+        if (done) setFiltered(resultPixbuf);
+    }
+
+    // Edge-preserving smoothing: a Gaussian of `sigma_spatial` pixels weighted by a
+    // Gaussian of `sigma_range` levels of luminance difference, through a bilateral grid.
+    void applyBilateralFilter(double sigma_spatial, double sigma_range) {
+        if (!filteredPixbuf) return;
+
+        ProfileScope scope("bilateral filter", getMegapixels());
+        BilateralGrid grid(width, height, sigma_spatial, sigma_range);
+        ProfileScope::countAllocation(grid.getBytes());
+
+        const guint8* src_pixels = filteredPixbuf->get_pixels();
+        int rowstride = filteredPixbuf->get_rowstride();
+        int n_channels = filteredPixbuf->get_n_channels();
+
+        beginStage(0, 5);
+        bool done = parallelTiles(grid.getRows(), [&](int gy) {
+            grid.splatRow(gy, src_pixels, rowstride, n_channels, width);
+        });
+        for (int axis = 0; axis < 3 && done; axis++) {
+            beginStage(1 + axis, 5);
+            done = parallelTiles(grid.blurTasks(axis), [&](int index) { grid.blur(axis, index); });
+        }
+        if (!done) return;
+
+        auto resultPixbuf = copyPixbuf(filteredPixbuf);
+        guint8* dst_pixels = resultPixbuf->get_pixels();
+
+        beginStage(4, 5);
+        done = parallelBands(0, height, [&](int y_begin, int y_end) {
+            grid.sliceRows(src_pixels, rowstride, n_channels, width, dst_pixels, y_begin, y_end);
+        });
+
+        if (done) setFiltered(resultPixbuf);
+    }
+
+    void applyMedianFilter(int radius) {
+        if (!filteredPixbuf) return;
+
+        ProfileScope scope("median", getMegapixels());
+        auto resultPixbuf = copyPixbuf(filteredPixbuf);
+
+        MedianFilter filter(radius);
+        const guint8* src_pixels = filteredPixbuf->get_pixels();
+        guint8* dst_pixels = resultPixbuf->get_pixels();
+        int rowstride = filteredPixbuf->get_rowstride();
+        int n_channels = filteredPixbuf->get_n_channels();
+
+        // Each band rebuilds its column histograms from 2r+1 rows, so bands grow with the
+        // radius to keep that start-up cost a small fraction of the band.
+        int band_height = std::max(bandHeight, 4 * (2 * filter.getRadius() + 1));
+        bool done = parallelBands(0, height, [&](int y_begin, int y_end) {
+            filter.filterRows(src_pixels, dst_pixels, width, height, rowstride, n_channels, 3, y_begin, y_end);
+        }, band_height);
+
+        if (done) setFiltered(resultPixbuf);
+    }
+
+    // Erosion, dilation, opening or closing with a (2 radius_x + 1) x (2 radius_y + 1)
+    // rectangle. Per channel by default; with `grayscale` it works on luminance and writes a
+    // gray image.
+    void applyMorphology(MorphologyOp op, int radius_x, int radius_y, bool grayscale) {
+        if (!filteredPixbuf) return;
+
+        ProfileScope scope("morphology", getMegapixels());
+        auto resultPixbuf = copyPixbuf(filteredPixbuf);
+        guint8* dst_pixels = resultPixbuf->get_pixels();
+        int rowstride = filteredPixbuf->get_rowstride();
+        int n_channels = filteredPixbuf->get_n_channels();
+
+        // Passes run from `image` through `temp` and back, on the pixbuf itself or on a
+        // luminance plane.
+        std::vector<guint8> plane;
+        guint8* image = dst_pixels;
+        int image_stride = rowstride, image_channels = n_channels, channels = 3;
+        if (grayscale) {
+            plane.resize(static_cast<size_t>(width) * height);
+            image = plane.data();
+            image_stride = width;
+            image_channels = channels = 1;
+            bool done = parallelBands(0, height, [&](int y_begin, int y_end) {
+                for (int y = y_begin; y < y_end; ++y) {
+                    const guint8* p = dst_pixels + static_cast<size_t>(y) * rowstride;
+                    guint8* l = image + static_cast<size_t>(y) * width;
+                    for (int x = 0; x < width; ++x, p += n_channels) l[x] = (77 * p[0] + 150 * p[1] + 29 * p[2] + 128) >> 8;
+                }
+            });
+            if (!done) return;
+        }
+        std::vector<guint8> temp(static_cast<size_t>(height) * image_stride);
+        ProfileScope::countAllocation(plane.size() + temp.size());
+
+        std::vector<bool> passes;
+        switch (op) {
+            case MorphologyOp::Erode: passes = {false}; break;
+            case MorphologyOp::Dilate: passes = {true}; break;
+            case MorphologyOp::Open: passes = {false, true}; break;
+            case MorphologyOp::Close: passes = {true, false}; break;
+        }
+
+        const int row_bytes = width * image_channels;
+        const int strips = (row_bytes + Morphology::stripBytes - 1) / Morphology::stripBytes;
+        const int stages = 2 * static_cast<int>(passes.size());
+        for (size_t pass = 0; pass < passes.size(); pass++) {
+            Morphology morphology(radius_x, radius_y, passes[pass]);
+
+            beginStage(2 * pass, stages);
+            bool done = parallelTiles(strips, [&](int index) {
+                int x_begin = index * Morphology::stripBytes;
+                morphology.verticalStrip(image, temp.data(), image_stride, height, x_begin,
+                                         std::min(row_bytes, x_begin + Morphology::stripBytes));
+            });
+            if (!done) return;
+
+            beginStage(2 * pass + 1, stages);
+            done = parallelBands(0, height, [&](int y_begin, int y_end) {
+                morphology.horizontalRows(temp.data(), image, image_stride, image_channels, channels, width, y_begin,
+                                          y_end);
+            });
+            if (!done) return;
+        }
+
+        if (grayscale) {
+            bool done = parallelBands(0, height, [&](int y_begin, int y_end) {
+                for (int y = y_begin; y < y_end; ++y) {
+                    guint8* p = dst_pixels + static_cast<size_t>(y) * rowstride;
+                    const guint8* l = image + static_cast<size_t>(y) * width;
+                    for (int x = 0; x < width; ++x, p += n_channels) p[0] = p[1] = p[2] = l[x];
+                }
+            });
+            if (!done) return;
+        }
+
+        setFiltered(resultPixbuf);
+    }
+
+    void applyGaussianBlur(double sigma) {
+        if (!filteredPixbuf) return;
+
+        ProfileScope scope("gaussian", getMegapixels());
+        auto resultPixbuf = copyPixbuf(filteredPixbuf);
+
+        RecursiveGaussian gaussian(sigma);
+        const SrgbTables* srgb = linearTables();
+        const int channels = 3;
+        const guint8* src_pixels = filteredPixbuf->get_pixels();
+        guint8* dst_pixels = resultPixbuf->get_pixels();
+        int rowstride = filteredPixbuf->get_rowstride();
+        int n_channels = filteredPixbuf->get_n_channels();
+
+        std::vector<uint16_t> temp(static_cast<size_t>(width) * height * channels);
+        ProfileScope::countAllocation(temp.size() * sizeof(uint16_t));
+
+        beginStage(0, 2);
+        bool done = parallelBands(0, height, [&](int y_begin, int y_end) {
+            gaussian.horizontalRows(src_pixels, rowstride, n_channels, channels, width, temp.data(), y_begin, y_end,
+                                    srgb);
+        });
+        if (!done) return;
+
+        const int values = width * channels;
+        const int strip = RecursiveGaussian::stripLanes / channels * channels;
+        const int strips = (values + strip - 1) / strip;
+        std::atomic<int> strips_done{0};
+
+        beginStage(1, 2);
+        parallelFor(strips, [&](int index) {
+            if (isCancelled()) return;
+
+            int v_begin = index * strip;
+            gaussian.verticalStrip(temp.data(), width, height, channels, dst_pixels, rowstride, n_channels,
+                                   v_begin, std::min(values, v_begin + strip), srgb);
+            if (job) job->setProgress(static_cast<double>(++strips_done) / strips);
+        });
+
+        if (!isCancelled()) setFiltered(resultPixbuf);
+    }
+
+    // Convolves R, G and B with `kernel`. Small kernels are applied directly; large ones
+    // go through overlap-add FFT convolution, whose cost does not depend on the number of
+    // taps.
+    void applyConvolution(const ConvolutionKernel& kernel, ConvolutionPath path = ConvolutionPath::Auto) {
+        if (!filteredPixbuf) return;
+
+        const int fft_size = FFTConvolution::bestFFTSize(kernel.size(), width, height);
+        bool use_fft = fft_size > 0 && path != ConvolutionPath::Spatial;
+        if (use_fft && path == ConvolutionPath::Auto) {
+            use_fft = FFTConvolution::fftCost(kernel.size(), fft_size, width, height) < FFTConvolution::spatialCost(kernel.taps());
+        }
+
+        ProfileScope scope(use_fft ? "convolution fft" : "convolution spatial", getMegapixels());
+        const guint8* src_pixels = filteredPixbuf->get_pixels();
+        int rowstride = filteredPixbuf->get_rowstride();
+        int n_channels = filteredPixbuf->get_n_channels();
+
+        auto resultPixbuf = copyPixbuf(filteredPixbuf);
+        guint8* dst_pixels = resultPixbuf->get_pixels();
+
+        if (!use_fft) {
+            SpatialConvolution convolution(kernel);
+            bool done = parallelBands(0, height, [&](int y_begin, int y_end) {
+                convolution.filterRows(src_pixels, dst_pixels, width, height, rowstride, n_channels, y_begin, y_end);
+            });
+            if (done) setFiltered(resultPixbuf);
+            return;
+        }
+
+        FFTConvolution convolution(kernel, fft_size, width, height);
+        ProfileScope::countAllocation(convolution.getBytes());
+        if (!transformKernel(convolution, kernel)) return;
+
+        std::vector<float> band(convolution.bandValues(), 0.0f);
+        const int tiles_x = convolution.tilesX(), tiles_y = convolution.tilesY();
+
+        beginStage(1, 2);
+        for (int ty = 0; ty < tiles_y; ty++) {
+            for (int parity = 0; parity < 2; parity++) {
+                parallelFor((tiles_x - parity + 1) / 2, [&](int index) {
+                    if (isCancelled()) return;
+
+                    std::vector<float> scratch;
+                    convolution.addTile(src_pixels, rowstride, n_channels, 2 * index + parity, ty, band.data(),
+                                        scratch);
+                });
+            }
+            if (isCancelled()) return;
+
+            const int rows = ty + 1 < tiles_y ? convolution.getTileSize() : convolution.bandRows();
+            parallelFor((rows + bandHeight - 1) / bandHeight, [&](int index) {
+                convolution.storeRows(band.data(), ty, dst_pixels, rowstride, n_channels, index * bandHeight,
+                                      std::min(rows, (index + 1) * bandHeight));
+            });
+            convolution.advance(band.data());
+            if (job) job->setProgress(static_cast<double>(ty + 1) / tiles_y);
+        }
+
+        setFiltered(resultPixbuf);
+    }
+
+    // Defocus blur with a round aperture of the given radius.
+    void applyLensBlur(int radius, ConvolutionPath path = ConvolutionPath::Auto) {
+        applyConvolution(ConvolutionKernel::disk(radius), path);
+    }
+
+    // Replaces the image with the filtered image resampled to the given size; the result
+    // becomes the new original.
+    void applyResize(int new_width, int new_height, ResampleFilter filter) {
+        if (!filteredPixbuf) return;
+
+        new_width = std::max(1, new_width);
+        new_height = std::max(1, new_height);
+        auto result = resample(filteredPixbuf, new_width, new_height, filter);
+        if (result) setImage(result);
+    }
+
+    // Rotates clockwise by `degrees`, into a box that holds the whole image when `expand`
+    // is set and into the current size otherwise. Multiples of 90 degrees are exact.
+    // False, with the image unchanged, when the warp would exceed AffineWarp::maxSize.
+    bool applyRotation(double degrees, bool expand = true) {
+        if (!filteredPixbuf) return true;
+
+        double turns = degrees / 90.0;
+        if (std::fabs(turns - std::round(turns)) < 1e-9) {
+            int quarter = ((static_cast<int>(std::round(turns)) % 4) + 4) % 4;
+            if (quarter == 0) return true;
+            if (expand || quarter == 2 || width == height) {
+                const Orientation orientations[] = {Orientation::Rotate90, Orientation::Rotate180,
+                                                    Orientation::Rotate270};
+                applyOrientation(orientations[quarter - 1]);
+                return true;
+            }
+        }
+
+        int new_width = width, new_height = height;
+        if (expand) AffineTransform::rotatedSize(degrees, width, height, new_width, new_height);
+        return applyAffine(AffineTransform::rotation(degrees, width, height, new_width, new_height), new_width,
+                           new_height);
+    }
+
+    // Replaces the image with a `new_width` x `new_height` warp of the filtered image,
+    // sampled where `transform` maps each pixel; the result becomes the new original.
+    // Returns false without warping when the source or the result is larger than
+    // AffineWarp::maxSize on a side.
+    bool applyAffine(const AffineTransform& transform, int new_width, int new_height) {
+        if (!filteredPixbuf) return true;
+        if (std::max({width, height, new_width, new_height}) > AffineWarp::maxSize) return false;
+
+        ProfileScope scope("affine warp", new_width * static_cast<double>(new_height) / 1e6);
+        auto result =
+            Gdk::Pixbuf::create(Gdk::COLORSPACE_RGB, filteredPixbuf->get_has_alpha(), 8, new_width, new_height);
+        ProfileScope::countAllocation(pixbufBytes(result));
+
+        AffineWarp warp(transform, width, height, new_width, new_height);
+        const guint8* src = filteredPixbuf->get_pixels();
+        const int rowstride = filteredPixbuf->get_rowstride();
+        const int n_channels = filteredPixbuf->get_n_channels();
+        guint8* dst = result->get_pixels();
+        const int dst_rowstride = result->get_rowstride();
+
+        beginStage(0, 1);
+        bool done = parallelTiles(warp.tileCount(), [&](int index) {
+            warp.warpTile(index, src, rowstride, n_channels, dst, dst_rowstride);
+        });
+        if (done) setImage(result);
+        return true;
+    }
+
+    void applyOrientation(Orientation orientation) {
+        if (!filteredPixbuf) return;
+
+        ProfileScope scope("orientation", getMegapixels());
+        OrientationCopy copy(orientation, width, height);
+        auto result = Gdk::Pixbuf::create(Gdk::COLORSPACE_RGB, filteredPixbuf->get_has_alpha(), 8, copy.getWidth(),
+                                          copy.getHeight());
+        ProfileScope::countAllocation(pixbufBytes(result));
+
+        const guint8* src = filteredPixbuf->get_pixels();
+        const int rowstride = filteredPixbuf->get_rowstride();
+        const int n_channels = filteredPixbuf->get_n_channels();
+        guint8* dst = result->get_pixels();
+        const int dst_rowstride = result->get_rowstride();
+
+        beginStage(0, 1);
+        bool done = parallelTiles(copy.tileCount(), [&](int index) {
+            copy.copyTile(index, src, rowstride, n_channels, dst, dst_rowstride);
+        });
+        if (done) setImage(result);
+    }
+
+    // Mean of the (2r+1)^2 window around every pixel; windows are cut off at the image
+    // edge and averaged over the pixels they still cover. In linear light the table sums
+    // 12-bit codes, which limits the radius to maxLinearBoxRadius.
+    void applyBoxFilter(int radius) {
+        if (!filteredPixbuf) return;
+
+        ProfileScope scope("box filter", getMegapixels());
+        const SrgbTables* srgb = linearTables();
+        radius = std::max(1, std::min(radius, srgb ? IntegralImage::maxLinearBoxRadius : IntegralImage::maxBoxRadius));
+
+        const int channels = 3;
+        const guint8* src_pixels = filteredPixbuf->get_pixels();
+        int rowstride = filteredPixbuf->get_rowstride();
+        int n_channels = filteredPixbuf->get_n_channels();
+
+        IntegralImage table(width, height, channels, false);
+        if (!buildIntegral(table, src_pixels, rowstride, n_channels, 0, 3, srgb ? srgb->toLinearCode : nullptr)) {
+            return;
+        }
+
+        auto resultPixbuf = copyPixbuf(filteredPixbuf);
+        guint8* dst_pixels = resultPixbuf->get_pixels();
+
+        beginStage(2, 3);
+        bool done = parallelBands(0, height, [&](int y_begin, int y_end) {
+            for (int y = y_begin; y < y_end; ++y) {
+                int y0 = std::max(0, y - radius), y1 = std::min(height, y + radius + 1);
+                const uint32_t* top = table.sumRow(y0);
+                const uint32_t* bottom = table.sumRow(y1);
+                guint8* p = dst_pixels + static_cast<size_t>(y) * rowstride;
+
+                for (int x = 0; x < width; ++x, p += n_channels) {
+                    int x0 = std::max(0, x - radius) * channels, x1 = std::min(width, x + radius + 1) * channels;
+                    float scale = 1.0f / ((x1 - x0) / channels * (y1 - y0));
+                    for (int c = 0; c < channels; c++) {
+                        uint32_t sum = bottom[x1 + c] - bottom[x0 + c] - top[x1 + c] + top[x0 + c];
+                        int mean = static_cast<int>(sum * scale + 0.5f);
+                        p[c] = srgb ? srgb->fromLinearCode[mean] : static_cast<guint8>(mean);
+                    }
+                }
+            }
+        });
+
+        if (done) setFiltered(resultPixbuf);
+    }
+
+    // Binarizes luminance against a threshold computed from the statistics of the window
+    // around each pixel; `sensitivity` is k of the chosen method.
+    void applyLocalThreshold(ThresholdMethod method, int radius, double sensitivity) {
+        if (!filteredPixbuf) return;
+
+        ProfileScope scope("local threshold", getMegapixels());
+        radius = std::max(1, std::min(radius, IntegralImage::maxSquareRadius));
+        const bool sauvola = method == ThresholdMethod::Sauvola;
+
+        const guint8* src_pixels = filteredPixbuf->get_pixels();
+        int rowstride = filteredPixbuf->get_rowstride();
+        int n_channels = filteredPixbuf->get_n_channels();
+
+        std::vector<guint8> luminance(static_cast<size_t>(width) * height);
+        ProfileScope::countAllocation(luminance.size());
+
+        beginStage(0, 4);
+        bool done = parallelBands(0, height, [&](int y_begin, int y_end) {
+            for (int y = y_begin; y < y_end; ++y) {
+                const guint8* p = src_pixels + static_cast<size_t>(y) * rowstride;
+                guint8* l = luminance.data() + static_cast<size_t>(y) * width;
+                for (int x = 0; x < width; ++x, p += n_channels) {
+                    l[x] = luma(p[0], p[1], p[2]);
+                }
+            }
+        });
+        if (!done) return;
+
+        IntegralImage table(width, height, 1, sauvola);
+        if (!buildIntegral(table, luminance.data(), width, 1, 1, 4)) return;
+
+        auto resultPixbuf = copyPixbuf(filteredPixbuf);
+        guint8* dst_pixels = resultPixbuf->get_pixels();
+
+        beginStage(3, 4);
+        done = parallelBands(0, height, [&](int y_begin, int y_end) {
+            for (int y = y_begin; y < y_end; ++y) {
+                int y0 = std::max(0, y - radius), y1 = std::min(height, y + radius + 1);
+                const guint8* l = luminance.data() + static_cast<size_t>(y) * width;
+                guint8* p = dst_pixels + static_cast<size_t>(y) * rowstride;
+
+                for (int x = 0; x < width; ++x, p += n_channels) {
+                    int x0 = std::max(0, x - radius), x1 = std::min(width, x + radius + 1);
+                    double area = static_cast<double>(x1 - x0) * (y1 - y0);
+                    double mean = table.boxSum(x0, y0, x1, y1, 0) / area;
+
+                    double threshold;
+                    if (sauvola) {
+                        double variance = table.boxSquareSum(x0, y0, x1, y1, 0) / area - mean * mean;
+                        double deviation = std::sqrt(std::max(0.0, variance));
+                        threshold = mean * (1.0 + sensitivity * (deviation / 128.0 - 1.0));
+                    } else {
+                        threshold = mean * (1.0 - sensitivity);
+                    }
+
+                    guint8 value = l[x] > threshold ? 255 : 0;
+                    p[0] = p[1] = p[2] = value;
+                }
+            }
+        });
+
+        if (done) setFiltered(resultPixbuf);
+    }
+
+    // Reduces the filtered image to at most `colors` colors chosen from a histogram with
+    // `bits` bits per channel. The palette is kept for indexed export.
+    void applyColorQuantization(QuantizeMethod method, int colors, int bits = ColorHistogram::maxBits) {
+        if (!filteredPixbuf) return;
+
+        ProfileScope scope("quantize", getMegapixels());
+        colors = std::max(2, std::min(colors, 256));
+
+        const guint8* src_pixels = filteredPixbuf->get_pixels();
+        int rowstride = filteredPixbuf->get_rowstride();
+        int n_channels = filteredPixbuf->get_n_channels();
+
+        // One histogram per pool thread rather than per band keeps the merge cheap even
+        // at 18 bits.
+        const int chunks = std::min(ThreadPool::instance().size(), std::max(1, height / bandHeight));
+        std::vector<ColorHistogram> partial(chunks, ColorHistogram(bits));
+        ProfileScope::countAllocation(partial.size() * partial[0].size() * sizeof(uint32_t));
+        std::atomic<int> chunks_done{0};
+
+        beginStage(0, 3);
+        parallelFor(chunks, [&](int chunk) {
+            if (isCancelled()) return;
+
+            partial[chunk].countRows(src_pixels, rowstride, n_channels, width, tileEdge(chunk, chunks, height),
+                                     tileEdge(chunk + 1, chunks, height));
+            if (job) job->setProgress(static_cast<double>(++chunks_done) / chunks);
+        });
+        if (isCancelled()) return;
+
+        ColorHistogram& histogram = partial[0];
+        for (int chunk = 1; chunk < chunks; chunk++) histogram.merge(partial[chunk]);
+
+        beginStage(1, 3);
+        std::vector<PaletteColor> colorPalette = method == QuantizeMethod::MedianCut
+                                                     ? medianCutPalette(histogram, colors)
+                                                     : octreePalette(histogram, colors);
+
+        InverseColorMap inverse(histogram, colorPalette);
+        const int ranges = 64;
+        parallelFor(ranges, [&](int range) {
+            if (isCancelled()) return;
+            inverse.build(tileEdge(range, ranges, histogram.size()), tileEdge(range + 1, ranges, histogram.size()));
+        });
+        if (isCancelled()) return;
+
+        auto resultPixbuf = copyPixbuf(filteredPixbuf);
+        guint8* dst_pixels = resultPixbuf->get_pixels();
+
+        beginStage(2, 3);
+        bool done = parallelBands(0, height, [&](int y_begin, int y_end) {
+            inverse.remapRows(dst_pixels, rowstride, n_channels, width, y_begin, y_end);
+        });
+
+        if (done) {
+            setFiltered(resultPixbuf);
+            palette = colorPalette;
+        }
+    }
+
+    // Dithers the filtered image to `levels` values per channel. Error diffusion runs on
+    // `threads` threads (all pool threads when 0), which the benchmark varies.
+    void applyDithering(DitherMethod method, int levels, int threads = 0) {
+        if (!filteredPixbuf) return;
+
+        ProfileScope scope("dither", getMegapixels());
+        const guint8* src_pixels = filteredPixbuf->get_pixels();
+        int rowstride = filteredPixbuf->get_rowstride();
+        int n_channels = filteredPixbuf->get_n_channels();
+
+        auto resultPixbuf = copyPixbuf(filteredPixbuf);
+        guint8* dst_pixels = resultPixbuf->get_pixels();
+
+        bool done;
+        if (method == DitherMethod::Bayer) {
+            OrderedDither dither(levels, n_channels);
+            done = parallelBands(0, height, [&](int y_begin, int y_end) {
+                dither.ditherRows(src_pixels, dst_pixels, rowstride, width, y_begin, y_end);
+            });
+        } else {
+            if (threads <= 0) threads = ThreadPool::instance().size();
+            ErrorDiffusion diffusion(method == DitherMethod::Jarvis, levels, width, height, 3, threads);
+            ProfileScope::countAllocation(static_cast<size_t>(2 * threads + 4) * width * 3 * sizeof(int16_t));
+            std::atomic<int> rows_done{0};
+
+            parallelFor(threads, [&](int) {
+                diffusion.run(src_pixels, dst_pixels, rowstride, n_channels, [this]() { return isCancelled(); },
+                              [&]() {
+                                  if (job) job->setProgress(static_cast<double>(++rows_done) / height);
+                              });
+            });
+            done = !isCancelled();
+        }
+
+        if (done) setFiltered(resultPixbuf);
+    }
+
+    std::vector<std::vector<int>> getHistogram() {
+        if (!originalPixbuf || !ensureHistogram(originalPixbuf, originalHistogram)) {
+            return std::vector<std::vector<int>>(3, std::vector<int>(256, 0));
+        }
+        return originalHistogram->total();
+    }
+
+    std::vector<std::vector<int>> getFilteredHistogram() {
+        if (!filteredPixbuf || !ensureHistogram(filteredPixbuf, filteredHistogram)) {
+            return std::vector<std::vector<int>>(3, std::vector<int>(256, 0));
+        }
+        return filteredHistogram->total();
+    }
+
+    // Histogram of a rectangle of the filtered image.
+    std::vector<std::vector<int>> getRegionHistogram(int x, int y, int w, int h) {
+        if (!filteredPixbuf || !ensureHistogram(filteredPixbuf, filteredHistogram)) {
+            return std::vector<std::vector<int>>(3, std::vector<int>(256, 0));
+        }
+        return filteredHistogram->region(filteredPixbuf->get_pixels(), filteredPixbuf->get_rowstride(),
+                                         filteredPixbuf->get_n_channels(), x, y, w, h);
+    }
+
+    // To be called after pixels of the filtered image inside the rectangle were changed
+    // in place; only the tiles they fall into are counted again.
+    void updateFilteredRegion(int x, int y, int w, int h) {
+        if (!filteredHistogram) return;
+
+        ProfileScope scope("histogram update", w * static_cast<double>(h) / 1e6);
+        auto updated = std::make_shared<TileHistogram>(*filteredHistogram);
+        std::vector<int> tiles = updated->tilesInRegion(x, y, w, h);
+
+        const guint8* pixels = filteredPixbuf->get_pixels();
+        int rowstride = filteredPixbuf->get_rowstride();
+        int n_channels = filteredPixbuf->get_n_channels();
+        parallelFor(static_cast<int>(tiles.size()), [&](int index) {
+            updated->scanTile(pixels, rowstride, n_channels, tiles[index]);
+        });
+        updated->updateTotals();
+        filteredHistogram = updated;
+    }
+
+    void applyHistogramEqualization() {
+        if (!originalPixbuf) return;
+
+        ProfileScope scope("equalize", getMegapixels());
+        if (deepOriginal) {
+            deepOriginal.visit([&](const auto& image) { equalizeDeep(image); });
+            return;
+        }
+
+        beginStage(0, 2);
+        auto histogram = getHistogram();
+        if (isCancelled()) return;
+
+        std::vector<std::vector<int>> cdf(3, std::vector<int>(256, 0));
+        int total_pixels = width * height;
+
+        for (int channel = 0; channel < 3; channel++) {
+            cdf[channel][0] = histogram[channel][0];
+            for (int i = 1; i < 256; i++) {
+                cdf[channel][i] = cdf[channel][i-1] + histogram[channel][i];
+            }
+        }
+
+        std::vector<int> cdf_min(3, total_pixels);
+        for (int channel = 0; channel < 3; channel++) {
+            for (int i = 0; i < 256; i++) {
+                if (histogram[channel][i] != 0) {
+                    cdf_min[channel] = std::min(cdf_min[channel], cdf[channel][i]);
+                }
+            }
+        }
+
+        std::vector<std::vector<guint8>> lut(3, std::vector<guint8>(256, 0));
+        for (int channel = 0; channel < 3; channel++) {
+            for (int i = 0; i < 256; i++) {
+                if (cdf[channel][i] > cdf_min[channel]) {
+                    float equalized = (cdf[channel][i] - cdf_min[channel]) /
+                                      static_cast<float>(total_pixels - cdf_min[channel]);
+                    lut[channel][i] = static_cast<guint8>(equalized * 255);
+                }
+            }
+        }
+
+        beginStage(1, 2);
+        applyChannelLut(lut);
+    }
+
+    // Contrast-limited adaptive histogram equalization of luminance. R, G and B are all
+    // shifted by the change in Y, which leaves Cb and Cr (and so the hue) untouched.
+    void applyCLAHE(int tiles_x = 8, int tiles_y = 8, double clip_limit = 2.0) {
+        if (!originalPixbuf) return;
+
+        ProfileScope scope("clahe", getMegapixels());
+        tiles_x = std::max(1, std::min(tiles_x, width));
+        tiles_y = std::max(1, std::min(tiles_y, height));
+
+        const guint8* src_pixels = originalPixbuf->get_pixels();
+        int rowstride = originalPixbuf->get_rowstride();
+        int n_channels = originalPixbuf->get_n_channels();
+
+        std::vector<guint8> luminance(static_cast<size_t>(width) * height);
+        ProfileScope::countAllocation(luminance.size());
+
+        beginStage(0, 3);
+        bool done = parallelBands(0, height, [&](int y_begin, int y_end) {
+            for (int y = y_begin; y < y_end; ++y) {
+                const guint8* p = src_pixels + static_cast<size_t>(y) * rowstride;
+                guint8* l = luminance.data() + static_cast<size_t>(y) * width;
+                for (int x = 0; x < width; ++x, p += n_channels) {
+                    l[x] = luma(p[0], p[1], p[2]);
+                }
+            }
+        });
+        if (!done) return;
+
+        std::vector<guint8> luts(static_cast<size_t>(tiles_x) * tiles_y * 256);
+        std::atomic<int> tiles_done{0};
+
+        beginStage(1, 3);
+        parallelFor(tiles_x * tiles_y, [&](int tile) {
+            if (isCancelled()) return;
+
+            int tx = tile % tiles_x;
+            int ty = tile / tiles_x;
+            int x0 = tileEdge(tx, tiles_x, width), x1 = tileEdge(tx + 1, tiles_x, width);
+            int y0 = tileEdge(ty, tiles_y, height), y1 = tileEdge(ty + 1, tiles_y, height);
+
+            int histogram[256] = {0};
+            for (int y = y0; y < y1; ++y) {
+                const guint8* l = luminance.data() + static_cast<size_t>(y) * width;
+                for (int x = x0; x < x1; ++x) {
+                    histogram[l[x]]++;
+                }
+            }
+
+            buildClippedLut(histogram, (x1 - x0) * (y1 - y0), clip_limit, &luts[static_cast<size_t>(tile) * 256]);
+            if (job) job->setProgress(static_cast<double>(++tiles_done) / (tiles_x * tiles_y));
+        });
+        if (isCancelled()) return;
+
+        // Horizontal interpolation terms depend only on x and are shared by every row.
+        std::vector<int> left_lut(width), right_lut(width), weight_x(width);
+        for (int x = 0; x < width; ++x) {
+            int t0, t1, weight;
+            tileNeighbours(x, tiles_x, width, t0, t1, weight);
+            left_lut[x] = t0 * 256;
+            right_lut[x] = t1 * 256;
+            weight_x[x] = weight;
+        }
+
+        auto resultPixbuf = copyPixbuf(originalPixbuf);
+        guint8* dst_pixels = resultPixbuf->get_pixels();
+
+        beginStage(2, 3);
+        done = parallelBands(0, height, [&](int y_begin, int y_end) {
+            std::vector<int> delta(width);
+
+            for (int y = y_begin; y < y_end; ++y) {
+                int t0, t1, weight_y;
+                tileNeighbours(y, tiles_y, height, t0, t1, weight_y);
+                const guint8* top = luts.data() + static_cast<size_t>(t0) * tiles_x * 256;
+                const guint8* bottom = luts.data() + static_cast<size_t>(t1) * tiles_x * 256;
+                const guint8* l = luminance.data() + static_cast<size_t>(y) * width;
+
+                int x = 0;
+#if defined(__SSE2__)
+                // Four pixels at a time in float, which is exact here: every product and
+                // partial sum is an integer below 2^24.
+                const __m128 full = _mm_set1_ps(256.0f), half = _mm_set1_ps(32768.0f);
+                const __m128 below = _mm_set1_ps(static_cast<float>(weight_y));
+                const __m128 above = _mm_set1_ps(static_cast<float>(256 - weight_y));
+                for (; x + 4 <= width; x += 4) {
+                    const int* left = left_lut.data() + x;
+                    const int* right = right_lut.data() + x;
+                    const guint8* v = l + x;
+                    __m128 a = _mm_cvtepi32_ps(_mm_setr_epi32(top[left[0] + v[0]], top[left[1] + v[1]],
+                                                              top[left[2] + v[2]], top[left[3] + v[3]]));
+                    __m128 b = _mm_cvtepi32_ps(_mm_setr_epi32(top[right[0] + v[0]], top[right[1] + v[1]],
+                                                              top[right[2] + v[2]], top[right[3] + v[3]]));
+                    __m128 c = _mm_cvtepi32_ps(_mm_setr_epi32(bottom[left[0] + v[0]], bottom[left[1] + v[1]],
+                                                              bottom[left[2] + v[2]], bottom[left[3] + v[3]]));
+                    __m128 d = _mm_cvtepi32_ps(_mm_setr_epi32(bottom[right[0] + v[0]], bottom[right[1] + v[1]],
+                                                              bottom[right[2] + v[2]], bottom[right[3] + v[3]]));
+
+                    __m128 wx = _mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(weight_x.data() + x)));
+                    __m128 wx_left = _mm_sub_ps(full, wx);
+                    __m128 upper = _mm_add_ps(_mm_mul_ps(a, wx_left), _mm_mul_ps(b, wx));
+                    __m128 lower = _mm_add_ps(_mm_mul_ps(c, wx_left), _mm_mul_ps(d, wx));
+                    __m128 sum = _mm_add_ps(_mm_add_ps(_mm_mul_ps(upper, above), _mm_mul_ps(lower, below)), half);
+
+                    __m128i value = _mm_srli_epi32(_mm_cvttps_epi32(sum), 16);
+                    __m128i luma_values = _mm_setr_epi32(v[0], v[1], v[2], v[3]);
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(delta.data() + x), _mm_sub_epi32(value, luma_values));
+                }
+#endif
+                for (; x < width; ++x) {
+                    int v = l[x];
+                    int a = top[left_lut[x] + v], b = top[right_lut[x] + v];
+                    int c = bottom[left_lut[x] + v], d = bottom[right_lut[x] + v];
+                    int upper = a * 256 + (b - a) * weight_x[x];
+                    int lower = c * 256 + (d - c) * weight_x[x];
+                    delta[x] = ((upper * 256 + (lower - upper) * weight_y + (1 << 15)) >> 16) - v;
+                }
+
+                guint8* row = dst_pixels + static_cast<size_t>(y) * rowstride;
+                if (n_channels == 4) {
+                    addToChannels<4>(row, delta.data(), width);
+                } else {
+                    addToChannels<3>(row, delta.data(), width);
+                }
+            }
+        });
+
+        if (done) setFiltered(resultPixbuf);
+    }
+
+    // Stretches each channel's range to [min_out, max_out]. In linear light the stretch
+    // is linear in intensity; the ends of the range land on the same values either way.
+    void applyLinearContrast(int min_out = 0, int max_out = 255) {
+        if (!originalPixbuf) return;
+
+        ProfileScope scope("contrast", getMegapixels());
+        if (deepOriginal) {
+            deepOriginal.visit([&](const auto& image) { contrastDeep(image, min_out, max_out); });
+            return;
+        }
+
+        beginStage(0, 2);
+        if (!computeChannelRange()) return;
+
+        const SrgbTables* srgb = linearTables();
+        std::vector<std::vector<guint8>> lut(3, std::vector<guint8>(256));
+        for (int channel = 0; channel < 3; channel++) {
+            for (int value = 0; value < 256; value++) {
+                if (srgb && rangeMax[channel] != rangeMin[channel]) {
+                    const float* linear = srgb->toLinear;
+                    float normalized = (linear[value] - linear[rangeMin[channel]]) /
+                                       (linear[rangeMax[channel]] - linear[rangeMin[channel]]);
+                    lut[channel][value] = value < rangeMin[channel] || value > rangeMax[channel]
+                                              ? static_cast<guint8>(value)
+                                              : srgb->encode(linear[min_out] + normalized * (linear[max_out] - linear[min_out]));
+                } else if (rangeMax[channel] != rangeMin[channel]) {
+                    float normalized = static_cast<float>(value - rangeMin[channel]) /
+                                       (rangeMax[channel] - rangeMin[channel]);
+                    lut[channel][value] = static_cast<guint8>(min_out + normalized * (max_out - min_out));
+                } else {
+                    lut[channel][value] = static_cast<guint8>(value);
+                }
+            }
+        }
+
+        beginStage(1, 2);
+        applyChannelLut(lut);
+    }
+
+    // Resampled copy of `image`, or null if cancelled. The horizontal pass runs over source
+    // rows into an intermediate of the output width, the vertical pass over output rows;
+    // an exact 2:1 area reduction takes the box path instead.
+    Glib::RefPtr<Gdk::Pixbuf> resample(const Glib::RefPtr<Gdk::Pixbuf>& image, int new_width, int new_height,
+                                       ResampleFilter filter) {
+        const int src_width = image->get_width();
+        const int src_height = image->get_height();
+        const int n_channels = image->get_n_channels();
+        const int rowstride = image->get_rowstride();
+        const guint8* src = image->get_pixels();
+
+        ProfileScope scope("resample", src_width * static_cast<double>(src_height) / 1e6);
+        auto result = Gdk::Pixbuf::create(Gdk::COLORSPACE_RGB, image->get_has_alpha(), 8, new_width, new_height);
+        ProfileScope::countAllocation(pixbufBytes(result));
+        guint8* dst = result->get_pixels();
+        const int dst_rowstride = result->get_rowstride();
+
+        if (filter == ResampleFilter::Area && src_width == 2 * new_width && src_height == 2 * new_height) {
+            beginStage(0, 1);
+            bool done = parallelBands(0, new_height, [&](int y_begin, int y_end) {
+                halveRows(src, rowstride, src_width, src_height, dst, dst_rowstride, n_channels, 0, new_width,
+                          y_begin, y_end);
+            });
+            return done ? result : Glib::RefPtr<Gdk::Pixbuf>();
+        }
+
+        Resampler resampler(src_width, src_height, new_width, new_height, filter);
+        const int temp_stride = new_width * n_channels;
+        std::vector<guint8> temp(static_cast<size_t>(temp_stride) * src_height);
+        ProfileScope::countAllocation(temp.size());
+
+        beginStage(0, 2);
+        bool done = parallelBands(0, src_height, [&](int y_begin, int y_end) {
+            resampler.horizontalRows(src, rowstride, n_channels, temp.data(), temp_stride, y_begin, y_end);
+        });
+        if (!done) return Glib::RefPtr<Gdk::Pixbuf>();
+
+        beginStage(1, 2);
+        done = parallelBands(0, new_height, [&](int y_begin, int y_end) {
+            resampler.verticalRows(temp.data(), temp_stride, n_channels, dst, dst_rowstride, y_begin, y_end);
+        });
+        return done ? result : Glib::RefPtr<Gdk::Pixbuf>();
+    }
+
+    // The proxy works on a downsampled original but keeps statistics measured on the
+    // full-resolution image, so running the same operation on it gives matching results.
+    // A deep original is downsampled as well, so the proxy takes the same deep path.
+    ImageProcessor createProxy(int proxy_width, int proxy_height) {
+        ImageProcessor proxy;
+        if (!originalPixbuf) return proxy;
+
+        computeChannelRange();
+
+        if (deepOriginal) {
+            deepOriginal.visit([&](const auto& image) {
+                using T = typename std::decay_t<decltype(image)>::Sample;
+                if (!computeDeepRange(image)) return;
+
+                auto shrunk = std::make_shared<PixelBuffer<T>>(proxy_width, proxy_height, image.getChannels());
+                ProfileScope::countAllocation(shrunk->getBytes());
+                parallelBands(0, proxy_height, [&](int y_begin, int y_end) {
+                    PixelKernels::shrinkRows(image, *shrunk, y_begin, y_end);
+                });
+                proxy.originalPixbuf = toDisplayPixbuf(*shrunk);
+                proxy.deepOriginal = proxy.deepFiltered = DeepImage(std::shared_ptr<const PixelBuffer<T>>(shrunk));
+            });
+            std::copy(deepLo, deepLo + 4, proxy.deepLo);
+            std::copy(deepHi, deepHi + 4, proxy.deepHi);
+            proxy.deepRangeValid = deepRangeValid;
+        } else {
+            proxy.originalPixbuf = resample(originalPixbuf, proxy_width, proxy_height, ResampleFilter::Area);
+        }
+        if (!proxy.originalPixbuf) return ImageProcessor();
+        proxy.filteredPixbuf = copyPixbuf(proxy.originalPixbuf);
+        proxy.width = proxy_width;
+        proxy.height = proxy_height;
+        proxy.rangeMin = rangeMin;
+        proxy.rangeMax = rangeMax;
+        proxy.rangeValid = rangeValid;
+        proxy.linearLight = linearLight;
+        return proxy;
+    }
+
+    std::vector<unsigned char> encodeRLE() {
+        std::vector<unsigned char> encoded;
+        if (!filteredPixbuf) return encoded;
+
+        ProfileScope scope("rle encode", getMegapixels());
+
+        guint8* pixels = filteredPixbuf->get_pixels();
+        int rowstride = filteredPixbuf->get_rowstride();
+        int n_channels = filteredPixbuf->get_n_channels();
+
+        encoded.push_back((width >> 8) & 0xFF);
+        encoded.push_back(width & 0xFF);
+        encoded.push_back((height >> 8) & 0xFF);
+        encoded.push_back(height & 0xFF);
+
+        bool done = forEachBand(0, height, [&](int y_begin, int y_end) {
+            for (int y = y_begin; y < y_end; ++y) {
+                for (int channel = 0; channel < 3; channel++) {
+                    int count = 1;
+                    unsigned char current = pixels[y * rowstride + channel];
+
+                    for (int x = 1; x < width; ++x) {
+                        unsigned char next = pixels[y * rowstride + x * n_channels + channel];
+                        if (next == current && count < 255) {
+                            count++;
+                        } else {
+                            encoded.push_back(count);
+                            encoded.push_back(current);
+                            current = next;
+                            count = 1;
+                        }
+                    }
+                    encoded.push_back(count);
+                    encoded.push_back(current);
+                }
+            }
+        });
+        if (!done) encoded.clear();
+
+        ProfileScope::countAllocation(encoded.capacity());
+        rleVerifyFailed = false;
+        if (verifyRLE && !encoded.empty() && !verifyEncodedRLE(encoded)) {
+            rleVerifyFailed = !isCancelled();
+            encoded.clear();
+        }
+        return encoded;
+    }
+
+    bool decodeRLE(const std::vector<unsigned char>& encoded) {
+        auto decodedPixbuf = decodeRLEPixbuf(encoded);
+        if (!decodedPixbuf) return false;
+
+        setFiltered(decodedPixbuf);
+        width = decodedPixbuf->get_width();
+        height = decodedPixbuf->get_height();
+
+        return true;
+    }
+
+    Glib::RefPtr<Gdk::Pixbuf> decodeRLEPixbuf(const std::vector<unsigned char>& encoded) {
+        if (encoded.size() < 4) return Glib::RefPtr<Gdk::Pixbuf>();
+
+        int decoded_width = (encoded[0] << 8) | encoded[1];
+        int decoded_height = (encoded[2] << 8) | encoded[3];
+
+        ProfileScope scope("rle decode", decoded_width * static_cast<double>(decoded_height) / 1e6);
+        auto decodedPixbuf = Gdk::Pixbuf::create(Gdk::COLORSPACE_RGB, false, 8, decoded_width, decoded_height);
+        ProfileScope::countAllocation(pixbufBytes(decodedPixbuf));
+
+        guint8* pixels = decodedPixbuf->get_pixels();
+        int rowstride = decodedPixbuf->get_rowstride();
+        int n_channels = decodedPixbuf->get_n_channels();
+
+        size_t pos = 4;
+
+        bool done = forEachBand(0, decoded_height, [&](int y_begin, int y_end) {
+            for (int y = y_begin; y < y_end && pos < encoded.size(); ++y) {
+                for (int channel = 0; channel < 3 && pos < encoded.size(); channel++) {
+                    int x = 0;
+                    while (x < decoded_width && pos + 1 < encoded.size()) {
+                        unsigned char count = encoded[pos++];
+                        unsigned char value = encoded[pos++];
+
+                        for (int i = 0; i < count && x < decoded_width; ++i) {
+                            pixels[y * rowstride + x * n_channels + channel] = value;
+                            x++;
+                        }
+                    }
+                }
+            }
+        });
+        if (!done) return Glib::RefPtr<Gdk::Pixbuf>();
+
+        return decodedPixbuf;
+    }
+
+    // Opt-in: every RLE encode decodes its output again and fails, returning nothing,
+    // unless that reproduces the image exactly. The check is timed as "rle verify".
+    void setVerifyRLE(bool enabled) { verifyRLE = enabled; }
+    bool isVerifyRLE() const { return verifyRLE; }
+    bool didRLEVerifyFail() const { return rleVerifyFailed; }
+
+    // MSE, PSNR, largest difference and SSIM of the filtered image against `reference`,
+    // which must have the same size. False if it does not or the job was cancelled.
+    bool measureQuality(const Glib::RefPtr<Gdk::Pixbuf>& reference, ImageQuality& quality) {
+        if (!filteredPixbuf || !reference) return false;
+        if (reference->get_width() != width || reference->get_height() != height) return false;
+
+        ProfileScope scope("quality metrics", getMegapixels());
+        QualityMetrics::Sums sums;
+        if (!measureDifference(filteredPixbuf, reference, true, sums)) return false;
+
+        quality = QualityMetrics::finish(sums);
+        return true;
+    }
+
+    // Saves the filtered image as PNG, filtering rows and then deflating chunks in
+    // parallel (see PngEncoder). Nothing is written if the job is cancelled.
+    // A 16-bit image is saved at 16 bits; a float one as its 8-bit display version, as
+    // PNG has no float samples (savePFM keeps them).
+    bool savePNG(const std::string& filename, int level, PngFilter filter) {
+        if (!filteredPixbuf) return false;
+
+        ProfileScope scope("png save", getMegapixels());
+        const auto& wide = deepFiltered.wide;
+        const int n_channels = wide ? wide->getChannels() : filteredPixbuf->get_n_channels();
+        const int sample_bytes = wide ? 2 : 1;
+        PngEncoder encoder(wide ? reinterpret_cast<const guint8*>(wide->row(0)) : filteredPixbuf->get_pixels(),
+                           wide ? static_cast<int>(wide->rowSamples() * 2) : filteredPixbuf->get_rowstride(),
+                           n_channels, width, height, level, filter, 8 * sample_bytes);
+        ProfileScope::countAllocation((static_cast<size_t>(width) * n_channels * sample_bytes + 1) * height);
+
+        beginStage(0, 2);
+        if (!parallelBands(0, height, [&](int y_begin, int y_end) { encoder.filterRows(y_begin, y_end); })) {
+            return false;
+        }
+
+        beginStage(1, 2);
+        std::atomic<bool> failed{false};
+        if (!parallelTiles(encoder.chunkCount(), [&](int chunk) {
+                if (!encoder.compressChunk(chunk)) failed = true;
+            })) {
+            return false;
+        }
+        if (failed) return false;
+
+        std::ofstream file(filename, std::ios::binary);
+        if (!file) return false;
+        return encoder.write(file);
+    }
+
+    // Saves the filtered image as PFM in linear light: float images as they are, 16-bit
+    // and 8-bit ones decoded from sRGB. Alpha is dropped.
+    bool savePFM(const std::string& filename) {
+        if (!filteredPixbuf) return false;
+
+        ProfileScope scope("pfm save", getMegapixels());
+        std::shared_ptr<const PixelBuffer<float>> hdr = deepFiltered.hdr;
+        if (deepFiltered.wide) {
+            hdr = DeepImageIO::toLinear(*deepFiltered.wide);
+        } else if (!hdr) {
+            auto linear = std::make_shared<PixelBuffer<float>>(width, height, 3);
+            const guint8* pixels = filteredPixbuf->get_pixels();
+            const int rowstride = filteredPixbuf->get_rowstride(), n_channels = filteredPixbuf->get_n_channels();
+            const float* to_linear = SrgbTables::instance().toLinear;
+            parallelBands(0, height, [&](int y_begin, int y_end) {
+                for (int y = y_begin; y < y_end; ++y) {
+                    const guint8* p = pixels + static_cast<size_t>(y) * rowstride;
+                    float* out = linear->row(y);
+                    for (int x = 0; x < width; ++x, p += n_channels, out += 3) {
+                        for (int c = 0; c < 3; c++) out[c] = to_linear[p[c]] / 255.0f;
+                    }
+                }
+            });
+            if (isCancelled()) return false;
+            hdr = linear;
+        }
+        return DeepImageIO::writePFM(filename, *hdr);
+    }
+
+    bool saveRLEToFile(const std::string& filename) {
+        auto encoded = encodeRLE();
+        if (encoded.empty()) return false;
+
+        std::ofstream file(filename, std::ios::binary);
+        if (!file) return false;
+
+        file.write(reinterpret_cast<const char*>(encoded.data()), encoded.size());
+        return true;
+    }
+
+    bool loadRLEFromFile(const std::string& filename) {
+        std::ifstream file(filename, std::ios::binary);
+        if (!file) return false;
+
+        file.seekg(0, std::ios::end);
+        size_t size = file.tellg();
+        file.seekg(0, std::ios::beg);
+
+        std::vector<unsigned char> encoded(size);
+        file.read(reinterpret_cast<char*>(encoded.data()), size);
+
+        return decodeRLE(encoded);
+    }
+
+    void setOriginalFromFiltered() {
+        if (filteredPixbuf) {
+            originalPixbuf = copyPixbuf(filteredPixbuf);
+            originalHistogram = filteredHistogram;
+            deepOriginal = deepFiltered;
+            rangeValid = false;
+            deepRangeValid = false;
+        }
+    }
+
+    Glib::RefPtr<Gdk::Pixbuf> getOriginalPixbuf() { return originalPixbuf; }
+    const std::vector<PaletteColor>& getPalette() const { return palette; }
+    Glib::RefPtr<Gdk::Pixbuf> getFilteredPixbuf() { return filteredPixbuf; }
+
+    void resetToOriginal() {
+        if (originalPixbuf) {
+            setFiltered(copyPixbuf(originalPixbuf), originalHistogram);
+            deepFiltered = deepOriginal;
+        }
+    }
+
+    bool hasImage() const { return (bool)originalPixbuf; }
+
+    // Sample type of the original; the pixbufs are always 8-bit.
+    SampleFormat getSampleFormat() const { return deepOriginal.format(); }
+
+    void setJobControl(JobControl* control) { job = control; }
+
+    // Opt-in: blurs, box means and contrast stretches then average light intensities
+    // instead of sRGB codes, which keeps bright edges from darkening.
+    void setLinearLight(bool enabled) { linearLight = enabled; }
+    bool isLinearLight() const { return linearLight; }
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    double getMegapixels() const { return width * static_cast<double>(height) / 1e6; }
+
+   private:
+    Glib::RefPtr<Gdk::Pixbuf> pixbuf;
+    Glib::RefPtr<Gdk::Pixbuf> originalPixbuf;
+    Glib::RefPtr<Gdk::Pixbuf> filteredPixbuf;
+    int width, height;
+    JobControl* job = nullptr;
+    bool linearLight = false;
+
+    std::shared_ptr<const TileHistogram> originalHistogram;
+    std::shared_ptr<const TileHistogram> filteredHistogram;
+    std::vector<PaletteColor> palette;
+
+    // Set for 16-bit and float images. Contrast and equalization work on these and show
+    // the result through the pixbufs; any other operation continues from the 8-bit
+    // filtered pixbuf and drops deepFiltered.
+    DeepImage deepOriginal, deepFiltered;
+
+    std::vector<int> rangeMin, rangeMax;
+    bool rangeValid = false;
+    // Per-channel range of deepOriginal, kept like rangeMin and rangeMax.
+    float deepLo[4] = {}, deepHi[4] = {};
+    bool deepRangeValid = false;
+
+    bool verifyRLE = false;
+    bool rleVerifyFailed = false;
+
+    // The reduced-size decode is only a head start: if it fails, the full decode
+    // still decides whether the load succeeds.
+    void loadThumbnail(const std::string& filename, int full_width, int full_height,
+                       const std::function<void(const Glib::RefPtr<Gdk::Pixbuf>&, int, int)>& on_thumbnail) {
+        ProfileScope scope("load thumbnail");
+        try {
+            auto thumbnail = Gdk::Pixbuf::create_from_file(filename, thumbnailSize, thumbnailSize, true);
+            if (thumbnail) on_thumbnail(thumbnail, full_width, full_height);
+        }
+        catch (const Glib::Exception& ex) {
+        }
+    }
+
+    // A loader must be closed before it is released; on a partial image that reports an
+    // error, which an abandoned load does not care about.
+    static void closeLoader(const Glib::RefPtr<Gdk::PixbufLoader>& loader) {
+        try {
+            loader->close();
+        }
+        catch (const Glib::Exception& ex) {
+        }
+    }
+
+    bool verifyEncodedRLE(const std::vector<unsigned char>& encoded) {
+        ProfileScope scope("rle verify", getMegapixels());
+        auto decodedPixbuf = decodeRLEPixbuf(encoded);
+        if (!decodedPixbuf || decodedPixbuf->get_width() != width || decodedPixbuf->get_height() != height) {
+            return false;
+        }
+
+        QualityMetrics::Sums sums;
+        return measureDifference(filteredPixbuf, decodedPixbuf, false, sums) && sums.maxAbs == 0;
+    }
+
+    // Accumulates the differences between two pixbufs of the same size in parallel
+    // bands, and their SSIM if `ssim` is set.
+    bool measureDifference(const Glib::RefPtr<Gdk::Pixbuf>& a, const Glib::RefPtr<Gdk::Pixbuf>& b, bool ssim,
+                           QualityMetrics::Sums& sums) {
+        const guint8* a_pixels = a->get_pixels();
+        const guint8* b_pixels = b->get_pixels();
+        int a_rowstride = a->get_rowstride(), b_rowstride = b->get_rowstride();
+        int a_channels = a->get_n_channels(), b_channels = b->get_n_channels();
+        const int stages = ssim ? 2 : 1;
+
+        std::vector<QualityMetrics::Sums> band_sums((height + bandHeight - 1) / bandHeight);
+        beginStage(0, stages);
+        bool done = parallelBands(0, height, [&](int y_begin, int y_end) {
+            QualityMetrics::differenceRows(a_pixels, a_rowstride, a_channels, b_pixels, b_rowstride, b_channels,
+                                           width, y_begin, y_end, band_sums[y_begin / bandHeight]);
+        });
+        if (!done) return false;
+
+        if (ssim) {
+            // Window rows are 4 image rows apart, so bands of them cover as many rows
+            // as the difference bands.
+            const int window_band = std::max(1, bandHeight / QualityMetrics::ssimBlock);
+            const int window_rows = QualityMetrics::ssimWindowRows(height);
+            std::vector<QualityMetrics::Sums> window_sums((window_rows + window_band - 1) / window_band);
+
+            beginStage(1, stages);
+            done = parallelBands(0, window_rows, [&](int row_begin, int row_end) {
+                QualityMetrics::ssimRows(a_pixels, a_rowstride, a_channels, b_pixels, b_rowstride, b_channels, width,
+                                         row_begin, row_end, window_sums[row_begin / window_band]);
+            }, window_band);
+            if (!done) return false;
+
+            for (const auto& band : window_sums) sums.merge(band);
+        }
+
+        for (const auto& band : band_sums) sums.merge(band);
+        return true;
+    }
+
+    bool computeChannelRange() {
+        if (rangeValid) return true;
+        if (!ensureHistogram(originalPixbuf, originalHistogram)) return false;
+
+        auto histogram = originalHistogram->total();
+        rangeMin.assign(3, 255);
+        rangeMax.assign(3, 0);
+        for (int channel = 0; channel < 3; channel++) {
+            for (int value = 0; value < 256; value++) {
+                if (histogram[channel][value] == 0) continue;
+                rangeMin[channel] = std::min(rangeMin[channel], value);
+                rangeMax[channel] = std::max(rangeMax[channel], value);
+            }
+        }
+        rangeValid = true;
+        return true;
+    }
+
+    // Counts the tile histograms of `image` unless `histogram` already holds them.
+    bool ensureHistogram(const Glib::RefPtr<Gdk::Pixbuf>& image, std::shared_ptr<const TileHistogram>& histogram) {
+        if (histogram) return true;
+
+        ProfileScope scope("histogram", image->get_width() * static_cast<double>(image->get_height()) / 1e6);
+        auto counted = std::make_shared<TileHistogram>(image->get_width(), image->get_height());
+        ProfileScope::countAllocation(counted->getBytes());
+
+        const guint8* pixels = image->get_pixels();
+        int rowstride = image->get_rowstride();
+        int n_channels = image->get_n_channels();
+        std::atomic<int> tiles_done{0};
+
+        parallelFor(counted->tileCount(), [&](int tile) {
+            if (isCancelled()) return;
+
+            counted->scanTile(pixels, rowstride, n_channels, tile);
+            if (job) job->setProgress(static_cast<double>(++tiles_done) / counted->tileCount());
+        });
+        if (isCancelled()) return false;
+
+        counted->updateTotals();
+        histogram = counted;
+        return true;
+    }
+
+    // Replaces the filtered image; `histogram` describes it when the caller already knows
+    // its counts, otherwise they are counted when first asked for.
+    void setFiltered(const Glib::RefPtr<Gdk::Pixbuf>& image, std::shared_ptr<const TileHistogram> histogram = nullptr) {
+        filteredPixbuf = image;
+        deepFiltered = DeepImage();
+        filteredHistogram = std::move(histogram);
+        palette.clear();
+    }
+
+    // The 8-bit pixbuf shown for a deep image, or null if cancelled.
+    template <typename T>
+    Glib::RefPtr<Gdk::Pixbuf> toDisplayPixbuf(const PixelBuffer<T>& image) {
+        const bool alpha = image.colorChannels() != image.getChannels();
+        auto result = Gdk::Pixbuf::create(Gdk::COLORSPACE_RGB, alpha, 8, image.getWidth(), image.getHeight());
+        ProfileScope::countAllocation(pixbufBytes(result));
+        guint8* pixels = result->get_pixels();
+        const int rowstride = result->get_rowstride(), n_channels = result->get_n_channels();
+        bool done = parallelBands(0, image.getHeight(), [&](int y_begin, int y_end) {
+            PixelKernels::displayRows(image, pixels, rowstride, n_channels, y_begin, y_end);
+        });
+        return done ? result : Glib::RefPtr<Gdk::Pixbuf>();
+    }
+
+    template <typename T>
+    void setFilteredDeep(const std::shared_ptr<const PixelBuffer<T>>& image) {
+        auto display = toDisplayPixbuf(*image);
+        if (!display) return;
+        setFiltered(display);
+        deepFiltered = DeepImage(image);
+    }
+
+    // Per-channel minimum and maximum of a deep image, or false if cancelled.
+    template <typename T>
+    bool deepRange(const PixelBuffer<T>& image, float* lo, float* hi) {
+        const int bands = (image.getHeight() + bandHeight - 1) / bandHeight;
+        std::vector<float> band_lo(static_cast<size_t>(bands) * 4, std::numeric_limits<float>::infinity());
+        std::vector<float> band_hi(band_lo.size(), -std::numeric_limits<float>::infinity());
+        bool done = parallelBands(0, image.getHeight(), [&](int y_begin, int y_end) {
+            const int band = y_begin / bandHeight;
+            PixelKernels::rangeRows(image, y_begin, y_end, &band_lo[band * 4], &band_hi[band * 4]);
+        });
+        if (!done) return false;
+
+        for (int c = 0; c < 4; c++) {
+            lo[c] = std::numeric_limits<float>::infinity();
+            hi[c] = -std::numeric_limits<float>::infinity();
+            for (int band = 0; band < bands; band++) {
+                lo[c] = std::min(lo[c], band_lo[band * 4 + c]);
+                hi[c] = std::max(hi[c], band_hi[band * 4 + c]);
+            }
+        }
+        return true;
+    }
+
+    // deepRange of the deep original, measured once; a proxy has it from the full image.
+    template <typename T>
+    bool computeDeepRange(const PixelBuffer<T>& image) {
+        if (deepRangeValid) return true;
+        deepRangeValid = deepRange(image, deepLo, deepHi);
+        return deepRangeValid;
+    }
+
+    // The stretch of applyLinearContrast on deep samples: min_out and max_out are on the
+    // 8-bit scale and map to the same fraction of white. Linear light does not apply:
+    // float samples are linear already, and 16-bit ones are stretched as coded.
+    template <typename T>
+    void contrastDeep(const PixelBuffer<T>& image, int min_out, int max_out) {
+        beginStage(0, 2);
+        if (!computeDeepRange(image)) return;
+        const float *lo = deepLo, *hi = deepHi;
+
+        const float white = SampleTraits<T>::white;
+        const float out_lo = min_out / 255.0f * white, out_hi = max_out / 255.0f * white;
+        float scale[4] = {1, 1, 1, 1}, offset[4] = {0, 0, 0, 0};
+        for (int c = 0; c < image.colorChannels(); c++) {
+            if (hi[c] <= lo[c]) continue;
+            scale[c] = (out_hi - out_lo) / (hi[c] - lo[c]);
+            offset[c] = out_lo - lo[c] * scale[c];
+        }
+
+        beginStage(1, 2);
+        auto result = std::make_shared<PixelBuffer<T>>(image.getWidth(), image.getHeight(), image.getChannels());
+        ProfileScope::countAllocation(result->getBytes());
+        bool done = parallelBands(0, image.getHeight(), [&](int y_begin, int y_end) {
+            PixelKernels::affineRows(image, *result, scale, offset, y_begin, y_end);
+        });
+        if (done) setFilteredDeep(std::shared_ptr<const PixelBuffer<T>>(result));
+    }
+
+    // Histogram equalization of each color channel of a deep image: over every value for
+    // 16 bits, over deepBins bins of the channel's range with interpolation for float.
+    static constexpr int deepBins = 4096;
+
+    template <typename T>
+    void equalizeDeep(const PixelBuffer<T>& image) {
+        const int channels = image.getChannels();
+        const int bins = std::is_integral<T>::value ? static_cast<int>(SampleTraits<T>::white) + 1 : deepBins;
+        float lo[4] = {0, 0, 0, 0}, hi[4] = {0, 0, 0, 0};
+
+        beginStage(0, 2);
+        if (!std::is_integral<T>::value && !deepRange(image, lo, hi)) return;
+
+        // One histogram per pool thread's share of the rows rather than per band.
+        const int parts = std::min(ThreadPool::instance().size(), image.getHeight());
+        const int rows = (image.getHeight() + parts - 1) / parts;
+        std::vector<std::vector<uint32_t>> counts(parts);
+        bool done = parallelTiles(parts, [&](int part) {
+            counts[part].assign(static_cast<size_t>(channels) * bins, 0);
+            PixelKernels::histogramRows(image, part * rows, std::min(image.getHeight(), (part + 1) * rows), bins, lo, hi,
+                                        counts[part].data());
+        });
+        if (!done) return;
+        for (int part = 1; part < parts; part++) {
+            for (size_t i = 0; i < counts[0].size(); i++) counts[0][i] += counts[part][i];
+        }
+
+        std::vector<float> curves[4];
+        for (int c = 0; c < image.colorChannels(); c++) {
+            curves[c] = PixelKernels::equalizationCurve(counts[0].data() + static_cast<size_t>(c) * bins, bins);
+        }
+
+        beginStage(1, 2);
+        auto result = std::make_shared<PixelBuffer<T>>(image.getWidth(), image.getHeight(), channels);
+        ProfileScope::countAllocation(result->getBytes());
+        done = parallelBands(0, image.getHeight(), [&](int y_begin, int y_end) {
+            PixelKernels::equalizeRows(image, *result, curves, bins, lo, hi, y_begin, y_end);
+        });
+        if (done) setFilteredDeep(std::shared_ptr<const PixelBuffer<T>>(result));
+    }
+
+    // Maps the original through a per-channel lookup table into the filtered image. Its
+    // histogram follows from the original's through the same table.
+    void applyChannelLut(const std::vector<std::vector<guint8>>& lut) {
+        auto resultPixbuf = copyPixbuf(originalPixbuf);
+        guint8* pixels = resultPixbuf->get_pixels();
+        int rowstride = resultPixbuf->get_rowstride();
+        int n_channels = resultPixbuf->get_n_channels();
+
+        bool done = parallelBands(0, height, [&](int y_begin, int y_end) {
+            for (int y = y_begin; y < y_end; ++y) {
+                guint8* p = pixels + static_cast<size_t>(y) * rowstride;
+                for (int x = 0; x < width; ++x, p += n_channels) {
+                    for (int channel = 0; channel < 3; channel++) {
+                        p[channel] = lut[channel][p[channel]];
+                    }
+                }
+            }
+        });
+        if (!done) return;
+
+        std::shared_ptr<const TileHistogram> histogram;
+        if (originalHistogram) histogram = std::make_shared<TileHistogram>(originalHistogram->mapped(lut));
+        setFiltered(resultPixbuf, std::move(histogram));
+    }
+
+    bool isCancelled() const { return job && job->isCancelled(); }
+
+    const SrgbTables* linearTables() const { return linearLight ? &SrgbTables::instance() : nullptr; }
+
+    static size_t pixbufBytes(const Glib::RefPtr<Gdk::Pixbuf>& image) {
+        return static_cast<size_t>(image->get_rowstride()) * image->get_height();
+    }
+
+    static Glib::RefPtr<Gdk::Pixbuf> copyPixbuf(const Glib::RefPtr<Gdk::Pixbuf>& image) {
+        ProfileScope::countPixbufCopy(pixbufBytes(image));
+        return image->copy();
+    }
+
+    void beginStage(int index, int count) {
+        if (job) job->beginStage(index, count);
+    }
+
+    // Fills `table` from `src`, mapped through `decode` if given, as stages `stage` and
+    // `stage + 1` of `stages`.
+    bool buildIntegral(IntegralImage& table, const guint8* src, int rowstride, int step, int stage, int stages,
+                       const uint16_t* decode = nullptr) {
+        ProfileScope scope("integral image", getMegapixels());
+        ProfileScope::countAllocation(table.getBytes());
+
+        beginStage(stage, stages);
+        bool done = parallelBands(0, height, [&](int y_begin, int y_end) {
+            table.scanRows(src, rowstride, step, y_begin, y_end, decode);
+        });
+        if (!done) return false;
+
+        const int values = table.rowValues();
+        const int strips = (values + IntegralImage::stripValues - 1) / IntegralImage::stripValues;
+        std::atomic<int> strips_done{0};
+
+        beginStage(stage + 1, stages);
+        parallelFor(strips, [&](int index) {
+            if (isCancelled()) return;
+
+            int v_begin = index * IntegralImage::stripValues;
+            table.scanColumns(v_begin, std::min(values, v_begin + IntegralImage::stripValues));
+            if (job) job->setProgress(static_cast<double>(++strips_done) / strips);
+        });
+        return !isCancelled();
+    }
+
+    // Fills the kernel spectrum of `convolution` as stage 0 of 2: rows in bands, then
+    // columns in strips, both spread over the pool.
+    bool transformKernel(FFTConvolution& convolution, const ConvolutionKernel& kernel) {
+        const RealFFT2D& fft = convolution.getFFT();
+        std::vector<float> padded = convolution.paddedKernel(kernel);
+        float* re = convolution.kernelSpectrumRe();
+        float* im = convolution.kernelSpectrumIm();
+
+        beginStage(0, 2);
+        bool done = parallelBands(0, kernel.size(), [&](int y_begin, int y_end) {
+            std::vector<float> scratch;
+            fft.forwardRows(padded.data(), fft.getWidth(), re, im, y_begin, y_end, scratch);
+        }, RealFFT2D::rowBatch);
+        if (!done) return false;
+
+        const int strips = (fft.spectrumWidth() + RealFFT2D::columnBatch - 1) / RealFFT2D::columnBatch;
+        parallelFor(strips, [&](int index) {
+            if (isCancelled()) return;
+
+            std::vector<float> scratch;
+            int c_begin = index * RealFFT2D::columnBatch;
+            fft.transformColumns(re, im, c_begin, std::min(fft.spectrumWidth(), c_begin + RealFFT2D::columnBatch),
+                                 false, scratch);
+        });
+        return !isCancelled();
+    }
+
+    static int luma(int r, int g, int b) {
+        return (77 * r + 150 * g + 29 * b + 128) >> 8;
+    }
+
+    static int tileEdge(int index, int tiles, int size) {
+        return static_cast<int>(static_cast<long long>(index) * size / tiles);
+    }
+
+    // Finds the two tiles whose centres surround `pos` and the 8-bit weight of the second.
+    static void tileNeighbours(int pos, int tiles, int size, int& t0, int& t1, int& weight) {
+        float f = (pos + 0.5f) * tiles / size - 0.5f;
+        int lower = static_cast<int>(std::floor(f));
+        weight = static_cast<int>((f - lower) * 256 + 0.5f);
+        t0 = std::max(0, lower);
+        t1 = std::min(tiles - 1, lower + 1);
+        if (lower < 0) weight = 0;
+    }
+
+    static void buildClippedLut(const int* histogram, int pixels, double clip_limit, guint8* lut) {
+        int clip = std::max(1, static_cast<int>(clip_limit * pixels / 256.0));
+        int clipped[256];
+        int excess = 0;
+        for (int i = 0; i < 256; i++) {
+            clipped[i] = std::min(histogram[i], clip);
+            excess += histogram[i] - clipped[i];
+        }
+
+        int bonus = excess / 256;
+        int remainder = excess % 256;
+        long long sum = 0;
+        for (int i = 0; i < 256; i++) {
+            sum += clipped[i] + bonus + (i * remainder / 256 != (i + 1) * remainder / 256 ? 1 : 0);
+            lut[i] = static_cast<guint8>(std::min(255LL, (sum * 255 + pixels / 2) / pixels));
+        }
+    }
+
+    // Adds delta[x] to the color channels of pixel x, clamped to [0, 255].
+    template <int Channels>
+    static void addToChannels(guint8* row, const int* delta, int count) {
+        int x = 0;
+#if defined(__SSE2__)
+        // Four pixels at a time: the positive and negative parts of each delta are spread
+        // over its color bytes and applied with saturating byte arithmetic. Three-channel
+        // rows are loaded 16 bytes at a time for 12, so the loop stops while the 4 extra
+        // bytes are still pixels of this row, rewritten unchanged.
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i color_mask = Channels == 4 ? _mm_set1_epi32(0x00FFFFFF) : _mm_setr_epi32(-1, -1, -1, 0);
+        auto spread = [&](__m128i parts) {
+            if (Channels == 4) {
+                return _mm_and_si128(_mm_or_si128(_mm_or_si128(parts, _mm_slli_epi32(parts, 8)), _mm_slli_epi32(parts, 16)),
+                                     color_mask);
+            }
+            // Byte k of lane i belongs to pixel (4i + k) / 3: pixels {0,1,2} for byte 0 of
+            // lanes 0-2, {0,1,3} for byte 1, {0,2,3} for byte 2 and {1,2,3} for byte 3.
+            __m128i second = _mm_shuffle_epi32(parts, _MM_SHUFFLE(3, 3, 1, 0));
+            __m128i third = _mm_shuffle_epi32(parts, _MM_SHUFFLE(3, 3, 2, 0));
+            __m128i fourth = _mm_shuffle_epi32(parts, _MM_SHUFFLE(3, 3, 2, 1));
+            __m128i bytes = _mm_or_si128(_mm_or_si128(parts, _mm_slli_epi32(second, 8)),
+                                         _mm_or_si128(_mm_slli_epi32(third, 16), _mm_slli_epi32(fourth, 24)));
+            return _mm_and_si128(bytes, color_mask);
+        };
+        for (; x + (Channels == 4 ? 4 : 6) <= count; x += 4) {
+            __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(delta + x));
+            __m128i positive = _mm_and_si128(d, _mm_cmpgt_epi32(d, zero));
+            __m128i negative = _mm_sub_epi32(positive, d);
+            __m128i* p = reinterpret_cast<__m128i*>(row + x * Channels);
+            __m128i pixels = _mm_loadu_si128(p);
+            pixels = _mm_subs_epu8(_mm_adds_epu8(pixels, spread(positive)), spread(negative));
+            _mm_storeu_si128(p, pixels);
+        }
+#endif
+        for (; x < count; ++x) {
+            guint8* p = row + x * Channels;
+            for (int channel = 0; channel < 3; channel++) {
+                p[channel] = static_cast<guint8>(std::min(255, std::max(0, p[channel] + delta[x])));
+            }
+        }
+    }
+
+    template <typename F>
+    bool parallelBands(int y_begin, int y_end, F process, int band_height = bandHeight) {
+        int bands = (y_end - y_begin + band_height - 1) / band_height;
+        std::atomic<int> completed{0};
+
+        parallelFor(bands, [&](int band) {
+            if (isCancelled()) return;
+
+            int y = y_begin + band * band_height;
+            process(y, std::min(y_end, y + band_height));
+            if (job) job->setProgress(static_cast<double>(++completed) / bands);
+        });
+        return !isCancelled();
+    }
+
+    template <typename F>
+    bool parallelTiles(int tiles, F process) {
+        std::atomic<int> completed{0};
+
+        parallelFor(tiles, [&](int index) {
+            if (isCancelled()) return;
+
+            process(index);
+            if (job) job->setProgress(static_cast<double>(++completed) / tiles);
+        });
+        return !isCancelled();
+    }
+
+    template <typename F>
+    bool forEachBand(int y_begin, int y_end, F process) {
+        for (int y = y_begin; y < y_end; y += bandHeight) {
+            if (isCancelled()) return false;
+
+            process(y, std::min(y_end, y + bandHeight));
+            if (job) job->setProgress(static_cast<double>(y + bandHeight - y_begin) / (y_end - y_begin));
+        }
+        return !isCancelled();
+    }
+};
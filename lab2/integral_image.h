@@ -0,0 +1,113 @@
+#pragma once
+
+#include <glib.h>
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Summed-area table: entry (x, y) holds the sum of all source values above and to the
+// left of pixel (x, y), so the sum over any box is four lookups whatever its size. Row 0
+// and column 0 are zero, which keeps box lookups free of edge cases.
+//
+// Sums are kept as uint32 and allowed to wrap: box sums come out of modular arithmetic
+// exactly as long as the true sum fits in 32 bits, which holds for boxes of up to
+// 2^32 / 255 pixels (radius maxBoxRadius) and, for the squared sums, 2^32 / 255^2 pixels
+// (radius maxSquareRadius). Memory is 4 bytes per pixel and channel for the sums and as
+// much again for the squares, e.g. 96 MiB of sums for the luminance of a 24 MP image.
+//
+// The table is built in two passes that parallelize differently: scanRows takes running
+// sums along independent rows, scanColumns then adds each row to the one below it over a
+// strip of columns, so its inner loop runs across the strip and vectorizes.
+class IntegralImage {
+   public:
+    static constexpr int maxBoxRadius = 2047;
+    // Radius limit for sums of 12-bit linear-light codes.
+    static constexpr int maxLinearBoxRadius = 511;
+    static constexpr int maxSquareRadius = 128;
+    static constexpr int stripValues = 1024;
+
+    IntegralImage(int width, int height, int channels, bool with_squares)
+        : width(width), height(height), channels(channels),
+          sums(tableSize(width, height, channels)),
+          squares(with_squares ? tableSize(width, height, channels) : 0) {}
+
+    static size_t tableSize(int width, int height, int channels) {
+        return static_cast<size_t>(width + 1) * (height + 1) * channels;
+    }
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    int getChannels() const { return channels; }
+    bool hasSquares() const { return !squares.empty(); }
+    size_t getBytes() const { return (sums.size() + squares.size()) * sizeof(uint32_t); }
+
+    // Number of values in a table row; scanColumns strips are ranges of these.
+    int rowValues() const { return (width + 1) * channels; }
+
+    // First pass for source rows [y_begin, y_end): the first `channels` of every
+    // `step` bytes are summed along the row, after mapping them through `decode` if given.
+    void scanRows(const guint8* src, int rowstride, int step, int y_begin, int y_end,
+                  const uint16_t* decode = nullptr) {
+        for (int y = y_begin; y < y_end; ++y) {
+            const guint8* p = src + static_cast<size_t>(y) * rowstride;
+            uint32_t* s = sumRow(y + 1) + channels;
+            uint32_t* q = hasSquares() ? squareRow(y + 1) + channels : nullptr;
+
+            uint32_t running[4] = {0}, running_squares[4] = {0};
+            for (int x = 0; x < width; ++x, p += step, s += channels) {
+                for (int c = 0; c < channels; c++) {
+                    running[c] += decode ? decode[p[c]] : p[c];
+                    s[c] = running[c];
+                }
+                if (!q) continue;
+                for (int c = 0; c < channels; c++) {
+                    running_squares[c] += static_cast<uint32_t>(p[c]) * p[c];
+                    q[c] = running_squares[c];
+                }
+                q += channels;
+            }
+        }
+    }
+
+    // Second pass for table values [v_begin, v_end) of every row.
+    void scanColumns(int v_begin, int v_end) {
+        accumulateColumns(sums.data(), v_begin, v_end);
+        if (hasSquares()) accumulateColumns(squares.data(), v_begin, v_end);
+    }
+
+    uint32_t* sumRow(int y) { return sums.data() + static_cast<size_t>(y) * rowValues(); }
+    const uint32_t* sumRow(int y) const { return sums.data() + static_cast<size_t>(y) * rowValues(); }
+    uint32_t* squareRow(int y) { return squares.data() + static_cast<size_t>(y) * rowValues(); }
+    const uint32_t* squareRow(int y) const { return squares.data() + static_cast<size_t>(y) * rowValues(); }
+
+    // Sum over the pixels [x0, x1) x [y0, y1) of one channel.
+    uint32_t boxSum(int x0, int y0, int x1, int y1, int channel) const {
+        return lookup(sums.data(), x0, y0, x1, y1, channel);
+    }
+
+    uint32_t boxSquareSum(int x0, int y0, int x1, int y1, int channel) const {
+        return lookup(squares.data(), x0, y0, x1, y1, channel);
+    }
+
+   private:
+    int width, height, channels;
+    std::vector<uint32_t> sums;
+    std::vector<uint32_t> squares;
+
+    void accumulateColumns(uint32_t* table, int v_begin, int v_end) const {
+        const size_t stride = rowValues();
+        for (int y = 2; y <= height; ++y) {
+            uint32_t* row = table + y * stride;
+            const uint32_t* above = row - stride;
+            for (int v = v_begin; v < v_end; v++) row[v] += above[v];
+        }
+    }
+
+    uint32_t lookup(const uint32_t* table, int x0, int y0, int x1, int y1, int channel) const {
+        const size_t stride = rowValues();
+        const uint32_t* top = table + y0 * stride;
+        const uint32_t* bottom = table + y1 * stride;
+        return bottom[x1 * channels + channel] - bottom[x0 * channels + channel] - top[x1 * channels + channel] +
+               top[x0 * channels + channel];
+    }
+};
@@ -2,307 +2,524 @@
 #include <vector>
 #include <string>
 #include <algorithm>
-#include <fstream>
+#include <unordered_map>
+#include <cmath>
+#include <filesystem>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <sstream>
+#include <iomanip>
+
+#include "image_processor.h"
+
+struct DirtyRect {
+    int x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+
+    bool empty() const { return x0 >= x1 || y0 >= y1; }
+
+    void add(int ax0, int ay0, int ax1, int ay1) {
+        if (ax0 >= ax1 || ay0 >= ay1) return;
+        if (empty()) {
+            x0 = ax0; y0 = ay0; x1 = ax1; y1 = ay1;
+            return;
+        }
+        x0 = std::min(x0, ax0);
+        y0 = std::min(y0, ay0);
+        x1 = std::max(x1, ax1);
+        y1 = std::max(y1, ay1);
+    }
+};
 
-class ImageProcessor {
+// Level 0 is the caller's pixbuf itself, every next level is a 2:1 box reduction
+// of the previous one. Levels are rebuilt lazily, when a zoom first needs them.
+class MipPyramid {
    public:
-    ImageProcessor() : width(0), height(0) {}
+    static constexpr int minLevelSize = 256;
+
+    void setImage(const Glib::RefPtr<Gdk::Pixbuf>& image) {
+        bool same_shape = image && !levels.empty() &&
+                          image->get_width() == levels[0]->get_width() &&
+                          image->get_height() == levels[0]->get_height() &&
+                          image->get_n_channels() == levels[0]->get_n_channels();
+        if (same_shape) {
+            levels[0] = image;
+            invalidate(0, 0, image->get_width(), image->get_height());
+            return;
+        }
+
+        levels.clear();
+        dirty.clear();
+        if (!image) return;
+
+        levels.push_back(image);
+        dirty.emplace_back();
+
+        int w = image->get_width();
+        int h = image->get_height();
+        while (w > minLevelSize || h > minLevelSize) {
+            w = (w + 1) / 2;
+            h = (h + 1) / 2;
+            levels.push_back(Gdk::Pixbuf::create(Gdk::COLORSPACE_RGB, image->get_has_alpha(), 8, w, h));
+            ProfileScope::countAllocation(static_cast<size_t>(levels.back()->get_rowstride()) * h);
+            dirty.emplace_back();
+            dirty.back().add(0, 0, w, h);
+        }
+    }
 
-    bool loadImage(const std::string& filename) {
-        try {
-            pixbuf = Gdk::Pixbuf::create_from_file(filename);
-            if (!pixbuf) return false;
+    void invalidate(int x0, int y0, int x1, int y1) {
+        if (levels.size() < 2) return;
+        addDirty(1, x0 / 2, y0 / 2, (x1 + 1) / 2, (y1 + 1) / 2);
+    }
 
-            width = pixbuf->get_width();
-            height = pixbuf->get_height();
+    void ensureLevel(int level) {
+        for (int k = 1; k <= level && k < levelCount(); k++) {
+            if (dirty[k].empty()) continue;
 
-            originalPixbuf = pixbuf;
-            filteredPixbuf = pixbuf->copy();
+            DirtyRect r = dirty[k];
+            dirty[k] = DirtyRect();
+            reduceRegion(levels[k - 1], levels[k], r);
 
-            return true;
+            if (k + 1 < levelCount()) {
+                addDirty(k + 1, r.x0 / 2, r.y0 / 2, (r.x1 + 1) / 2, (r.y1 + 1) / 2);
+            }
         }
-        catch (const Glib::Exception& ex) {
-            return false;
+    }
+
+    int levelFor(double zoom) const {
+        int level = 0;
+        while (level + 1 < levelCount() && zoom * (1 << (level + 1)) <= 1.0) {
+            level++;
         }
+        return level;
     }
 
-    void applyLowPassFilter() {
-        if (!filteredPixbuf) return;
+    int levelCount() const { return static_cast<int>(levels.size()); }
+    bool hasImage() const { return !levels.empty(); }
+    Glib::RefPtr<Gdk::Pixbuf> level(int index) const { return levels[index]; }
 
-        auto tempPixbuf = filteredPixbuf->copy();
+   private:
+    std::vector<Glib::RefPtr<Gdk::Pixbuf>> levels;
+    std::vector<DirtyRect> dirty;
 
-        const int kernelSize = 3;
-        int radius = kernelSize / 2;
-        guint8* src_pixels = tempPixbuf->get_pixels();
-        guint8* dst_pixels = filteredPixbuf->get_pixels();
-        int rowstride = filteredPixbuf->get_rowstride();
-        int n_channels = filteredPixbuf->get_n_channels();
+    void addDirty(int level, int x0, int y0, int x1, int y1) {
+        int w = levels[level]->get_width();
+        int h = levels[level]->get_height();
+        dirty[level].add(std::max(0, x0), std::max(0, y0), std::min(w, x1), std::min(h, y1));
+    }
 
-        for (int y = radius; y < height - radius; ++y) {
-            for (int x = radius; x < width - radius; ++x) {
-                for (int channel = 0; channel < 3; channel++) {
-                    int sum = 0;
-                    int count = 0;
+    // Rows of the region are reduced in bands spread over the pool.
+    static void reduceRegion(const Glib::RefPtr<Gdk::Pixbuf>& src, const Glib::RefPtr<Gdk::Pixbuf>& dst,
+                             const DirtyRect& r) {
+        const int bands = (r.y1 - r.y0 + ImageProcessor::bandHeight - 1) / ImageProcessor::bandHeight;
+        parallelFor(bands, [&](int band) {
+            int y = r.y0 + band * ImageProcessor::bandHeight;
+            halveRows(src->get_pixels(), src->get_rowstride(), src->get_width(), src->get_height(),
+                      dst->get_pixels(), dst->get_rowstride(), dst->get_n_channels(), r.x0, r.x1, y,
+                      std::min(r.y1, y + ImageProcessor::bandHeight));
+        });
+    }
+};
 
-                    for (int ky = -radius; ky <= radius; ++ky) {
-                        for (int kx = -radius; kx <= radius; ++kx) {
-                            guint8* p = src_pixels + (y + ky) * rowstride + (x + kx) * n_channels;
-                            sum += p[channel];
-                            count++;
-                        }
-                    }
+// Draws only the tiles of the pyramid level matching the current zoom that intersect
+// the viewport. Tiles are converted to cairo surfaces once and kept until invalidated.
+class ImageViewer : public Gtk::DrawingArea {
+   public:
+    static constexpr int tileSize = 256;
+    static constexpr size_t maxCachedTiles = 384;
 
-                    guint8* dst_p = dst_pixels + y * rowstride + x * n_channels;
-                    dst_p[channel] = static_cast<guint8>(sum / count);
-                }
-            }
-        }
+    ImageViewer() {
+        add_events(Gdk::BUTTON_PRESS_MASK | Gdk::BUTTON_RELEASE_MASK | Gdk::POINTER_MOTION_MASK |
+                   Gdk::SCROLL_MASK | Gdk::SMOOTH_SCROLL_MASK);
+    }
+
+    void setImage(const Glib::RefPtr<Gdk::Pixbuf>& image) {
+        if (image == source) return;
+
+        bool same_size = image && image->get_width() == imageWidth && image->get_height() == imageHeight;
+        source = image;
+        imageWidth = image ? image->get_width() : 0;
+        imageHeight = image ? image->get_height() : 0;
+        pyramid.setImage(image);
+        tiles.clear();
+        previewSurface.reset();
+
+        if (!same_size) zoomToFit();
+        queue_draw();
     }
 
-    std::vector<std::vector<int>> getHistogram() {
-        std::vector<std::vector<int>> histogram(3, std::vector<int>(256, 0));
+    // Stands in for an image of `full_width` x `full_height` that is still loading:
+    // `thumbnail` is drawn stretched over that extent, and the view keeps its zoom when
+    // setImage() delivers the image itself.
+    void setPlaceholder(const Glib::RefPtr<Gdk::Pixbuf>& thumbnail, int full_width, int full_height) {
+        bool same_size = full_width == imageWidth && full_height == imageHeight;
+        source.reset();
+        imageWidth = full_width;
+        imageHeight = full_height;
+        pyramid.setImage(source);
+        tiles.clear();
+        previewSurface = createSurface(thumbnail);
+
+        if (!same_size) zoomToFit();
+        queue_draw();
+    }
 
-        if (!originalPixbuf) return histogram;
+    void setView(double new_zoom, double new_origin_x, double new_origin_y) {
+        fitMode = false;
+        zoom = new_zoom;
+        originX = new_origin_x;
+        originY = new_origin_y;
+        clampView();
+        queue_draw();
+    }
 
-        guint8* pixels = originalPixbuf->get_pixels();
-        int rowstride = originalPixbuf->get_rowstride();
-        int n_channels = originalPixbuf->get_n_channels();
+    void zoomToFit() {
+        fitMode = true;
+        if (imageWidth == 0) return;
 
-        for (int y = 0; y < height; ++y) {
-            for (int x = 0; x < width; ++x) {
-                guint8* p = pixels + y * rowstride + x * n_channels;
-                histogram[0][p[0]]++;
-                histogram[1][p[1]]++;
-                histogram[2][p[2]]++;
-            }
-        }
+        int view_width = std::max(1, get_allocated_width());
+        int view_height = std::max(1, get_allocated_height());
+        zoom = std::min(1.0, std::min(view_width / static_cast<double>(imageWidth),
+                                      view_height / static_cast<double>(imageHeight)));
+        clampView();
+    }
 
-        return histogram;
+    // Shows a reduced-resolution rendering stretched over the full image extent
+    // until the next clearPreview() or setImage().
+    void setPreview(const Glib::RefPtr<Gdk::Pixbuf>& image) {
+        previewSurface = createSurface(image);
+        queue_draw();
     }
 
-    void applyHistogramEqualization() {
-        if (!originalPixbuf) return;
+    void clearPreview() {
+        if (!previewSurface) return;
+        previewSurface.reset();
+        queue_draw();
+    }
 
-        filteredPixbuf = originalPixbuf->copy();
+    double getZoom() const { return zoom; }
+    double getOriginX() const { return originX; }
+    double getOriginY() const { return originY; }
 
-        auto histogram = getHistogram();
+    sigc::signal<void>& signal_view_changed() { return viewChanged; }
 
-        std::vector<std::vector<int>> cdf(3, std::vector<int>(256, 0));
-        int total_pixels = width * height;
+   protected:
+    bool on_draw(const Cairo::RefPtr<Cairo::Context>& cr) override {
+        ProfileScope scope("display draw");
+        cr->set_source_rgb(0.85, 0.85, 0.85);
+        cr->paint();
 
-        for (int channel = 0; channel < 3; channel++) {
-            cdf[channel][0] = histogram[channel][0];
-            for (int i = 1; i < 256; i++) {
-                cdf[channel][i] = cdf[channel][i-1] + histogram[channel][i];
-            }
+        if (previewSurface) {
+            drawPreview(cr);
+            return true;
         }
 
-        std::vector<int> cdf_min(3, total_pixels);
-        for (int channel = 0; channel < 3; channel++) {
-            for (int i = 0; i < 256; i++) {
-                if (histogram[channel][i] != 0) {
-                    cdf_min[channel] = std::min(cdf_min[channel], cdf[channel][i]);
-                }
+        if (!source) return true;
+
+        const int view_width = get_allocated_width();
+        const int view_height = get_allocated_height();
+
+        int level = pyramid.levelFor(zoom);
+        pyramid.ensureLevel(level);
+        auto image = pyramid.level(level);
+
+        const double level_factor = 1 << level;
+        const double scale = zoom * level_factor;
+        const double left = originX / level_factor;
+        const double top = originY / level_factor;
+
+        int tiles_x = (image->get_width() + tileSize - 1) / tileSize;
+        int tiles_y = (image->get_height() + tileSize - 1) / tileSize;
+        int tx0 = std::max(0, static_cast<int>(std::floor(left / tileSize)));
+        int ty0 = std::max(0, static_cast<int>(std::floor(top / tileSize)));
+        int tx1 = std::min(tiles_x - 1, static_cast<int>(std::floor((left + view_width / scale) / tileSize)));
+        int ty1 = std::min(tiles_y - 1, static_cast<int>(std::floor((top + view_height / scale) / tileSize)));
+
+        Cairo::Filter filter = (scale == 1.0 || scale >= 2.0) ? Cairo::FILTER_NEAREST : Cairo::FILTER_BILINEAR;
+
+        for (int ty = ty0; ty <= ty1; ++ty) {
+            for (int tx = tx0; tx <= tx1; ++tx) {
+                auto surface = tileSurface(level, tx, ty);
+                const double ox = (tx * tileSize - left) * scale;
+                const double oy = (ty * tileSize - top) * scale;
+                const double dx0 = std::round(ox);
+                const double dy0 = std::round(oy);
+                const double dx1 = std::round(ox + surface->get_width() * scale);
+                const double dy1 = std::round(oy + surface->get_height() * scale);
+
+                auto pattern = Cairo::SurfacePattern::create(surface);
+                pattern->set_filter(filter);
+                pattern->set_extend(Cairo::EXTEND_PAD);
+
+                cr->save();
+                cr->translate(ox, oy);
+                cr->scale(scale, scale);
+                cr->set_source(pattern);
+                cr->rectangle((dx0 - ox) / scale, (dy0 - oy) / scale, (dx1 - dx0) / scale, (dy1 - dy0) / scale);
+                cr->fill();
+                cr->restore();
             }
         }
 
-        guint8* pixels = filteredPixbuf->get_pixels();
-        int rowstride = filteredPixbuf->get_rowstride();
-        int n_channels = filteredPixbuf->get_n_channels();
-
-        for (int y = 0; y < height; ++y) {
-            for (int x = 0; x < width; ++x) {
-                guint8* p = pixels + y * rowstride + x * n_channels;
-                for (int channel = 0; channel < 3; channel++) {
-                    int old_intensity = p[channel];
-                    if (cdf[channel][old_intensity] > cdf_min[channel]) {
-                        float equalized = (cdf[channel][old_intensity] - cdf_min[channel]) /
-                                          static_cast<float>(total_pixels - cdf_min[channel]);
-                        p[channel] = static_cast<guint8>(equalized * 255);
-                    } else {
-                        p[channel] = 0;
-                    }
-                }
-            }
+        if (tiles.size() > maxCachedTiles) {
+            trimTiles(level, tx0, ty0, tx1, ty1);
         }
-    }
-
-    void applyLinearContrast(int min_out = 0, int max_out = 255) {
-        if (!originalPixbuf) return;
 
-        filteredPixbuf = originalPixbuf->copy();
+        return true;
+    }
 
-        std::vector<int> min_val(3, 255);
-        std::vector<int> max_val(3, 0);
+    void on_size_allocate(Gtk::Allocation& allocation) override {
+        Gtk::DrawingArea::on_size_allocate(allocation);
+        if (fitMode) {
+            zoomToFit();
+        } else {
+            clampView();
+        }
+    }
 
-        guint8* orig_pixels = originalPixbuf->get_pixels();
-        int rowstride = originalPixbuf->get_rowstride();
-        int n_channels = originalPixbuf->get_n_channels();
+    bool on_button_press_event(GdkEventButton* event) override {
+        if (imageWidth == 0 || event->button != 1) return false;
 
-        for (int y = 0; y < height; ++y) {
-            for (int x = 0; x < width; ++x) {
-                guint8* p = orig_pixels + y * rowstride + x * n_channels;
-                for (int channel = 0; channel < 3; channel++) {
-                    min_val[channel] = std::min(min_val[channel], (int)p[channel]);
-                    max_val[channel] = std::max(max_val[channel], (int)p[channel]);
-                }
+        if (event->type == GDK_2BUTTON_PRESS) {
+            if (fitMode) {
+                zoomAt(1.0, event->x, event->y);
+            } else {
+                zoomToFit();
             }
+            queue_draw();
+            viewChanged.emit();
+            return true;
         }
 
-        guint8* pixels = filteredPixbuf->get_pixels();
+        dragging = true;
+        lastX = event->x;
+        lastY = event->y;
+        return true;
+    }
 
-        for (int y = 0; y < height; ++y) {
-            for (int x = 0; x < width; ++x) {
-                guint8* p = pixels + y * rowstride + x * n_channels;
-                for (int channel = 0; channel < 3; channel++) {
-                    if (max_val[channel] != min_val[channel]) {
-                        float normalized = static_cast<float>(p[channel] - min_val[channel]) /
-                                           (max_val[channel] - min_val[channel]);
-                        p[channel] = static_cast<guint8>(min_out + normalized * (max_out - min_out));
-                    }
-                }
-            }
-        }
+    bool on_button_release_event(GdkEventButton* event) override {
+        if (event->button == 1) dragging = false;
+        return true;
     }
 
-    std::vector<unsigned char> encodeRLE() {
-        std::vector<unsigned char> encoded;
-        if (!filteredPixbuf) return encoded;
+    bool on_motion_notify_event(GdkEventMotion* event) override {
+        if (!dragging) return false;
 
-        guint8* pixels = filteredPixbuf->get_pixels();
-        int rowstride = filteredPixbuf->get_rowstride();
-        int n_channels = filteredPixbuf->get_n_channels();
+        panBy(lastX - event->x, lastY - event->y);
+        lastX = event->x;
+        lastY = event->y;
+        return true;
+    }
 
-        encoded.push_back((width >> 8) & 0xFF);
-        encoded.push_back(width & 0xFF);
-        encoded.push_back((height >> 8) & 0xFF);
-        encoded.push_back(height & 0xFF);
+    bool on_scroll_event(GdkEventScroll* event) override {
+        if (imageWidth == 0) return false;
 
-        for (int y = 0; y < height; ++y) {
-            for (int channel = 0; channel < 3; channel++) {
-                int count = 1;
-                unsigned char current = pixels[y * rowstride + channel];
+        double dx = 0, dy = 0;
+        switch (event->direction) {
+            case GDK_SCROLL_UP: dy = -1; break;
+            case GDK_SCROLL_DOWN: dy = 1; break;
+            case GDK_SCROLL_LEFT: dx = -1; break;
+            case GDK_SCROLL_RIGHT: dx = 1; break;
+            case GDK_SCROLL_SMOOTH: dx = event->delta_x; dy = event->delta_y; break;
+        }
 
-                for (int x = 1; x < width; ++x) {
-                    unsigned char next = pixels[y * rowstride + x * n_channels + channel];
-                    if (next == current && count < 255) {
-                        count++;
-                    } else {
-                        encoded.push_back(count);
-                        encoded.push_back(current);
-                        current = next;
-                        count = 1;
-                    }
-                }
-                encoded.push_back(count);
-                encoded.push_back(current);
-            }
+        if (event->state & GDK_CONTROL_MASK) {
+            zoomAt(zoom * std::pow(1.25, -dy), event->x, event->y);
+            queue_draw();
+            viewChanged.emit();
+        } else if (event->state & GDK_SHIFT_MASK) {
+            panBy(dy * 64, dx * 64);
+        } else {
+            panBy(dx * 64, dy * 64);
         }
+        return true;
+    }
 
-        return encoded;
+   private:
+    Glib::RefPtr<Gdk::Pixbuf> source;
+    int imageWidth = 0, imageHeight = 0;
+    MipPyramid pyramid;
+    std::unordered_map<guint64, Cairo::RefPtr<Cairo::ImageSurface>> tiles;
+    Cairo::RefPtr<Cairo::ImageSurface> previewSurface;
+    sigc::signal<void> viewChanged;
+
+    double zoom = 1.0;
+    double originX = 0, originY = 0;
+    bool fitMode = true;
+    bool dragging = false;
+    double lastX = 0, lastY = 0;
+
+    static guint64 tileKey(int level, int tx, int ty) {
+        return (static_cast<guint64>(level) << 48) | (static_cast<guint64>(ty) << 24) | static_cast<guint64>(tx);
     }
 
-    bool decodeRLE(const std::vector<unsigned char>& encoded) {
-        if (encoded.size() < 4) return false;
+    Cairo::RefPtr<Cairo::ImageSurface> tileSurface(int level, int tx, int ty) {
+        guint64 key = tileKey(level, tx, ty);
+        auto it = tiles.find(key);
+        if (it != tiles.end()) return it->second;
 
-        int decoded_width = (encoded[0] << 8) | encoded[1];
-        int decoded_height = (encoded[2] << 8) | encoded[3];
+        auto image = pyramid.level(level);
+        int x = tx * tileSize;
+        int y = ty * tileSize;
+        int w = std::min(tileSize, image->get_width() - x);
+        int h = std::min(tileSize, image->get_height() - y);
 
-        filteredPixbuf = Gdk::Pixbuf::create(Gdk::COLORSPACE_RGB, false, 8, decoded_width, decoded_height);
-        width = decoded_width;
-        height = decoded_height;
+        auto surface = createSurface(Gdk::Pixbuf::create_subpixbuf(image, x, y, w, h));
+        tiles[key] = surface;
+        return surface;
+    }
 
-        guint8* pixels = filteredPixbuf->get_pixels();
-        int rowstride = filteredPixbuf->get_rowstride();
-        int n_channels = filteredPixbuf->get_n_channels();
+    static Cairo::RefPtr<Cairo::ImageSurface> createSurface(const Glib::RefPtr<Gdk::Pixbuf>& image) {
+        auto surface = Cairo::ImageSurface::create(
+            image->get_has_alpha() ? Cairo::FORMAT_ARGB32 : Cairo::FORMAT_RGB24,
+            image->get_width(), image->get_height());
+        ProfileScope::countAllocation(static_cast<size_t>(surface->get_stride()) * surface->get_height());
+        auto surface_cr = Cairo::Context::create(surface);
+        Gdk::Cairo::set_source_pixbuf(surface_cr, image, 0, 0);
+        surface_cr->paint();
+        return surface;
+    }
 
-        size_t pos = 4;
+    void drawPreview(const Cairo::RefPtr<Cairo::Context>& cr) {
+        auto pattern = Cairo::SurfacePattern::create(previewSurface);
+        pattern->set_filter(Cairo::FILTER_BILINEAR);
+        pattern->set_extend(Cairo::EXTEND_PAD);
 
-        for (int y = 0; y < height && pos < encoded.size(); ++y) {
-            for (int channel = 0; channel < 3 && pos < encoded.size(); channel++) {
-                int x = 0;
-                while (x < width && pos + 1 < encoded.size()) {
-                    unsigned char count = encoded[pos++];
-                    unsigned char value = encoded[pos++];
+        cr->save();
+        cr->scale(zoom, zoom);
+        cr->translate(-originX, -originY);
+        cr->scale(imageWidth / static_cast<double>(previewSurface->get_width()),
+                  imageHeight / static_cast<double>(previewSurface->get_height()));
+        cr->set_source(pattern);
+        cr->rectangle(0, 0, previewSurface->get_width(), previewSurface->get_height());
+        cr->fill();
+        cr->restore();
+    }
 
-                    for (int i = 0; i < count && x < width; ++i) {
-                        pixels[y * rowstride + x * n_channels + channel] = value;
-                        x++;
-                    }
-                }
+    void trimTiles(int level, int tx0, int ty0, int tx1, int ty1) {
+        for (auto it = tiles.begin(); it != tiles.end();) {
+            int tile_level = static_cast<int>(it->first >> 48);
+            int ty = static_cast<int>((it->first >> 24) & 0xFFFFFF);
+            int tx = static_cast<int>(it->first & 0xFFFFFF);
+            bool visible = tile_level == level && tx >= tx0 && tx <= tx1 && ty >= ty0 && ty <= ty1;
+            if (!visible) {
+                it = tiles.erase(it);
+            } else {
+                ++it;
             }
         }
-
-        return true;
     }
 
-    bool saveRLEToFile(const std::string& filename) {
-        auto encoded = encodeRLE();
-        if (encoded.empty()) return false;
-
-        std::ofstream file(filename, std::ios::binary);
-        if (!file) return false;
+    void zoomAt(double new_zoom, double x, double y) {
+        new_zoom = std::max(1.0 / 64, std::min(32.0, new_zoom));
+        double image_x = originX + x / zoom;
+        double image_y = originY + y / zoom;
 
-        file.write(reinterpret_cast<const char*>(encoded.data()), encoded.size());
-        return true;
+        fitMode = false;
+        zoom = new_zoom;
+        originX = image_x - x / zoom;
+        originY = image_y - y / zoom;
+        clampView();
     }
 
-    bool loadRLEFromFile(const std::string& filename) {
-        std::ifstream file(filename, std::ios::binary);
-        if (!file) return false;
+    void panBy(double dx, double dy) {
+        originX += dx / zoom;
+        originY += dy / zoom;
+        fitMode = false;
+        clampView();
+        queue_draw();
+        viewChanged.emit();
+    }
 
-        file.seekg(0, std::ios::end);
-        size_t size = file.tellg();
-        file.seekg(0, std::ios::beg);
+    void clampView() {
+        if (imageWidth == 0) return;
 
-        std::vector<unsigned char> encoded(size);
-        file.read(reinterpret_cast<char*>(encoded.data()), size);
+        double visible_w = get_allocated_width() / zoom;
+        double visible_h = get_allocated_height() / zoom;
+        double image_w = imageWidth;
+        double image_h = imageHeight;
 
-        return decodeRLE(encoded);
-    }
+        if (image_w <= visible_w) {
+            originX = -(visible_w - image_w) / 2;
+        } else {
+            originX = std::max(0.0, std::min(originX, image_w - visible_w));
+        }
 
-    void setOriginalFromFiltered() {
-        if (filteredPixbuf) {
-            originalPixbuf = filteredPixbuf->copy();
+        if (image_h <= visible_h) {
+            originY = -(visible_h - image_h) / 2;
+        } else {
+            originY = std::max(0.0, std::min(originY, image_h - visible_h));
         }
     }
+};
 
-    Glib::RefPtr<Gdk::Pixbuf> getOriginalPixbuf() { return originalPixbuf; }
-    Glib::RefPtr<Gdk::Pixbuf> getFilteredPixbuf() { return filteredPixbuf; }
+// Plots one channel of a histogram. Every channel is rendered once per size and scale
+// into its own cached surface, with all bars in a single path and one fill, so exposes
+// and tab switches only paint the cache.
+class HistogramDrawingArea : public Gtk::DrawingArea {
+   public:
+    HistogramDrawingArea() { set_size_request(550, 300); }
 
-    void resetToOriginal() {
-        if (originalPixbuf) {
-            filteredPixbuf = originalPixbuf->copy();
+    void setHistogram(const std::vector<std::vector<int>>& values) {
+        histogram = values;
+        for (int channel = 0; channel < 3; channel++) {
+            maxCount[channel] = std::max(1, *std::max_element(histogram[channel].begin(), histogram[channel].end()));
         }
+        invalidate();
     }
 
-    bool hasImage() const { return (bool)originalPixbuf; }
-
-   private:
-    Glib::RefPtr<Gdk::Pixbuf> pixbuf;
-    Glib::RefPtr<Gdk::Pixbuf> originalPixbuf;
-    Glib::RefPtr<Gdk::Pixbuf> filteredPixbuf;
-    int width, height;
-};
+    void setChannel(int index) {
+        channel = index;
+        queue_draw();
+    }
 
-class HistogramDrawingArea : public Gtk::DrawingArea {
-   public:
-    HistogramDrawingArea(const std::vector<int>& histogram, const Gdk::RGBA& color)
-            : histogram(histogram), color(color) {
-        set_size_request(550, 300);
+    void setLogScale(bool enabled) {
+        if (logScale == enabled) return;
+        logScale = enabled;
+        invalidate();
     }
 
    protected:
     bool on_draw(const Cairo::RefPtr<Cairo::Context>& cr) override {
+        if (histogram.empty()) return true;
+
         Gtk::Allocation allocation = get_allocation();
         const int width = allocation.get_width();
         const int height = allocation.get_height();
 
-        cr->set_source_rgb(1, 1, 1);
+        auto& surface = cache[channel];
+        if (!surface || surface->get_width() != width || surface->get_height() != height) {
+            surface = render(width, height);
+        }
+
+        cr->set_source(surface, 0, 0);
         cr->paint();
+        return true;
+    }
 
-        int max_count = *std::max_element(histogram.begin(), histogram.end());
-        if (max_count == 0) max_count = 1;
+   private:
+    std::vector<std::vector<int>> histogram;
+    int maxCount[3] = {1, 1, 1};
+    int channel = 0;
+    bool logScale = false;
+    Cairo::RefPtr<Cairo::ImageSurface> cache[3];
+
+    void invalidate() {
+        for (auto& surface : cache) surface.reset();
+        queue_draw();
+    }
+
+    Cairo::RefPtr<Cairo::ImageSurface> render(int width, int height) const {
+        static const char* names[] = {"Red Channel", "Green Channel", "Blue Channel"};
+
+        auto surface = Cairo::ImageSurface::create(Cairo::FORMAT_RGB24, width, height);
+        auto cr = Cairo::Context::create(surface);
+
+        cr->set_source_rgb(1, 1, 1);
+        cr->paint();
 
         const int margin = 50;
         const int graph_width = width - 2 * margin;
@@ -316,19 +533,20 @@ class HistogramDrawingArea : public Gtk::DrawingArea {
         cr->line_to(width - margin, height - margin);
         cr->stroke();
 
-        cr->set_source_rgba(color.get_red(), color.get_green(), color.get_blue(), 0.7);
-
+        const std::vector<int>& counts = histogram[channel];
+        const double scale = logScale ? 1.0 / std::log1p(maxCount[channel]) : 1.0 / maxCount[channel];
         double bar_width = static_cast<double>(graph_width) / 256;
         for (int i = 0; i < 256; i++) {
-            if (histogram[i] > 0) {
-                double bar_height = (histogram[i] / static_cast<double>(max_count)) * graph_height;
+            if (counts[i] > 0) {
+                double bar_height = (logScale ? std::log1p(counts[i]) : counts[i]) * scale * graph_height;
                 cr->rectangle(margin + i * bar_width,
                               height - margin - bar_height,
                               bar_width - 1,
                               bar_height);
-                cr->fill();
             }
         }
+        cr->set_source_rgba(channel == 0 ? 1 : 0, channel == 1 ? 0.5 : 0, channel == 2 ? 1 : 0, 0.7);
+        cr->fill();
 
         cr->set_source_rgb(0, 0, 0);
         cr->select_font_face("Sans", Cairo::FONT_SLANT_NORMAL, Cairo::FONT_WEIGHT_NORMAL);
@@ -337,7 +555,7 @@ class HistogramDrawingArea : public Gtk::DrawingArea {
         cr->save();
         cr->move_to(10, height / 2);
         cr->rotate(-M_PI / 2);
-        cr->show_text("Frequency");
+        cr->show_text(logScale ? "Frequency (log)" : "Frequency");
         cr->restore();
 
         cr->move_to(width / 2 - 30, height - 10);
@@ -345,23 +563,17 @@ class HistogramDrawingArea : public Gtk::DrawingArea {
 
         cr->set_font_size(14);
         cr->move_to(width / 2 - 40, 20);
-        if (color.get_red() > 0.5) cr->show_text("Red Channel");
-        else if (color.get_green() > 0.5) cr->show_text("Green Channel");
-        else cr->show_text("Blue Channel");
+        cr->show_text(names[channel]);
 
-        return true;
+        return surface;
     }
-
-   private:
-    std::vector<int> histogram;
-    Gdk::RGBA color;
 };
 
+// Non-modal, so it can stay open and follow the image while editing. The notebook only
+// provides the channel tabs; the one drawing area below it shows the selected channel.
 class HistogramDialog : public Gtk::Dialog {
    public:
-    HistogramDialog(Gtk::Window& parent, const std::vector<std::vector<int>>& histogram)
-            : Gtk::Dialog("Image Histogram", parent, true) {
-
+    explicit HistogramDialog(Gtk::Window& parent) : Gtk::Dialog("Image Histogram", parent, false) {
         set_default_size(600, 400);
         set_border_width(10);
 
@@ -370,34 +582,177 @@ class HistogramDialog : public Gtk::Dialog {
         notebook.append_page(redBox, "Red Channel");
         notebook.append_page(greenBox, "Green Channel");
         notebook.append_page(blueBox, "Blue Channel");
-
-        redDrawingArea = Gtk::manage(new HistogramDrawingArea(histogram[0], Gdk::RGBA("red")));
-        greenDrawingArea = Gtk::manage(new HistogramDrawingArea(histogram[1], Gdk::RGBA("green")));
-        blueDrawingArea = Gtk::manage(new HistogramDrawingArea(histogram[2], Gdk::RGBA("blue")));
-
-        redBox.pack_start(*redDrawingArea, true, true, 0);
-        greenBox.pack_start(*greenDrawingArea, true, true, 0);
-        blueBox.pack_start(*blueDrawingArea, true, true, 0);
-
-        contentBox->pack_start(notebook, true, true, 0);
+        notebook.signal_switch_page().connect([this](Gtk::Widget*, guint page) {
+            drawingArea.setChannel(static_cast<int>(page));
+        });
+        contentBox->pack_start(notebook, Gtk::PACK_SHRINK);
+        contentBox->pack_start(drawingArea, true, true, 0);
+
+        optionsBox.set_spacing(10);
+        sourceCombo.append("Result");
+        sourceCombo.append("Original");
+        sourceCombo.set_active(0);
+        sourceCombo.signal_changed().connect([this]() { sourceChanged.emit(); });
+        optionsBox.pack_start(sourceCombo, Gtk::PACK_SHRINK);
+
+        logScaleCheck.set_label("Log Scale");
+        logScaleCheck.signal_toggled().connect([this]() { drawingArea.setLogScale(logScaleCheck.get_active()); });
+        optionsBox.pack_start(logScaleCheck, Gtk::PACK_SHRINK);
+        contentBox->pack_start(optionsBox, Gtk::PACK_SHRINK);
 
         add_button("_Close", Gtk::RESPONSE_CLOSE);
+        signal_response().connect([this](int) { hide(); });
 
         show_all_children();
-
-        redDrawingArea->queue_draw();
-        greenDrawingArea->queue_draw();
-        blueDrawingArea->queue_draw();
     }
 
+    void setHistogram(const std::vector<std::vector<int>>& histogram) { drawingArea.setHistogram(histogram); }
+
+    bool showsOriginal() const { return sourceCombo.get_active_row_number() == 1; }
+
+    sigc::signal<void>& signal_source_changed() { return sourceChanged; }
+
    private:
     Gtk::Notebook notebook;
     Gtk::Box redBox{Gtk::ORIENTATION_VERTICAL};
     Gtk::Box greenBox{Gtk::ORIENTATION_VERTICAL};
     Gtk::Box blueBox{Gtk::ORIENTATION_VERTICAL};
-    HistogramDrawingArea* redDrawingArea;
-    HistogramDrawingArea* greenDrawingArea;
-    HistogramDrawingArea* blueDrawingArea;
+    HistogramDrawingArea drawingArea;
+    Gtk::Box optionsBox{Gtk::ORIENTATION_HORIZONTAL};
+    Gtk::ComboBoxText sourceCombo;
+    Gtk::CheckButton logScaleCheck;
+    sigc::signal<void> sourceChanged;
+};
+
+// Runs one job at a time on its own thread. Starting a job cancels the one in flight
+// instead of waiting for it; superseded threads are joined once they notice. A job that
+// throws is reported through signal_failed instead of its done callback.
+class BackgroundWorker {
+   public:
+    BackgroundWorker() {
+        progressDispatcher.connect([this]() { on_progress(); });
+        finishedDispatcher.connect([this]() { on_finished(); });
+    }
+
+    ~BackgroundWorker() {
+        for (auto& job : jobs) {
+            job->control.cancel();
+            if (job->thread.joinable()) job->thread.join();
+        }
+    }
+
+    void run(std::function<void(JobControl&)> work, std::function<void()> done) {
+        cancel();
+
+        auto job = std::make_shared<Job>();
+        job->work = std::move(work);
+        job->done = std::move(done);
+        job->control.setProgressCallback([this]() { progressDispatcher.emit(); });
+
+        current = job;
+        jobs.push_back(job);
+
+        Job* raw = job.get();
+        job->thread = std::thread([this, raw]() {
+            try {
+                raw->work(raw->control);
+            }
+            catch (const std::bad_alloc&) {
+                raw->fail("Out of memory");
+            }
+            catch (const std::exception& ex) {
+                raw->fail(ex.what());
+            }
+            catch (const Glib::Exception& ex) {
+                raw->fail(ex.what());
+            }
+            catch (...) {
+                raw->fail("");
+            }
+            {
+                std::lock_guard<std::mutex> lock(finishedMutex);
+                finished.push_back(raw);
+            }
+            finishedDispatcher.emit();
+        });
+
+        progressChanged.emit(0.0);
+    }
+
+    void cancel() {
+        if (current) {
+            current->control.cancel();
+            current.reset();
+            idleChanged.emit();
+        }
+    }
+
+    bool isBusy() const { return (bool)current; }
+
+    sigc::signal<void, double>& signal_progress() { return progressChanged; }
+    sigc::signal<void>& signal_idle() { return idleChanged; }
+    sigc::signal<void, std::string>& signal_failed() { return failed; }
+
+   private:
+    struct Job {
+        JobControl control;
+        std::function<void(JobControl&)> work;
+        std::function<void()> done;
+        std::thread thread;
+        // Set by the job's thread when work throws; read after the join.
+        bool failed = false;
+        std::string error;
+
+        void fail(const std::string& message) {
+            failed = true;
+            error = message.empty() ? "Unknown error" : message;
+        }
+    };
+
+    std::list<std::shared_ptr<Job>> jobs;
+    std::shared_ptr<Job> current;
+
+    std::mutex finishedMutex;
+    std::vector<Job*> finished;
+
+    Glib::Dispatcher progressDispatcher;
+    Glib::Dispatcher finishedDispatcher;
+    sigc::signal<void, double> progressChanged;
+    sigc::signal<void> idleChanged;
+    sigc::signal<void, std::string> failed;
+
+    void on_progress() {
+        if (current) progressChanged.emit(current->control.getProgress());
+    }
+
+    void on_finished() {
+        std::vector<Job*> done_jobs;
+        {
+            std::lock_guard<std::mutex> lock(finishedMutex);
+            done_jobs.swap(finished);
+        }
+
+        for (Job* raw : done_jobs) {
+            auto it = std::find_if(jobs.begin(), jobs.end(),
+                                   [raw](const std::shared_ptr<Job>& job) { return job.get() == raw; });
+            if (it == jobs.end()) continue;
+
+            auto job = *it;
+            jobs.erase(it);
+            job->thread.join();
+
+            if (job == current && !job->control.isCancelled()) {
+                current.reset();
+                if (job->failed) {
+                    idleChanged.emit();
+                    failed.emit(job->error);
+                    continue;
+                }
+                job->done();
+                idleChanged.emit();
+            }
+        }
+    }
 };
 
 class MainWindow : public Gtk::Window {
@@ -413,6 +768,8 @@ class MainWindow : public Gtk::Window {
         setupImages();
         setupControls();
 
+        mainBox.pack_start(statusBar, Gtk::PACK_SHRINK);
+
         show_all_children();
     }
 
@@ -421,24 +778,102 @@ class MainWindow : public Gtk::Window {
     Gtk::Box imagesBox{Gtk::ORIENTATION_HORIZONTAL};
     Gtk::Box controlsBox{Gtk::ORIENTATION_VERTICAL};
 
-    Gtk::ScrolledWindow originalScrolled, filteredScrolled;
     Gtk::Frame originalFrame, filteredFrame;
-    Gtk::Image originalImage, filteredImage;
+    ImageViewer originalViewer, filteredViewer;
 
     Gtk::MenuBar menuBar;
     Gtk::Menu fileMenu, filterMenu, histogramMenu, compressionMenu;
     Gtk::MenuItem fileMenuItem, filterMenuItem, histogramMenuItem, compressionMenuItem;
-    Gtk::MenuItem openMenuItem, saveMenuItem, exitMenuItem;
-    Gtk::MenuItem lowpassMenuItem, equalizeMenuItem, contrastMenuItem, showHistogramMenuItem;
+    Gtk::MenuItem openMenuItem, closeMenuItem, saveMenuItem, compareMenuItem, exportTraceMenuItem, exitMenuItem;
+    Gtk::MenuItem lowpassMenuItem, edgesMenuItem, bilateralMenuItem, medianMenuItem, gaussianMenuItem, lensMenuItem, resizeMenuItem, rotateMenuItem, flipHorizontalMenuItem, flipVerticalMenuItem, morphologyMenuItem, boxMenuItem, thresholdMenuItem, quantizeMenuItem, ditherMenuItem, equalizeMenuItem, claheMenuItem, contrastMenuItem, showHistogramMenuItem;
     Gtk::MenuItem encodeAndSaveRLEMenuItem, decodeAndOpenRLEMenuItem;
 
     Gtk::Label contrastMinLabel, contrastMaxLabel;
     Gtk::Scale contrastMinScale, contrastMaxScale;
-    Gtk::Button lowpassButton, equalizeButton, contrastButton, showHistogramButton, resetButton, saveButton;
+    Gtk::Button lowpassButton, edgesButton, bilateralButton, medianButton, gaussianButton, lensButton, resizeButton, rotateButton, rotateLeftButton, rotateRightButton, flipHorizontalButton, flipVerticalButton, morphologyButton, boxButton, thresholdButton, quantizeButton, ditherButton, equalizeButton, claheButton, contrastButton, showHistogramButton, resetButton, saveButton, compareButton, closeDocumentButton;
     Gtk::Button encodeAndSaveRLEButton, decodeAndOpenRLEButton;
+    Gtk::Label documentLabel, pngLevelLabel;
+    Gtk::SpinButton pngLevelSpin;
+    Gtk::ComboBoxText pngFilterCombo;
+    Gtk::ComboBoxText documentCombo;
+    Gtk::CheckButton contrastPreviewCheck, linearLightCheck, rotateExpandCheck, verifyRLECheck;
+    Gtk::Label edgesLowLabel, edgesHighLabel;
+    Gtk::SpinButton edgesLowSpin, edgesHighSpin;
+    Gtk::Label bilateralSpatialLabel, bilateralRangeLabel;
+    Gtk::SpinButton bilateralSpatialSpin, bilateralRangeSpin;
+    Gtk::Label medianRadiusLabel;
+    Gtk::SpinButton medianRadiusSpin;
+    Gtk::Label gaussianSigmaLabel;
+    Gtk::SpinButton gaussianSigmaSpin;
+    Gtk::Label lensRadiusLabel;
+    Gtk::SpinButton lensRadiusSpin;
+    Gtk::Label resizeScaleLabel;
+    Gtk::SpinButton resizeScaleSpin;
+    Gtk::ComboBoxText resizeFilterCombo;
+    Gtk::Label rotateAngleLabel;
+    Gtk::SpinButton rotateAngleSpin;
+    Gtk::ComboBoxText morphologyOpCombo, morphologyModeCombo;
+    Gtk::Label morphologyRadiusXLabel, morphologyRadiusYLabel;
+    Gtk::SpinButton morphologyRadiusXSpin, morphologyRadiusYSpin;
+    Gtk::Label boxRadiusLabel, thresholdRadiusLabel, thresholdSensitivityLabel;
+    Gtk::SpinButton boxRadiusSpin, thresholdRadiusSpin, thresholdSensitivitySpin;
+    Gtk::ComboBoxText thresholdMethodCombo;
+    Gtk::Label quantizeColorsLabel;
+    Gtk::SpinButton quantizeColorsSpin;
+    Gtk::ComboBoxText quantizeMethodCombo;
+    Gtk::Label ditherLevelsLabel;
+    Gtk::SpinButton ditherLevelsSpin;
+    Gtk::ComboBoxText ditherMethodCombo;
+
+    Gtk::Box progressBox{Gtk::ORIENTATION_HORIZONTAL};
+    Gtk::ProgressBar progressBar;
+    Gtk::Button cancelButton;
+    Gtk::Statusbar statusBar;
 
     ImageProcessor processor;
 
+    // Open images. The active one works in `processor` and its entry here is empty; the
+    // others keep their processor here until switched to. Processors hold pixbufs by
+    // reference, so switching copies no pixels.
+    struct Document {
+        std::string path;
+        DecodedImageCache::Key key;
+        ImageProcessor processor;
+    };
+    std::vector<Document> documents;
+    int activeDocument = -1;
+    bool fillingDocuments = false;
+
+    // A load in progress; thumbnails from the worker wait in pendingThumbnail until the
+    // dispatcher runs on this thread, and are dropped if another load has started since.
+    // Declared before the worker, which joins its threads first when the window goes.
+    struct PendingThumbnail {
+        int generation = 0;
+        Glib::RefPtr<Gdk::Pixbuf> image;
+        int fullWidth = 0, fullHeight = 0;
+    };
+    Glib::Dispatcher thumbnailDispatcher;
+    std::mutex thumbnailMutex;
+    PendingThumbnail pendingThumbnail;
+    int loadGeneration = 0;
+    bool loading = false;
+    bool firstPixelShown = false;
+    double loadStartUs = 0;
+
+    DecodedImageCache imageCache;
+
+    BackgroundWorker worker;
+    std::unique_ptr<HistogramDialog> histogramDialog;
+
+    static constexpr int maxPreviewPixels = 4 * 1024 * 1024;
+    ImageProcessor previewProcessor;
+    Glib::RefPtr<Gdk::Pixbuf> previewSource;
+    bool previewPending = false;
+    bool previewActive = false;
+    bool contrastDragging = false;
+    sigc::connection contrastCommit;
+    static constexpr int contrastCommitDelayMs = 400;
+
     void setupMenu() {
         fileMenuItem.set_label("File");
         fileMenuItem.set_submenu(fileMenu);
@@ -447,10 +882,22 @@ class MainWindow : public Gtk::Window {
         openMenuItem.signal_activate().connect([this]() { on_open_clicked(); });
         fileMenu.append(openMenuItem);
 
+        closeMenuItem.set_label("Close Image");
+        closeMenuItem.signal_activate().connect([this]() { on_close_document_clicked(); });
+        fileMenu.append(closeMenuItem);
+
         saveMenuItem.set_label("Save Filtered Image");
         saveMenuItem.signal_activate().connect([this]() { on_save_clicked(); });
         fileMenu.append(saveMenuItem);
 
+        compareMenuItem.set_label("Compare to Original");
+        compareMenuItem.signal_activate().connect([this]() { on_compare_clicked(); });
+        fileMenu.append(compareMenuItem);
+
+        exportTraceMenuItem.set_label("Export Performance Trace");
+        exportTraceMenuItem.signal_activate().connect([this]() { on_export_trace_clicked(); });
+        fileMenu.append(exportTraceMenuItem);
+
         fileMenu.append(*(new Gtk::SeparatorMenuItem()));
 
         exitMenuItem.set_label("Exit");
@@ -464,6 +911,62 @@ class MainWindow : public Gtk::Window {
         lowpassMenuItem.signal_activate().connect([this]() { on_lowpass_clicked(); });
         filterMenu.append(lowpassMenuItem);
 
+        edgesMenuItem.set_label("Edge Detection");
+        edgesMenuItem.signal_activate().connect([this]() { on_edges_clicked(); });
+        filterMenu.append(edgesMenuItem);
+
+        bilateralMenuItem.set_label("Bilateral Filter");
+        bilateralMenuItem.signal_activate().connect([this]() { on_bilateral_clicked(); });
+        filterMenu.append(bilateralMenuItem);
+
+        medianMenuItem.set_label("Median Filter");
+        medianMenuItem.signal_activate().connect([this]() { on_median_clicked(); });
+        filterMenu.append(medianMenuItem);
+
+        gaussianMenuItem.set_label("Gaussian Blur");
+        gaussianMenuItem.signal_activate().connect([this]() { on_gaussian_clicked(); });
+        filterMenu.append(gaussianMenuItem);
+
+        lensMenuItem.set_label("Lens Blur");
+        lensMenuItem.signal_activate().connect([this]() { on_lens_clicked(); });
+        filterMenu.append(lensMenuItem);
+
+        resizeMenuItem.set_label("Resize");
+        resizeMenuItem.signal_activate().connect([this]() { on_resize_clicked(); });
+        filterMenu.append(resizeMenuItem);
+
+        rotateMenuItem.set_label("Rotate");
+        rotateMenuItem.signal_activate().connect([this]() { on_rotate_clicked(); });
+        filterMenu.append(rotateMenuItem);
+
+        flipHorizontalMenuItem.set_label("Flip Horizontally");
+        flipHorizontalMenuItem.signal_activate().connect([this]() { on_orientation_clicked(Orientation::FlipHorizontal); });
+        filterMenu.append(flipHorizontalMenuItem);
+
+        flipVerticalMenuItem.set_label("Flip Vertically");
+        flipVerticalMenuItem.signal_activate().connect([this]() { on_orientation_clicked(Orientation::FlipVertical); });
+        filterMenu.append(flipVerticalMenuItem);
+
+        morphologyMenuItem.set_label("Morphology");
+        morphologyMenuItem.signal_activate().connect([this]() { on_morphology_clicked(); });
+        filterMenu.append(morphologyMenuItem);
+
+        boxMenuItem.set_label("Box Filter");
+        boxMenuItem.signal_activate().connect([this]() { on_box_clicked(); });
+        filterMenu.append(boxMenuItem);
+
+        thresholdMenuItem.set_label("Local Threshold");
+        thresholdMenuItem.signal_activate().connect([this]() { on_threshold_clicked(); });
+        filterMenu.append(thresholdMenuItem);
+
+        quantizeMenuItem.set_label("Color Quantization");
+        quantizeMenuItem.signal_activate().connect([this]() { on_quantize_clicked(); });
+        filterMenu.append(quantizeMenuItem);
+
+        ditherMenuItem.set_label("Dithering");
+        ditherMenuItem.signal_activate().connect([this]() { on_dither_clicked(); });
+        filterMenu.append(ditherMenuItem);
+
         histogramMenuItem.set_label("Histogram");
         histogramMenuItem.set_submenu(histogramMenu);
 
@@ -471,6 +974,10 @@ class MainWindow : public Gtk::Window {
         equalizeMenuItem.signal_activate().connect([this]() { on_equalize_clicked(); });
         histogramMenu.append(equalizeMenuItem);
 
+        claheMenuItem.set_label("Adaptive Equalization (CLAHE)");
+        claheMenuItem.signal_activate().connect([this]() { on_clahe_clicked(); });
+        histogramMenu.append(claheMenuItem);
+
         contrastMenuItem.set_label("Linear Contrast");
         contrastMenuItem.signal_activate().connect([this]() { on_contrast_clicked(); });
         histogramMenu.append(contrastMenuItem);
@@ -504,25 +1011,28 @@ class MainWindow : public Gtk::Window {
         mainBox.pack_start(imagesBox, true, true, 0);
 
         originalFrame.set_label("Original Image");
-        originalScrolled.set_policy(Gtk::POLICY_AUTOMATIC, Gtk::POLICY_AUTOMATIC);
-        originalScrolled.set_size_request(400, 400);
-        originalScrolled.add(originalImage);
-        originalFrame.add(originalScrolled);
+        originalViewer.set_size_request(400, 400);
+        originalFrame.add(originalViewer);
         imagesBox.pack_start(originalFrame, true, true, 0);
 
         filteredFrame.set_label("Filtered Image");
-        filteredScrolled.set_policy(Gtk::POLICY_AUTOMATIC, Gtk::POLICY_AUTOMATIC);
-        filteredScrolled.set_size_request(400, 400);
-        filteredScrolled.add(filteredImage);
-        filteredFrame.add(filteredScrolled);
+        filteredViewer.set_size_request(400, 400);
+        filteredFrame.add(filteredViewer);
         imagesBox.pack_start(filteredFrame, true, true, 0);
+
+        originalViewer.signal_view_changed().connect([this]() {
+            filteredViewer.setView(originalViewer.getZoom(), originalViewer.getOriginX(), originalViewer.getOriginY());
+        });
+        filteredViewer.signal_view_changed().connect([this]() {
+            originalViewer.setView(filteredViewer.getZoom(), filteredViewer.getOriginX(), filteredViewer.getOriginY());
+        });
     }
 
     void setupControls() {
         controlsBox.set_spacing(10);
         controlsBox.set_border_width(10);
 
-        Gtk::Frame lowpassFrame("Low-Pass Filter");
+        Gtk::Frame lowpassFrame("Filters");
         Gtk::Box lowpassBox{Gtk::ORIENTATION_HORIZONTAL};
         lowpassBox.set_spacing(10);
         lowpassBox.set_border_width(5);
@@ -531,9 +1041,276 @@ class MainWindow : public Gtk::Window {
         lowpassButton.signal_clicked().connect([this]() { on_lowpass_clicked(); });
         lowpassBox.pack_start(lowpassButton, Gtk::PACK_SHRINK);
 
+        edgesLowLabel.set_label("Edges Low:");
+        lowpassBox.pack_start(edgesLowLabel, Gtk::PACK_SHRINK);
+
+        edgesLowSpin.set_range(1, CannyEdgeDetector::maxThreshold);
+        edgesLowSpin.set_increments(1, 10);
+        edgesLowSpin.set_value(20);
+        lowpassBox.pack_start(edgesLowSpin, Gtk::PACK_SHRINK);
+
+        edgesHighLabel.set_label("High:");
+        lowpassBox.pack_start(edgesHighLabel, Gtk::PACK_SHRINK);
+
+        edgesHighSpin.set_range(1, CannyEdgeDetector::maxThreshold);
+        edgesHighSpin.set_increments(1, 10);
+        edgesHighSpin.set_value(60);
+        lowpassBox.pack_start(edgesHighSpin, Gtk::PACK_SHRINK);
+
+        edgesButton.set_label("Detect Edges");
+        edgesButton.signal_clicked().connect([this]() { on_edges_clicked(); });
+        lowpassBox.pack_start(edgesButton, Gtk::PACK_SHRINK);
+
+        bilateralSpatialLabel.set_label("Bilateral Spatial:");
+        lowpassBox.pack_start(bilateralSpatialLabel, Gtk::PACK_SHRINK);
+
+        bilateralSpatialSpin.set_range(BilateralGrid::minSpatialSigma, 64);
+        bilateralSpatialSpin.set_increments(1, 8);
+        bilateralSpatialSpin.set_value(16);
+        lowpassBox.pack_start(bilateralSpatialSpin, Gtk::PACK_SHRINK);
+
+        bilateralRangeLabel.set_label("Range:");
+        lowpassBox.pack_start(bilateralRangeLabel, Gtk::PACK_SHRINK);
+
+        bilateralRangeSpin.set_range(BilateralGrid::minRangeSigma, 128);
+        bilateralRangeSpin.set_increments(1, 8);
+        bilateralRangeSpin.set_value(24);
+        lowpassBox.pack_start(bilateralRangeSpin, Gtk::PACK_SHRINK);
+
+        bilateralButton.set_label("Bilateral Filter");
+        bilateralButton.signal_clicked().connect([this]() { on_bilateral_clicked(); });
+        lowpassBox.pack_start(bilateralButton, Gtk::PACK_SHRINK);
+
+        medianRadiusLabel.set_label("Median Radius:");
+        lowpassBox.pack_start(medianRadiusLabel, Gtk::PACK_SHRINK);
+
+        medianRadiusSpin.set_range(1, MedianFilter::maxRadius);
+        medianRadiusSpin.set_increments(1, 5);
+        medianRadiusSpin.set_value(2);
+        lowpassBox.pack_start(medianRadiusSpin, Gtk::PACK_SHRINK);
+
+        medianButton.set_label("Apply Median Filter");
+        medianButton.signal_clicked().connect([this]() { on_median_clicked(); });
+        lowpassBox.pack_start(medianButton, Gtk::PACK_SHRINK);
+
+        gaussianSigmaLabel.set_label("Sigma:");
+        lowpassBox.pack_start(gaussianSigmaLabel, Gtk::PACK_SHRINK);
+
+        gaussianSigmaSpin.set_digits(1);
+        gaussianSigmaSpin.set_range(RecursiveGaussian::minSigma, 200);
+        gaussianSigmaSpin.set_increments(0.5, 5);
+        gaussianSigmaSpin.set_value(2);
+        lowpassBox.pack_start(gaussianSigmaSpin, Gtk::PACK_SHRINK);
+
+        gaussianButton.set_label("Apply Gaussian Blur");
+        gaussianButton.signal_clicked().connect([this]() { on_gaussian_clicked(); });
+        lowpassBox.pack_start(gaussianButton, Gtk::PACK_SHRINK);
+
+        lensRadiusLabel.set_label("Lens Radius:");
+        lowpassBox.pack_start(lensRadiusLabel, Gtk::PACK_SHRINK);
+
+        lensRadiusSpin.set_range(1, ConvolutionKernel::maxRadius);
+        lensRadiusSpin.set_increments(1, 10);
+        lensRadiusSpin.set_value(20);
+        lowpassBox.pack_start(lensRadiusSpin, Gtk::PACK_SHRINK);
+
+        lensButton.set_label("Apply Lens Blur");
+        lensButton.signal_clicked().connect([this]() { on_lens_clicked(); });
+        lowpassBox.pack_start(lensButton, Gtk::PACK_SHRINK);
+
         lowpassFrame.add(lowpassBox);
         controlsBox.pack_start(lowpassFrame, Gtk::PACK_SHRINK);
 
+        Gtk::Frame resizeFrame("Geometry");
+        Gtk::Box resizeBox{Gtk::ORIENTATION_HORIZONTAL};
+        resizeBox.set_spacing(10);
+        resizeBox.set_border_width(5);
+
+        resizeFilterCombo.append("Area Average");
+        resizeFilterCombo.append("Lanczos-3");
+        resizeFilterCombo.set_active(0);
+        resizeBox.pack_start(resizeFilterCombo, Gtk::PACK_SHRINK);
+
+        resizeScaleLabel.set_label("Scale %:");
+        resizeBox.pack_start(resizeScaleLabel, Gtk::PACK_SHRINK);
+
+        resizeScaleSpin.set_range(1, 400);
+        resizeScaleSpin.set_increments(1, 10);
+        resizeScaleSpin.set_value(50);
+        resizeBox.pack_start(resizeScaleSpin, Gtk::PACK_SHRINK);
+
+        resizeButton.set_label("Resize");
+        resizeButton.signal_clicked().connect([this]() { on_resize_clicked(); });
+        resizeBox.pack_start(resizeButton, Gtk::PACK_SHRINK);
+
+        rotateAngleLabel.set_label("Angle:");
+        resizeBox.pack_start(rotateAngleLabel, Gtk::PACK_SHRINK);
+
+        rotateAngleSpin.set_digits(1);
+        rotateAngleSpin.set_range(-180, 180);
+        rotateAngleSpin.set_increments(0.1, 1);
+        rotateAngleSpin.set_value(0);
+        resizeBox.pack_start(rotateAngleSpin, Gtk::PACK_SHRINK);
+
+        rotateExpandCheck.set_label("Expand");
+        rotateExpandCheck.set_active(true);
+        resizeBox.pack_start(rotateExpandCheck, Gtk::PACK_SHRINK);
+
+        rotateButton.set_label("Rotate");
+        rotateButton.signal_clicked().connect([this]() { on_rotate_clicked(); });
+        resizeBox.pack_start(rotateButton, Gtk::PACK_SHRINK);
+
+        rotateLeftButton.set_label("Rotate Left");
+        rotateLeftButton.signal_clicked().connect([this]() { on_orientation_clicked(Orientation::Rotate270); });
+        resizeBox.pack_start(rotateLeftButton, Gtk::PACK_SHRINK);
+
+        rotateRightButton.set_label("Rotate Right");
+        rotateRightButton.signal_clicked().connect([this]() { on_orientation_clicked(Orientation::Rotate90); });
+        resizeBox.pack_start(rotateRightButton, Gtk::PACK_SHRINK);
+
+        flipHorizontalButton.set_label("Flip Horizontally");
+        flipHorizontalButton.signal_clicked().connect([this]() { on_orientation_clicked(Orientation::FlipHorizontal); });
+        resizeBox.pack_start(flipHorizontalButton, Gtk::PACK_SHRINK);
+
+        flipVerticalButton.set_label("Flip Vertically");
+        flipVerticalButton.signal_clicked().connect([this]() { on_orientation_clicked(Orientation::FlipVertical); });
+        resizeBox.pack_start(flipVerticalButton, Gtk::PACK_SHRINK);
+
+        resizeFrame.add(resizeBox);
+        controlsBox.pack_start(resizeFrame, Gtk::PACK_SHRINK);
+
+        Gtk::Frame morphologyFrame("Morphology");
+        Gtk::Box morphologyBox{Gtk::ORIENTATION_HORIZONTAL};
+        morphologyBox.set_spacing(10);
+        morphologyBox.set_border_width(5);
+
+        morphologyOpCombo.append("Erode");
+        morphologyOpCombo.append("Dilate");
+        morphologyOpCombo.append("Open");
+        morphologyOpCombo.append("Close");
+        morphologyOpCombo.set_active(0);
+        morphologyBox.pack_start(morphologyOpCombo, Gtk::PACK_SHRINK);
+
+        morphologyModeCombo.append("Per Channel");
+        morphologyModeCombo.append("Grayscale");
+        morphologyModeCombo.set_active(0);
+        morphologyBox.pack_start(morphologyModeCombo, Gtk::PACK_SHRINK);
+
+        morphologyRadiusXLabel.set_label("Radius X:");
+        morphologyBox.pack_start(morphologyRadiusXLabel, Gtk::PACK_SHRINK);
+
+        morphologyRadiusXSpin.set_range(0, 500);
+        morphologyRadiusXSpin.set_increments(1, 10);
+        morphologyRadiusXSpin.set_value(3);
+        morphologyBox.pack_start(morphologyRadiusXSpin, Gtk::PACK_SHRINK);
+
+        morphologyRadiusYLabel.set_label("Y:");
+        morphologyBox.pack_start(morphologyRadiusYLabel, Gtk::PACK_SHRINK);
+
+        morphologyRadiusYSpin.set_range(0, 500);
+        morphologyRadiusYSpin.set_increments(1, 10);
+        morphologyRadiusYSpin.set_value(3);
+        morphologyBox.pack_start(morphologyRadiusYSpin, Gtk::PACK_SHRINK);
+
+        morphologyButton.set_label("Apply Morphology");
+        morphologyButton.signal_clicked().connect([this]() { on_morphology_clicked(); });
+        morphologyBox.pack_start(morphologyButton, Gtk::PACK_SHRINK);
+
+        morphologyFrame.add(morphologyBox);
+        controlsBox.pack_start(morphologyFrame, Gtk::PACK_SHRINK);
+
+        Gtk::Frame localFrame("Local Statistics");
+        Gtk::Box localBox{Gtk::ORIENTATION_HORIZONTAL};
+        localBox.set_spacing(10);
+        localBox.set_border_width(5);
+
+        boxRadiusLabel.set_label("Box Radius:");
+        localBox.pack_start(boxRadiusLabel, Gtk::PACK_SHRINK);
+
+        boxRadiusSpin.set_range(1, IntegralImage::maxBoxRadius);
+        boxRadiusSpin.set_increments(1, 10);
+        boxRadiusSpin.set_value(5);
+        localBox.pack_start(boxRadiusSpin, Gtk::PACK_SHRINK);
+
+        boxButton.set_label("Apply Box Filter");
+        boxButton.signal_clicked().connect([this]() { on_box_clicked(); });
+        localBox.pack_start(boxButton, Gtk::PACK_SHRINK);
+
+        thresholdMethodCombo.append("Sauvola");
+        thresholdMethodCombo.append("Bradley");
+        thresholdMethodCombo.set_active(0);
+        thresholdMethodCombo.signal_changed().connect([this]() {
+            thresholdSensitivitySpin.set_value(thresholdMethodCombo.get_active_row_number() == 0 ? 0.34 : 0.15);
+        });
+        localBox.pack_start(thresholdMethodCombo, Gtk::PACK_SHRINK);
+
+        thresholdRadiusLabel.set_label("Window Radius:");
+        localBox.pack_start(thresholdRadiusLabel, Gtk::PACK_SHRINK);
+
+        thresholdRadiusSpin.set_range(1, IntegralImage::maxSquareRadius);
+        thresholdRadiusSpin.set_increments(1, 10);
+        thresholdRadiusSpin.set_value(15);
+        localBox.pack_start(thresholdRadiusSpin, Gtk::PACK_SHRINK);
+
+        thresholdSensitivityLabel.set_label("k:");
+        localBox.pack_start(thresholdSensitivityLabel, Gtk::PACK_SHRINK);
+
+        thresholdSensitivitySpin.set_digits(2);
+        thresholdSensitivitySpin.set_range(0, 1);
+        thresholdSensitivitySpin.set_increments(0.01, 0.1);
+        thresholdSensitivitySpin.set_value(0.34);
+        localBox.pack_start(thresholdSensitivitySpin, Gtk::PACK_SHRINK);
+
+        thresholdButton.set_label("Apply Threshold");
+        thresholdButton.signal_clicked().connect([this]() { on_threshold_clicked(); });
+        localBox.pack_start(thresholdButton, Gtk::PACK_SHRINK);
+
+        localFrame.add(localBox);
+        controlsBox.pack_start(localFrame, Gtk::PACK_SHRINK);
+
+        Gtk::Frame quantizeFrame("Color Reduction");
+        Gtk::Box quantizeBox{Gtk::ORIENTATION_HORIZONTAL};
+        quantizeBox.set_spacing(10);
+        quantizeBox.set_border_width(5);
+
+        quantizeMethodCombo.append("Median Cut");
+        quantizeMethodCombo.append("Octree");
+        quantizeMethodCombo.set_active(0);
+        quantizeBox.pack_start(quantizeMethodCombo, Gtk::PACK_SHRINK);
+
+        quantizeColorsLabel.set_label("Colors:");
+        quantizeBox.pack_start(quantizeColorsLabel, Gtk::PACK_SHRINK);
+
+        quantizeColorsSpin.set_range(2, 256);
+        quantizeColorsSpin.set_increments(1, 16);
+        quantizeColorsSpin.set_value(64);
+        quantizeBox.pack_start(quantizeColorsSpin, Gtk::PACK_SHRINK);
+
+        quantizeButton.set_label("Quantize Colors");
+        quantizeButton.signal_clicked().connect([this]() { on_quantize_clicked(); });
+        quantizeBox.pack_start(quantizeButton, Gtk::PACK_SHRINK);
+
+        ditherMethodCombo.append("Floyd-Steinberg");
+        ditherMethodCombo.append("Jarvis-Judice-Ninke");
+        ditherMethodCombo.append("Ordered (Bayer)");
+        ditherMethodCombo.set_active(0);
+        quantizeBox.pack_start(ditherMethodCombo, Gtk::PACK_SHRINK);
+
+        ditherLevelsLabel.set_label("Levels:");
+        quantizeBox.pack_start(ditherLevelsLabel, Gtk::PACK_SHRINK);
+
+        ditherLevelsSpin.set_range(2, 16);
+        ditherLevelsSpin.set_increments(1, 2);
+        ditherLevelsSpin.set_value(2);
+        quantizeBox.pack_start(ditherLevelsSpin, Gtk::PACK_SHRINK);
+
+        ditherButton.set_label("Dither");
+        ditherButton.signal_clicked().connect([this]() { on_dither_clicked(); });
+        quantizeBox.pack_start(ditherButton, Gtk::PACK_SHRINK);
+
+        quantizeFrame.add(quantizeBox);
+        controlsBox.pack_start(quantizeFrame, Gtk::PACK_SHRINK);
+
         Gtk::Frame histogramFrame("Histogram Operations");
         Gtk::Box histogramControlsBox{Gtk::ORIENTATION_HORIZONTAL};
         histogramControlsBox.set_spacing(10);
@@ -543,6 +1320,10 @@ class MainWindow : public Gtk::Window {
         equalizeButton.signal_clicked().connect([this]() { on_equalize_clicked(); });
         histogramControlsBox.pack_start(equalizeButton, Gtk::PACK_SHRINK);
 
+        claheButton.set_label("Adaptive Equalization (CLAHE)");
+        claheButton.signal_clicked().connect([this]() { on_clahe_clicked(); });
+        histogramControlsBox.pack_start(claheButton, Gtk::PACK_SHRINK);
+
         showHistogramButton.set_label("Show Histogram");
         showHistogramButton.signal_clicked().connect([this]() { on_show_histogram_clicked(); });
         histogramControlsBox.pack_start(showHistogramButton, Gtk::PACK_SHRINK);
@@ -575,6 +1356,24 @@ class MainWindow : public Gtk::Window {
         contrastButton.signal_clicked().connect([this]() { on_contrast_clicked(); });
         contrastBox.pack_start(contrastButton, Gtk::PACK_SHRINK);
 
+        contrastPreviewCheck.set_label("Live Preview");
+        contrastPreviewCheck.set_active(true);
+        contrastBox.pack_start(contrastPreviewCheck, Gtk::PACK_SHRINK);
+
+        contrastMinScale.signal_value_changed().connect([this]() { on_contrast_changed(); });
+        contrastMaxScale.signal_value_changed().connect([this]() { on_contrast_changed(); });
+        for (Gtk::Scale* scale : {&contrastMinScale, &contrastMaxScale}) {
+            scale->signal_button_press_event().connect([this](GdkEventButton*) {
+                contrastDragging = true;
+                return false;
+            }, false);
+            scale->signal_button_release_event().connect([this](GdkEventButton*) {
+                contrastDragging = false;
+                on_contrast_released();
+                return false;
+            }, false);
+        }
+
         contrastFrame.add(contrastBox);
         controlsBox.pack_start(contrastFrame, Gtk::PACK_SHRINK);
 
@@ -591,6 +1390,9 @@ class MainWindow : public Gtk::Window {
         decodeAndOpenRLEButton.signal_clicked().connect([this]() { on_decode_and_open_rle_clicked(); });
         compressionBox.pack_start(decodeAndOpenRLEButton, Gtk::PACK_SHRINK);
 
+        verifyRLECheck.set_label("Verify");
+        compressionBox.pack_start(verifyRLECheck, Gtk::PACK_SHRINK);
+
         compressionFrame.add(compressionBox);
         controlsBox.pack_start(compressionFrame, Gtk::PACK_SHRINK);
 
@@ -598,6 +1400,19 @@ class MainWindow : public Gtk::Window {
         commonBox.set_spacing(10);
         commonBox.set_border_width(5);
 
+        documentLabel.set_label("Image:");
+        commonBox.pack_start(documentLabel, Gtk::PACK_SHRINK);
+
+        documentCombo.signal_changed().connect([this]() {
+            if (!fillingDocuments) switchDocument(documentCombo.get_active_row_number());
+        });
+        commonBox.pack_start(documentCombo, Gtk::PACK_SHRINK);
+
+        closeDocumentButton.set_label("Close");
+        closeDocumentButton.set_sensitive(false);
+        closeDocumentButton.signal_clicked().connect([this]() { on_close_document_clicked(); });
+        commonBox.pack_start(closeDocumentButton, Gtk::PACK_SHRINK);
+
         resetButton.set_label("Reset to Original");
         resetButton.signal_clicked().connect([this]() { on_reset_clicked(); });
         commonBox.pack_start(resetButton, Gtk::PACK_SHRINK);
@@ -606,8 +1421,68 @@ class MainWindow : public Gtk::Window {
         saveButton.signal_clicked().connect([this]() { on_save_clicked(); });
         commonBox.pack_start(saveButton, Gtk::PACK_SHRINK);
 
+        pngLevelLabel.set_label("PNG Level:");
+        commonBox.pack_start(pngLevelLabel, Gtk::PACK_SHRINK);
+
+        pngLevelSpin.set_range(0, 9);
+        pngLevelSpin.set_increments(1, 3);
+        pngLevelSpin.set_value(6);
+        commonBox.pack_start(pngLevelSpin, Gtk::PACK_SHRINK);
+
+        pngFilterCombo.append("No Filter");
+        pngFilterCombo.append("Sub");
+        pngFilterCombo.append("Up");
+        pngFilterCombo.append("Average");
+        pngFilterCombo.append("Paeth");
+        pngFilterCombo.append("Adaptive");
+        pngFilterCombo.set_active(static_cast<int>(PngFilter::Adaptive));
+        commonBox.pack_start(pngFilterCombo, Gtk::PACK_SHRINK);
+
+        compareButton.set_label("Compare to Original");
+        compareButton.signal_clicked().connect([this]() { on_compare_clicked(); });
+        commonBox.pack_start(compareButton, Gtk::PACK_SHRINK);
+
+        linearLightCheck.set_label("Linear Light");
+        linearLightCheck.signal_toggled().connect([this]() { on_linear_light_toggled(); });
+        commonBox.pack_start(linearLightCheck, Gtk::PACK_SHRINK);
+
         controlsBox.pack_start(commonBox, Gtk::PACK_SHRINK);
 
+        progressBox.set_spacing(10);
+        progressBox.set_border_width(5);
+
+        progressBar.set_show_text(true);
+        progressBox.pack_start(progressBar, true, true, 0);
+
+        cancelButton.set_label("Cancel");
+        cancelButton.set_sensitive(false);
+        cancelButton.signal_clicked().connect([this]() { worker.cancel(); });
+        progressBox.pack_start(cancelButton, Gtk::PACK_SHRINK);
+
+        controlsBox.pack_start(progressBox, Gtk::PACK_SHRINK);
+
+        worker.signal_progress().connect([this](double fraction) {
+            progressBar.set_fraction(fraction);
+            cancelButton.set_sensitive(true);
+        });
+        worker.signal_idle().connect([this]() {
+            progressBar.set_fraction(0);
+            progressBar.set_text("");
+            cancelButton.set_sensitive(false);
+
+            // A cancelled load leaves its thumbnail in the viewers.
+            if (loading) {
+                loading = false;
+                updateImages();
+            }
+        });
+        worker.signal_failed().connect([this](const std::string& message) {
+            Gtk::MessageDialog error(*this, "Operation failed", false, Gtk::MESSAGE_ERROR);
+            error.set_secondary_text(message);
+            error.run();
+        });
+        thumbnailDispatcher.connect([this]() { on_thumbnail_ready(); });
+
         mainBox.pack_start(controlsBox, Gtk::PACK_SHRINK);
     }
 
@@ -627,14 +1502,172 @@ class MainWindow : public Gtk::Window {
         filter_image->add_pattern("*.jpeg");
         filter_image->add_pattern("*.png");
         filter_image->add_pattern("*.bmp");
+        filter_image->add_pattern("*.pfm");
         dialog.add_filter(filter_image);
 
         if (dialog.run() == Gtk::RESPONSE_OK) {
-            std::string filename = dialog.get_filename();
-            if (processor.loadImage(filename)) {
-                updateImages();
+            openDocument(dialog.get_filename());
+        }
+    }
+
+    // A file that is already open is switched to rather than loaded again, matched by its
+    // canonical path as the image cache does. One that changed on disk since is loaded
+    // again and replaces the open document.
+    void openDocument(const std::string& filename) {
+        DecodedImageCache::Key key;
+        if (DecodedImageCache::keyOf(filename, key)) {
+            for (size_t i = 0; i < documents.size(); i++) {
+                const DecodedImageCache::Key& open = documents[i].key;
+                if (open.path != key.path) continue;
+                if (open.modified == key.modified && open.size == key.size) {
+                    switchDocument(static_cast<int>(i));
+                    return;
+                }
+                break;
+            }
+        }
+        startLoad(filename, key);
+    }
+
+    void switchDocument(int index) {
+        if (index == activeDocument || index < 0 || index >= static_cast<int>(documents.size())) return;
+
+        worker.cancel();
+        {
+            ProfileScope scope("image switch");
+            storeActiveDocument();
+            activeDocument = index;
+            processor = std::move(documents[index].processor);
+            processor.setLinearLight(linearLightCheck.get_active());
+            updateImages();
+            refreshDocuments();
+            scope.setMegapixels(processor.getMegapixels());
+        }
+        showTiming("image switch");
+    }
+
+    void on_close_document_clicked() {
+        if (activeDocument < 0) return;
+
+        worker.cancel();
+        const int closed = activeDocument;
+        documents.erase(documents.begin() + closed);
+        activeDocument = -1;
+        processor = ImageProcessor();
+        if (documents.empty()) {
+            originalViewer.setImage({});
+            filteredViewer.setImage({});
+            updateImages();
+            refreshDocuments();
+            statusBar.remove_all_messages();
+            return;
+        }
+        switchDocument(std::min(closed, static_cast<int>(documents.size()) - 1));
+    }
+
+    // Keeps the active document's state before `processor` moves on to another image.
+    // Operations cancel each other, so a load started after this either finishes before
+    // the active document changes again or never replaces `processor` at all.
+    void storeActiveDocument() {
+        // A contrast preview is not part of the document and goes with the switch.
+        contrastCommit.disconnect();
+        filteredViewer.clearPreview();
+        previewActive = false;
+        if (activeDocument >= 0) documents[activeDocument].processor = processor;
+    }
+
+    // The image just loaded into `processor` becomes the active document. It replaces an
+    // open document of the same file, which is then out of date.
+    void addDocument(const std::string& path, const DecodedImageCache::Key& key) {
+        for (size_t i = 0; i < documents.size(); i++) {
+            if (!key.path.empty() && documents[i].key.path == key.path) {
+                documents[i] = {path, key, ImageProcessor()};
+                activeDocument = static_cast<int>(i);
+                refreshDocuments();
+                return;
             }
         }
+        documents.push_back({path, key, ImageProcessor()});
+        activeDocument = static_cast<int>(documents.size()) - 1;
+        refreshDocuments();
+    }
+
+    void refreshDocuments() {
+        fillingDocuments = true;
+        documentCombo.remove_all();
+        for (const Document& document : documents) {
+            documentCombo.append(std::filesystem::path(document.path).filename().string());
+        }
+        documentCombo.set_active(activeDocument);
+        fillingDocuments = false;
+        closeDocumentButton.set_sensitive(activeDocument >= 0);
+    }
+
+    // Decodes in the background, unless the image cache still has the file; a JPEG
+    // thumbnail may show in both viewers first. The time until something of the new image
+    // is on screen is recorded as "first pixel". The image opens as a document; `key` is the
+    // file as it was when the load started.
+    void startLoad(const std::string& filename, const DecodedImageCache::Key& key) {
+        const int generation = ++loadGeneration;
+        loadStartUs = Profiler::instance().now();
+        firstPixelShown = false;
+        storeActiveDocument();
+
+        auto loaded = std::make_shared<bool>(false);
+        runOperation("Load image", [this, filename, generation, loaded](ImageProcessor& work) {
+            *loaded = work.loadImageCached(filename, imageCache, [this, generation](const Glib::RefPtr<Gdk::Pixbuf>& thumbnail,
+                                                                             int full_width, int full_height) {
+                {
+                    std::lock_guard<std::mutex> lock(thumbnailMutex);
+                    pendingThumbnail = {generation, thumbnail, full_width, full_height};
+                }
+                thumbnailDispatcher.emit();
+            });
+        }, [this, filename, key, loaded]() {
+            loading = false;
+            if (!*loaded) {
+                Gtk::MessageDialog error(*this, "Failed to load image", false, Gtk::MESSAGE_ERROR);
+                error.run();
+                return;
+            }
+            addDocument(filename, key);
+            recordFirstPixel();
+            showTiming("Load image");
+        });
+        loading = true;
+    }
+
+    void on_thumbnail_ready() {
+        PendingThumbnail pending;
+        {
+            std::lock_guard<std::mutex> lock(thumbnailMutex);
+            std::swap(pending, pendingThumbnail);
+        }
+        if (!loading || pending.generation != loadGeneration || !pending.image) return;
+
+        originalViewer.setPlaceholder(pending.image, pending.fullWidth, pending.fullHeight);
+        filteredViewer.setPlaceholder(pending.image, pending.fullWidth, pending.fullHeight);
+        recordFirstPixel();
+
+        ProfileRecord record;
+        Profiler::instance().last("first pixel", record);
+        std::ostringstream text;
+        text << std::fixed << std::setprecision(1) << "Loading " << pending.fullWidth << "x" << pending.fullHeight
+             << ", first pixel: " << record.durationUs / 1000 << " ms";
+        statusBar.remove_all_messages();
+        statusBar.push(text.str());
+    }
+
+    void recordFirstPixel() {
+        if (firstPixelShown) return;
+        firstPixelShown = true;
+
+        ProfileRecord record;
+        record.name = "first pixel";
+        record.thread = Profiler::threadIndex();
+        record.startUs = loadStartUs;
+        record.durationUs = Profiler::instance().now() - loadStartUs;
+        Profiler::instance().add(record);
     }
 
     void on_save_clicked() {
@@ -652,46 +1685,260 @@ class MainWindow : public Gtk::Window {
         filter_png->add_pattern("*.png");
         dialog.add_filter(filter_png);
 
+        auto filter_pfm = Gtk::FileFilter::create();
+        filter_pfm->set_name("PFM files (float)");
+        filter_pfm->add_pattern("*.pfm");
+        dialog.add_filter(filter_pfm);
+
         dialog.set_current_name("processed_image.png");
 
         if (dialog.run() == Gtk::RESPONSE_OK) {
             std::string filename = dialog.get_filename();
             if (!filename.empty()) {
-                processor.getFilteredPixbuf()->save(filename, "png");
+                // A contrast preview is applied on the worker by runOperation, before saving.
+                int level = static_cast<int>(pngLevelSpin.get_value());
+                auto filter = static_cast<PngFilter>(pngFilterCombo.get_active_row_number());
+                bool pfm = std::filesystem::path(filename).extension() == ".pfm";
+                auto saved = std::make_shared<bool>(false);
+                runOperation(pfm ? "Save PFM" : "Save PNG", [filename, level, filter, pfm, saved](ImageProcessor& work) {
+                    *saved = pfm ? work.savePFM(filename) : work.savePNG(filename, level, filter);
+                }, [this, saved]() {
+                    if (!*saved) {
+                        Gtk::MessageDialog error(*this, "Failed to save image", false, Gtk::MESSAGE_ERROR);
+                        error.run();
+                    }
+                });
             }
         }
     }
 
     void on_lowpass_clicked() {
         if (!processor.hasImage()) return;
-        processor.applyLowPassFilter();
-        updateImages();
+        runOperation("Low-pass filter", [](ImageProcessor& work) { work.applyLowPassFilter(); });
+    }
+
+    void on_edges_clicked() {
+        if (!processor.hasImage()) return;
+
+        int low = static_cast<int>(edgesLowSpin.get_value());
+        int high = static_cast<int>(edgesHighSpin.get_value());
+        runOperation("Edge detection", [low, high](ImageProcessor& work) { work.applyEdgeDetection(low, high); });
+    }
+
+    void on_bilateral_clicked() {
+        if (!processor.hasImage()) return;
+
+        double sigma_spatial = bilateralSpatialSpin.get_value();
+        double sigma_range = bilateralRangeSpin.get_value();
+        runOperation("Bilateral filter", [sigma_spatial, sigma_range](ImageProcessor& work) {
+            work.applyBilateralFilter(sigma_spatial, sigma_range);
+        });
+    }
+
+    void on_median_clicked() {
+        if (!processor.hasImage()) return;
+
+        int radius = static_cast<int>(medianRadiusSpin.get_value());
+        runOperation("Median filter", [radius](ImageProcessor& work) { work.applyMedianFilter(radius); });
+    }
+
+    void on_gaussian_clicked() {
+        if (!processor.hasImage()) return;
+
+        double sigma = gaussianSigmaSpin.get_value();
+        runOperation("Gaussian blur", [sigma](ImageProcessor& work) { work.applyGaussianBlur(sigma); });
+    }
+
+    void on_lens_clicked() {
+        if (!processor.hasImage()) return;
+
+        int radius = static_cast<int>(lensRadiusSpin.get_value());
+        runOperation("Lens blur", [radius](ImageProcessor& work) { work.applyLensBlur(radius); });
+    }
+
+    void on_resize_clicked() {
+        if (!processor.hasImage()) return;
+
+        ResampleFilter filter = resizeFilterCombo.get_active_row_number() == 0 ? ResampleFilter::Area
+                                                                               : ResampleFilter::Lanczos3;
+        double scale = resizeScaleSpin.get_value() / 100.0;
+        int new_width = static_cast<int>(std::lround(processor.getWidth() * scale));
+        int new_height = static_cast<int>(std::lround(processor.getHeight() * scale));
+        runOperation("Resize", [new_width, new_height, filter](ImageProcessor& work) {
+            work.applyResize(new_width, new_height, filter);
+        });
+    }
+
+    void on_rotate_clicked() {
+        if (!processor.hasImage()) return;
+
+        double degrees = rotateAngleSpin.get_value();
+        bool expand = rotateExpandCheck.get_active();
+        auto fits = std::make_shared<bool>(true);
+        runOperation("Rotate", [degrees, expand, fits](ImageProcessor& work) {
+            *fits = work.applyRotation(degrees, expand);
+        }, [this, fits]() {
+            if (!*fits) {
+                Gtk::MessageDialog error(*this, "Rotated image would exceed " + std::to_string(AffineWarp::maxSize) +
+                                                    " pixels on a side", false, Gtk::MESSAGE_ERROR);
+                error.run();
+            }
+        });
+    }
+
+    void on_orientation_clicked(Orientation orientation) {
+        if (!processor.hasImage()) return;
+
+        runOperation("Orientation", [orientation](ImageProcessor& work) { work.applyOrientation(orientation); });
+    }
+
+    void on_morphology_clicked() {
+        if (!processor.hasImage()) return;
+
+        static const MorphologyOp ops[] = {MorphologyOp::Erode, MorphologyOp::Dilate, MorphologyOp::Open,
+                                           MorphologyOp::Close};
+        MorphologyOp op = ops[std::max(0, morphologyOpCombo.get_active_row_number())];
+        bool grayscale = morphologyModeCombo.get_active_row_number() == 1;
+        int radius_x = static_cast<int>(morphologyRadiusXSpin.get_value());
+        int radius_y = static_cast<int>(morphologyRadiusYSpin.get_value());
+        runOperation("Morphology", [op, radius_x, radius_y, grayscale](ImageProcessor& work) {
+            work.applyMorphology(op, radius_x, radius_y, grayscale);
+        });
+    }
+
+    void on_box_clicked() {
+        if (!processor.hasImage()) return;
+
+        int radius = static_cast<int>(boxRadiusSpin.get_value());
+        runOperation("Box filter", [radius](ImageProcessor& work) { work.applyBoxFilter(radius); });
+    }
+
+    void on_threshold_clicked() {
+        if (!processor.hasImage()) return;
+
+        ThresholdMethod method = thresholdMethodCombo.get_active_row_number() == 0 ? ThresholdMethod::Sauvola
+                                                                                   : ThresholdMethod::Bradley;
+        int radius = static_cast<int>(thresholdRadiusSpin.get_value());
+        double sensitivity = thresholdSensitivitySpin.get_value();
+        runOperation("Local threshold", [method, radius, sensitivity](ImageProcessor& work) {
+            work.applyLocalThreshold(method, radius, sensitivity);
+        });
+    }
+
+    void on_quantize_clicked() {
+        if (!processor.hasImage()) return;
+
+        QuantizeMethod method = quantizeMethodCombo.get_active_row_number() == 0 ? QuantizeMethod::MedianCut
+                                                                                 : QuantizeMethod::Octree;
+        int colors = static_cast<int>(quantizeColorsSpin.get_value());
+        runOperation("Color quantization", [method, colors](ImageProcessor& work) {
+            work.applyColorQuantization(method, colors);
+        });
+    }
+
+    void on_dither_clicked() {
+        if (!processor.hasImage()) return;
+
+        static const DitherMethod methods[] = {DitherMethod::FloydSteinberg, DitherMethod::Jarvis, DitherMethod::Bayer};
+        DitherMethod method = methods[std::max(0, ditherMethodCombo.get_active_row_number())];
+        int levels = static_cast<int>(ditherLevelsSpin.get_value());
+        runOperation("Dithering", [method, levels](ImageProcessor& work) { work.applyDithering(method, levels); });
     }
 
     void on_equalize_clicked() {
         if (!processor.hasImage()) return;
-        processor.applyHistogramEqualization();
-        updateImages();
+        runOperation("Histogram equalization", [](ImageProcessor& work) { work.applyHistogramEqualization(); });
+    }
+
+    void on_clahe_clicked() {
+        if (!processor.hasImage()) return;
+        runOperation("CLAHE", [](ImageProcessor& work) { work.applyCLAHE(); });
     }
 
     void on_contrast_clicked() {
         if (!processor.hasImage()) return;
+        contrastCommit.disconnect();
 
         int min_out = static_cast<int>(contrastMinScale.get_value());
         int max_out = static_cast<int>(contrastMaxScale.get_value());
 
         if (min_out >= max_out) return;
 
-        processor.applyLinearContrast(min_out, max_out);
-        updateImages();
+        // A live preview of these values is applied by runOperation already.
+        runOperation("Linear contrast", [min_out, max_out, previewed = previewActive](ImageProcessor& work) {
+            if (!previewed) work.applyLinearContrast(min_out, max_out);
+        });
+    }
+
+    void on_contrast_changed() {
+        if (!processor.hasImage() || !contrastPreviewCheck.get_active()) return;
+
+        // Keyboard and scroll changes have no release, so the full-resolution pass follows
+        // once the value has rested for a moment.
+        contrastCommit.disconnect();
+        contrastCommit = Glib::signal_timeout().connect([this]() {
+            if (!contrastDragging) on_contrast_released();
+            return false;
+        }, contrastCommitDelayMs);
+
+        if (previewPending) return;
+        previewPending = true;
+        Glib::signal_timeout().connect_once([this]() {
+            previewPending = false;
+            renderContrastPreview();
+        }, 16);
+    }
+
+    void on_contrast_released() {
+        if (previewActive) on_contrast_clicked();
+    }
+
+    void renderContrastPreview() {
+        if (!processor.hasImage()) return;
+
+        int min_out = static_cast<int>(contrastMinScale.get_value());
+        int max_out = static_cast<int>(contrastMaxScale.get_value());
+        if (min_out >= max_out) return;
+
+        auto original = processor.getOriginalPixbuf();
+        double area = static_cast<double>(original->get_width()) * original->get_height();
+        double scale = std::min({1.0, filteredViewer.getZoom(), std::sqrt(maxPreviewPixels / area)});
+        int proxy_width = std::max(1, static_cast<int>(original->get_width() * scale));
+        int proxy_height = std::max(1, static_cast<int>(original->get_height() * scale));
+
+        auto proxyOriginal = previewProcessor.getOriginalPixbuf();
+        if (previewSource != original || !proxyOriginal || proxyOriginal->get_width() != proxy_width ||
+            proxyOriginal->get_height() != proxy_height) {
+            previewProcessor = processor.createProxy(proxy_width, proxy_height);
+            previewSource = original;
+        }
+
+        previewProcessor.setLinearLight(processor.isLinearLight());
+        previewProcessor.applyLinearContrast(min_out, max_out);
+        filteredViewer.setPreview(previewProcessor.getFilteredPixbuf());
+        previewActive = true;
     }
 
     void on_show_histogram_clicked() {
         if (!processor.hasImage()) return;
 
-        auto histogram = processor.getHistogram();
-        HistogramDialog dialog(*this, histogram);
-        dialog.run();
+        if (!histogramDialog) {
+            histogramDialog = std::make_unique<HistogramDialog>(*this);
+            histogramDialog->signal_source_changed().connect([this]() { refreshHistogram(); });
+        }
+        histogramDialog->present();
+        refreshHistogram();
+    }
+
+    bool histogramVisible() const { return histogramDialog && histogramDialog->get_visible(); }
+
+    // Both histograms are cached by the processor, so this only sums tiles unless the
+    // image changed since they were last counted.
+    void refreshHistogram() {
+        if (!histogramVisible() || !processor.hasImage()) return;
+
+        histogramDialog->setHistogram(histogramDialog->showsOriginal() ? processor.getHistogram()
+                                                                       : processor.getFilteredHistogram());
     }
 
     void on_encode_and_save_rle_clicked() {
@@ -713,10 +1960,21 @@ class MainWindow : public Gtk::Window {
         if (dialog.run() == Gtk::RESPONSE_OK) {
             std::string filename = dialog.get_filename();
             if (!filename.empty()) {
-                if (processor.saveRLEToFile(filename)) {
-                    Gtk::MessageDialog success(*this, "RLE saved successfully", false, Gtk::MESSAGE_INFO);
-                    success.run();
-                }
+                auto saved = std::make_shared<bool>(false);
+                bool verify = verifyRLECheck.get_active();
+                runOperation("RLE encode", [filename, saved, verify](ImageProcessor& work) {
+                    work.setVerifyRLE(verify);
+                    *saved = work.saveRLEToFile(filename);
+                }, [this, saved]() {
+                    if (*saved) {
+                        Gtk::MessageDialog success(*this, "RLE saved successfully", false, Gtk::MESSAGE_INFO);
+                        success.run();
+                    } else if (processor.didRLEVerifyFail()) {
+                        Gtk::MessageDialog error(*this, "RLE verification failed: the decoded image differs", false,
+                                                 Gtk::MESSAGE_ERROR);
+                        error.run();
+                    }
+                });
             }
         }
     }
@@ -735,34 +1993,168 @@ class MainWindow : public Gtk::Window {
 
         if (dialog.run() == Gtk::RESPONSE_OK) {
             std::string filename = dialog.get_filename();
-            if (processor.loadRLEFromFile(filename)) {
-                processor.setOriginalFromFiltered();
-                updateImages();
-                Gtk::MessageDialog success(*this, "RLE loaded as original image", false, Gtk::MESSAGE_INFO);
-                success.run();
+            DecodedImageCache::Key key;
+            DecodedImageCache::keyOf(filename, key);
+            auto loaded = std::make_shared<bool>(false);
+            storeActiveDocument();
+            runOperation("RLE decode", [filename, loaded](ImageProcessor& work) {
+                if (work.loadRLEFromFile(filename)) {
+                    work.setOriginalFromFiltered();
+                    *loaded = true;
+                }
+            }, [this, filename, key, loaded]() {
+                if (*loaded) {
+                    addDocument(filename, key);
+                    Gtk::MessageDialog success(*this, "RLE loaded as original image", false, Gtk::MESSAGE_INFO);
+                    success.run();
+                }
+            });
+        }
+    }
+
+    void on_compare_clicked() {
+        if (!processor.hasImage()) return;
+
+        auto quality = std::make_shared<ImageQuality>();
+        auto measured = std::make_shared<bool>(false);
+        runOperation("Quality metrics", [quality, measured](ImageProcessor& work) {
+            *measured = work.measureQuality(work.getOriginalPixbuf(), *quality);
+        }, [this, quality, measured]() {
+            if (!*measured) {
+                Gtk::MessageDialog error(*this, "The filtered image has a different size than the original", false,
+                                         Gtk::MESSAGE_ERROR);
+                error.run();
+                return;
+            }
+
+            std::ostringstream text;
+            text << std::fixed << std::setprecision(3) << "MSE: " << quality->mse << "\nPSNR: ";
+            if (std::isinf(quality->psnr)) {
+                text << "infinite (identical)";
+            } else {
+                text << quality->psnr << " dB";
+            }
+            text << "\nMax abs difference: " << quality->maxAbsDifference << "\nSSIM: " << std::setprecision(5)
+                 << quality->ssim;
+            Gtk::MessageDialog result(*this, "Filtered vs original", false, Gtk::MESSAGE_INFO);
+            result.set_secondary_text(text.str());
+            result.run();
+        });
+    }
+
+    void on_export_trace_clicked() {
+        Gtk::FileChooserDialog dialog("Export trace", Gtk::FILE_CHOOSER_ACTION_SAVE);
+        dialog.set_transient_for(*this);
+
+        dialog.add_button("_Cancel", Gtk::RESPONSE_CANCEL);
+        dialog.add_button("_Save", Gtk::RESPONSE_OK);
+
+        auto filter_json = Gtk::FileFilter::create();
+        filter_json->set_name("Chrome trace files");
+        filter_json->add_pattern("*.json");
+        dialog.add_filter(filter_json);
+
+        dialog.set_current_name("lab2_trace.json");
+
+        if (dialog.run() == Gtk::RESPONSE_OK) {
+            std::string filename = dialog.get_filename();
+            if (!filename.empty() && !Profiler::instance().exportTrace(filename)) {
+                Gtk::MessageDialog error(*this, "Failed to write trace", false, Gtk::MESSAGE_ERROR);
+                error.run();
             }
         }
     }
 
+    void on_linear_light_toggled() {
+        processor.setLinearLight(linearLightCheck.get_active());
+        if (previewActive) renderContrastPreview();
+    }
+
     void on_reset_clicked() {
         if (!processor.hasImage()) return;
+        worker.cancel();
         processor.resetToOriginal();
         updateImages();
     }
 
     void updateImages() {
+        ProfileScope scope("display update", processor.getMegapixels());
+        static const char* original_labels[] = {"Original Image", "Original Image (16-bit)", "Original Image (float)"};
+        originalFrame.set_label(original_labels[static_cast<int>(processor.getSampleFormat())]);
         if (processor.hasImage()) {
             auto original = processor.getOriginalPixbuf();
             auto filtered = processor.getFilteredPixbuf();
 
             if (original) {
-                originalImage.set(original);
+                originalViewer.setImage(original);
             }
 
             if (filtered) {
-                filteredImage.set(filtered);
+                filteredViewer.setImage(filtered);
             }
         }
+
+        filteredViewer.clearPreview();
+        refreshHistogram();
+        previewActive = false;
+    }
+
+    // A contrast still shown only as a preview is applied first, on the worker, so the
+    // operation starts from the image on screen.
+    void runOperation(const std::string& name, std::function<void(ImageProcessor&)> operation,
+                      std::function<void()> done = nullptr) {
+        auto work = std::make_shared<ImageProcessor>(processor);
+        bool count_histogram = histogramVisible();
+        int preview_min = static_cast<int>(contrastMinScale.get_value());
+        int preview_max = static_cast<int>(contrastMaxScale.get_value());
+        bool preview = previewActive && preview_min < preview_max;
+        // The preview is applied here, so a pending commit would only cancel this job.
+        if (preview) contrastCommit.disconnect();
+
+        worker.run([work, operation, name, count_histogram, preview, preview_min, preview_max](JobControl& control) {
+            ProfileScope scope(name.c_str());
+            work->setJobControl(&control);
+            if (preview) work->applyLinearContrast(preview_min, preview_max);
+            operation(*work);
+            scope.setMegapixels(work->getMegapixels());
+
+            // Counted here rather than on the main thread when the result is shown.
+            if (count_histogram) work->getFilteredHistogram();
+        }, [this, work, done, name]() {
+            work->setJobControl(nullptr);
+            processor = *work;
+            processor.setLinearLight(linearLightCheck.get_active());
+            updateImages();
+            showTiming(name);
+            if (done) done();
+        });
+        progressBar.set_text(name);
+    }
+
+    void showTiming(const std::string& name) {
+        std::ostringstream text;
+        text << std::fixed << std::setprecision(1);
+
+        ProfileRecord operation;
+        bool has_operation = Profiler::instance().last(name, operation);
+
+        for (const std::string& record_name :
+             {name, std::string("first pixel"), std::string("rle verify"), std::string("display update")}) {
+            ProfileRecord record;
+            if (!Profiler::instance().last(record_name, record)) continue;
+            // Optional stages are shown only when they ended during this operation.
+            bool optional = record_name == "first pixel" || record_name == "rle verify";
+            if (optional && (!has_operation || record.startUs + record.durationUs < operation.startUs)) continue;
+
+            if (text.tellp() > 0) text << "  |  ";
+            text << record.name << ": " << record.durationUs / 1000 << " ms, "
+                 << record.megapixelsPerSecond() << " MP/s, "
+                 << record.bytesAllocated / (1024.0 * 1024.0) << " MB allocated, "
+                 << record.pixbufCopies << " pixbuf copies";
+        }
+
+        statusBar.remove_all_messages();
+        statusBar.push(text.str());
     }
 };
 
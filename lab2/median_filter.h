@@ -0,0 +1,146 @@
+#pragma once
+
+#include <glib.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Constant-time median filter after Perreault and Hébert, "Median Filtering in Constant
+// Time" (2007). Every column keeps a histogram of the 2r+1 pixels above and below the
+// current row, and the kernel histogram slides along the row by adding one column
+// histogram and subtracting another. Histograms are split into 16 coarse and 16x16 fine
+// bins; the fine kernel bins are only brought up to date for the coarse bin that holds
+// the median, so each pixel costs a fixed number of 16-lane additions for any radius.
+class MedianFilter {
+   public:
+    static constexpr int maxRadius = 127;
+
+    explicit MedianFilter(int radius) : radius(std::max(1, std::min(radius, maxRadius))) {}
+
+    int getRadius() const { return radius; }
+
+    // Filters rows [y_begin, y_end) of the first `channels` channels. Pixels outside the
+    // image are replaced by the nearest edge pixel.
+    void filterRows(const guint8* src, guint8* dst, int width, int height, int rowstride, int n_channels,
+                    int channels, int y_begin, int y_end) const {
+        std::vector<uint16_t> fine(static_cast<size_t>(width) * 256);
+        std::vector<uint16_t> coarse(static_cast<size_t>(width) * 16);
+
+        for (int channel = 0; channel < channels; channel++) {
+            std::fill(fine.begin(), fine.end(), 0);
+            std::fill(coarse.begin(), coarse.end(), 0);
+
+            for (int k = -radius; k <= radius; k++) {
+                addRow(src + clampRow(y_begin + k, height) * rowstride + channel, n_channels, width,
+                       fine.data(), coarse.data(), 1);
+            }
+
+            for (int y = y_begin; y < y_end; ++y) {
+                if (y > y_begin) {
+                    addRow(src + clampRow(y - radius - 1, height) * rowstride + channel, n_channels, width,
+                           fine.data(), coarse.data(), -1);
+                    addRow(src + clampRow(y + radius, height) * rowstride + channel, n_channels, width,
+                           fine.data(), coarse.data(), 1);
+                }
+                filterRow(fine.data(), coarse.data(), width, dst + static_cast<size_t>(y) * rowstride + channel,
+                          n_channels);
+            }
+        }
+    }
+
+   private:
+    int radius;
+
+    static size_t clampRow(int y, int height) { return static_cast<size_t>(std::max(0, std::min(y, height - 1))); }
+
+    int column(int x, int width) const { return std::max(0, std::min(x, width - 1)); }
+
+    static void addRow(const guint8* row, int n_channels, int width, uint16_t* fine, uint16_t* coarse, int sign) {
+        for (int x = 0; x < width; ++x) {
+            int value = row[x * n_channels];
+            fine[x * 256 + value] += sign;
+            coarse[x * 16 + (value >> 4)] += sign;
+        }
+    }
+
+    // dst[i] += add[i] - sub[i] for 16 lanes.
+    static void slide16(uint16_t* dst, const uint16_t* add, const uint16_t* sub) {
+#if defined(__SSE2__)
+        for (int i = 0; i < 16; i += 8) {
+            __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+            __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(add + i));
+            __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(sub + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_sub_epi16(_mm_add_epi16(d, a), s));
+        }
+#else
+        for (int i = 0; i < 16; i++) dst[i] = static_cast<uint16_t>(dst[i] + add[i] - sub[i]);
+#endif
+    }
+
+    static void add16(uint16_t* dst, const uint16_t* add) {
+#if defined(__SSE2__)
+        for (int i = 0; i < 16; i += 8) {
+            __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+            __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(add + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_add_epi16(d, a));
+        }
+#else
+        for (int i = 0; i < 16; i++) dst[i] = static_cast<uint16_t>(dst[i] + add[i]);
+#endif
+    }
+
+    void filterRow(const uint16_t* fine, const uint16_t* coarse, int width, guint8* dst, int n_channels) const {
+        const int window = 2 * radius + 1;
+        const int rank = window * window / 2;
+
+        alignas(16) uint16_t kernel_coarse[16] = {0};
+        alignas(16) uint16_t kernel_fine[256];
+        int updated_at[16];
+
+        for (int k = -radius; k <= radius; k++) {
+            add16(kernel_coarse, coarse + column(k, width) * 16);
+        }
+        std::fill(updated_at, updated_at + 16, -window - 1);
+
+        for (int x = 0; x < width; ++x) {
+            if (x > 0) {
+                slide16(kernel_coarse, coarse + column(x + radius, width) * 16,
+                        coarse + column(x - radius - 1, width) * 16);
+            }
+
+            int bucket = 0;
+            int below = 0;
+            while (below + kernel_coarse[bucket] <= rank) {
+                below += kernel_coarse[bucket];
+                bucket++;
+            }
+
+            uint16_t* bins = kernel_fine + bucket * 16;
+            const int offset = bucket * 16;
+            if (x - updated_at[bucket] >= window) {
+                std::memset(bins, 0, 16 * sizeof(uint16_t));
+                for (int k = x - radius; k <= x + radius; k++) {
+                    add16(bins, fine + column(k, width) * 256 + offset);
+                }
+            } else {
+                for (int j = updated_at[bucket] + 1; j <= x; j++) {
+                    slide16(bins, fine + column(j + radius, width) * 256 + offset,
+                            fine + column(j - radius - 1, width) * 256 + offset);
+                }
+            }
+            updated_at[bucket] = x;
+
+            int bin = 0;
+            while (below + bins[bin] <= rank) {
+                below += bins[bin];
+                bin++;
+            }
+            dst[x * n_channels] = static_cast<guint8>(offset + bin);
+        }
+    }
+};
@@ -0,0 +1,178 @@
+#pragma once
+
+#include <glib.h>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+enum class MorphologyOp { Erode, Dilate, Open, Close };
+
+// Erosion (running minimum) or dilation (running maximum) over a rectangle of
+// (2 radius_x + 1) x (2 radius_y + 1) pixels, separably, with the van Herk/Gil-Werman
+// algorithm. The padded line is cut into blocks of the window length. A suffix pass stores
+// the running extreme from every position to the end of its block, and a prefix pass keeps
+// it from the block start. Every window then spans exactly one block boundary, so its
+// result is one more comparison of the two. That is three comparisons per value whatever
+// the radius. Positions outside the image count as 255 for erosion and 0 for dilation, so
+// windows are clipped to the image.
+//
+// Both passes treat pixels as runs of bytes, so any channel count works: RGB(A) pixbufs
+// per channel, or a one-byte plane for grayscale. The vertical pass works on whole rows of
+// bytes in SSE2 registers, across columns. The horizontal pass follows each channel along
+// its row.
+class Morphology {
+   public:
+    // Vertical strips are this many bytes wide: their suffix buffers stay small and
+    // rows are still long enough to stream.
+    static constexpr int stripBytes = 256;
+
+    Morphology(int radius_x, int radius_y, bool dilate)
+        : radiusX(std::max(0, radius_x)), radiusY(std::max(0, radius_y)), dilate(dilate) {}
+
+    // Filters bytes [x_begin, x_end) of every row down the columns, from `src` to `dst`.
+    void verticalStrip(const guint8* src, guint8* dst, int rowstride, int height, int x_begin, int x_end) const {
+        if (dilate) {
+            verticalStrip<MaxOp>(src, dst, rowstride, height, x_begin, x_end);
+        } else {
+            verticalStrip<MinOp>(src, dst, rowstride, height, x_begin, x_end);
+        }
+    }
+
+    // Filters rows [y_begin, y_end) along x, from `src` to `dst`. Pixels are `n_channels`
+    // bytes apart and the first `channels` of them are written; the rest of `dst` is kept.
+    void horizontalRows(const guint8* src, guint8* dst, int rowstride, int n_channels, int channels, int width,
+                        int y_begin, int y_end) const {
+        if (dilate) {
+            horizontalRows<MaxOp>(src, dst, rowstride, n_channels, channels, width, y_begin, y_end);
+        } else {
+            horizontalRows<MinOp>(src, dst, rowstride, n_channels, channels, width, y_begin, y_end);
+        }
+    }
+
+   private:
+    int radiusX, radiusY;
+    bool dilate;
+
+    struct MinOp {
+        static constexpr guint8 identity = 255;
+        static guint8 apply(guint8 a, guint8 b) { return std::min(a, b); }
+#if defined(__SSE2__)
+        static __m128i apply(__m128i a, __m128i b) { return _mm_min_epu8(a, b); }
+#endif
+    };
+
+    struct MaxOp {
+        static constexpr guint8 identity = 0;
+        static guint8 apply(guint8 a, guint8 b) { return std::max(a, b); }
+#if defined(__SSE2__)
+        static __m128i apply(__m128i a, __m128i b) { return _mm_max_epu8(a, b); }
+#endif
+    };
+
+    // out[i] = Op(a[i], b[i]) for `n` bytes; `out` may be `a`.
+    template <typename Op>
+    static void combineBytes(const guint8* a, const guint8* b, guint8* out, int n) {
+        int i = 0;
+#if defined(__SSE2__)
+        for (; i + 16 <= n; i += 16) {
+            __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+            __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), Op::apply(va, vb));
+        }
+#endif
+        for (; i < n; i++) out[i] = Op::apply(a[i], b[i]);
+    }
+
+    template <typename Op>
+    void verticalStrip(const guint8* src, guint8* dst, int rowstride, int height, int x_begin, int x_end) const {
+        const int bytes = x_end - x_begin;
+        const int radius = std::min(radiusY, height - 1);
+        if (radius == 0) {
+            for (int y = 0; y < height; ++y) {
+                std::memcpy(dst + static_cast<size_t>(y) * rowstride + x_begin,
+                            src + static_cast<size_t>(y) * rowstride + x_begin, bytes);
+            }
+            return;
+        }
+
+        // Padded position t is image row t - radius.
+        const int length = height + 2 * radius, block = 2 * radius + 1;
+        const std::vector<guint8> outside(bytes, Op::identity);
+        auto row = [&](int t) {
+            const int y = t - radius;
+            return y < 0 || y >= height ? outside.data() : src + static_cast<size_t>(y) * rowstride + x_begin;
+        };
+
+        std::vector<guint8> suffix(static_cast<size_t>(length) * bytes);
+        for (int t = length - 1; t >= 0; --t) {
+            guint8* s = suffix.data() + static_cast<size_t>(t) * bytes;
+            if (t == length - 1 || (t + 1) % block == 0) {
+                std::memcpy(s, row(t), bytes);
+            } else {
+                combineBytes<Op>(row(t), s + bytes, s, bytes);
+            }
+        }
+
+        // Output row y is the window [y, y + 2 radius] in padded positions.
+        std::vector<guint8> prefix(bytes);
+        for (int t = 0; t < length; ++t) {
+            if (t % block == 0) {
+                std::memcpy(prefix.data(), row(t), bytes);
+            } else {
+                combineBytes<Op>(prefix.data(), row(t), prefix.data(), bytes);
+            }
+            const int y = t - 2 * radius;
+            if (y < 0) continue;
+            combineBytes<Op>(suffix.data() + static_cast<size_t>(y) * bytes, prefix.data(),
+                             dst + static_cast<size_t>(y) * rowstride + x_begin, bytes);
+        }
+    }
+
+    template <typename Op>
+    void horizontalRows(const guint8* src, guint8* dst, int rowstride, int n_channels, int channels, int width,
+                        int y_begin, int y_end) const {
+        const int radius = std::min(radiusX, width - 1);
+        const int length = width + 2 * radius, block = 2 * radius + 1;
+        const int pad = radius * channels, row_values = width * channels;
+
+        // The row with `channels` values per pixel and `radius` pixels of padding at both
+        // ends; the prefix pass overwrites it in place.
+        std::vector<guint8> line(static_cast<size_t>(length) * channels);
+        std::vector<guint8> suffix(line.size()), out(row_values);
+
+        for (int y = y_begin; y < y_end; ++y) {
+            const guint8* s = src + static_cast<size_t>(y) * rowstride;
+            guint8* d = dst + static_cast<size_t>(y) * rowstride;
+            if (radius == 0) {
+                for (int x = 0; x < width; ++x) std::memcpy(d + x * n_channels, s + x * n_channels, channels);
+                continue;
+            }
+
+            std::fill(line.begin(), line.begin() + pad, Op::identity);
+            std::fill(line.end() - pad, line.end(), Op::identity);
+            if (n_channels == channels) {
+                std::memcpy(line.data() + pad, s, row_values);
+            } else {
+                for (int x = 0; x < width; ++x) std::memcpy(line.data() + pad + x * channels, s + x * n_channels, channels);
+            }
+
+            for (int start = 0; start < length; start += block) {
+                const int begin = start * channels, end = std::min(length, start + block) * channels;
+                std::memcpy(suffix.data() + end - channels, line.data() + end - channels, channels);
+                for (int i = end - channels - 1; i >= begin; --i) suffix[i] = Op::apply(line[i], suffix[i + channels]);
+                for (int i = begin + channels; i < end; ++i) line[i] = Op::apply(line[i], line[i - channels]);
+            }
+
+            // Output pixel x is the window [x, x + 2 radius] in padded positions.
+            guint8* o = n_channels == channels ? d : out.data();
+            combineBytes<Op>(suffix.data(), line.data() + 2 * pad, o, row_values);
+            if (o != d) {
+                for (int x = 0; x < width; ++x) std::memcpy(d + x * n_channels, o + x * channels, channels);
+            }
+        }
+    }
+};
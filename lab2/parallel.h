@@ -0,0 +1,112 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent worker threads shared by all image operations. Any number of threads may
+// submit batches at once; the submitting thread always works on its own batch too, so
+// nested or concurrent calls never wait on an idle pool.
+class ThreadPool {
+   public:
+    static ThreadPool& instance() {
+        static ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()));
+        return pool;
+    }
+
+    explicit ThreadPool(unsigned thread_count) : threadCount(thread_count) {
+        for (unsigned i = 1; i < thread_count; i++) {
+            workers.emplace_back([this]() { workerLoop(); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wakeWorkers.notify_all();
+        for (auto& worker : workers) worker.join();
+    }
+
+    int size() const { return static_cast<int>(threadCount); }
+
+    // Calls task(i) for every i in [0, count) and returns when all calls have finished.
+    void run(int count, const std::function<void(int)>& task) {
+        if (count <= 0) return;
+        if (count == 1 || workers.empty()) {
+            for (int i = 0; i < count; i++) task(i);
+            return;
+        }
+
+        auto batch = std::make_shared<Batch>();
+        batch->task = &task;
+        batch->count = count;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            batches.push_back(batch);
+        }
+        wakeWorkers.notify_all();
+
+        work(*batch);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        batchDone.wait(lock, [&]() { return batch->finished == batch->count; });
+    }
+
+   private:
+    struct Batch {
+        const std::function<void(int)>* task = nullptr;
+        int count = 0;
+        std::atomic<int> next{0};
+        int finished = 0;
+    };
+
+    unsigned threadCount;
+    std::vector<std::thread> workers;
+    std::deque<std::shared_ptr<Batch>> batches;
+    std::mutex mutex;
+    std::condition_variable wakeWorkers;
+    std::condition_variable batchDone;
+    bool stopping = false;
+
+    void work(Batch& batch) {
+        int completed = 0;
+        for (int i = batch.next++; i < batch.count; i = batch.next++) {
+            (*batch.task)(i);
+            completed++;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = std::find_if(batches.begin(), batches.end(),
+                               [&](const std::shared_ptr<Batch>& queued) { return queued.get() == &batch; });
+        if (it != batches.end()) batches.erase(it);
+
+        batch.finished += completed;
+        if (batch.finished == batch.count) batchDone.notify_all();
+    }
+
+    void workerLoop() {
+        while (true) {
+            std::shared_ptr<Batch> batch;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wakeWorkers.wait(lock, [&]() { return stopping || !batches.empty(); });
+                if (stopping) return;
+                batch = batches.front();
+            }
+            work(*batch);
+        }
+    }
+};
+
+template <typename F>
+void parallelFor(int count, F task) {
+    ThreadPool::instance().run(count, std::function<void(int)>(task));
+}
@@ -0,0 +1,466 @@
+#pragma once
+
+#include <glib.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#include "srgb.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+enum class SampleFormat { UInt8, UInt16, Float32 };
+
+// Sample types of the deep pipeline. Integer samples span [0, white] and are sRGB coded,
+// as in PNG; float samples are linear light with 1 as nominal white and no upper limit,
+// as in PFM.
+template <typename T>
+struct SampleTraits;
+
+template <>
+struct SampleTraits<guint8> {
+    static constexpr SampleFormat format = SampleFormat::UInt8;
+    static constexpr float white = 255;
+};
+
+template <>
+struct SampleTraits<uint16_t> {
+    static constexpr SampleFormat format = SampleFormat::UInt16;
+    static constexpr float white = 65535;
+};
+
+template <>
+struct SampleTraits<float> {
+    static constexpr SampleFormat format = SampleFormat::Float32;
+    static constexpr float white = 1;
+};
+
+// Interleaved samples without row padding: gray, gray + alpha, RGB or RGBA.
+template <typename T>
+class PixelBuffer {
+   public:
+    using Sample = T;
+
+    PixelBuffer(int width, int height, int channels)
+        : width(width), height(height), channels(channels),
+          samples(static_cast<size_t>(width) * channels * height) {}
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    int getChannels() const { return channels; }
+    // All channels but a trailing alpha.
+    int colorChannels() const { return channels == 2 || channels == 4 ? channels - 1 : channels; }
+    size_t rowSamples() const { return static_cast<size_t>(width) * channels; }
+    size_t getBytes() const { return samples.size() * sizeof(T); }
+
+    T* row(int y) { return samples.data() + y * rowSamples(); }
+    const T* row(int y) const { return samples.data() + y * rowSamples(); }
+
+   private:
+    int width, height, channels;
+    std::vector<T> samples;
+};
+
+// The 16-bit or float image behind a processor's 8-bit pixbufs, shared between copies of
+// the processor. At most one of the two is set; neither for an 8-bit image.
+struct DeepImage {
+    std::shared_ptr<const PixelBuffer<uint16_t>> wide;
+    std::shared_ptr<const PixelBuffer<float>> hdr;
+
+    DeepImage() = default;
+    DeepImage(std::shared_ptr<const PixelBuffer<uint16_t>> image) : wide(std::move(image)) {}
+    DeepImage(std::shared_ptr<const PixelBuffer<float>> image) : hdr(std::move(image)) {}
+
+    explicit operator bool() const { return wide || hdr; }
+
+    SampleFormat format() const {
+        return wide ? SampleFormat::UInt16 : hdr ? SampleFormat::Float32 : SampleFormat::UInt8;
+    }
+
+    template <typename F>
+    void visit(F&& f) const {
+        if (wide) {
+            f(*wide);
+        } else if (hdr) {
+            f(*hdr);
+        }
+    }
+};
+
+// Row kernels over PixelBuffer<T> for the three sample types. Every SIMD path converts
+// samples to floats four to a register, through SampleVectors<T>, and works there; a
+// register of interleaved samples starts at some channel, its phase, and constants are
+// kept per phase. The scalar paths do the same float arithmetic in the same order, so
+// both give identical results.
+class PixelKernels {
+   public:
+    // Per-channel minimum and maximum of rows [y_begin, y_end), merged into lo and hi.
+    template <typename T>
+    static void rangeRows(const PixelBuffer<T>& image, int y_begin, int y_end, float* lo, float* hi) {
+        const int channels = image.getChannels();
+        const int n = static_cast<int>(image.rowSamples());
+
+#if defined(__SSE2__)
+        using V = SampleVectors<T>;
+        const int step = 4 % channels;
+        __m128 low[4], high[4];
+        for (int phase = 0; phase < channels; phase++) {
+            low[phase] = _mm_set1_ps(std::numeric_limits<float>::infinity());
+            high[phase] = _mm_set1_ps(-std::numeric_limits<float>::infinity());
+        }
+#endif
+
+        for (int y = y_begin; y < y_end; ++y) {
+            const T* p = image.row(y);
+            int i = 0;
+#if defined(__SSE2__)
+            int phase = 0;
+            for (; i + V::samples <= n; i += V::samples) {
+                __m128 v[V::vectors];
+                V::load(p + i, v);
+                for (int j = 0; j < V::vectors; j++) {
+                    low[phase] = _mm_min_ps(low[phase], v[j]);
+                    high[phase] = _mm_max_ps(high[phase], v[j]);
+                    phase += step;
+                    if (phase >= channels) phase -= channels;
+                }
+            }
+#endif
+            for (; i < n; i++) {
+                const int c = i % channels;
+                lo[c] = std::min(lo[c], static_cast<float>(p[i]));
+                hi[c] = std::max(hi[c], static_cast<float>(p[i]));
+            }
+        }
+
+#if defined(__SSE2__)
+        for (int phase = 0; phase < channels; phase++) {
+            alignas(16) float lanes_lo[4], lanes_hi[4];
+            _mm_store_ps(lanes_lo, low[phase]);
+            _mm_store_ps(lanes_hi, high[phase]);
+            for (int k = 0; k < 4; k++) {
+                const int c = (phase + k) % channels;
+                lo[c] = std::min(lo[c], lanes_lo[k]);
+                hi[c] = std::max(hi[c], lanes_hi[k]);
+            }
+        }
+#endif
+    }
+
+    // dst = clamp(src * scale[c] + offset[c]) over rows [y_begin, y_end), clamped to
+    // [0, white] for integers and at 0 for float. An alpha channel given scale 1 and
+    // offset 0 comes through unchanged.
+    template <typename T>
+    static void affineRows(const PixelBuffer<T>& src, PixelBuffer<T>& dst, const float* scale, const float* offset,
+                           int y_begin, int y_end) {
+        const int channels = src.getChannels();
+        const int n = static_cast<int>(src.rowSamples());
+        const float limit = upperLimit<T>();
+
+#if defined(__SSE2__)
+        using V = SampleVectors<T>;
+        const int step = 4 % channels;
+        __m128 scales[4], offsets[4];
+        for (int phase = 0; phase < channels; phase++) {
+            scales[phase] = _mm_setr_ps(scale[phase % channels], scale[(phase + 1) % channels],
+                                        scale[(phase + 2) % channels], scale[(phase + 3) % channels]);
+            offsets[phase] = _mm_setr_ps(offset[phase % channels], offset[(phase + 1) % channels],
+                                         offset[(phase + 2) % channels], offset[(phase + 3) % channels]);
+        }
+        const __m128 zero = _mm_setzero_ps(), upper = _mm_set1_ps(limit);
+#endif
+
+        for (int y = y_begin; y < y_end; ++y) {
+            const T* s = src.row(y);
+            T* d = dst.row(y);
+            int i = 0;
+#if defined(__SSE2__)
+            int phase = 0;
+            for (; i + V::samples <= n; i += V::samples) {
+                __m128 v[V::vectors];
+                V::load(s + i, v);
+                for (int j = 0; j < V::vectors; j++) {
+                    v[j] = _mm_min_ps(_mm_max_ps(_mm_add_ps(_mm_mul_ps(v[j], scales[phase]), offsets[phase]), zero),
+                                      upper);
+                    phase += step;
+                    if (phase >= channels) phase -= channels;
+                }
+                V::store(d + i, v);
+            }
+#endif
+            for (; i < n; i++) {
+                const int c = i % channels;
+                d[i] = fromFloat<T>(std::min(std::max(s[i] * scale[c] + offset[c], 0.0f), limit));
+            }
+        }
+    }
+
+    // Rows [y_begin, y_end) of `dst` as a box-filtered reduction of `src`: every output
+    // sample is the mean of the block of source samples it covers.
+    template <typename T>
+    static void shrinkRows(const PixelBuffer<T>& src, PixelBuffer<T>& dst, int y_begin, int y_end) {
+        const int channels = src.getChannels();
+        const int src_width = src.getWidth(), src_height = src.getHeight();
+        const int dst_width = dst.getWidth(), dst_height = dst.getHeight();
+        std::vector<int> x_begin(dst_width), x_end(dst_width);
+        for (int x = 0; x < dst_width; ++x) {
+            x_begin[x] = static_cast<int>(static_cast<int64_t>(x) * src_width / dst_width);
+            x_end[x] = std::max(x_begin[x] + 1, static_cast<int>(static_cast<int64_t>(x + 1) * src_width / dst_width));
+        }
+
+        std::vector<double> sums(dst.rowSamples());
+        for (int y = y_begin; y < y_end; ++y) {
+            const int sy_begin = static_cast<int>(static_cast<int64_t>(y) * src_height / dst_height);
+            const int sy_end = std::max(sy_begin + 1, static_cast<int>(static_cast<int64_t>(y + 1) * src_height / dst_height));
+            std::fill(sums.begin(), sums.end(), 0.0);
+            for (int sy = sy_begin; sy < sy_end; ++sy) {
+                const T* s = src.row(sy);
+                for (int x = 0; x < dst_width; ++x) {
+                    double* sum = sums.data() + static_cast<size_t>(x) * channels;
+                    for (int sx = x_begin[x]; sx < x_end[x]; ++sx) {
+                        for (int c = 0; c < channels; c++) sum[c] += s[sx * channels + c];
+                    }
+                }
+            }
+
+            T* d = dst.row(y);
+            for (int x = 0; x < dst_width; ++x) {
+                const double count = static_cast<double>(sy_end - sy_begin) * (x_end[x] - x_begin[x]);
+                for (int c = 0; c < channels; c++) {
+                    const size_t i = static_cast<size_t>(x) * channels + c;
+                    d[i] = fromFloat<T>(static_cast<float>(sums[i] / count));
+                }
+            }
+        }
+    }
+
+    // Display bytes of rows [y_begin, y_end) in a pixbuf of `dst_channels` (3 or 4):
+    // 16-bit samples rounded to 8 bits, float samples sRGB coded through SrgbTables,
+    // gray repeated into R, G and B.
+    template <typename T>
+    static void displayRows(const PixelBuffer<T>& image, guint8* dst, int dst_rowstride, int dst_channels, int y_begin,
+                            int y_end) {
+        const int channels = image.getChannels(), width = image.getWidth();
+        const int colors = image.colorChannels();
+        const bool alpha = colors != channels;
+        const int n = static_cast<int>(image.rowSamples());
+        std::vector<guint8> bytes(n);
+
+        for (int y = y_begin; y < y_end; ++y) {
+            const T* p = image.row(y);
+            toDisplayBytes(p, n, channels, colors, bytes.data());
+
+            guint8* d = dst + static_cast<size_t>(y) * dst_rowstride;
+            if (channels == dst_channels) {
+                std::memcpy(d, bytes.data(), n);
+                continue;
+            }
+            for (int x = 0; x < width; ++x, d += dst_channels) {
+                const guint8* b = bytes.data() + static_cast<size_t>(x) * channels;
+                d[0] = b[0];
+                d[1] = b[colors > 1 ? 1 : 0];
+                d[2] = b[colors > 1 ? 2 : 0];
+                if (dst_channels == 4) d[3] = alpha ? b[channels - 1] : 255;
+            }
+        }
+    }
+
+    // Samples counted per channel into `bins` bins of [lo[c], hi[c]]: one bin per value
+    // for integers, where lo and hi are ignored. counts holds channels * bins entries.
+    template <typename T>
+    static void histogramRows(const PixelBuffer<T>& image, int y_begin, int y_end, int bins, const float* lo,
+                              const float* hi, uint32_t* counts) {
+        const int channels = image.getChannels();
+        const int n = static_cast<int>(image.rowSamples());
+        for (int y = y_begin; y < y_end; ++y) {
+            const T* p = image.row(y);
+            for (int i = 0; i < n; i++) {
+                const int c = i % channels;
+                counts[static_cast<size_t>(c) * bins + binOf(p[i], bins, lo[c], hi[c])]++;
+            }
+        }
+    }
+
+    // Maps rows through per-channel equalization curves built by equalizationCurve: a
+    // table lookup for integers, linear interpolation within the bin for float. Channels
+    // without a curve are copied, as are constant float channels, which have no bins.
+    template <typename T>
+    static void equalizeRows(const PixelBuffer<T>& src, PixelBuffer<T>& dst, const std::vector<float>* curves,
+                             int bins, const float* lo, const float* hi, int y_begin, int y_end) {
+        const int channels = src.getChannels();
+        const int n = static_cast<int>(src.rowSamples());
+        for (int y = y_begin; y < y_end; ++y) {
+            const T* s = src.row(y);
+            T* d = dst.row(y);
+            for (int i = 0; i < n; i++) {
+                const int c = i % channels;
+                const std::vector<float>& curve = curves[c];
+                if (curve.empty() || (!std::is_integral<T>::value && !(hi[c] > lo[c]))) {
+                    d[i] = s[i];
+                } else if (std::is_integral<T>::value) {
+                    d[i] = fromFloat<T>(curve[static_cast<size_t>(s[i]) + 1] * SampleTraits<T>::white);
+                } else {
+                    const float position = std::min(std::max((s[i] - lo[c]) * bins / (hi[c] - lo[c]), 0.0f),
+                                                    static_cast<float>(bins));
+                    const int bin = std::min(static_cast<int>(position), bins - 1);
+                    const float fraction = position - bin;
+                    d[i] = fromFloat<T>(curve[bin] + (curve[bin + 1] - curve[bin]) * fraction);
+                }
+            }
+        }
+    }
+
+    // The normalized cumulative histogram of one channel: curve[k] is the share of
+    // samples below bin k, from 0 at the first occupied bin to 1 past the last.
+    static std::vector<float> equalizationCurve(const uint32_t* counts, int bins) {
+        uint64_t total = 0, first = 0;
+        for (int b = 0; b < bins; b++) total += counts[b];
+        for (int b = 0; b < bins; b++) {
+            if (counts[b]) {
+                first = counts[b];
+                break;
+            }
+        }
+
+        std::vector<float> curve(static_cast<size_t>(bins) + 1, 0.0f);
+        if (total <= first) return curve;
+        uint64_t below = 0;
+        for (int b = 0; b < bins; b++) {
+            below += counts[b];
+            curve[b + 1] = below > first ? static_cast<float>(below - first) / (total - first) : 0.0f;
+        }
+        return curve;
+    }
+
+    template <typename T>
+    static T fromFloat(float value) {
+        if (std::is_integral<T>::value) return static_cast<T>(std::nearbyint(value));
+        return static_cast<T>(value);
+    }
+
+   private:
+    template <typename T>
+    static float upperLimit() {
+        return std::is_integral<T>::value ? SampleTraits<T>::white : std::numeric_limits<float>::infinity();
+    }
+
+    template <typename T>
+    static int binOf(T value, int bins, float lo, float hi) {
+        if (std::is_integral<T>::value) return static_cast<int>(value);
+        if (!(hi > lo)) return 0;
+        return std::min(bins - 1, std::max(0, static_cast<int>((value - lo) * bins / (hi - lo))));
+    }
+
+    static void toDisplayBytes(const guint8* p, int n, int, int, guint8* out) { std::memcpy(out, p, n); }
+
+    // round(v / 257) as ((v * 65281 >> 16) + 128) >> 8, exact for every 16-bit value.
+    static void toDisplayBytes(const uint16_t* p, int n, int, int, guint8* out) {
+        int i = 0;
+#if defined(__SSE2__)
+        const __m128i factor = _mm_set1_epi16(static_cast<short>(65281)), half = _mm_set1_epi16(128);
+        for (; i + 16 <= n; i += 16) {
+            __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+            __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i + 8));
+            a = _mm_srli_epi16(_mm_add_epi16(_mm_mulhi_epu16(a, factor), half), 8);
+            b = _mm_srli_epi16(_mm_add_epi16(_mm_mulhi_epu16(b, factor), half), 8);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packus_epi16(a, b));
+        }
+#endif
+        for (; i < n; i++) out[i] = static_cast<guint8>(((p[i] * 65281u >> 16) + 128) >> 8);
+    }
+
+    // Colors through the 12-bit linear code of SrgbTables; alpha is coverage, not light,
+    // and only scales to 0..255. NaN shows as 0 on both paths: _mm_max_ps returns its
+    // second operand when either is NaN, and the scalar clamp tests `v > 0` first.
+    static void toDisplayBytes(const float* p, int n, int channels, int colors, guint8* out) {
+        const SrgbTables& srgb = SrgbTables::instance();
+        constexpr float codes = SrgbTables::linearCodes - 1;
+        int i = 0;
+#if defined(__SSE2__)
+        const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+        const __m128 scale = _mm_set1_ps(codes), half = _mm_set1_ps(0.5f);
+        alignas(16) int32_t lanes[4];
+        for (; i + 4 <= n; i += 4) {
+            __m128 v = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(p + i), zero), one);
+            _mm_store_si128(reinterpret_cast<__m128i*>(lanes), _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(v, scale), half)));
+            for (int k = 0; k < 4; k++) out[i + k] = srgb.fromLinearCode[lanes[k]];
+        }
+#endif
+        for (; i < n; i++) out[i] = srgb.fromLinearCode[static_cast<int>(unitClamp(p[i]) * codes + 0.5f)];
+        if (colors != channels) {
+            for (int a = channels - 1; a < n; a += channels) {
+                out[a] = static_cast<guint8>(unitClamp(p[a]) * 255.0f + 0.5f);
+            }
+        }
+    }
+
+    static float unitClamp(float v) { return !(v > 0.0f) ? 0.0f : std::min(v, 1.0f); }
+
+#if defined(__SSE2__)
+    // Loads and stores `samples` samples as `vectors` registers of four floats. Stores
+    // expect values already clamped to the sample range and round to nearest even, as
+    // std::nearbyint does in the scalar paths.
+    template <typename T>
+    struct SampleVectors;
+#endif
+};
+
+#if defined(__SSE2__)
+template <>
+struct PixelKernels::SampleVectors<guint8> {
+    static constexpr int samples = 16, vectors = 4;
+
+    static void load(const guint8* p, __m128* v) {
+        const __m128i zero = _mm_setzero_si128();
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i lo = _mm_unpacklo_epi8(bytes, zero), hi = _mm_unpackhi_epi8(bytes, zero);
+        v[0] = _mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero));
+        v[1] = _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero));
+        v[2] = _mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero));
+        v[3] = _mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero));
+    }
+
+    static void store(guint8* p, const __m128* v) {
+        __m128i lo = _mm_packs_epi32(_mm_cvtps_epi32(v[0]), _mm_cvtps_epi32(v[1]));
+        __m128i hi = _mm_packs_epi32(_mm_cvtps_epi32(v[2]), _mm_cvtps_epi32(v[3]));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(p), _mm_packus_epi16(lo, hi));
+    }
+};
+
+// SSE2 has no unsigned 32-to-16-bit pack: values are biased into the signed range,
+// packed with saturation that never triggers, and the bias flipped back.
+template <>
+struct PixelKernels::SampleVectors<uint16_t> {
+    static constexpr int samples = 8, vectors = 2;
+
+    static void load(const uint16_t* p, __m128* v) {
+        const __m128i zero = _mm_setzero_si128();
+        __m128i words = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        v[0] = _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero));
+        v[1] = _mm_cvtepi32_ps(_mm_unpackhi_epi16(words, zero));
+    }
+
+    static void store(uint16_t* p, const __m128* v) {
+        const __m128i bias = _mm_set1_epi32(32768);
+        __m128i lo = _mm_sub_epi32(_mm_cvtps_epi32(v[0]), bias);
+        __m128i hi = _mm_sub_epi32(_mm_cvtps_epi32(v[1]), bias);
+        __m128i packed = _mm_xor_si128(_mm_packs_epi32(lo, hi), _mm_set1_epi16(static_cast<short>(0x8000)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(p), packed);
+    }
+};
+
+template <>
+struct PixelKernels::SampleVectors<float> {
+    static constexpr int samples = 4, vectors = 1;
+
+    static void load(const float* p, __m128* v) { v[0] = _mm_loadu_ps(p); }
+    static void store(float* p, const __m128* v) { _mm_storeu_ps(p, v[0]); }
+};
+#endif
@@ -0,0 +1,246 @@
+#pragma once
+
+#include <glib.h>
+#include <zlib.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <ostream>
+#include <vector>
+
+// Row filter written before every scanline. Adaptive tries all five on each row and keeps
+// the one with the smallest sum of absolute values, the heuristic libpng uses by default.
+enum class PngFilter { None, Sub, Up, Average, Paeth, Adaptive };
+
+// PNG encoder whose deflate runs on independent chunks, as pigz does. It writes 8-bit
+// samples from pixbuf rows or 16-bit samples from rows of host-order uint16_t, with 1 to
+// 4 channels: gray, gray + alpha, RGB or RGBA.
+// Rows are filtered first; each chunk of about chunkBytes of filtered data is then
+// deflated by its own stream, primed with the 32 KiB before it as a preset dictionary so
+// matches still reach back across the boundary. Every chunk but the last ends with a sync
+// flush, which closes it on a byte boundary with an empty stored block, so the chunks
+// concatenate into one valid zlib stream. Its Adler-32 is combined from those of the
+// chunks. Each chunk becomes one IDAT.
+//
+// filterRows and compressChunk may run in parallel over disjoint rows and chunks, but all
+// rows must be filtered before any chunk is compressed.
+class PngEncoder {
+   public:
+    static constexpr size_t chunkBytes = 256 * 1024;
+    static constexpr size_t windowBytes = 32 * 1024;
+
+    PngEncoder(const guint8* pixels, int rowstride, int n_channels, int width, int height, int level,
+               PngFilter filter, int bit_depth = 8)
+        : pixels(pixels), rowstride(rowstride), channels(n_channels), width(width), height(height),
+          level(std::min(9, std::max(0, level))), bitDepth(bit_depth == 16 ? 16 : 8), filter(filter),
+          pixelBytes(n_channels * bitDepth / 8), lineBytes(static_cast<size_t>(width) * pixelBytes + 1),
+          chunkRows(static_cast<int>(std::max<size_t>(1, chunkBytes / lineBytes))),
+          filtered(lineBytes * height), chunks((height + chunkRows - 1) / chunkRows) {}
+
+    int chunkCount() const { return static_cast<int>(chunks.size()); }
+
+    void filterRows(int y_begin, int y_end) {
+        const int bytes = width * pixelBytes;
+        std::vector<guint8> candidates;
+        if (filter == PngFilter::Adaptive) candidates.resize(static_cast<size_t>(5) * bytes);
+
+        // 16-bit rows are made big-endian first, the row above as well.
+        std::vector<guint8> current, above;
+        const guint8* row = y_begin > 0 ? sourceRow(y_begin - 1, above) : nullptr;
+        for (int y = y_begin; y < y_end; ++y) {
+            const guint8* previous = row;
+            row = sourceRow(y, current);
+            if (bitDepth == 16) std::swap(current, above);
+            guint8* out = filtered.data() + static_cast<size_t>(y) * lineBytes;
+
+            if (filter != PngFilter::Adaptive) {
+                out[0] = static_cast<guint8>(filter);
+                filterRow(filter, row, previous, bytes, out + 1);
+                continue;
+            }
+
+            int best = 0;
+            uint64_t best_cost = UINT64_MAX;
+            for (int type = 0; type < 5; type++) {
+                guint8* candidate = candidates.data() + static_cast<size_t>(type) * bytes;
+                filterRow(static_cast<PngFilter>(type), row, previous, bytes, candidate);
+                uint64_t cost = 0;
+                for (int i = 0; i < bytes; i++) cost += std::abs(static_cast<int8_t>(candidate[i]));
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best = type;
+                }
+            }
+            out[0] = static_cast<guint8>(best);
+            std::memcpy(out + 1, candidates.data() + static_cast<size_t>(best) * bytes, bytes);
+        }
+    }
+
+    // Deflates the filtered rows of chunk `index`; false if zlib fails.
+    bool compressChunk(int index) {
+        const size_t begin = static_cast<size_t>(index) * chunkRows * lineBytes;
+        const size_t end = std::min(filtered.size(), begin + static_cast<size_t>(chunkRows) * lineBytes);
+        const bool last = index == chunkCount() - 1;
+        Chunk& chunk = chunks[index];
+
+        z_stream stream{};
+        // Filtered data is mostly small values, which Z_FILTERED favours over long
+        // matches, as libpng does; unfiltered rows keep the default strategy.
+        const int strategy = filter == PngFilter::None ? Z_DEFAULT_STRATEGY : Z_FILTERED;
+        if (deflateInit2(&stream, level, Z_DEFLATED, -15, 8, strategy) != Z_OK) return false;
+
+        if (begin > 0 && level > 0) {
+            const size_t window = std::min(windowBytes, begin);
+            deflateSetDictionary(&stream, filtered.data() + begin - window, static_cast<uInt>(window));
+        }
+
+        // A sync flush adds an empty stored block, five bytes, beyond the bound.
+        chunk.data.resize(deflateBound(&stream, end - begin) + 16);
+        stream.next_in = filtered.data() + begin;
+        stream.avail_in = static_cast<uInt>(end - begin);
+        stream.next_out = chunk.data.data();
+        stream.avail_out = static_cast<uInt>(chunk.data.size());
+
+        const int result = deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+        const bool ok = last ? result == Z_STREAM_END : result == Z_OK && stream.avail_in == 0 && stream.avail_out > 0;
+        chunk.data.resize(stream.total_out);
+        deflateEnd(&stream);
+
+        chunk.adler = adler32(1, filtered.data() + begin, static_cast<uInt>(end - begin));
+        chunk.length = end - begin;
+        return ok;
+    }
+
+    // Writes the file once every chunk is compressed.
+    bool write(std::ostream& out) const {
+        static const guint8 signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+        out.write(reinterpret_cast<const char*>(signature), sizeof(signature));
+
+        guint8 header[13];
+        putBigEndian(header, width);
+        putBigEndian(header + 4, height);
+        static const guint8 color_types[4] = {0, 4, 2, 6};
+        header[8] = static_cast<guint8>(bitDepth);
+        header[9] = color_types[channels - 1];
+        header[10] = header[11] = header[12] = 0;
+        writeChunk(out, "IHDR", header, sizeof(header));
+
+        // zlib header: 32 KiB window, the level class in FLEVEL, FCHECK making it a multiple
+        // of 31.
+        const int flevel = level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3;
+        guint8 zlib_header[2] = {0x78, static_cast<guint8>(flevel << 6)};
+        zlib_header[1] += 31 - (zlib_header[0] * 256 + zlib_header[1]) % 31;
+
+        uLong adler = 1;
+        std::vector<guint8> payload;
+        for (size_t i = 0; i < chunks.size(); i++) {
+            const Chunk& chunk = chunks[i];
+            adler = i == 0 ? chunk.adler : adler32_combine(adler, chunk.adler, static_cast<z_off_t>(chunk.length));
+
+            payload.clear();
+            if (i == 0) payload.insert(payload.end(), zlib_header, zlib_header + 2);
+            payload.insert(payload.end(), chunk.data.begin(), chunk.data.end());
+            if (i + 1 == chunks.size()) {
+                guint8 trailer[4];
+                putBigEndian(trailer, static_cast<uint32_t>(adler));
+                payload.insert(payload.end(), trailer, trailer + 4);
+            }
+            writeChunk(out, "IDAT", payload.data(), payload.size());
+        }
+
+        writeChunk(out, "IEND", nullptr, 0);
+        return static_cast<bool>(out);
+    }
+
+   private:
+    struct Chunk {
+        std::vector<guint8> data;
+        uLong adler = 1;
+        size_t length = 0;
+    };
+
+    const guint8* pixels;
+    int rowstride, channels, width, height, level, bitDepth;
+    PngFilter filter;
+    int pixelBytes;
+    size_t lineBytes;
+    int chunkRows;
+    std::vector<guint8> filtered;
+    std::vector<Chunk> chunks;
+
+    const guint8* sourceRow(int y, std::vector<guint8>& scratch) const {
+        const guint8* row = pixels + static_cast<size_t>(y) * rowstride;
+        if (bitDepth == 8) return row;
+
+        scratch.resize(static_cast<size_t>(width) * pixelBytes);
+        for (size_t i = 0; i < scratch.size(); i += 2) {
+            uint16_t value;
+            std::memcpy(&value, row + i, 2);
+            scratch[i] = value >> 8;
+            scratch[i + 1] = value & 0xFF;
+        }
+        return scratch.data();
+    }
+
+    // Differences against the byte one pixel to the left (a), above (b) and above-left (c);
+    // outside the image they are 0. Modulo 256, as PNG defines them.
+    void filterRow(PngFilter type, const guint8* row, const guint8* previous, int bytes, guint8* out) const {
+        const int bpp = pixelBytes;
+        switch (type) {
+            case PngFilter::Sub:
+                std::memcpy(out, row, bpp);
+                for (int i = bpp; i < bytes; i++) out[i] = row[i] - row[i - bpp];
+                break;
+            case PngFilter::Up:
+                if (!previous) {
+                    std::memcpy(out, row, bytes);
+                    break;
+                }
+                for (int i = 0; i < bytes; i++) out[i] = row[i] - previous[i];
+                break;
+            case PngFilter::Average:
+                for (int i = 0; i < bytes; i++) {
+                    const int a = i >= bpp ? row[i - bpp] : 0, b = previous ? previous[i] : 0;
+                    out[i] = row[i] - ((a + b) >> 1);
+                }
+                break;
+            case PngFilter::Paeth:
+                for (int i = 0; i < bytes; i++) {
+                    const int a = i >= bpp ? row[i - bpp] : 0, b = previous ? previous[i] : 0;
+                    const int c = i >= bpp && previous ? previous[i - bpp] : 0;
+                    out[i] = row[i] - paeth(a, b, c);
+                }
+                break;
+            default:
+                std::memcpy(out, row, bytes);
+                break;
+        }
+    }
+
+    static int paeth(int a, int b, int c) {
+        const int pa = std::abs(b - c), pb = std::abs(a - c), pc = std::abs(a + b - 2 * c);
+        if (pa <= pb && pa <= pc) return a;
+        return pb <= pc ? b : c;
+    }
+
+    static void putBigEndian(guint8* out, uint32_t value) {
+        out[0] = value >> 24;
+        out[1] = value >> 16;
+        out[2] = value >> 8;
+        out[3] = value;
+    }
+
+    static void writeChunk(std::ostream& out, const char* type, const guint8* data, size_t length) {
+        guint8 length_bytes[4], crc_bytes[4];
+        putBigEndian(length_bytes, static_cast<uint32_t>(length));
+        uLong crc = crc32(0, reinterpret_cast<const Bytef*>(type), 4);
+        if (length > 0) crc = crc32(crc, data, static_cast<uInt>(length));
+        putBigEndian(crc_bytes, static_cast<uint32_t>(crc));
+
+        out.write(reinterpret_cast<const char*>(length_bytes), 4);
+        out.write(type, 4);
+        if (length > 0) out.write(reinterpret_cast<const char*>(data), length);
+        out.write(reinterpret_cast<const char*>(crc_bytes), 4);
+    }
+};
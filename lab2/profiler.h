@@ -0,0 +1,160 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+
+struct ProfileRecord {
+    std::string name;
+    int thread = 0;
+    int depth = 0;
+    double startUs = 0;
+    double durationUs = 0;
+    double megapixels = 0;
+    size_t bytesAllocated = 0;
+    int pixbufCopies = 0;
+
+    double megapixelsPerSecond() const {
+        return durationUs > 0 ? megapixels / (durationUs / 1e6) : 0;
+    }
+};
+
+class Profiler {
+   public:
+    static constexpr size_t maxRecords = 100000;
+
+    static Profiler& instance() {
+        static Profiler profiler;
+        return profiler;
+    }
+
+    double now() const {
+        return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - epoch).count();
+    }
+
+    static int threadIndex() {
+        static std::atomic<int> next{1};
+        thread_local int index = next++;
+        return index;
+    }
+
+    void add(const ProfileRecord& record) {
+        std::lock_guard<std::mutex> lock(mutex);
+        records.push_back(record);
+        if (records.size() > maxRecords) records.pop_front();
+        latest[record.name] = record;
+    }
+
+    bool last(const std::string& name, ProfileRecord& record) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = latest.find(name);
+        if (it == latest.end()) return false;
+        record = it->second;
+        return true;
+    }
+
+    // Chrome trace-event format, loadable in chrome://tracing or Perfetto.
+    bool exportTrace(const std::string& filename) const {
+        std::ofstream file(filename);
+        if (!file) return false;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        file << "{\"traceEvents\":[";
+        bool first = true;
+        for (const auto& record : records) {
+            if (!first) file << ",";
+            first = false;
+            file << "\n{\"name\":\"" << escapeJson(record.name) << "\",\"cat\":\"lab2\",\"ph\":\"X\""
+                 << ",\"ts\":" << std::fixed << std::setprecision(1) << record.startUs
+                 << ",\"dur\":" << record.durationUs
+                 << ",\"pid\":1,\"tid\":" << record.thread
+                 << ",\"args\":{\"depth\":" << record.depth
+                 << ",\"megapixels\":" << std::setprecision(3) << record.megapixels
+                 << ",\"mp_per_s\":" << record.megapixelsPerSecond()
+                 << ",\"bytes_allocated\":" << record.bytesAllocated
+                 << ",\"pixbuf_copies\":" << record.pixbufCopies << "}}";
+        }
+        file << "\n],\"displayTimeUnit\":\"ms\"}\n";
+        return (bool)file;
+    }
+
+   private:
+    static std::string escapeJson(const std::string& text) {
+        std::string escaped;
+        for (char c : text) {
+            if (c == '"' || c == '\\') {
+                escaped += '\\';
+                escaped += c;
+            } else if (static_cast<unsigned char>(c) < 0x20) {
+                char code[7];
+                std::snprintf(code, sizeof(code), "\\u%04x", c);
+                escaped += code;
+            } else {
+                escaped += c;
+            }
+        }
+        return escaped;
+    }
+
+    std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+    mutable std::mutex mutex;
+    std::deque<ProfileRecord> records;
+    std::map<std::string, ProfileRecord> latest;
+};
+
+// Times the enclosing block on the current thread. Allocations and pixbuf copies are
+// charged to the innermost open scope and rolled up into its parents when it closes.
+class ProfileScope {
+   public:
+    explicit ProfileScope(const char* name, double megapixels = 0)
+            : parent(current()) {
+        record.name = name;
+        record.thread = Profiler::threadIndex();
+        record.depth = parent ? parent->record.depth + 1 : 0;
+        record.megapixels = megapixels;
+        record.startUs = Profiler::instance().now();
+        current() = this;
+    }
+
+    ~ProfileScope() {
+        record.durationUs = Profiler::instance().now() - record.startUs;
+        current() = parent;
+        if (parent) {
+            parent->record.bytesAllocated += record.bytesAllocated;
+            parent->record.pixbufCopies += record.pixbufCopies;
+        }
+        Profiler::instance().add(record);
+    }
+
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+    void setMegapixels(double megapixels) { record.megapixels = megapixels; }
+
+    static void countAllocation(size_t bytes) {
+        if (current()) current()->record.bytesAllocated += bytes;
+    }
+
+    static void countPixbufCopy(size_t bytes) {
+        if (current()) {
+            current()->record.bytesAllocated += bytes;
+            current()->record.pixbufCopies++;
+        }
+    }
+
+   private:
+    ProfileRecord record;
+    ProfileScope* parent;
+
+    static ProfileScope*& current() {
+        thread_local ProfileScope* scope = nullptr;
+        return scope;
+    }
+};
@@ -0,0 +1,217 @@
+#pragma once
+
+#include <glib.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+struct ImageQuality {
+    double mse = 0;
+    double psnr = std::numeric_limits<double>::infinity();
+    int maxAbsDifference = 0;
+    double ssim = 1;
+};
+
+// Full-reference quality metrics between two images of the same size. MSE, PSNR and the
+// largest absolute difference cover the R, G and B values; alpha is ignored, so RGB and
+// RGBA pixbufs compare directly.
+//
+// SSIM is computed on luminance, with 8x8 windows of uniform weight every 4 pixels: the
+// variant of x264 and ffmpeg. Sums over 4x4 blocks are shared by the four windows that
+// overlap them. Images smaller than one window have no SSIM, reported as NaN.
+//
+// Work splits into row ranges that accumulate into separate Sums, merged afterwards, so
+// bands can run in parallel.
+class QualityMetrics {
+   public:
+    static constexpr int ssimBlock = 4;
+    static constexpr int ssimWindow = 2 * ssimBlock;
+
+    struct Sums {
+        uint64_t squaredError = 0;
+        uint64_t values = 0;
+        int maxAbs = 0;
+        double ssim = 0;
+        uint64_t windows = 0;
+
+        void merge(const Sums& other) {
+            squaredError += other.squaredError;
+            values += other.values;
+            maxAbs = std::max(maxAbs, other.maxAbs);
+            ssim += other.ssim;
+            windows += other.windows;
+        }
+    };
+
+    static int ssimWindowRows(int height) { return height < ssimWindow ? 0 : height / ssimBlock - 1; }
+
+    // Squared error and the largest difference over rows [y_begin, y_end).
+    static void differenceRows(const guint8* a, int a_rowstride, int a_channels, const guint8* b, int b_rowstride,
+                               int b_channels, int width, int y_begin, int y_end, Sums& sums) {
+        for (int y = y_begin; y < y_end; ++y) {
+            const guint8* pa = a + static_cast<size_t>(y) * a_rowstride;
+            const guint8* pb = b + static_cast<size_t>(y) * b_rowstride;
+            int x = 0;
+            uint64_t squares = 0;
+            int max_abs = sums.maxAbs;
+
+#if defined(__SSE2__)
+            // Same layout on both sides: 16 bytes at a time, with alpha masked out of the
+            // differences for RGBA. A lane gains at most 4 * 255^2 per step, so 32-bit
+            // lanes hold a row of up to 2^31 / 260100 steps, well past 16384 pixels.
+            if (a_channels == b_channels && (a_channels == 3 || a_channels == 4)) {
+                // Whole pixels only: 48 bytes are 16 RGB pixels, 16 bytes 4 RGBA pixels.
+                const int step = a_channels == 3 ? 48 : 16;
+                const int n = width * a_channels / step * step;
+                const __m128i zero = _mm_setzero_si128();
+                const __m128i mask = a_channels == 4 ? _mm_set1_epi32(0x00FFFFFF) : _mm_set1_epi32(-1);
+                __m128i sum = zero, largest = zero;
+                int i = 0;
+                for (; i + 16 <= n; i += 16) {
+                    __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pa + i));
+                    __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pb + i));
+                    __m128i d = _mm_and_si128(_mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va)), mask);
+                    largest = _mm_max_epu8(largest, d);
+                    __m128i lo = _mm_unpacklo_epi8(d, zero), hi = _mm_unpackhi_epi8(d, zero);
+                    sum = _mm_add_epi32(sum, _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi)));
+                }
+
+                alignas(16) uint32_t lanes[4];
+                _mm_store_si128(reinterpret_cast<__m128i*>(lanes), sum);
+                squares = static_cast<uint64_t>(lanes[0]) + lanes[1] + lanes[2] + lanes[3];
+                alignas(16) guint8 bytes[16];
+                _mm_store_si128(reinterpret_cast<__m128i*>(bytes), largest);
+                max_abs = std::max(max_abs, static_cast<int>(*std::max_element(bytes, bytes + 16)));
+                x = n / a_channels;
+            }
+#endif
+
+            for (; x < width; ++x) {
+                for (int c = 0; c < 3; c++) {
+                    int d = std::abs(pa[x * a_channels + c] - pb[x * b_channels + c]);
+                    squares += d * d;
+                    max_abs = std::max(max_abs, d);
+                }
+            }
+
+            sums.squaredError += squares;
+            sums.maxAbs = max_abs;
+        }
+        sums.values += static_cast<uint64_t>(y_end - y_begin) * width * 3;
+    }
+
+    // SSIM of the windows in window rows [row_begin, row_end), those starting at image
+    // rows 4 * row_begin up to 4 * row_end.
+    static void ssimRows(const guint8* a, int a_rowstride, int a_channels, const guint8* b, int b_rowstride,
+                         int b_channels, int width, int row_begin, int row_end, Sums& sums) {
+        const int blocks = width / ssimBlock;
+        if (blocks < 2 || row_begin >= row_end) return;
+
+        // Block sums of the current and the previous block row.
+        std::vector<BlockSums> previous(blocks), current(blocks);
+        std::vector<guint8> luma_a(static_cast<size_t>(ssimBlock) * blocks * ssimBlock);
+        std::vector<guint8> luma_b(luma_a.size());
+        const int luma_stride = blocks * ssimBlock;
+
+        for (int block_row = row_begin; block_row <= row_end; ++block_row) {
+            for (int r = 0; r < ssimBlock; r++) {
+                const int y = block_row * ssimBlock + r;
+                lumaRow(a + static_cast<size_t>(y) * a_rowstride, a_channels, luma_stride, &luma_a[r * luma_stride]);
+                lumaRow(b + static_cast<size_t>(y) * b_rowstride, b_channels, luma_stride, &luma_b[r * luma_stride]);
+            }
+            blockSums(luma_a.data(), luma_b.data(), luma_stride, blocks, current.data());
+
+            if (block_row > row_begin) {
+                for (int bx = 0; bx + 1 < blocks; bx++) {
+                    sums.ssim += windowSsim(previous[bx], previous[bx + 1], current[bx], current[bx + 1]);
+                }
+                sums.windows += blocks - 1;
+            }
+            std::swap(previous, current);
+        }
+    }
+
+    static ImageQuality finish(const Sums& sums) {
+        ImageQuality quality;
+        quality.maxAbsDifference = sums.maxAbs;
+        quality.mse = sums.values ? static_cast<double>(sums.squaredError) / sums.values : 0;
+        if (quality.mse > 0) quality.psnr = 10 * std::log10(255.0 * 255.0 / quality.mse);
+        quality.ssim = sums.windows ? sums.ssim / sums.windows : std::numeric_limits<double>::quiet_NaN();
+        return quality;
+    }
+
+   private:
+    struct BlockSums {
+        uint32_t a = 0, b = 0, squares = 0, product = 0;
+    };
+
+    static void lumaRow(const guint8* p, int n_channels, int width, guint8* out) {
+        for (int x = 0; x < width; ++x, p += n_channels) out[x] = (77 * p[0] + 150 * p[1] + 29 * p[2] + 128) >> 8;
+    }
+
+    // Sums of a, b, a^2 + b^2 and a * b over each 4x4 block of four luminance rows.
+    static void blockSums(const guint8* a, const guint8* b, int stride, int blocks, BlockSums* out) {
+        int bx = 0;
+#if defined(__SSE2__)
+        // Two blocks per step: 16-bit lanes for the values, pmaddwd for the products
+        // and pair sums, then adjacent 32-bit lanes added into one total per block.
+        const __m128i zero = _mm_setzero_si128(), ones = _mm_set1_epi16(1);
+        for (; bx + 2 <= blocks; bx += 2) {
+            __m128i sum_a = zero, sum_b = zero, squares = zero, product = zero;
+            for (int r = 0; r < ssimBlock; r++) {
+                const size_t offset = static_cast<size_t>(r) * stride + bx * ssimBlock;
+                __m128i va = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(a + offset)), zero);
+                __m128i vb = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(b + offset)), zero);
+                sum_a = _mm_add_epi32(sum_a, _mm_madd_epi16(va, ones));
+                sum_b = _mm_add_epi32(sum_b, _mm_madd_epi16(vb, ones));
+                squares = _mm_add_epi32(squares, _mm_add_epi32(_mm_madd_epi16(va, va), _mm_madd_epi16(vb, vb)));
+                product = _mm_add_epi32(product, _mm_madd_epi16(va, vb));
+            }
+
+            alignas(16) uint32_t lanes[4][4];
+            const __m128i totals[4] = {sum_a, sum_b, squares, product};
+            for (int k = 0; k < 4; k++) {
+                _mm_store_si128(reinterpret_cast<__m128i*>(lanes[k]),
+                                _mm_add_epi32(totals[k], _mm_srli_epi64(totals[k], 32)));
+            }
+            out[bx] = {lanes[0][0], lanes[1][0], lanes[2][0], lanes[3][0]};
+            out[bx + 1] = {lanes[0][2], lanes[1][2], lanes[2][2], lanes[3][2]};
+        }
+#endif
+        for (; bx < blocks; bx++) {
+            BlockSums sums;
+            for (int r = 0; r < ssimBlock; r++) {
+                for (int k = 0; k < ssimBlock; k++) {
+                    const size_t offset = static_cast<size_t>(r) * stride + bx * ssimBlock + k;
+                    const uint32_t va = a[offset], vb = b[offset];
+                    sums.a += va;
+                    sums.b += vb;
+                    sums.squares += va * va + vb * vb;
+                    sums.product += va * vb;
+                }
+            }
+            out[bx] = sums;
+        }
+    }
+
+    static double windowSsim(const BlockSums& s0, const BlockSums& s1, const BlockSums& s2, const BlockSums& s3) {
+        constexpr double n = ssimWindow * ssimWindow;
+        constexpr double c1 = (0.01 * 255) * (0.01 * 255), c2 = (0.03 * 255) * (0.03 * 255);
+
+        const double mean_a = (s0.a + s1.a + s2.a + s3.a) / n;
+        const double mean_b = (s0.b + s1.b + s2.b + s3.b) / n;
+        const double squares = (s0.squares + s1.squares + s2.squares + s3.squares) / n;
+        const double product = (s0.product + s1.product + s2.product + s3.product) / n;
+
+        const double variances = squares - mean_a * mean_a - mean_b * mean_b;
+        const double covariance = product - mean_a * mean_b;
+        return (2 * mean_a * mean_b + c1) * (2 * covariance + c2) /
+               ((mean_a * mean_a + mean_b * mean_b + c1) * (variances + c2));
+    }
+};
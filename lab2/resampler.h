@@ -0,0 +1,279 @@
+#pragma once
+
+#include <glib.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Area: every output pixel is the mean of the source area it covers, with partially
+// covered pixels weighted by their coverage. Lanczos3: windowed sinc with three lobes,
+// widened by the reduction factor when shrinking.
+enum class ResampleFilter { Area, Lanczos3 };
+
+// Taps of every output pixel along one axis: a run of source pixels starting at first(i)
+// and their weights in 1.14 fixed point, summing to exactly 1 << 14. Taps reaching past
+// an edge are folded onto the edge pixel.
+class ResampleWeights {
+   public:
+    static constexpr int precisionBits = 14;
+
+    ResampleWeights(int src_size, int dst_size, ResampleFilter filter) : srcSize(src_size), dstSize(dst_size) {
+        const double scale = static_cast<double>(src_size) / dst_size;
+        const double stretch = std::max(1.0, scale);
+        const double support = filter == ResampleFilter::Area ? 0.5 * stretch + 0.5 : 3.0 * stretch;
+
+        std::vector<std::vector<double>> taps(dst_size);
+        firsts.resize(dst_size);
+        counts.resize(dst_size);
+        for (int i = 0; i < dst_size; i++) {
+            const double centre = (i + 0.5) * scale;
+            int begin = static_cast<int>(std::floor(centre - support));
+            int end = static_cast<int>(std::ceil(centre + support));
+
+            std::vector<double> weights;
+            double total = 0;
+            for (int j = begin; j < end; j++) {
+                double w = filter == ResampleFilter::Area ? coverage(j, i * scale, (i + 1) * scale)
+                                                          : lanczos3((j + 0.5 - centre) / stretch);
+                weights.push_back(w);
+                total += w;
+            }
+
+            // Fold the taps outside [0, src_size) onto the edge pixels, then trim zeros.
+            int first = std::max(0, begin), last = std::min(src_size - 1, end - 1);
+            std::vector<double> folded(last - first + 1, 0.0);
+            for (int j = begin; j < end; j++) {
+                folded[std::max(first, std::min(last, j)) - first] += weights[j - begin] / total;
+            }
+            int lo = 0, hi = static_cast<int>(folded.size());
+            while (lo + 1 < hi && folded[lo] == 0) lo++;
+            while (hi - 1 > lo && folded[hi - 1] == 0) hi--;
+
+            firsts[i] = first + lo;
+            counts[i] = hi - lo;
+            taps[i].assign(folded.begin() + lo, folded.begin() + hi);
+            maxTaps = std::max(maxTaps, counts[i]);
+        }
+
+        values.assign(static_cast<size_t>(dst_size) * maxTaps, 0);
+        for (int i = 0; i < dst_size; i++) {
+            int16_t* w = values.data() + static_cast<size_t>(i) * maxTaps;
+            int sum = 0, largest = 0;
+            for (int k = 0; k < counts[i]; k++) {
+                w[k] = static_cast<int16_t>(std::lround(taps[i][k] * (1 << precisionBits)));
+                sum += w[k];
+                if (w[k] > w[largest]) largest = k;
+            }
+            w[largest] += (1 << precisionBits) - sum;
+        }
+    }
+
+    int getSourceSize() const { return srcSize; }
+    int getSize() const { return dstSize; }
+    int first(int i) const { return firsts[i]; }
+    int count(int i) const { return counts[i]; }
+    const int16_t* weights(int i) const { return values.data() + static_cast<size_t>(i) * maxTaps; }
+
+   private:
+    int srcSize, dstSize;
+    int maxTaps = 1;
+    std::vector<int> firsts, counts;
+    std::vector<int16_t> values;
+
+    static double coverage(int j, double begin, double end) {
+        return std::max(0.0, std::min<double>(j + 1, end) - std::max<double>(j, begin));
+    }
+
+    static double lanczos3(double x) {
+        x = std::fabs(x);
+        if (x < 1e-8) return 1.0;
+        if (x >= 3.0) return 0.0;
+        const double px = M_PI * x;
+        return 3.0 * std::sin(px) * std::sin(px / 3.0) / (px * px);
+    }
+};
+
+// Separable resampling: a horizontal pass from source rows into rows of the output
+// width, then a vertical pass from those into the output. Weights for both axes are
+// computed once when the resampler is made and shared by every row and every thread.
+// Both passes multiply pairs of 16-bit values with 16-bit weights (SSE2 pmaddwd) into
+// 32-bit sums; all channels, alpha included, are filtered alike.
+class Resampler {
+   public:
+    Resampler(int src_width, int src_height, int dst_width, int dst_height, ResampleFilter filter)
+        : horizontal(src_width, dst_width, filter), vertical(src_height, dst_height, filter) {}
+
+    const ResampleWeights& horizontalWeights() const { return horizontal; }
+    const ResampleWeights& verticalWeights() const { return vertical; }
+
+    // First pass for source rows [y_begin, y_end) into rows of `temp`, which hold the
+    // output width.
+    void horizontalRows(const guint8* src, int rowstride, int n_channels, guint8* temp, int temp_stride, int y_begin,
+                        int y_end) const {
+        if (n_channels == 4) {
+            filterRows<4>(src, rowstride, temp, temp_stride, y_begin, y_end);
+        } else {
+            filterRows<3>(src, rowstride, temp, temp_stride, y_begin, y_end);
+        }
+    }
+
+    // Second pass for output rows [y_begin, y_end); `temp` holds every source row.
+    void verticalRows(const guint8* temp, int temp_stride, int n_channels, guint8* dst, int rowstride, int y_begin,
+                      int y_end) const {
+        const int bytes = horizontal.getSize() * n_channels;
+        const int round = 1 << (ResampleWeights::precisionBits - 1);
+        std::vector<const guint8*> rows(vertical.count(0));
+
+        for (int y = y_begin; y < y_end; ++y) {
+            const int count = vertical.count(y);
+            const int16_t* w = vertical.weights(y);
+            rows.resize(count);
+            for (int k = 0; k < count; k++) rows[k] = temp + static_cast<size_t>(vertical.first(y) + k) * temp_stride;
+            guint8* d = dst + static_cast<size_t>(y) * rowstride;
+
+            int i = 0;
+#if defined(__SSE2__)
+            const __m128i zero = _mm_setzero_si128();
+            for (; i + 8 <= bytes; i += 8) {
+                __m128i lo = _mm_set1_epi32(round), hi = lo;
+                int k = 0;
+                for (; k + 1 < count; k += 2) {
+                    __m128i a = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(rows[k] + i)), zero);
+                    __m128i b =
+                        _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(rows[k + 1] + i)), zero);
+                    __m128i pair = weightPair(w[k], w[k + 1]);
+                    lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), pair));
+                    hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), pair));
+                }
+                if (k < count) {
+                    __m128i a = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(rows[k] + i)), zero);
+                    __m128i pair = weightPair(w[k], 0);
+                    lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, zero), pair));
+                    hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, zero), pair));
+                }
+                lo = _mm_srai_epi32(lo, ResampleWeights::precisionBits);
+                hi = _mm_srai_epi32(hi, ResampleWeights::precisionBits);
+                __m128i packed = _mm_packs_epi32(lo, hi);
+                _mm_storel_epi64(reinterpret_cast<__m128i*>(d + i), _mm_packus_epi16(packed, packed));
+            }
+#endif
+            for (; i < bytes; i++) {
+                int sum = round;
+                for (int k = 0; k < count; k++) sum += w[k] * rows[k][i];
+                d[i] = clampByte(sum >> ResampleWeights::precisionBits);
+            }
+        }
+    }
+
+   private:
+    ResampleWeights horizontal, vertical;
+
+    static guint8 clampByte(int value) { return static_cast<guint8>(std::min(255, std::max(0, value))); }
+
+#if defined(__SSE2__)
+    static __m128i weightPair(int16_t a, int16_t b) {
+        return _mm_set1_epi32(static_cast<int>((static_cast<uint32_t>(static_cast<uint16_t>(b)) << 16) |
+                                               static_cast<uint16_t>(a)));
+    }
+
+    // One pixel widened to 16-bit lanes; three-channel pixels are read byte by byte so the
+    // last pixel of the image is never overread.
+    template <int Channels>
+    static __m128i loadPixel(const guint8* p) {
+        uint32_t value;
+        if (Channels == 4) {
+            std::memcpy(&value, p, 4);
+        } else {
+            value = p[0] | (p[1] << 8) | (p[2] << 16);
+        }
+        return _mm_unpacklo_epi8(_mm_cvtsi32_si128(static_cast<int>(value)), _mm_setzero_si128());
+    }
+#endif
+
+    template <int Channels>
+    void filterRows(const guint8* src, int rowstride, guint8* temp, int temp_stride, int y_begin, int y_end) const {
+        const int width = horizontal.getSize();
+        const int round = 1 << (ResampleWeights::precisionBits - 1);
+
+        for (int y = y_begin; y < y_end; ++y) {
+            const guint8* s = src + static_cast<size_t>(y) * rowstride;
+            guint8* d = temp + static_cast<size_t>(y) * temp_stride;
+
+            for (int x = 0; x < width; ++x, d += Channels) {
+                const guint8* p = s + horizontal.first(x) * Channels;
+                const int16_t* w = horizontal.weights(x);
+                const int count = horizontal.count(x);
+#if defined(__SSE2__)
+                __m128i sum = _mm_set1_epi32(round);
+                int k = 0;
+                for (; k + 1 < count; k += 2) {
+                    __m128i pixels = _mm_unpacklo_epi16(loadPixel<Channels>(p + k * Channels),
+                                                        loadPixel<Channels>(p + (k + 1) * Channels));
+                    sum = _mm_add_epi32(sum, _mm_madd_epi16(pixels, weightPair(w[k], w[k + 1])));
+                }
+                if (k < count) {
+                    __m128i pixels = _mm_unpacklo_epi16(loadPixel<Channels>(p + k * Channels), _mm_setzero_si128());
+                    sum = _mm_add_epi32(sum, _mm_madd_epi16(pixels, weightPair(w[k], 0)));
+                }
+                sum = _mm_srai_epi32(sum, ResampleWeights::precisionBits);
+                sum = _mm_packs_epi32(sum, sum);
+                uint32_t packed = static_cast<uint32_t>(_mm_cvtsi128_si32(_mm_packus_epi16(sum, sum)));
+                for (int c = 0; c < Channels; c++) d[c] = static_cast<guint8>(packed >> (8 * c));
+#else
+                for (int c = 0; c < Channels; c++) {
+                    int sum = round;
+                    for (int k = 0; k < count; k++) sum += w[k] * p[k * Channels + c];
+                    d[c] = clampByte(sum >> ResampleWeights::precisionBits);
+                }
+#endif
+            }
+        }
+    }
+};
+
+// 2:1 box reduction of rows [y_begin, y_end) and columns [x_begin, x_end) of `dst`, the
+// rounded mean of each 2x2 block of `src`; an odd last row or column is paired with
+// itself. The four-channel path averages two output pixels per SSE2 step.
+inline void halveRows(const guint8* src, int src_rowstride, int src_width, int src_height, guint8* dst,
+                      int dst_rowstride, int n_channels, int x_begin, int x_end, int y_begin, int y_end) {
+    for (int y = y_begin; y < y_end; ++y) {
+        const guint8* row0 = src + static_cast<size_t>(2 * y) * src_rowstride;
+        const guint8* row1 = src + static_cast<size_t>(std::min(2 * y + 1, src_height - 1)) * src_rowstride;
+        guint8* d = dst + static_cast<size_t>(y) * dst_rowstride;
+
+        int x = x_begin;
+#if defined(__SSE2__)
+        if (n_channels == 4) {
+            const __m128i zero = _mm_setzero_si128();
+            const __m128i two = _mm_set1_epi16(2);
+            // Whole pairs of source pixels only; the last column may lack its partner.
+            const int x_vector_end = std::min(x_end, src_width / 2);
+            for (; x + 2 <= x_vector_end; x += 2) {
+                __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + 8 * x));
+                __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + 8 * x));
+                __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+                __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+                // Each half now holds two vertically summed pixels; add them to each other.
+                lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+                hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+                __m128i sums = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(lo, hi), two), 2);
+                _mm_storel_epi64(reinterpret_cast<__m128i*>(d + 4 * x), _mm_packus_epi16(sums, sums));
+            }
+        }
+#endif
+        for (; x < x_end; ++x) {
+            const int left = 2 * x * n_channels;
+            const int right = std::min(2 * x + 1, src_width - 1) * n_channels;
+            for (int c = 0; c < n_channels; c++) {
+                d[x * n_channels + c] = static_cast<guint8>(
+                    (row0[left + c] + row0[right + c] + row1[left + c] + row1[right + c] + 2) >> 2);
+            }
+        }
+    }
+}
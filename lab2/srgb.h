@@ -0,0 +1,48 @@
+#pragma once
+
+#include <glib.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+// Conversion between 8-bit sRGB and linear light. Decoding is a 256-entry table, either
+// to float scaled to 0..255 or to a 12-bit integer code; encoding goes through a
+// 4096-entry table indexed by that code. 12 bits are enough for every 8-bit value to
+// survive the round trip, including the steep part of the curve near black.
+class SrgbTables {
+   public:
+    static constexpr int linearCodes = 4096;
+
+    static const SrgbTables& instance() {
+        static SrgbTables tables;
+        return tables;
+    }
+
+    float toLinear[256];
+    uint16_t toLinearCode[256];
+    guint8 fromLinearCode[linearCodes];
+
+    static int codeOf(float linear255) {
+        int code = static_cast<int>(linear255 * ((linearCodes - 1) / 255.0f) + 0.5f);
+        return std::max(0, std::min(code, linearCodes - 1));
+    }
+
+    guint8 encode(float linear255) const { return fromLinearCode[codeOf(linear255)]; }
+
+   private:
+    SrgbTables() {
+        for (int value = 0; value < 256; value++) {
+            double linear = decode(value / 255.0);
+            toLinear[value] = static_cast<float>(linear * 255.0);
+            toLinearCode[value] = static_cast<uint16_t>(std::lround(linear * (linearCodes - 1)));
+        }
+        for (int code = 0; code < linearCodes; code++) {
+            double encoded = encodeValue(code / static_cast<double>(linearCodes - 1));
+            fromLinearCode[code] = static_cast<guint8>(std::lround(std::min(1.0, encoded) * 255.0));
+        }
+    }
+
+    static double decode(double v) { return v <= 0.04045 ? v / 12.92 : std::pow((v + 0.055) / 1.055, 2.4); }
+
+    static double encodeValue(double l) { return l <= 0.0031308 ? l * 12.92 : 1.055 * std::pow(l, 1.0 / 2.4) - 0.055; }
+};